@@ -22,7 +22,8 @@
 @ DEALINGS IN THE SOFTWARE.
 
     .syntax unified
-    .cpu cortex-m0
+    .cpu cortex-m4
+    .fpu fpv4-sp-d16
     .thumb
     .text
     .align 2
@@ -33,6 +34,19 @@
     .global save_register_context
     .global restore_register_context
 
+@ Offsets into PROCESSOR_TCB (see codal_target_hal_base.cpp)
+    .equ    TCB_SP,         52
+    .equ    TCB_LR,         56
+    .equ    TCB_STACK_BASE, 60
+    .equ    TCB_FPU,        64
+    .equ    TCB_S16,        68
+
+@ CONTROL.FPCA is set by the hardware whenever a floating point instruction is executed.
+@ It is cleared as each fiber is scheduled in, so when the fiber is scheduled out it tells us whether the fiber
+@ touched the FPU in between. Only then are the callee saved FPU registers (S16-S31) stored in its TCB.
+@ The caller saved registers (S0-S15, FPSCR) need not be kept, as a context switch is a function call.
+    .equ    CONTROL_FPCA,   4
+
 @ R0 Contains a pointer to the TCB of the fibre being scheduled out.
 @ R1 Contains a pointer to the base of the stack of the fibre being scheduled out.
 @ R2 Contains a pointer to the TCB of the fibre being scheduled in.
@@ -41,59 +55,55 @@
 swap_context:
 
     @ Write our core registers into the TCB
-    @ First, store the general registers
 
     @ Skip this is we're given a NULL parameter for the TCB
-    CMP     R0, #0
-    BEQ     store_context_complete
+    CBZ     R0, store_context_complete
 
-    STR     R0, [R0,#0]
-    STR     R1, [R0,#4]
-    STR     R2, [R0,#8]
-    STR     R3, [R0,#12]
-    STR     R4, [R0,#16]
-    STR     R5, [R0,#20]
-    STR     R6, [R0,#24]
-    STR     R7, [R0,#28]
-
-    @ Now the high general purpose registers
-    MOV     R4, R8
-    STR     R4, [R0,#32]
-    MOV     R4, R9
-    STR     R4, [R0,#36]
-    MOV     R4, R10
-    STR     R4, [R0,#40]
-    MOV     R4, R11
-    STR     R4, [R0,#44]
-    MOV     R4, R12
-    STR     R4, [R0,#48]
+    STMIA   R0, {R0-R12}
 
     @ Now the Stack and Link Register.
     @ As this context is only intended for use with a fiber scheduler,
     @ we don't need the PC.
     MOV     R6, SP
-    STR     R6, [R0,#52]
-    MOV     R4, LR
-    STR     R4, [R0,#56]
+    STR     R6, [R0, #TCB_SP]
+    STR     LR, [R0, #TCB_LR]
+
+    @ Store the FPU registers, if the fiber has used them since it was scheduled in.
+    MRS     R4, CONTROL
+    TST     R4, #CONTROL_FPCA
+    BEQ     store_context_complete
+
+    ADD     R5, R0, #TCB_S16
+    VSTMIA  R5, {S16-S31}
+    MOVS    R5, #1
+    STR     R5, [R0, #TCB_FPU]
 
 store_context_complete:
     @ Finally, Copy the stack. We do this to reduce RAM footprint, as stack is usually very small at the point
     @ of scheduling, but we need a lot of capacity for interrupt handling and other functions.
 
     @ Skip this is we're given a NULL parameter for the stack.
-    CMP     R1, #0
-    BEQ     store_stack_complete
+    CBZ     R1, store_stack_complete
 
-    LDR     R4, [R0,#60]         @ Load R4 with the fiber's defined stack_base.
+    LDR     R4, [R0, #TCB_STACK_BASE]   @ Load R4 with the fiber's defined stack_base.
+
+    @ Copy four words at a time, then any remainder one word at a time.
 store_stack:
-    SUBS    R4, #4
-    SUBS    R1, #4
+    SUB     R5, R4, R6
+    CMP     R5, #16
+    BLO     store_stack_tail
 
-    LDR     R5, [R4]
-    STR     R5, [R1]
+    LDMDB   R4!, {R7-R10}
+    STMDB   R1!, {R7-R10}
+    B       store_stack
 
+store_stack_tail:
     CMP     R4, R6
-    BNE     store_stack
+    BEQ     store_stack_complete
+
+    LDR     R5, [R4, #-4]!
+    STR     R5, [R1, #-4]!
+    B       store_stack_tail
 
 store_stack_complete:
 
@@ -101,50 +111,52 @@ store_stack_complete:
     @ Now page in the new context.
     @ Update all registers except the PC. We can also safely ignore the STATUS register, as we're just a fiber scheduler.
     @
-    LDR     R4, [R2, #56]
-    MOV     LR, R4
-    LDR     R6, [R2, #52]
+    LDR     LR, [R2, #TCB_LR]
+    LDR     R6, [R2, #TCB_SP]
     MOV     SP, R6
 
     @ Copy the stack in.
     @ n.b. we do this after setting the SP to make comparisons easier.
 
     @ Skip this is we're given a NULL parameter for the stack.
-    CMP     R3, #0
-    BEQ     restore_stack_complete
+    CBZ     R3, restore_stack_complete
 
-    LDR     R4, [R2,#60]         @ Load R4 with the fiber's defined stack_base.
+    LDR     R4, [R2, #TCB_STACK_BASE]   @ Load R4 with the fiber's defined stack_base.
 
 restore_stack:
-    SUBS    R4, #4
-    SUBS    R3, #4
+    SUB     R5, R4, R6
+    CMP     R5, #16
+    BLO     restore_stack_tail
 
-    LDR     R5, [R3]
-    STR     R5, [R4]
+    LDMDB   R3!, {R7-R10}
+    STMDB   R4!, {R7-R10}
+    B       restore_stack
 
+restore_stack_tail:
     CMP     R4, R6
-    BNE     restore_stack
+    BEQ     restore_stack_complete
+
+    LDR     R5, [R3, #-4]!
+    STR     R5, [R4, #-4]!
+    B       restore_stack_tail
 
 restore_stack_complete:
-    LDR     R4, [R2, #48]
-    MOV     R12, R4
-    LDR     R4, [R2, #44]
-    MOV     R11, R4
-    LDR     R4, [R2, #40]
-    MOV     R10, R4
-    LDR     R4, [R2, #36]
-    MOV     R9, R4
-    LDR     R4, [R2, #32]
-    MOV     R8, R4
-
-    LDR     R7, [R2, #28]
-    LDR     R6, [R2, #24]
-    LDR     R5, [R2, #20]
-    LDR     R4, [R2, #16]
-    LDR     R3, [R2, #12]
-    LDR     R1, [R2, #4]
-    LDR     R0, [R2, #0]
-    LDR     R2, [R2, #8]
+    @ Restore the FPU registers, if the TCB holds any.
+    LDR     R5, [R2, #TCB_FPU]
+    CBZ     R5, restore_fpu_complete
+
+    ADD     R5, R2, #TCB_S16
+    VLDMIA  R5, {S16-S31}
+
+restore_fpu_complete:
+    @ Start tracking FPU use afresh for this fiber. This also spares interrupts taken while a fiber that doesn't use
+    @ the FPU is running from reserving space for FPU state on the stack.
+    MRS     R4, CONTROL
+    BIC     R4, R4, #CONTROL_FPCA
+    MSR     CONTROL, R4
+    ISB
+
+    LDMIA   R2, {R0-R12}
 
     @ Return to caller (scheduler).
     BX      LR
@@ -156,58 +168,53 @@ restore_stack_complete:
 save_context:
 
     @ Write our core registers into the TCB
-    @ First, store the general registers
-
-    STR     R0, [R0,#0]
-    STR     R1, [R0,#4]
-    STR     R2, [R0,#8]
-    STR     R3, [R0,#12]
-    STR     R4, [R0,#16]
-    STR     R5, [R0,#20]
-    STR     R6, [R0,#24]
-    STR     R7, [R0,#28]
-
-    @ Now the high general purpose registers
-    MOV     R4, R8
-    STR     R4, [R0,#32]
-    MOV     R4, R9
-    STR     R4, [R0,#36]
-    MOV     R4, R10
-    STR     R4, [R0,#40]
-    MOV     R4, R11
-    STR     R4, [R0,#44]
-    MOV     R4, R12
-    STR     R4, [R0,#48]
+
+    STMIA   R0, {R0-R12}
 
     @ Now the Stack and Link Register.
     @ As this context is only intended for use with a fiber scheduler,
     @ we don't need the PC.
     MOV     R6, SP
-    STR     R6, [R0,#52]
-    MOV     R4, LR
-    STR     R4, [R0,#56]
+    STR     R6, [R0, #TCB_SP]
+    STR     LR, [R0, #TCB_LR]
+
+    @ Store the FPU registers, if the fiber has used them since it was scheduled in.
+    MRS     R4, CONTROL
+    TST     R4, #CONTROL_FPCA
+    BEQ     save_fpu_complete
 
+    ADD     R5, R0, #TCB_S16
+    VSTMIA  R5, {S16-S31}
+    MOVS    R5, #1
+    STR     R5, [R0, #TCB_FPU]
+
+save_fpu_complete:
     @ Finally, Copy the stack. We do this to reduce RAM footprint, as stackis usually very small at the point
     @ of sceduling, but we need a lot of capacity for interrupt handling and other functions.
 
-    LDR     R4, [R0,#60]         @ Load R4 with the fiber's defined stack_base.
+    LDR     R4, [R0, #TCB_STACK_BASE]   @ Load R4 with the fiber's defined stack_base.
 
 store_stack1:
-    SUBS    R4, #4
-    SUBS    R1, #4
+    SUB     R5, R4, R6
+    CMP     R5, #16
+    BLO     store_stack1_tail
 
-    LDR     R5, [R4]
-    STR     R5, [R1]
+    LDMDB   R4!, {R7-R10}
+    STMDB   R1!, {R7-R10}
+    B       store_stack1
 
+store_stack1_tail:
     CMP     R4, R6
-    BNE     store_stack1
+    BEQ     store_stack1_complete
 
-    @ Restore scratch registers.
+    LDR     R5, [R4, #-4]!
+    STR     R5, [R1, #-4]!
+    B       store_stack1_tail
 
-    LDR     R7, [R0, #28]
-    LDR     R6, [R0, #24]
-    LDR     R5, [R0, #20]
-    LDR     R4, [R0, #16]
+store_stack1_complete:
+    @ Restore scratch registers.
+    ADD     R4, R0, #16
+    LDMIA   R4, {R4-R10}
 
     @ Return to caller (scheduler).
     BX      LR
@@ -217,37 +224,27 @@ store_stack1:
 save_register_context:
 
     @ Write our core registers into the TCB
-    @ First, store the general registers
-
-    STR     R0, [R0,#0]
-    STR     R1, [R0,#4]
-    STR     R2, [R0,#8]
-    STR     R3, [R0,#12]
-    STR     R4, [R0,#16]
-    STR     R5, [R0,#20]
-    STR     R6, [R0,#24]
-    STR     R7, [R0,#28]
-
-    @ Now the high general purpose registers
-    MOV     R4, R8
-    STR     R4, [R0,#32]
-    MOV     R4, R9
-    STR     R4, [R0,#36]
-    MOV     R4, R10
-    STR     R4, [R0,#40]
-    MOV     R4, R11
-    STR     R4, [R0,#44]
-    MOV     R4, R12
-    STR     R4, [R0,#48]
+
+    STMIA   R0, {R0-R12}
 
     @ Now the Stack Pointer and Link Register.
     @ As this context is only intended for use with a fiber scheduler,
     @ we don't need the PC.
     MOV     R4, SP
-    STR     R4, [R0,#52]
-    MOV     R4, LR
-    STR     R4, [R0,#56]
+    STR     R4, [R0, #TCB_SP]
+    STR     LR, [R0, #TCB_LR]
+
+    @ Store the FPU registers, if they have been used.
+    MRS     R4, CONTROL
+    TST     R4, #CONTROL_FPCA
+    BEQ     save_register_fpu_complete
+
+    ADD     R4, R0, #TCB_S16
+    VSTMIA  R4, {S16-S31}
+    MOVS    R4, #1
+    STR     R4, [R0, #TCB_FPU]
 
+save_register_fpu_complete:
     @ Restore scratch registers.
     LDR     R4, [R0, #16]
 
@@ -261,32 +258,20 @@ restore_register_context:
     @ Now page in the new context.
     @ Update all registers except the PC. We can also safely ignore the STATUS register, as we're just a fiber scheduler.
     @
-    LDR     R4, [R0, #56]
-    MOV     LR, R4
-    LDR     R4, [R0, #52]
+    LDR     LR, [R0, #TCB_LR]
+    LDR     R4, [R0, #TCB_SP]
     MOV     SP, R4
 
-    @ High registers...
-    LDR     R4, [R0, #48]
-    MOV     R12, R4
-    LDR     R4, [R0, #44]
-    MOV     R11, R4
-    LDR     R4, [R0, #40]
-    MOV     R10, R4
-    LDR     R4, [R0, #36]
-    MOV     R9, R4
-    LDR     R4, [R0, #32]
-    MOV     R8, R4
-
-    @ Low registers...
-    LDR     R7, [R0, #28]
-    LDR     R6, [R0, #24]
-    LDR     R5, [R0, #20]
-    LDR     R4, [R0, #16]
-    LDR     R3, [R0, #12]
-    LDR     R2, [R0, #8]
-    LDR     R0, [R0, #0]
-    LDR     R1, [R0, #4]
+    @ FPU registers, if the TCB holds any...
+    LDR     R4, [R0, #TCB_FPU]
+    CBZ     R4, restore_register_fpu_complete
+
+    ADD     R4, R0, #TCB_S16
+    VLDMIA  R4, {S16-S31}
+
+restore_register_fpu_complete:
+    @ Core registers...
+    LDMIA   R0, {R0-R12}
 
     @ Return to caller (normally the scheduler).
     BX      LR
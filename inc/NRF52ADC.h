@@ -37,10 +37,24 @@ DEALINGS IN THE SOFTWARE.
 #define NRF52_ADC_CHANNELS          8
 #define NRF52_ADC_DMA_SIZE          512
 
+// The minimum number of DMA and output buffers that are recycled, rather than allocated for each cycle.
+// The pool grows to two buffers per enabled channel, plus the two DMA buffers and NRF52_ADC_POOL_HEADROOM, as sampling starts.
+#ifndef NRF52_ADC_POOL_SIZE
+#define NRF52_ADC_POOL_SIZE         8
+#endif
+
+// The number of spare pool entries kept beyond those needed by the enabled channels.
+#ifndef NRF52_ADC_POOL_HEADROOM
+#define NRF52_ADC_POOL_HEADROOM     2
+#endif
+
 //
 // Event codes
 //
 #define NRF52_ADC_DATA_READY     1
+#define NRF52_ADC_EVT_LIMIT_HIGH(c)     (0x10 + (c))        // Channel c has risen above its window.
+#define NRF52_ADC_EVT_LIMIT_LOW(c)      (0x20 + (c))        // Channel c has fallen below its window.
+#define NRF52_ADC_EVT_LIMIT_IN(c)       (0x30 + (c))        // Channel c has returned to its window.
 
 
 using namespace codal;
@@ -51,10 +65,20 @@ using namespace codal;
 #define NRF52_ADC_CHANNEL_STATUS_ENABLED                0x10
 #define NRF52_ADC_CHANNEL_STATUS_CONNECTED              0x20
 
+//
+// NRF52ADCChannel limit monitoring states
+//
+#define NRF52_ADC_LIMIT_DISABLED                        0
+#define NRF52_ADC_LIMIT_INSIDE                          1
+#define NRF52_ADC_LIMIT_ABOVE                           2
+#define NRF52_ADC_LIMIT_BELOW                           3
+
 class NRF52ADC;
 
 class NRF52ADCChannel : public DataSource
 {
+    friend class NRF52ADC;
+
 private:
 
     NRF52ADC            &adc;
@@ -66,6 +90,14 @@ private:
     uint8_t             channel;
     uint8_t             gain;
     uint8_t             bias;
+    int16_t             limitLow;
+    int16_t             limitHigh;
+    uint8_t             limitState;
+
+    /**
+     * Called by the ADC interrupt handler to process this channel's limit events.
+     */
+    void limitIrq();
  
 public:
     DataStream      output;
@@ -177,6 +209,32 @@ public:
      *
      */
     void configureGain();
+
+    /**
+     * Monitor this channel against a window of values. The SAADC compares every conversion against the window
+     * in hardware, and an event is raised (with the ADC's id) only as the input leaves or re-enters it:
+     * NRF52_ADC_EVT_LIMIT_HIGH(channel), NRF52_ADC_EVT_LIMIT_LOW(channel) or NRF52_ADC_EVT_LIMIT_IN(channel).
+     *
+     * Use NRF52ADC::setMonitorMode() to avoid waking the CPU for anything other than these events.
+     *
+     * @param low The lowest raw sample value considered inside the window.
+     * @param high The highest raw sample value considered inside the window.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if low > high.
+     */
+    int setLimits(int16_t low, int16_t high);
+
+    /**
+     * Stop monitoring this channel against a window of values.
+     *
+     * @return DEVICE_OK on success.
+     */
+    int clearLimits();
+
+    /**
+     * Program the SAADC limit comparators for this channel.
+     */
+    void configureLimits();
     
     /**
     * Demultiplexes the current DMA output buffer into the buffer of this channel.
@@ -203,8 +261,12 @@ public:
     NRFLowLevelTimer&   timer;                                  // The timer module used to drive this ADC.
     NRF52ADCChannel     channels[NRF52_ADC_CHANNELS];           // ADC channel objects
     ManagedBuffer       dma[2];                                 // Double buffered DMA receive buffers.
+    ManagedBuffer       *pool;                                  // DMA and output buffers, reused once released by their consumers.
+    int                 poolSize;                               // The number of entries in pool.
     int                 softwareOversample;                     // The level of software oversampling level in use.
     volatile bool       running;
+    bool                monitoring;                             // true if in monitor mode (see setMonitorMode()).
+    int16_t             monitorBuffer[NRF52_ADC_CHANNELS];      // The scratch DMA buffer used in monitor mode.
    
 public:
     /**
@@ -222,6 +284,21 @@ public:
      */
     ManagedBuffer allocateDMABuffer();
 
+    /**
+     * Obtain a buffer of the given size from the pool, recycling one released by its consumers where possible.
+     * Buffers are only allocated from the heap when none of the right size is free.
+     *
+     * @param size The size of the buffer, in bytes.
+     * @return The buffer. Its contents are undefined.
+     */
+    ManagedBuffer allocateBuffer(int size);
+
+    /**
+     * Grows the pool to suit the enabled channels, and fills it with buffers of the sizes they will use,
+     * so that the SAADC interrupt recycles buffers rather than allocating them. Called before sampling starts.
+     */
+    void reservePool();
+
     /**
      * Interrupt callback when playback of DMA buffer has completed
      */
@@ -295,11 +372,37 @@ public:
      */
     int releaseChannel(Pin& pin);
 
+    /**
+     * Take a single sample from the given pin.
+     *
+     * If the ADC is already streaming, this is the most recent sample from the pin's channel (which is added to the
+     * stream if necessary). Otherwise, a one-shot conversion is performed with the SAADC's IRQ masked, and the SAADC
+     * is powered back down afterwards. The conversion takes around 10us, and leaves no timer, DMA or IRQ activity behind.
+     *
+     * @param pin The pin to sample.
+     * @return The raw sample, clipped at zero, or DEVICE_NOT_SUPPORTED if the given pin does not support analogue input.
+     */
+    int getSampleOnce(Pin& pin);
+
     /**
       * Puts the component in (or out of) sleep (low power) mode.
       */
     virtual int setSleep(bool doSleep) override;
 
+    /**
+     * Enable or disable monitor mode. In monitor mode, no data is streamed. The SAADC repeatedly samples
+     * the enabled channels into a single frame of scratch memory, and the CPU is only woken when a channel
+     * configured with NRF52ADCChannel::setLimits() leaves or re-enters its window.
+     * getSample() continues to return the latest value of each channel.
+     *
+     * @param enable true to enter monitor mode, false to return to streaming.
+     * @return DEVICE_OK on success.
+     */
+    int setMonitorMode(bool enable);
+
+    // Times demux() directly. See NRF52Benchmark.h.
+    friend int benchmark_adc(NRF52ADC &adc, int iterations);
+
 private:
     /**
      * Stop the ADC running, if it is running.
@@ -320,6 +423,13 @@ private:
      *
      */
     void configureSampling();
+
+    /**
+     * Demultiplexes a completed DMA buffer into the buffers of all enabled channels, in a single pass.
+     *
+     * @param dmaBuffer the DMA buffer to read from
+     */
+    void demux(ManagedBuffer dmaBuffer);
 };
 
 #endif
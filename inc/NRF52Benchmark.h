@@ -0,0 +1,152 @@
+#ifndef NRF52_BENCHMARK_H
+#define NRF52_BENCHMARK_H
+
+#include "CodalConfig.h"
+#include "NRF52SPI.h"
+#include "NRF52Serial.h"
+#include "NRF52Radio.h"
+#include "NRF52ADC.h"
+
+/**
+ * On-target benchmarks of the drivers in this library.
+ *
+ * Each benchmark times a hot path with the DWT cycle counter, and reports one line per result in the form:
+ *
+ *     BENCH,<name>,<parameter>,<value>,<unit>
+ *
+ * so logs from different releases can be compared mechanically. Results go to the Serial given to benchmark_start(),
+ * or to DMESG if none was given. The library cannot own an application, so a benchmark build is an application that
+ * defines DEVICE_BENCHMARK 1, configures the drivers for its board, and calls the benchmarks it wants from main().
+ *
+ * Rates are derived from SystemCoreClock. For repeatable figures, run the benchmarks with nothing else active on the device.
+ */
+#ifndef DEVICE_BENCHMARK
+#define DEVICE_BENCHMARK                        0
+#endif
+
+// The number of iterations used by benchmarks that do not take them as a parameter.
+#ifndef BENCHMARK_ITERATIONS
+#define BENCHMARK_ITERATIONS                    1000
+#endif
+
+// How long to wait for a reply or a looped back byte before giving up, in milliseconds.
+#ifndef BENCHMARK_TIMEOUT
+#define BENCHMARK_TIMEOUT                       100
+#endif
+
+/**
+ * Enables the DWT cycle counter, selects where results are reported, and reports the core clock.
+ *
+ * @param output The serial port to report results on, or NULL to report them over DMESG.
+ */
+void benchmark_start(codal::Serial *output = NULL);
+
+/**
+ * Reports a single result, in the format described above.
+ */
+void benchmark_report(const char *name, int parameter, uint32_t value, const char *unit);
+
+/**
+ * Measures SPI throughput at each standard frequency from 125kHz to 8MHz, with full duplex transfers of the given size.
+ * MOSI may be left unconnected, or looped back to MISO.
+ *
+ * Reports spi_bytes_per_s for each frequency, and spi_setup_cycles, the fixed cost of one transfer at 8MHz.
+ *
+ * @param spi A configured SPI. Its frequency is left at the last one measured.
+ *
+ * @param size The size of each transfer, in bytes, up to 256.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if size is out of range.
+ */
+int benchmark_spi(codal::NRF52SPI &spi, int size = 256);
+
+/**
+ * Measures sustained UART transmit and receive rates at the given baud rate.
+ * TX must be looped back to RX for the receive figures.
+ *
+ * Reports uart_tx_bytes_per_s, uart_rx_bytes_per_s and uart_rx_lost (bytes that did not arrive).
+ *
+ * @param serial The UART to measure. Its baud rate is left at the rate measured.
+ *
+ * @param baud The baud rate to measure, default 1Mbaud.
+ *
+ * @param size The number of bytes to transfer in each direction, up to 255.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if size is out of range.
+ */
+int benchmark_serial(codal::NRF52Serial &serial, uint32_t baud = 1000000, int size = 255);
+
+/**
+ * Measures the rate at which the radio transmits back to back frames of the given size.
+ *
+ * Reports radio_packets_per_s.
+ *
+ * @param radio An enabled radio.
+ *
+ * @param packets The number of frames to send.
+ *
+ * @param size The payload size of each frame, up to the radio's maximum packet size.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if packets or size is out of range,
+ *         or DEVICE_NO_RESOURCES if a frame could not be queued.
+ */
+int benchmark_radio(codal::NRF52Radio &radio, int packets = BENCHMARK_ITERATIONS, int size = 32);
+
+/**
+ * Measures the round trip time of a minimal frame to a second device running benchmark_radio_echo().
+ *
+ * Reports radio_rtt_us (the average), radio_rtt_max_us and radio_rtt_lost.
+ *
+ * @param radio An enabled radio, set to the same group and band as the echoing device.
+ *
+ * @param probes The number of round trips to time.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a probe could not be queued.
+ */
+int benchmark_radio_latency(codal::NRF52Radio &radio, int probes = 100);
+
+/**
+ * Echoes every NRF52_RADIO_PROTOCOL_BENCHMARK frame received back to its sender, for benchmark_radio_latency().
+ *
+ * @param radio An enabled radio.
+ *
+ * @param enable true to start echoing, false to stop.
+ */
+void benchmark_radio_echo(codal::NRF52Radio &radio, bool enable = true);
+
+/**
+ * Measures the cost of demultiplexing a DMA buffer into the buffers of all enabled channels.
+ *
+ * Reports adc_demux_cycles_per_sample, for the number of enabled channels.
+ *
+ * @param adc An ADC with at least one channel enabled, and a DMA buffer allocated.
+ *
+ * @param iterations The number of DMA buffers to demultiplex.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if no channel is enabled.
+ */
+int benchmark_adc(NRF52ADC &adc, int iterations = BENCHMARK_ITERATIONS);
+
+/**
+ * Measures the cost of encoding pixel data into WS2812B PWM samples. This needs no hardware.
+ *
+ * Reports ws2812b_encode_cycles_per_byte.
+ *
+ * @param size The number of bytes of pixel data to encode.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the data could not be allocated.
+ */
+int benchmark_ws2812b(int size = 300);
+
+/**
+ * Measures the cost of a context switch between two fibers.
+ *
+ * Reports fiber_switch_cycles.
+ *
+ * @param iterations The number of round trips between the two fibers.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the scheduler is not running.
+ */
+int benchmark_fiber_switch(int iterations = BENCHMARK_ITERATIONS);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_EDGE_CAPTURE_H
+#define NRF52_EDGE_CAPTURE_H
+
+#include "CodalConfig.h"
+#include "Pin.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+#include "NRFLowLevelTimer.h"
+#include "ppi_alloc.h"
+
+// The number of timestamps held awaiting collection by pull(). Must be a power of two.
+#ifndef NRF52_EDGE_CAPTURE_RING_SIZE
+#define NRF52_EDGE_CAPTURE_RING_SIZE        64
+#endif
+
+// The default number of timestamps collected before our downstream component is asked to pull them.
+#ifndef NRF52_EDGE_CAPTURE_BATCH_SIZE
+#define NRF52_EDGE_CAPTURE_BATCH_SIZE       16
+#endif
+
+// The value held in a capture register once its timestamp has been collected.
+#define NRF52_EDGE_CAPTURE_EMPTY            0xFFFFFFFF
+
+// The register NRFLowLevelTimer::captureCounter() captures into. The capture and idle timeout registers must all lie below it.
+#define NRF52_EDGE_CAPTURE_COUNTER_CC       3
+
+namespace codal
+{
+    /**
+      * Class definition for an NRF52EdgeCapture
+      *
+      * Timestamps every edge on a pin in hardware, for decoding fast protocols such as IR remotes, rotary encoders and 1-Wire.
+      *
+      * A GPIOTE channel senses both edges, and PPI triggers a TIMER CAPTURE task on each, so every timestamp is exact to a
+      * tick of the 16MHz timer regardless of interrupt latency. Successive edges are captured alternately into two registers,
+      * switched by a pair of PPI channel groups, so an edge arriving before the previous one has been collected is not lost.
+      * A short interrupt handler moves the captured values into a ring, and our downstream component is only asked to pull
+      * once a batch has accumulated.
+      *
+      * Each pull() returns the timestamps (as 32 bit timer ticks) of the edges since the last. Edges alternate in polarity,
+      * starting with the opposite of getInitialLevel().
+      *
+      * Only two edges are held in hardware, so at most one edge may arrive while the interrupt handler is waiting to run.
+      * If more do, the older ones are overwritten. Edges are always dropped in pairs, whether lost this way or because the
+      * ring is full, so the polarity of the edges delivered is preserved, but the timestamps either side of a loss do not
+      * bound a single pulse. An even number of edges overwritten in hardware cannot be detected, so is not counted by
+      * getOverrunCount().
+      */
+    class NRF52EdgeCapture : public DataSource
+    {
+        Pin                 &pin;               // The pin being sensed.
+        NRFLowLevelTimer    &timer;             // The free running timer that timestamps each edge.
+        DataSink            *downstream;        // The component that consumes the timestamps, if any.
+        uint32_t            ring[NRF52_EDGE_CAPTURE_RING_SIZE];  // Timestamps awaiting collection.
+        volatile uint16_t   head;               // The number of timestamps written into the ring.
+        volatile uint16_t   tail;               // The number of timestamps read from the ring.
+        uint16_t            batchSize;          // The number of timestamps that triggers a pull request.
+        uint32_t            overruns;           // The number of edges lost because the ring was full.
+        int8_t              gpiote;             // The GPIOTE channel sensing the pin, or -1 when stopped.
+        int8_t              ppi[4];             // The PPI channels capturing (and switching) each register.
+        int8_t              group[2];           // The PPI channel groups enabling each capture register in turn.
+        uint8_t             cc;                 // The first of the two capture registers used.
+        uint8_t             next;               // The capture register (0 or 1) that holds the next edge.
+        bool                discard;            // true if the next edge is to be dropped, to pair it with one that was lost.
+        bool                initialLevel;       // The level of the pin when capture started.
+        bool                requested;          // true if a pull request is outstanding.
+        bool                idle;               // true if no edge has arrived within the idle timeout.
+        uint32_t            idleTimeout;        // The time without an edge after which the pin is idle, in ticks, or 0.
+        uint32_t            lastEdge;           // The timestamp of the most recent edge collected.
+
+        /**
+          * Moves the captured timestamps into the ring.
+          *
+          * @return The number of timestamps collected.
+          */
+        int collect();
+
+        /**
+          * Releases the GPIOTE and PPI resources in use, if any.
+          */
+        void release();
+
+        public:
+
+        NRF52EdgeCapture    *nextCapture;       // The next instance sharing the timer interrupt handler.
+
+        /**
+          * Constructor.
+          *
+          * @param pin The pin to sense.
+          *
+          * @param timer A timer dedicated to edge capture. This is configured as a free running, 16MHz, 32 bit timer.
+          *
+          * @param channel The first of the two consecutive capture registers to use: 0 or 1. Only channel 0 leaves
+          *                a register free for the idle timeout.
+          */
+        NRF52EdgeCapture(Pin &pin, NRFLowLevelTimer &timer, uint8_t channel = 0);
+
+        /**
+          * Destructor.
+          */
+        ~NRF52EdgeCapture();
+
+        /**
+          * Starts timestamping edges, discarding any not yet collected. The pin is configured as a digital input.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the channel given to the constructor is out of range,
+          *         or DEVICE_NO_RESOURCES if no GPIOTE channel, or too few PPI channels or groups, are free.
+          */
+        int start();
+
+        /**
+          * Stops timestamping edges. Timestamps already captured may still be pulled.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int stop();
+
+        /**
+          * Defines the number of timestamps collected before our downstream component is asked to pull them.
+          *
+          * @param size The batch size, in the range 1..NRF52_EDGE_CAPTURE_RING_SIZE.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is out of range.
+          */
+        int setBatchSize(int size);
+
+        /**
+          * Defines the time without an edge after which the pin is considered idle. When it becomes idle, our downstream
+          * component is asked to pull whatever has been captured, even if less than a batch, so the end of a burst of
+          * edges (such as an IR frame) is delivered promptly. This uses the compare register after the two capture registers.
+          *
+          * @param timeout The idle timeout, in microseconds, or 0 to disable it.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if there is no compare register free
+          *         (the channel given to the constructor was not 0).
+          */
+        int setIdleTimeout(uint32_t timeout);
+
+        /**
+          * Determines if no edge has arrived within the idle timeout.
+          */
+        bool isIdle();
+
+        /**
+          * Determines the level of the pin when capture started, from which the polarity of each edge follows.
+          */
+        bool getInitialLevel();
+
+        /**
+          * Determines the number of edges lost because the ring was full, or because they arrived faster than they could be collected.
+          */
+        uint32_t getOverrunCount();
+
+        /**
+          * Provide the timestamps captured since the last pull to our downstream caller.
+          *
+          * @return A buffer of 32 bit timestamps, or an empty ManagedBuffer if none are available.
+          */
+        virtual ManagedBuffer pull();
+
+        /**
+          * Update our reference to a downstream component.
+          */
+        virtual void connect(DataSink &sink);
+
+        /**
+          *  Determine the data format of the buffers streamed out of this component.
+          */
+        virtual int getFormat();
+
+        /**
+          * Interrupt handler, called on each edge to collect the captured timestamps.
+          */
+        void onEdge();
+
+        /**
+          * Timer interrupt handler, called when the idle timeout may have expired.
+          */
+        void onTimer();
+    };
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_FILTER_H
+#define NRF52_FILTER_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+
+// The number of input samples the FIR decimator processes at a time. This sets the size of its state buffer.
+#ifndef NRF52_FILTER_BLOCK_SIZE
+#define NRF52_FILTER_BLOCK_SIZE         64
+#endif
+
+#if NRF52_FILTER_BLOCK_SIZE > 0xFFFF
+#error "NRF52_FILTER_BLOCK_SIZE must fit the 16 bit decimation factor"
+#endif
+
+#define NRF52_FILTER_MAX_DECIMATION     NRF52_FILTER_BLOCK_SIZE
+#define NRF52_FILTER_BIQUAD_COEFFS      6       // The number of coefficients per biquad stage: {b0, 0, b1, b2, a1, a2}.
+
+namespace codal
+{
+
+/**
+ * Class definition for an NRF52Filter.
+ *
+ * A pipeline stage that filters a stream of 16 bit signed samples, such as the output of an NRF52ADCChannel
+ * or NRF52PDM. Each buffer pulled from upstream passes through an optional FIR decimator, and then an optional
+ * cascade of biquad sections, before being offered downstream.
+ *
+ * Coefficients use the same Q15 layouts as the CMSIS-DSP arm_fir_decimate_q15() and arm_biquad_cascade_df1_q15()
+ * functions, so filters designed for those can be used unchanged. On cores with the DSP extension, two taps are
+ * accumulated per instruction with SMLALD into a 64 bit accumulator.
+ *
+ * Buffers are filtered in place when this stage holds the only reference to them. Otherwise (or when decimating),
+ * the output is written to a new buffer, and the input is left untouched.
+ */
+class NRF52Filter : public DataSink, public DataSource
+{
+    DataSource      &upstream;              // The component providing samples.
+    DataSink        *downstream;            // The component consuming filtered samples, if any.
+
+    const int16_t   *firCoefficients;       // FIR taps, in time reversed order, or NULL if no FIR is applied.
+    int16_t         *firState;              // The last (firTaps - 1) input samples, followed by the block being processed.
+    uint16_t        firTaps;                // The number of FIR taps.
+    uint16_t        decimation;             // The FIR decimation factor.
+    uint16_t        phase;                  // The number of input samples since the last output sample.
+
+    const int16_t   *biquadCoefficients;    // Biquad coefficients, NRF52_FILTER_BIQUAD_COEFFS per stage, or NULL if none are applied.
+    int16_t         *biquadState;           // {x[n-1], x[n-2], y[n-1], y[n-2]} for each stage.
+    uint8_t         biquadStages;           // The number of biquad stages.
+    uint8_t         postShift;              // The left shift applied to the output of each stage, allowing coefficients above 1.0.
+
+    /**
+     * Applies the FIR decimator to the given samples.
+     *
+     * @return The number of output samples written. dst may equal src.
+     */
+    int decimate(const int16_t *src, int16_t *dst, int count);
+
+    /**
+     * Applies the biquad cascade to the given samples, in place.
+     */
+    void biquad(int16_t *data, int count);
+
+    public:
+
+    /**
+     * Constructor.
+     *
+     * Connects to the given upstream component. Until a filter is configured, buffers are passed through unchanged.
+     *
+     * @param upstream The component providing 16 bit signed samples.
+     */
+    NRF52Filter(DataSource &upstream);
+
+    /**
+     * Destructor.
+     */
+    ~NRF52Filter();
+
+    /**
+     * Configures the FIR decimator. The state of the filter is reset.
+     *
+     * @param coefficients The Q15 filter taps, in time reversed order (as for arm_fir_decimate_q15()), or NULL to remove the FIR.
+     *                     These are not copied, and must remain valid while the filter is in use.
+     * @param taps The number of taps.
+     * @param factor The decimation factor, in the range 1..NRF52_FILTER_MAX_DECIMATION. 1 applies the FIR without decimating.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES if the state could not be allocated.
+     */
+    int setDecimator(const int16_t *coefficients, int taps, int factor = 1);
+
+    /**
+     * Configures the biquad cascade. The state of the filter is reset.
+     *
+     * @param coefficients NRF52_FILTER_BIQUAD_COEFFS Q15 coefficients per stage, {b0, 0, b1, b2, a1, a2}, with the feedback
+     *                     coefficients already negated (as for arm_biquad_cascade_df1_q15()), or NULL to remove the cascade.
+     *                     These are not copied, and must remain valid while the filter is in use.
+     * @param stages The number of stages.
+     * @param postShift The left shift applied to the output of each stage, in the range 0..15.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES if the state could not be allocated.
+     */
+    int setBiquad(const int16_t *coefficients, int stages, int postShift = 0);
+
+    /**
+     * Clears the history of the filter, as though silence had preceded the next buffer.
+     */
+    void reset();
+
+    /**
+     * Callback provided when data is ready upstream. Passed on to our downstream component.
+     */
+    virtual int pullRequest();
+
+    /**
+     * Provide the next filtered buffer to our downstream caller, if available.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Update our reference to a downstream component.
+     */
+    virtual void connect(DataSink &sink);
+
+    /**
+     * Determine the data format of the buffers streamed out of this component.
+     */
+    virtual int getFormat();
+
+    /**
+     * Defines the data format of the buffers streamed out of this component.
+     * @param format only DATASTREAM_FORMAT_16BIT_SIGNED is supported.
+     */
+    virtual int setFormat(int format);
+};
+
+}
+
+#endif
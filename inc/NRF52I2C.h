@@ -29,17 +29,64 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/driver-models/I2C.h"
 #include "NRF52Pin.h"
 #include "hal/nrf_twim.h"
+#include "CodalFiber.h"
+#include "NRFLowLevelTimer.h"
 
 namespace codal
 {
+/**
+ * A register read performed as part of a batch (see NRF52I2C::startBatch()).
+ */
+struct NRF52I2CRead
+{
+    uint16_t address;               // The 8bit I2C address of the device to read from.
+    uint8_t reg;                    // The register to read.
+    uint8_t length;                 // The number of bytes to read.
+    uint8_t *data;                  // Where to store the bytes read.
+    int result;                     // The result of the last read: DEVICE_OK or DEVICE_I2C_ERROR.
+};
+
 /**
  * Class definition for I2C service
  */
 class NRF52I2C : public codal::I2C
 {
     int minimumBusIdlePeriod;
+    IRQn_Type IRQn;
+    void *owner;                        // The fiber (or, for async operations, this object) using the bus, or NULL if it is free.
+    volatile bool inFlight;             // true while an interrupt driven operation is in progress.
+    volatile bool failed;               // true if the operation in progress has reported an error.
+    volatile int status;                // The result of the last operation.
+    int waitEvent;                      // The TWIM event that completes the operation in progress.
+    volatile bool suspendOnLastRx;      // true to suspend the bus when the last byte is received.
+    uint16_t doneEvent;                 // The DEVICE_ID_NOTIFY event value raised as each operation completes.
+    PVoidCallback doneHandler;
+    void *doneHandlerArg;
+    uint8_t regAddress;                 // The register address sent by readRegister(), held here for EasyDMA.
+
+    NRF52I2CRead * volatile batch;      // The batch of reads in progress, or NULL.
+    int batchCount;                     // The number of reads in the batch.
+    volatile int batchIndex;            // The read in progress (or armed).
+    NRFLowLevelTimer *batchTimer;       // The timer triggering periodic batches, or NULL.
+    int8_t batchPpi;                    // The PPI channel starting each periodic batch (TIMER COMPARE0 -> TWIM STARTTX, forking to disable itself).
+    int8_t batchGroup;                  // The PPI channel group used to disarm the trigger while a batch runs.
+    PVoidCallback batchHandler;
+    void *batchHandlerArg;
+    uint8_t *txCopy;                    // A RAM copy of the bytes being written, if EasyDMA can't reach the caller's, or NULL.
 
     int waitForStop(int evt);
+    int waitForCompletion(int evt, bool lastRxSuspend, bool poll);
+    void armIrq(int evt, bool lastRxSuspend);
+    int acquire(void *token);
+    uint8_t *stageTx(uint8_t *data, int len);
+    void releaseTx();
+    void startWrite(uint16_t address, uint8_t *data, int len, bool repeated);
+    void startRead(uint16_t address, uint8_t *data, int len, bool repeated);
+    void startWriteRead(uint16_t address, uint8_t *txData, int txLen, uint8_t *rxData, int rxLen, bool start = true);
+    void startBatchRead(int index, bool start);
+    void batchStep();
+
+    static void _irqHandler(void *self);
 protected:
     NRF52Pin &sda, &scl;
     NRF_TWIM_Type *p_twim;
@@ -63,14 +110,16 @@ public:
     *  - Writing a number of raw data bytes provided
     *  - Asserting a Stop condition on the bus
     *
-    * The CPU will busy wait until the transmission is complete.
+    * The calling fiber sleeps until the transmission is complete, so other fibers can run in the meantime.
+    * If called before the scheduler is running, or from interrupt context, the CPU busy waits instead.
     *
     * @param address The 8bit I2C address of the device to write to
     * @param data pointer to the bytes to write
     * @param len the number of bytes to write
     * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
     *
-    * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed.
+    * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed, or DEVICE_NO_RESOURCES
+    *         if data is in flash and can't be copied to RAM.
     */
     virtual int write(uint16_t address, uint8_t *data, int len, bool repeated = false);
 
@@ -82,7 +131,8 @@ public:
       *  - reading "len" bytes of raw 8 bit data into the buffer provided
       *  - Asserting a Stop condition on the bus
       *
-      * The CPU will busy wait until the transmission is complete.
+      * The calling fiber sleeps until the transmission is complete, so other fibers can run in the meantime.
+      * If called before the scheduler is running, or from interrupt context, the CPU busy waits instead.
       *
       * @param address The 8bit I2C address of the device to read from
       * @param data pointer to store the the bytes read
@@ -93,6 +143,47 @@ public:
       */
     virtual int read(uint16_t address, uint8_t *data, int len, bool repeated = false);
 
+    /**
+      * Starts a write to the I2C bus, returning immediately. The given handler is called (in IRQ context) once the
+      * write has completed, and its result can then be read with getTransferResult().
+      *
+      * @param address The 8bit I2C address of the device to write to
+      * @param data pointer to the bytes to write. This must remain valid until the write has completed, unless it is
+      *             in flash, in which case it is copied to RAM first.
+      * @param len the number of bytes to write
+      * @param repeated Suppresses the generation of a STOP condition if set.
+      * @param doneHandler The function to call once the write has completed.
+      * @param arg An argument passed to doneHandler.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if len or doneHandler are invalid,
+      *         DEVICE_BUSY if the bus is in use and we can't wait for it, or DEVICE_NO_RESOURCES if data is in flash
+      *         and can't be copied to RAM.
+      */
+    int writeAsync(uint16_t address, uint8_t *data, int len, bool repeated, PVoidCallback doneHandler, void *arg);
+
+    /**
+      * Starts a read from the I2C bus, returning immediately. The given handler is called (in IRQ context) once the
+      * read has completed, and its result can then be read with getTransferResult().
+      *
+      * @param address The 8bit I2C address of the device to read from
+      * @param data pointer to store the the bytes read. This must remain valid until the read has completed.
+      * @param len the number of bytes to read into the buffer
+      * @param repeated Suppresses the generation of a STOP condition if set.
+      * @param doneHandler The function to call once the read has completed.
+      * @param arg An argument passed to doneHandler.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if len or doneHandler are invalid,
+      *         or DEVICE_BUSY if the bus is in use and we can't wait for it.
+      */
+    int readAsync(uint16_t address, uint8_t *data, int len, bool repeated, PVoidCallback doneHandler, void *arg);
+
+    /**
+      * Determines the result of the last operation on the bus.
+      *
+      * @return DEVICE_OK if it succeeded, DEVICE_I2C_ERROR if it failed, or DEVICE_BUSY if it is still in progress.
+      */
+    int getTransferResult();
+
     /**
       * Performs a typical register read operation to the I2C slave device provided.
       * This consists of:
@@ -105,7 +196,9 @@ public:
       *  - Performing an 8 bit read operation (of the requested register)
       *  - Asserting a Stop condition on the bus
       *
-      * The CPU will busy wait until the transmission is complete..
+      * A repeated START read runs as a single hardware transaction: the TWIM is programmed with both buffers up front,
+      * and the LASTTX_STARTRX and LASTRX_STOP shorts carry it from the write, through the repeated START, to the final STOP.
+      * The calling fiber sleeps until it is complete.
       *
       * @param address 8bit I2C address of the device to read from
       * @param reg The 8bit register address of the to read.
@@ -117,6 +210,78 @@ public:
       */
     virtual int readRegister(uint16_t address, uint8_t reg, uint8_t *data, int length, bool repeated = true);
 
+    /**
+      * Starts a register read from the I2C slave device provided, returning immediately. The transaction runs entirely
+      * in hardware, as a write of the register address followed by a repeated START read. The given handler is called
+      * (in IRQ context) once it has completed, and its result can then be read with getTransferResult().
+      *
+      * @param address 8bit I2C address of the device to read from
+      * @param reg The 8bit register address of the to read.
+      * @param data A pointer to a memory location to store the result of the read operation. This must remain valid until the read has completed.
+      * @param length The number of bytes to read
+      * @param doneHandler The function to call once the read has completed.
+      * @param arg An argument passed to doneHandler.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if length or doneHandler are invalid,
+      *         or DEVICE_BUSY if the bus is in use and we can't wait for it.
+      */
+    int readRegisterAsync(uint16_t address, uint8_t reg, uint8_t *data, int length, PVoidCallback doneHandler, void *arg);
+
+    /**
+      * Starts executing a list of register reads back to back, returning immediately.
+      * Each read is a single repeated START transaction (see readRegisterAsync()), and each is started from
+      * the completion interrupt of the one before, so the batch runs without any fiber scheduling.
+      * The result of each read is stored in its descriptor.
+      *
+      * @param reads The reads to perform. These must remain valid until the batch has completed.
+      * @param count The number of reads.
+      * @param handler A function to call (in IRQ context) once all reads have completed, or NULL.
+      * @param arg An argument passed to handler.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the reads are invalid, or DEVICE_BUSY if the
+      *         bus is in use and we can't wait for it.
+      */
+    int startBatch(NRF52I2CRead *reads, int count, PVoidCallback handler = NULL, void *arg = NULL);
+
+    /**
+      * Executes a list of register reads back to back, as a single operation. The calling fiber sleeps until
+      * all reads are complete.
+      *
+      * @param reads The reads to perform. The result of each is stored in its descriptor.
+      * @param count The number of reads.
+      *
+      * @return DEVICE_OK if all reads succeeded, DEVICE_I2C_ERROR if any failed, DEVICE_INVALID_PARAMETER if the
+      *         reads are invalid, or DEVICE_BUSY if the bus is in use and we can't wait for it.
+      */
+    int readBatch(NRF52I2CRead *reads, int count);
+
+    /**
+      * Executes a list of register reads periodically. A timer compare starts the first read of each batch through
+      * PPI, so the sampling instant is free of interrupt and scheduling jitter. The rest of the batch follows
+      * back to back, as with startBatch().
+      *
+      * While periodic reads are running, the bus is dedicated to them, and other operations wait until
+      * stopPeriodicBatch() is called. If a batch overruns the period, the trigger is ignored until it completes.
+      *
+      * @param timer A timer dedicated to timing the batches. It is configured for 1MHz operation.
+      * @param period The time between batches, in microseconds.
+      * @param reads The reads to perform. These must remain valid until stopPeriodicBatch() is called.
+      * @param count The number of reads.
+      * @param handler A function to call (in IRQ context) as each batch completes, or NULL.
+      * @param arg An argument passed to handler.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_BUSY if the
+      *         bus is in use and we can't wait for it, or DEVICE_NO_RESOURCES if no PPI channel or group is free.
+      */
+    int startPeriodicBatch(NRFLowLevelTimer &timer, uint32_t period, NRF52I2CRead *reads, int count, PVoidCallback handler = NULL, void *arg = NULL);
+
+    /**
+      * Stops periodic reads started by startPeriodicBatch(), waiting for any batch in progress to complete.
+      *
+      * @return DEVICE_OK on success.
+      */
+    int stopPeriodicBatch();
+
     /**
       * Clear I2C bus
       */ 
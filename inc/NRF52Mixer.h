@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_MIXER_H
+#define NRF52_MIXER_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+
+// The maximum number of sources that can be mixed.
+#ifndef NRF52_MIXER_MAX_INPUTS
+#define NRF52_MIXER_MAX_INPUTS          4
+#endif
+
+// The number of output buffers kept for reuse.
+#ifndef NRF52_MIXER_POOL_SIZE
+#define NRF52_MIXER_POOL_SIZE           4
+#endif
+
+// The default size of each output buffer, in bytes.
+#ifndef NRF52_MIXER_BUFFER_SIZE
+#define NRF52_MIXER_BUFFER_SIZE         512
+#endif
+
+#define NRF52_MIXER_UNITY_GAIN          1024
+
+namespace codal
+{
+
+class NRF52Mixer;
+
+/**
+ * One input to an NRF52Mixer. Receives pull requests from its source on behalf of the mixer.
+ */
+class NRF52MixerInput : public DataSink
+{
+    friend class NRF52Mixer;
+
+    NRF52Mixer      &mixer;                 // The mixer we belong to.
+    DataSource      &source;                // The component providing our samples.
+    ManagedBuffer   current;                // The buffer being mixed, or empty.
+    uint16_t        offset;                 // The position of the next sample to mix in current, in bytes.
+    uint16_t        gain;                   // The gain applied to our samples, where NRF52_MIXER_UNITY_GAIN is 1.0.
+    volatile uint8_t ready;                 // The number of buffers our source has announced, but we have not yet pulled.
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param mixer The mixer this input belongs to.
+     * @param source The component providing samples. We connect ourselves to it.
+     * @param gain The initial gain, where NRF52_MIXER_UNITY_GAIN is 1.0.
+     */
+    NRF52MixerInput(NRF52Mixer &mixer, DataSource &source, int gain);
+
+    /**
+     * Callback provided when data is ready.
+     */
+    virtual int pullRequest();
+};
+
+/**
+ * Class definition for an NRF52Mixer.
+ *
+ * A DataSource that mixes the streams of up to NRF52_MIXER_MAX_INPUTS sources, for example to play several sounds
+ * at once through a single NRF52PWM. Each output buffer is mixed in one pass per source, straight into the buffer
+ * that the PWM then plays by EasyDMA, with no intermediate copies. Samples are summed with saturation, two at a time
+ * with the M4's SIMD instructions.
+ *
+ * Sources are mixed in the format of the mixer: 16 bit signed samples (e.g. audio), or 16 bit unsigned values
+ * (e.g. raw PWM channel values for LED fades). Signed audio can be mapped onto the range of a PWM in the same step,
+ * with setOutputRange(). A source with no data ready contributes silence, and buffers of any length may be mixed.
+ *
+ * Output buffers are drawn from a small pool, and are reused once the downstream component releases them.
+ */
+class NRF52Mixer : public DataSource
+{
+    friend class NRF52MixerInput;
+
+    NRF52MixerInput *inputs[NRF52_MIXER_MAX_INPUTS];    // The sources being mixed, or NULL.
+    ManagedBuffer   pool[NRF52_MIXER_POOL_SIZE];        // Output buffers, reused once released by the downstream component.
+    DataSink        *downstream;            // The component consuming mixed samples, if any.
+    uint16_t        bufferSize;             // The size of each output buffer, in bytes.
+    uint16_t        outputRange;            // The range that signed samples are mapped onto, or 0 to leave them unchanged.
+    uint8_t         format;                 // DATASTREAM_FORMAT_16BIT_SIGNED or DATASTREAM_FORMAT_16BIT_UNSIGNED.
+    volatile bool   active;                 // true if we have told downstream that data is available, and it has not yet pulled.
+
+    /**
+     * Called when an input has data ready. Notifies downstream if we are idle.
+     */
+    void inputReady();
+
+    /**
+     * Obtain an output buffer from the pool, recycling one released by the downstream component where possible.
+     */
+    ManagedBuffer allocateBuffer();
+
+    /**
+     * Mixes samples from the given input into the output, until the output or the input runs out.
+     *
+     * @param first true if this is the first input mixed into this buffer, in which case the output is overwritten.
+     * @return The number of samples mixed.
+     */
+    int mix(NRF52MixerInput *input, int16_t *out, int count, bool first);
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param format The format of the samples to mix: DATASTREAM_FORMAT_16BIT_SIGNED or DATASTREAM_FORMAT_16BIT_UNSIGNED.
+     */
+    NRF52Mixer(int format = DATASTREAM_FORMAT_16BIT_SIGNED);
+
+    /**
+     * Destructor.
+     */
+    ~NRF52Mixer();
+
+    /**
+     * Start mixing the given source.
+     *
+     * @param source The component providing samples, in the format of this mixer.
+     * @param gain The gain to apply, where NRF52_MIXER_UNITY_GAIN is 1.0.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the source is already mixed,
+     *         or DEVICE_NO_RESOURCES if NRF52_MIXER_MAX_INPUTS sources are already mixed.
+     */
+    int addInput(DataSource &source, int gain = NRF52_MIXER_UNITY_GAIN);
+
+    /**
+     * Stop mixing the given source.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the source is not mixed.
+     */
+    int removeInput(DataSource &source);
+
+    /**
+     * Change the gain applied to the given source.
+     *
+     * @param gain The gain to apply, where NRF52_MIXER_UNITY_GAIN is 1.0, in the range 0..0xFFFF.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the source is not mixed or the gain is out of range.
+     */
+    int setGain(DataSource &source, int gain);
+
+    /**
+     * Map signed samples onto the range 0..range as they are mixed, so that they can be played directly by an NRF52PWM.
+     * Silence is mapped to range / 2.
+     *
+     * @param range The range to map onto (typically NRF52PWM::getSampleRange()), or 0 to leave samples unchanged.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mixer is unsigned or the range is invalid.
+     */
+    int setOutputRange(int range);
+
+    /**
+     * Define the size of each output buffer.
+     *
+     * @param size The size of each buffer in bytes. This must be even, and non-zero.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is invalid.
+     */
+    int setBufferSize(int size);
+
+    /**
+     * Provide the next mixed buffer to our downstream caller, if any source has data.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Update our reference to a downstream component.
+     */
+    virtual void connect(DataSink &sink);
+
+    /**
+     * Determine the data format of the buffers streamed out of this component.
+     */
+    virtual int getFormat();
+};
+
+}
+
+#endif
@@ -38,12 +38,73 @@ DEALINGS IN THE SOFTWARE.
 //
 // Constants
 //
-#define NRF52_PDM_BUFFER_SIZE           512
+#ifndef NRF52_PDM_BUFFER_SIZE
+#define NRF52_PDM_BUFFER_SIZE           512         // The default DMA block size, in bytes.
+#endif
+
+#ifndef NRF52_PDM_POOL_SIZE
+#define NRF52_PDM_POOL_SIZE             8           // The maximum number of DMA buffers kept for reuse.
+#endif
+
+#ifndef NRF52_PDM_BUFFER_COUNT
+#define NRF52_PDM_BUFFER_COUNT          4           // The default number of DMA buffers kept for reuse.
+#endif
+
+#define NRF52_PDM_MAX_BUFFER_SIZE       (0x7FFF * 2)
+
+// The range of PDM clock frequencies setSampleRate() may choose, in Hz. Check that your microphone supports them.
+#ifndef NRF52_PDM_MIN_CLOCK
+#define NRF52_PDM_MIN_CLOCK             500000
+#endif
+
+#ifndef NRF52_PDM_MAX_CLOCK
+#define NRF52_PDM_MAX_CLOCK             1334000
+#endif
+
+#define NRF52_PDM_LEFT                  0
+#define NRF52_PDM_RIGHT                 1
 
 using namespace codal;
 
+class NRF52PDM;
+
+/**
+ * One side of a stereo NRF52PDM, delivered as a DataSource of its own.
+ * Each block is de-interleaved from the PDM's output as it is pulled.
+ */
+class NRF52PDMChannel : public DataSource
+{
+    friend class NRF52PDM;
+
+    NRF52PDM        &pdm;                                   // The PDM module we take samples from.
+    DataSink        *downstream;                            // The component consuming our samples, if any.
+    uint8_t         side;                                   // NRF52_PDM_LEFT or NRF52_PDM_RIGHT.
+    ManagedBuffer   pool[NRF52_PDM_POOL_SIZE];              // Blocks of this side's samples in stereo mode, reused once released.
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param pdm The PDM module to take samples from.
+     * @param side NRF52_PDM_LEFT or NRF52_PDM_RIGHT.
+     */
+    NRF52PDMChannel(NRF52PDM &pdm, int side);
+
+    /**
+     * Provide the samples of this side from the PDM's most recent block. In mono mode, this is the whole block.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Update our reference to a downstream component.
+     */
+    virtual void connect(DataSink &sink);
+};
+
 class NRF52PDM : public CodalComponent, public DataSource
 {
+    friend class NRF52PDMChannel;
 
 private:
     bool            enabled;                                // Determines if this component is actively receiving data.
@@ -51,10 +112,16 @@ private:
     uint32_t        outputBufferSize;                       // The size of our output buffer.
 	uint32_t        sampleRate;                             // The PCM output target sample rate (in bps).
     uint8_t         gain;                                   // The gain to apply to the pdm input channels.
+    uint8_t         bufferCount;                            // The number of entries in pool that are in use.
+    bool            stereo;                                 // true if both microphones are sampled, with L/R interleaved in each block.
+    uint16_t        bufferSize;                             // The size of each DMA buffer, in bytes.
+    ManagedBuffer   pool[NRF52_PDM_POOL_SIZE];              // DMA buffers, reused once released by their consumers.
 
 public:
 
-	DataStream output;
+	DataStream output;                                      // The stream of blocks, interleaved L/R in stereo mode.
+    NRF52PDMChannel left;                                   // The left channel alone (the only channel in mono mode).
+    NRF52PDMChannel right;                                  // The right channel alone, in stereo mode.
 
     /**
       * Constructor for an instance of a PDM input (typically microphone),
@@ -99,8 +166,80 @@ public:
      */
     int setGain(int gain);
 
+    /**
+     * Define the size of each block of samples DMA'd from the microphone, and delivered downstream.
+     * Small blocks reduce latency, and large blocks reduce the interrupt rate. The change takes effect
+     * from the next block to be queued.
+     *
+     * @param size The block size in bytes. This must be even, and at most NRF52_PDM_MAX_BUFFER_SIZE.
+     * Each sample is 2 bytes, so the default of 512 bytes is 16ms of audio.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is invalid.
+     */
+    int setBufferSize(int size);
+
+    /**
+     * Determine the size of each block of samples delivered downstream.
+     *
+     * @return The block size, in bytes.
+     */
+    int getBufferSize();
+
+    /**
+     * Define the number of DMA buffers kept for reuse. Two are always held by the PDM hardware, so
+     * any more allow downstream components to hold on to blocks without a heap allocation being made
+     * for each new block.
+     *
+     * @param count The number of buffers, in the range 2..NRF52_PDM_POOL_SIZE.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the count is invalid.
+     */
+    int setBufferCount(int count);
+
+    /**
+     * Select mono or stereo operation. In stereo mode, the left and right samples are interleaved in
+     * each block delivered by output, and are also available separately through left and right.
+     * If the PDM is running, it is restarted.
+     *
+     * @param stereo true to sample both microphones, false for the left microphone only.
+     *
+     * @return DEVICE_OK on success.
+     */
+    int setStereo(bool stereo);
+
+    /**
+     * Determine if the PDM is operating in stereo.
+     *
+     * @return true if in stereo mode.
+     */
+    bool isStereo();
+
+    /**
+     * Select the sample rate, by choosing a PDM clock frequency and decimation ratio (RATIO is only
+     * available on the nRF52833/840). The clock is kept between NRF52_PDM_MIN_CLOCK and NRF52_PDM_MAX_CLOCK.
+     * If the PDM is running, it is restarted.
+     *
+     * @param rate The target rate of each channel, in Hz (e.g. 8000 or 16000).
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate can't be reached with a supported clock.
+     */
+    int setSampleRate(int rate);
+
+    /**
+     * Determine the rate at which samples are generated in each channel.
+     *
+     * @return The sample rate, in Hz.
+     */
+    int getSampleRate();
+
 private:
 
+    /**
+     * Obtain a DMA buffer from the pool, recycling one released by its consumers where possible.
+     * Buffers are only allocated from the heap when none of the right size is free.
+     */
+    ManagedBuffer allocateBuffer();
+
     void startDMA();
 };
 
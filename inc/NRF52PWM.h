@@ -12,9 +12,23 @@
 #define NRF52PWM_DEFAULT_FREQUENCY 16000
 #endif
 
+// The largest number of buffers that can be pre-pulled ahead of the two hardware sequence slots.
+#ifndef NRF52PWM_MAX_QUEUE_DEPTH
+#define NRF52PWM_MAX_QUEUE_DEPTH    6
+#endif
+
 #define NRF52PWM_PWM_PERIPHERALS    3
 #define NRF52PWM_PWM_CHANNELS       4
 
+// The longest time streamed playout waits for the queue to fill before starting with whatever it holds, in microseconds.
+#ifndef NRF52PWM_PREROLL_TIMEOUT
+#define NRF52PWM_PREROLL_TIMEOUT    20000
+#endif
+
+// Events
+#define NRF52PWM_EVT_UNDERRUN       1       // A sequence ended in streaming mode with no new buffer ready to play.
+#define NRF52PWM_EVT_PREROLL        2       // Internal event, raised when the preroll timeout expires.
+
 
 using namespace codal;
 
@@ -33,6 +47,15 @@ private:
     uint8_t         bufferPlaying;          // ID of the buffer currently being played (0 or 1). Output is hardware double buffered.
     int8_t          stopStreamingAfterBuf;  // When stopping, the last buffer ID to play beforhand. -1 if no stop is scheduled.
     ManagedBuffer   buffer[2];              // The ManagedBuffers currently being used by the PWN hardware
+    ManagedBuffer   queue[NRF52PWM_MAX_QUEUE_DEPTH + 2];    // Buffers pulled from upstream, awaiting a hardware slot.
+    uint8_t         queueHead;              // The index of the oldest buffer in queue.
+    uint8_t         queueCount;             // The number of buffers in queue.
+    uint8_t         queueDepth;             // The number of buffers to hold in queue in addition to the two hardware slots.
+    uint8_t         valuesPerPeriod;        // The number of 16 bit values consumed each PWM period, for the current decoder mode.
+    volatile bool   filling;                // true while buffers are being pulled into queue.
+    uint32_t        underruns;              // The number of sequences that ended with no new buffer ready to play.
+    bool            prerolling;             // true while the preroll timeout is running.
+    bool            prerollFlush;           // true if upstream has returned an empty buffer, so playout should start with what is queued.
 
 public:
 
@@ -113,6 +136,44 @@ public:
      */
     void setStreamingMode(bool streamingMode, bool repeatOnEmpty = true);
 
+    /**
+     * Repeatedly play the given values from RAM, with no CPU involvement. The values are re-read by EasyDMA every period,
+     * so changes written to them take effect from the next period, without restarting playback. Any stream is stopped.
+     *
+     * @param values The values to play, interpreted according to the decoder mode. These must remain valid while playing.
+     * @param count The number of 16 bit values.
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER.
+     */
+    int playLive(uint16_t *values, int count);
+
+    /**
+     * Defines how many buffers are pulled from upstream ahead of the two being played by the hardware.
+     * A deeper queue rides out longer delays in the upstream component (e.g. under fiber or radio load) without an underrun,
+     * at the cost of latency. In streaming mode, playout starts once the hardware slots and the queue are full, or
+     * with whatever has been queued if upstream returns an empty buffer or NRF52PWM_PREROLL_TIMEOUT passes first,
+     * so short sounds are still played.
+     *
+     * @param depth The number of buffers, in the range 0..NRF52PWM_MAX_QUEUE_DEPTH. The default of 0 is plain double buffering.
+     * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER.
+     */
+    int setQueueDepth(int depth);
+
+    /**
+     * Determine the number of sequences that have ended in streaming mode with no new buffer ready to play.
+     * An NRF52PWM_EVT_UNDERRUN event is also raised each time this happens.
+     *
+     * @return The number of underruns since this component was created.
+     */
+    uint32_t getUnderrunCount();
+
+    /**
+     * Determine the time a buffer pulled now will take to reach the output: the duration of all the
+     * data queued and held by the hardware. This is an upper bound, as part of the playing buffer may already have been output.
+     *
+     * @return The playout latency, in microseconds.
+     */
+    int getLatencyUs();
+
     /**
      * Interrupt callback when playback of DMA buffer has completed
      */
@@ -146,6 +207,27 @@ public:
      */
     int tryPull(uint8_t b);
 
+    /**
+     * Pull buffers that upstream has announced into the queue, until it holds the given number.
+     */
+    void fillQueue(int limit);
+
+    /**
+     * Take the oldest buffer from the queue or, if it is empty, directly from upstream.
+     * @return true if a buffer was obtained.
+     */
+    bool nextBuffer(ManagedBuffer &b);
+
+    /**
+     * Pre-roll the queue, and start streamed playout once the hardware slots and the queue are full, or the preroll ends early.
+     */
+    void preload();
+
+    /**
+     * Starts streamed playout with whatever is queued, once the preroll timeout expires.
+     */
+    void onPreroll(Event);
+
 };
 
 #endif
@@ -43,6 +43,18 @@ DEALINGS IN THE SOFTWARE.
 
 #define NRF52PIN_PWM_CHANNEL_MAP_SIZE        4
 
+// The number of PWM modules (from PWM0 upwards) that pins may use for analog output.
+// By default, PWM2 is left for the neopixel driver if it is in use.
+#ifndef NRF52PIN_PWM_MODULES
+#if CONFIG_ENABLED(HARDWARE_NEOPIXEL)
+#define NRF52PIN_PWM_MODULES                2
+#else
+#define NRF52PIN_PWM_MODULES                NRF52PWM_PWM_PERIPHERALS
+#endif
+#endif
+
+#define NRF52PIN_PWM_DEFAULT_PERIOD         20000
+
 #ifndef CAPTOUCH_DEFAULT_CALIBRATION
 #define CAPTOUCH_DEFAULT_CALIBRATION        -1
 #endif
@@ -68,18 +80,52 @@ namespace codal
         
      private:
         static MemorySource* pwmSource;
-        static NRF52PWM* pwm;
-        static uint16_t pwmBuffer[NRF52PIN_PWM_CHANNEL_MAP_SIZE];
-        static int8_t pwmChannelMap[NRF52PIN_PWM_CHANNEL_MAP_SIZE];
-        static uint8_t lastUsedChannel;
+        static NRF52PWM* pwm[NRF52PIN_PWM_MODULES];
+        static uint16_t pwmBuffer[NRF52PIN_PWM_MODULES][NRF52PIN_PWM_CHANNEL_MAP_SIZE];
+        static int8_t pwmChannelMap[NRF52PIN_PWM_MODULES][NRF52PIN_PWM_CHANNEL_MAP_SIZE];
+        static uint32_t pwmPeriod[NRF52PIN_PWM_MODULES];
 
         void* obj;
 
 
         /**
-             * Instantiates the components required for PWM if not previously created
+             * Instantiates the components required for PWM on the given module if not previously created.
+             * If the module is idle, it is configured for the given period and its live sequence is started.
+             */
+        int initialisePWM(int module, uint32_t period);
+
+        /**
+             * Finds the PWM channel driving this pin.
+             *
+             * @return The index of the channel (module * NRF52PIN_PWM_CHANNEL_MAP_SIZE + channel), or -1 if none is allocated.
              */
-        int initialisePWM();
+        int findPWMChannel();
+
+        /**
+             * Allocates a PWM channel for this pin, on a module running at the given period.
+             * Modules already running at that period are preferred, then idle modules (which are configured for it).
+             * If flexible, any module with a free channel is used as a last resort, and the pin adopts its period.
+             *
+             * @param exclude A module not to consider, or -1.
+             *
+             * @return The index of the channel, or -1 if none is free.
+             */
+        int allocatePWMChannel(uint32_t period, bool flexible, int exclude = -1);
+
+        /**
+             * Changes the period of the PWM channel driving this pin, moving the pin to another module if
+             * the one it is on is shared with pins at other periods. The duty cycle is preserved.
+             *
+             * @param index The channel currently driving this pin.
+             *
+             * @return The index of the channel now driving this pin.
+             */
+        int setPWMPeriod(int index, uint32_t period);
+
+        /**
+             * Sets the duty cycle of the given PWM channel to numerator / denominator, by updating its value in the live sequence.
+             */
+        void setPWMDuty(int index, uint32_t numerator, uint32_t denominator);
 
         /**
              * This member function manages the calculation of the timestamp of a pulse detected
@@ -186,8 +232,8 @@ namespace codal
              *
              * @param value the level to set on the output pin, in the range 0 - 1024
              *
-             * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if value is out of range, or DEVICE_NOT_SUPPORTED
-             *         if the given pin does not have analog capability.
+             * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if value is out of range, DEVICE_NOT_SUPPORTED
+             *         if the given pin does not have analog capability, or DEVICE_NO_RESOURCES if all PWM channels are in use.
              */
         virtual int setAnalogValue(int value) override;
 
@@ -0,0 +1,132 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_PIN_GROUP_H
+#define NRF52_PIN_GROUP_H
+
+#include "CodalConfig.h"
+#include "Pin.h"
+#include "nrf.h"
+
+// The largest number of pins in a group: one per bit of a value.
+#define NRF52_PIN_GROUP_MAX_PINS        32
+
+#ifdef NRF_P1
+#define NRF52_PIN_GROUP_PORTS           2
+#else
+#define NRF52_PIN_GROUP_PORTS           1
+#endif
+
+namespace codal
+{
+    /**
+      * Class definition for an NRF52PinGroup
+      *
+      * Drives a set of pins together as a parallel bus, such as the data lines of a display, a shift register or the rows
+      * of a multiplexed LED matrix. Bit n of each value corresponds to the nth pin given to the constructor.
+      *
+      * The pins are resolved to GPIO port masks once, at construction, so each write is a single OUT update per port
+      * (changing every pin on that port at the same moment), and each read a single IN read per port.
+      * Pins are configured through their Pin instances by setOutput() or setInput(), so they remain consistent
+      * with the rest of the system; other uses of the pins in between must be followed by another call to these.
+      */
+    class NRF52PinGroup
+    {
+        uint32_t        mask[NRF52_PIN_GROUP_PORTS];    // The bits of each port belonging to the group.
+        uint32_t        *table;                     // The port bits set by each nibble of a value, for each port, or NULL.
+        Pin             **pins;                     // The pins in the group, in bit order.
+        uint8_t         count;                      // The number of pins in the group.
+        uint8_t         contiguousPort;             // The port holding the whole group, if contiguous.
+        int8_t          shift;                      // The offset from value bits to port bits, or -1 if not contiguous.
+
+        /**
+          * Determines the bits to set on each port for the given value.
+          */
+        void scatter(uint32_t value, uint32_t *bits);
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * @param pins The pins in the group. Bit n of each value corresponds to pins[n]. The array must remain valid
+          *             for the lifetime of the group.
+          *
+          * @param count The number of pins, in the range 1..NRF52_PIN_GROUP_MAX_PINS.
+          */
+        NRF52PinGroup(Pin **pins, int count);
+
+        /**
+          * Destructor.
+          */
+        ~NRF52PinGroup();
+
+        /**
+          * Configures every pin in the group as a digital output.
+          *
+          * @param value The initial value of the group.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int setOutput(uint32_t value = 0);
+
+        /**
+          * Configures every pin in the group as a digital input.
+          *
+          * @param pull The pull mode applied to each pin.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int setInput(PullMode pull = PullMode::None);
+
+        /**
+          * Writes the given value to the group, changing every pin on each port at once.
+          *
+          * @param value The value to write.
+          */
+        void write(uint32_t value);
+
+        /**
+          * Sets the pins corresponding to the 1 bits of the given value, leaving the others unchanged.
+          * This is a single OUTSET write per port, so is safe from any context.
+          */
+        void set(uint32_t bits);
+
+        /**
+          * Clears the pins corresponding to the 1 bits of the given value, leaving the others unchanged.
+          * This is a single OUTCLR write per port, so is safe from any context.
+          */
+        void clear(uint32_t bits);
+
+        /**
+          * Reads the current level of every pin in the group.
+          *
+          * @return The value of the group.
+          */
+        uint32_t read();
+    };
+}
+
+#endif
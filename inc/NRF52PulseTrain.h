@@ -0,0 +1,132 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_PULSE_TRAIN_H
+#define NRF52_PULSE_TRAIN_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+#include "NRF52EdgeCapture.h"
+
+// The default time without an edge that ends a frame, in microseconds.
+#ifndef NRF52_PULSE_TRAIN_TIMEOUT
+#define NRF52_PULSE_TRAIN_TIMEOUT           10000
+#endif
+
+// The largest number of pulses in a frame. Longer frames are delivered in parts.
+#ifndef NRF52_PULSE_TRAIN_MAX_PULSES
+#define NRF52_PULSE_TRAIN_MAX_PULSES        128
+#endif
+
+// The number of completed frames held awaiting collection by pull().
+#ifndef NRF52_PULSE_TRAIN_QUEUE_SIZE
+#define NRF52_PULSE_TRAIN_QUEUE_SIZE        4
+#endif
+
+namespace codal
+{
+    /**
+      * Class definition for an NRF52PulseTrain
+      *
+      * Converts the edge timestamps of an NRF52EdgeCapture into frames of pulse widths, so decoders for protocols such as
+      * IR remotes or DHT22 sensors can process a whole frame in a single pass.
+      *
+      * A frame is a run of edges with no gap longer than the timeout between them. Each frame is delivered as a
+      * ManagedBuffer of uint32_t durations in microseconds: the first is the time from the first edge of the frame to the
+      * second, and so on, the pulses alternating in level.
+      */
+    class NRF52PulseTrain : public DataSink, public DataSource
+    {
+        NRF52EdgeCapture    &upstream;          // The source of edge timestamps.
+        DataSink            *downstream;        // The component that consumes completed frames, if any.
+        uint32_t            timeout;            // The gap that ends a frame, in timer ticks.
+        uint32_t            lastEdge;           // The timestamp of the last edge of the current frame.
+        bool                inFrame;            // true if a frame has been started.
+        uint16_t            pulseCount;         // The number of pulses in the current frame.
+        uint32_t            pulses[NRF52_PULSE_TRAIN_MAX_PULSES];      // The pulses of the current frame.
+        ManagedBuffer       output[NRF52_PULSE_TRAIN_QUEUE_SIZE];      // A ring of completed frames awaiting collection.
+        uint8_t             outputHead;         // The index of the oldest frame in output.
+        uint8_t             outputCount;        // The number of frames in output.
+        uint32_t            dropped;            // The number of frames lost because the queue was full.
+
+        /**
+          * Completes the current frame, if it has any pulses, and queues it for collection.
+          */
+        void endFrame();
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * Connects to the given edge capture, and sets its idle timeout to match the frame timeout.
+          * The edge capture is started and stopped by the caller.
+          *
+          * @param capture The source of edge timestamps.
+          *
+          * @param timeout The time without an edge that ends a frame, in microseconds.
+          */
+        NRF52PulseTrain(NRF52EdgeCapture &capture, uint32_t timeout = NRF52_PULSE_TRAIN_TIMEOUT);
+
+        /**
+          * Defines the time without an edge that ends a frame.
+          *
+          * @param timeout The timeout, in microseconds.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the timeout is zero.
+          */
+        int setTimeout(uint32_t timeout);
+
+        /**
+          * Determines the number of frames lost because they were not pulled in time.
+          */
+        uint32_t getDroppedCount();
+
+        /**
+          * Callback provided when data is ready.
+          */
+        virtual int pullRequest();
+
+        /**
+          * Provide the next completed frame to our downstream caller, if available.
+          *
+          * @return A buffer of uint32_t pulse widths in microseconds, or an empty ManagedBuffer if no frame is available.
+          */
+        virtual ManagedBuffer pull();
+
+        /**
+          * Update our reference to a downstream component.
+          */
+        virtual void connect(DataSink &sink);
+
+        /**
+          *  Determine the data format of the buffers streamed out of this component.
+          */
+        virtual int getFormat();
+    };
+}
+
+#endif
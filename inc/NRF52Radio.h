@@ -30,6 +30,7 @@ DEALINGS IN THE SOFTWARE.
 namespace codal
 {
     class NRF52Radio;
+    class NRF52RadioScheduler;
     struct FrameBuffer;
 }
 
@@ -71,46 +72,245 @@ namespace codal
 #define NRF52_RADIO_DEFAULT_GROUP            0
 #define NRF52_RADIO_DEFAULT_TX_POWER         6
 #define NRF52_RADIO_DEFAULT_FREQUENCY        7
-#define NRF52_RADIO_MAX_PACKET_SIZE          32
+#ifndef NRF52_RADIO_MAX_PACKET_SIZE
+#define NRF52_RADIO_MAX_PACKET_SIZE          32      // The default maximum payload size, which can be changed with setMaxPacketSize().
+#endif
 #define NRF52_RADIO_HEADER_SIZE              4
+
+// The largest payload setMaxPacketSize() accepts, which also sizes FrameBuffer::payload. This defaults to the legacy size,
+// so FrameBuffers stay small. Builds that need larger frames can raise it to as much as the 8 bit LENGTH field allows.
+#ifndef NRF52_RADIO_MAX_PACKET_SIZE_LIMIT
+#define NRF52_RADIO_MAX_PACKET_SIZE_LIMIT    NRF52_RADIO_MAX_PACKET_SIZE
+#endif
+
+#if NRF52_RADIO_MAX_PACKET_SIZE_LIMIT > 255 - NRF52_RADIO_HEADER_SIZE + 1 || NRF52_RADIO_MAX_PACKET_SIZE_LIMIT < NRF52_RADIO_MAX_PACKET_SIZE
+#error "NRF52_RADIO_MAX_PACKET_SIZE_LIMIT must be between NRF52_RADIO_MAX_PACKET_SIZE and 252"
+#endif
+
+#define NRF52_RADIO_DEFAULT_MODE             RADIO_MODE_MODE_Nrf_1Mbit
+#define NRF52_RADIO_MAXIMUM_GROUPS           8       // The number of logical addresses supported by the RADIO hardware.
+
+// Encryption configuration
+#define NRF52_RADIO_VERSION_ENCRYPTED        2       // The FrameBuffer::version of frames whose payload is encrypted by the CCM.
+#define NRF52_RADIO_CCM_NONCE_SIZE           8       // Cleartext sender id and packet counter, used to build a unique CCM nonce.
+#define NRF52_RADIO_CCM_MIC_SIZE             4
+#define NRF52_RADIO_CCM_OVERHEAD             (NRF52_RADIO_CCM_NONCE_SIZE + 3 + NRF52_RADIO_CCM_MIC_SIZE)  // Payload bytes used by encryption.
+#define NRF52_RADIO_CCM_SCRATCH_SIZE         (16 + 256)
+
+// CCM operation results
+#define NRF52_RADIO_CCM_IDLE                 0
+#define NRF52_RADIO_CCM_DONE                 1
+#define NRF52_RADIO_CCM_ERROR                2
+
+#ifndef NRF52_RADIO_MAXIMUM_PROTOCOLS
+#define NRF52_RADIO_MAXIMUM_PROTOCOLS        6       // The number of protocol handlers that can be registered, including the built in ones.
+#endif
 #define NRF52_RADIO_MAXIMUM_RX_BUFFERS       4
 
+#ifndef NRF52_RADIO_MAXIMUM_TX_BUFFERS
+#define NRF52_RADIO_MAXIMUM_TX_BUFFERS       4
+#endif
+
+// The number of FrameBuffers preallocated for use by the radio. This needs to cover the receiver queue,
+// the buffer held by the RADIO hardware, any packets held by higher level protocols awaiting collection
+// and the transmit queue.
+#ifndef NRF52_RADIO_FRAMEBUFFER_POOL_SIZE
+#define NRF52_RADIO_FRAMEBUFFER_POOL_SIZE    (2 * NRF52_RADIO_MAXIMUM_RX_BUFFERS + 1 + NRF52_RADIO_MAXIMUM_TX_BUFFERS)
+#endif
+
+// Transmitter states
+#define NRF52_RADIO_TX_IDLE                  0       // The radio is listening. No transmission is in progress.
+#define NRF52_RADIO_TX_PENDING               1       // The receiver is being disabled, ready for transmission.
+#define NRF52_RADIO_TX_ACTIVE                2       // Packets are being transmitted from the transmit queue.
+#define NRF52_RADIO_TX_BEACON                3       // A beacon is being transmitted by the NRF52RadioScheduler.
+
 // Known Protocol Numbers
 #define NRF52_RADIO_PROTOCOL_DATAGRAM        1       // A simple, single frame datagram. a little like UDP but with smaller packets. :-)
 #define NRF52_RADIO_PROTOCOL_EVENTBUS        2       // Transparent propogation of events from one micro:bit to another.
+#define NRF52_RADIO_PROTOCOL_BEACON          3       // Slot timing beacons, used by NRF52RadioScheduler.
+#define NRF52_RADIO_PROTOCOL_FRAGMENT        4       // Fragments of datagrams too large for a single frame, used by NRF52RadioFragmenter.
+#define NRF52_RADIO_PROTOCOL_BENCHMARK       5       // Round trip timing probes, used by benchmark_radio_latency() and benchmark_radio_echo().
 
 // Events
 #define NRF52_RADIO_EVT_DATAGRAM             1       // Event to signal that a new datagram has been received.
+#define NRF52_RADIO_EVT_TX_COMPLETE          2       // Event to signal that queued packets have been transmitted.
+#define NRF52_RADIO_EVT_EVENT_FLUSH          3       // Internal event, used to end an NRF52RadioEvent coalescing window.
 
 #define NRF52_BLE_POWER_LEVELS                 8
 
+// Compile time trace hook for the radio. Enable with the NRF52_RADIO_TRACE config option.
+#if CONFIG_ENABLED(NRF52_RADIO_TRACE)
+#include "CodalDmesg.h"
+#define NRF52_RADIO_TRACE(...)                 DMESG(__VA_ARGS__)
+#else
+#define NRF52_RADIO_TRACE(...)                 ((void)0)
+#endif
+
 namespace codal
 {
 struct FrameBuffer
 {
+    FrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
+    int             rssi;                               // Received signal strength of this frame.
+    uint8_t         address;                            // The logical address (RXMATCH) this frame was received on. See NRF52Radio::getGroup().
+
+    // Fields below this point are transferred by the RADIO hardware.
     uint8_t         length;                             // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
     uint8_t         version;                            // Protocol version code.
     uint8_t         group;                              // ID of the group to which this packet belongs.
     uint8_t         protocol;                           // Inner protocol number c.f. those issued by IANA for IP protocols
 
-    uint8_t         payload[NRF52_RADIO_MAX_PACKET_SIZE];    // User / higher layer protocol data
-    FrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
-    int             rssi;                               // Received signal strength of this frame.
+    // User / higher layer protocol data. Only the first NRF52Radio::getMaxPacketSize() bytes are allocated in FrameBuffers taken from the pool.
+    uint8_t         payload[NRF52_RADIO_MAX_PACKET_SIZE_LIMIT];
 };
 
+/**
+  * The data structure used by the CCM peripheral (c.f. CNFPTR).
+  */
+struct NRF52RadioCcmConfig
+{
+    uint8_t         key[16];                            // The AES key.
+    uint8_t         counter[8];                         // The 39 bit packet counter, least significant byte first.
+    uint8_t         direction;                          // The direction bit of the nonce.
+    uint8_t         iv[8];                              // The initialisation vector.
+};
+
+/**
+  * An AES key associated with a radio group, c.f. NRF52Radio::setEncryptionKey().
+  */
+struct NRF52RadioKey
+{
+    uint8_t         key[16];
+    uint8_t         group;
+    bool            valid;
+};
+
+/**
+  * A protocol handler registered with NRF52Radio::setProtocolHandler().
+  */
+struct NRF52RadioProtocol
+{
+    PVoidCallback   handler;                            // Called from idleCallback() when a packet for this protocol is at the head of the receive queue.
+    void            *arg;                               // Passed to handler.
+    uint8_t         protocol;                           // The protocol number, as carried in FrameBuffer::protocol.
+};
+
+/**
+  * Counters maintained by NRF52Radio, to help diagnose lost packets. See NRF52Radio::getStatistics().
+  */
+struct NRF52RadioStatistics
+{
+    uint32_t        rxPackets;                          // Packets received with a valid CRC.
+    uint32_t        rxCrcErrors;                        // Packets discarded due to a CRC failure.
+    uint32_t        rxDropQueueFull;                    // Valid packets discarded because the receive queue was full.
+    uint32_t        rxDropNoBuffer;                     // Valid packets discarded because the FrameBuffer pool was exhausted.
+    uint32_t        rxDropProtocol;                     // Packets discarded by a higher level protocol (e.g. a full datagram queue).
+    uint32_t        rxDropNoKey;                        // Encrypted packets discarded because no key was available, or the CCM was busy.
+    uint32_t        rxMicErrors;                        // Encrypted packets discarded because they failed authentication.
+    uint32_t        txPackets;                          // Packets transmitted.
+    uint32_t        txDropped;                          // Packets that could not be added to the transmit queue, or for which getTxBuf() had no buffer.
+    uint32_t        txTime;                             // Total time spent transmitting, including ramp up, in microseconds.
+    uint32_t        isrCount;                           // The number of times RADIO_IRQHandler has run.
+    uint32_t        isrCyclesMin;                       // The shortest RADIO_IRQHandler run, in processor cycles.
+    uint32_t        isrCyclesMax;                       // The longest RADIO_IRQHandler run, in processor cycles.
+    uint8_t         rxQueueHighWater;                   // The deepest the receive queue has been.
+    uint8_t         txQueueHighWater;                   // The deepest the transmit queue has been.
+};
 
 class NRF52Radio : public Radio
 {
-    uint8_t                 group;      // The radio group to which this micro:bit belongs.
+    friend class NRF52RadioDatagram;
+    friend class NRF52RadioScheduler;
+    friend class NRF52RadioFragmenter;
+
+    uint8_t                 groups[NRF52_RADIO_MAXIMUM_GROUPS]; // The radio group assigned to each logical address. groups[0] is used for transmission.
+    uint8_t                 groupMask;  // The logical addresses currently in use, as a bitmask (c.f. RXADDRESSES).
     uint8_t                 queueDepth; // The number of packets in the receiver queue.
+    uint8_t                 rxHead;     // The index of the oldest packet in the receiver queue.
     int                     rssi;
-    FrameBuffer             *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
+    FrameBuffer             *rxQueue[NRF52_RADIO_MAXIMUM_RX_BUFFERS];   // A ring of incoming packets, queued awaiting processing.
     FrameBuffer             *rxBuf;     // A pointer to the buffer being actively used by the RADIO hardware.
+    uint8_t                 *pool;      // The block of memory from which all FrameBuffers are allocated.
+    uint16_t                frameSize;  // The number of bytes of the pool used by each FrameBuffer.
+    uint8_t                 poolFree;   // The number of FrameBuffers currently in the free list.
+    uint8_t                 maxPacketSize; // The largest payload this radio will send or receive.
+    uint32_t                mode;       // The RADIO_MODE_MODE_* setting in use.
+    FrameBuffer             *freeList;  // A linear list of FrameBuffers in the pool that are available for use.
+    FrameBuffer             *txQueue;   // A linear list of outgoing packets, queued awaiting transmission.
+    FrameBuffer             *txTail;    // The last packet in the transmit queue.
+    uint8_t                 txQueueDepth; // The number of packets in the transmit queue.
+    volatile uint8_t        txState;    // The state of the transmitter (one of NRF52_RADIO_TX_*).
+    bool                    txChained;  // true if the RADIO hardware will disable the transmitter rather than return to receive after the current packet.
+    volatile bool           txWaiting;  // true if a fiber is blocked awaiting space in the transmit queue.
+    PVoidCallback           txHandler;  // Optional callback invoked from interrupt context as each packet is transmitted.
+    void                    *txHandlerArg;
+    uint32_t                txStartCycles; // The DWT cycle count when the current transmission was started.
+    NRF52RadioStatistics    stats;
+    NRF52RadioProtocol      protocols[NRF52_RADIO_MAXIMUM_PROTOCOLS]; // Registered protocol handlers, used by idleCallback().
+    uint8_t                 protocolCount; // The number of entries in protocols.
+    NRF52RadioKey           keys[NRF52_RADIO_MAXIMUM_GROUPS]; // AES keys, per group.
+    NRF52RadioCcmConfig     ccmConfig;  // The key and nonce for the current CCM operation.
+    uint8_t                 *ccmScratch; // Scratch memory required by the CCM peripheral.
+    FrameBuffer             *txCipher;  // The encrypted form of the packet being transmitted.
+    FrameBuffer             *ccmPlain;  // The frame a received packet is being decrypted into, or NULL.
+    uint32_t                txCounter;  // The packet counter used to build the nonce of the next encrypted packet.
+    uint32_t                deviceId;   // Our unique sender id, used to build nonces.
+    bool                    ccmEnabled; // true if the CCM peripheral has been configured.
+    int8_t                  ccmPpi;     // The PPI channel that starts the transmitter once a packet has been encrypted.
+    volatile bool           ccmBusy;    // true while the CCM peripheral is encrypting or decrypting a packet.
+    bool                    txDeferred; // true if a transmission is waiting for the CCM to finish decrypting a packet.
+    NRF52RadioScheduler     *scheduler; // The scheduler controlling when we transmit, or NULL to transmit on demand.
+
+    /**
+      * Configures the RADIO hardware to transmit the packet at the head of the transmit queue.
+      *
+      * @note should only be called with the RADIO interrupt disabled, or from RADIO_IRQHandler.
+      */
+    void startTx();
+
+    /**
+      * Writes the groups in use to the PREFIX and RXADDRESSES registers of the RADIO hardware.
+      */
+    void updateAddresses();
+
+    /**
+      * Allocates the memory used for encryption, and configures the CCM peripheral.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if memory could not be allocated.
+      */
+    int initialiseCrypto();
+
+    /**
+      * Looks up the AES key associated with a group.
+      *
+      * @param group The group.
+      *
+      * @return A pointer to the key, or NULL if packets for this group are not encrypted.
+      */
+    const uint8_t* getEncryptionKey(uint8_t group);
+
+    /**
+      * Prepares ccmConfig for a CCM operation.
+      */
+    void setNonce(const uint8_t *key, uint32_t counter, uint32_t sender);
+
+    /**
+      * Encrypts the given packet into txCipher. The CCM starts the transmitter through PPI once complete.
+      */
+    void encrypt(FrameBuffer *buffer, const uint8_t *key);
+
+    /**
+      * Starts decryption of the packet held in rxBuf into a new frame from the pool.
+      *
+      * @return DEVICE_OK if decryption has started, or an error code if the packet has been dropped.
+      */
+    int decrypt();
 
     public:
     NRF52RadioDatagram   datagram;   // A simple datagram service.
     NRF52RadioEvent      event;      // A simple event handling service.
     static NRF52Radio    *instance;  // A singleton reference, used purely by the interrupt service routine.
+    volatile uint8_t     ccmResult;  // The outcome of the last CCM operation, awaiting RADIO_IRQHandler (one of NRF52_RADIO_CCM_*).
 
     /**
       * Constructor.
@@ -141,6 +341,44 @@ class NRF52Radio : public Radio
       */
     int setFrequencyBand(int band);
 
+    /**
+      * Selects the on-air data rate and modulation used by the radio.
+      * If the radio is already enabled, it is restarted in the new mode. Any packets awaiting transmission are discarded.
+      *
+      * @param mode One of RADIO_MODE_MODE_Nrf_1Mbit, RADIO_MODE_MODE_Nrf_2Mbit, RADIO_MODE_MODE_Ble_1Mbit
+      *             or RADIO_MODE_MODE_Ble_2Mbit (where supported by the device).
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not supported.
+      */
+    int setMode(uint32_t mode);
+
+    /**
+      * Retrieves the on-air data rate and modulation used by the radio.
+      *
+      * @return The RADIO_MODE_MODE_* value currently selected.
+      */
+    uint32_t getMode();
+
+    /**
+      * Changes the largest payload that can be sent or received, up to NRF52_RADIO_MAX_PACKET_SIZE_LIMIT bytes.
+      * FrameBuffers in the pool are sized to match, so memory is not wasted on larger packets than needed.
+      * Devices can only receive packets from peers using the same, or a smaller, maximum size.
+      * At the default size, the radio keeps the legacy on-air length limit, so it interoperates with unmodified peers.
+      *
+      * @param size The maximum payload size, in bytes.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the size is out of range, or DEVICE_BUSY
+      *         if the radio is enabled or FrameBuffers are still in use.
+      */
+    int setMaxPacketSize(int size);
+
+    /**
+      * Retrieves the largest payload that can be sent or received.
+      *
+      * @return The maximum payload size, in bytes.
+      */
+    int getMaxPacketSize();
+
     /**
       * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
       * actively being used by the radio hardware to store incoming data.
@@ -149,14 +387,138 @@ class NRF52Radio : public Radio
       */
     FrameBuffer * getRxBuf();
 
+    /**
+      * Takes a FrameBuffer from the pool of preallocated buffers.
+      * This never touches the heap, and so is safe to call from RADIO_IRQHandler.
+      *
+      * @return a pointer to a FrameBuffer, or NULL if the pool is exhausted.
+      */
+    FrameBuffer* allocateFrameBuffer();
+
+    /**
+      * Returns a FrameBuffer to the pool of preallocated buffers, once it is no longer needed.
+      *
+      * @param buffer A FrameBuffer previously obtained from recv() or allocateFrameBuffer().
+      */
+    void releaseFrameBuffer(FrameBuffer *buffer);
+
     /**
       * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
       *
       * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
-      *         could not be allocated (either by policy or memory exhaustion).
+      *         could not be allocated (either by policy or pool exhaustion).
       */
     int queueRxBuf();
 
+    /**
+      * Interrupt service routine for the END event. Hands the packet to the receive queue, or
+      * completes the packet at the head of the transmit queue.
+      *
+      * @note should only be called from RADIO_IRQHandler...
+      */
+    void onEnd();
+
+    /**
+      * Interrupt service routine for the DISABLED event. Moves the radio between the transmitter and the receiver.
+      *
+      * @note should only be called from RADIO_IRQHandler...
+      */
+    void onDisabled();
+
+    /**
+      * Interrupt service routine for the CCM ENDCRYPT and ERROR events.
+      *
+      * @param error true if the CCM reported an error.
+      *
+      * @note should only be called from CCM_AAR_IRQHandler...
+      */
+    void onCcmEnd(bool error);
+
+    /**
+      * Handles completion of a CCM operation. Queues a decrypted packet, and resumes the radio.
+      *
+      * @note should only be called from RADIO_IRQHandler...
+      */
+    void onCcmComplete();
+
+    /**
+      * Enables hardware AES-CCM encryption of packets sent to, and received from, the given group.
+      *
+      * Encrypted packets are encrypted and authenticated by the CCM peripheral using EasyDMA, and are otherwise
+      * handled exactly as unencrypted packets. Packets received for a group without a key that claim to be encrypted
+      * are discarded, as are those that fail authentication.
+      *
+      * Encryption uses NRF52_RADIO_CCM_OVERHEAD bytes of each packet, reducing the space available for payload.
+      * There is no protection against replayed packets.
+      *
+      * @param group The group.
+      *
+      * @param key A pointer to a 16 byte AES key, or NULL to stop encrypting packets for this group.
+      *
+      * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if a key is given while NRF52RadioScheduler is running (slotted
+      *         operation does not encrypt), or DEVICE_NO_RESOURCES if keys are already held for NRF52_RADIO_MAXIMUM_GROUPS groups
+      *         or memory could not be allocated.
+      */
+    int setEncryptionKey(uint8_t group, const uint8_t *key);
+
+    /**
+      * Takes a FrameBuffer from the pool for use in transmission.
+      *
+      * If the transmit queue is full and the caller is a fiber, the calling fiber is blocked until space is available.
+      * The caller should fill in the returned FrameBuffer, and pass it to queueTxBuf().
+      *
+      * @return a pointer to a FrameBuffer, or NULL if none is available (or the radio is not enabled).
+      */
+    FrameBuffer* getTxBuf();
+
+    /**
+      * Adds the given FrameBuffer to the transmit queue, and starts the transmitter if necessary.
+      * This call returns immediately - the buffer is returned to the pool once the packet has been transmitted.
+      *
+      * @param buffer A FrameBuffer obtained from getTxBuf().
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid,
+      *         or DEVICE_NO_RESOURCES if the transmit queue is full (in which case the buffer is released).
+      */
+    int queueTxBuf(FrameBuffer *buffer);
+
+    /**
+      * Registers a callback to be invoked as each queued packet has been transmitted.
+      *
+      * @param handler The function to call (in interrupt context), or NULL to remove any existing handler.
+      *
+      * @param arg An argument passed to handler.
+      */
+    void setTxCompleteHandler(PVoidCallback handler, void *arg = NULL);
+
+    /**
+      * Records the duration of a single run of RADIO_IRQHandler.
+      *
+      * @param cycles The number of processor cycles taken.
+      *
+      * @note should only be called from RADIO_IRQHandler...
+      */
+    void recordInterrupt(uint32_t cycles);
+
+    /**
+      * Takes a snapshot of the radio statistics.
+      *
+      * @param s The structure to fill in.
+      */
+    void getStatistics(NRF52RadioStatistics &s);
+
+    /**
+      * Resets all radio statistics to zero.
+      */
+    void resetStatistics();
+
+    /**
+      * Determines the number of packets awaiting transmission.
+      *
+      * @return The number of packets in the transmit queue.
+      */
+    int txPending();
+
     /**
       * Sets the RSSI for the most recent packet.
       * The value is measured in -dbm. The higher the value, the stronger the signal.
@@ -193,13 +555,62 @@ class NRF52Radio : public Radio
 
     /**
       * Sets the radio to listen to packets sent with the given group id.
+      * This is the group used for transmission. Additional groups can be received by using joinGroup().
       *
-      * @param group The group to join. A micro:bit can only listen to one group ID at any time.
+      * @param group The group to join.
       *
       * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
       */
     int setGroup(uint8_t group);
 
+    /**
+      * Additionally listens to packets sent with the given group id.
+      * Up to NRF52_RADIO_MAXIMUM_GROUPS groups (including that given to setGroup()) can be received at once.
+      * Filtering is performed by the RADIO hardware, so packets for other groups never reach the processor.
+      *
+      * @param group The group to join.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no logical addresses are free.
+      */
+    int joinGroup(uint8_t group);
+
+    /**
+      * Stops listening to packets sent with the given group id, previously joined using joinGroup().
+      *
+      * @param group The group to leave.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the group has not been joined with joinGroup().
+      */
+    int leaveGroup(uint8_t group);
+
+    /**
+      * Retrieves the group associated with a logical address, such as that recorded in a received FrameBuffer.
+      *
+      * @param address The logical address, in the range 0..NRF52_RADIO_MAXIMUM_GROUPS-1. Address 0 is the group given to setGroup().
+      *
+      * @return The group id, or DEVICE_INVALID_PARAMETER if the address is not in use.
+      */
+    int getGroup(int address = 0);
+
+    /**
+      * Registers a handler for packets of the given protocol, replacing any existing handler for that protocol.
+      *
+      * The handler is called from idleCallback() when a packet for the protocol reaches the head of the receive queue.
+      * It should take the packet using recv() and return it to the pool using releaseFrameBuffer() once done.
+      * If it does not call recv(), the packet is discarded on its return.
+      *
+      * Packets for protocols without a handler raise an event with id DEVICE_ID_RADIO_DATA_READY and the protocol number as its value.
+      *
+      * @param protocol The protocol number, as carried in FrameBuffer::protocol.
+      *
+      * @param handler The function to call, or NULL to remove the handler.
+      *
+      * @param arg An argument passed to handler.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if NRF52_RADIO_MAXIMUM_PROTOCOLS handlers are already registered.
+      */
+    int setProtocolHandler(uint8_t protocol, PVoidCallback handler, void *arg = NULL);
+
     /**
       * A background, low priority callback that is triggered whenever the processor is idle.
       * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
@@ -221,17 +632,18 @@ class NRF52Radio : public Radio
       * @return The buffer containing the the packet. If no data is available, NULL is returned.
       *
       * @note Once recv() has been called, it is the callers responsibility to
-      *       delete the buffer when appropriate.
+      *       return the buffer to the pool using releaseFrameBuffer() when appropriate.
       */
     FrameBuffer* recv();
 
     /**
       * Transmits the given buffer onto the broadcast radio.
-      * The call will wait until the transmission of the packet has completed before returning.
+      * The packet is copied into the transmit queue, and the call returns without waiting for transmission to complete.
       *
       * @param data The packet contents to transmit.
       *
-      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid,
+      *         or DEVICE_NO_RESOURCES if the packet could not be queued.
       */
     int send(FrameBuffer *buffer);
 
@@ -249,11 +661,11 @@ class NRF52Radio : public Radio
 
     /**
       * Transmits the given buffer onto the broadcast radio.
-      * The call will wait until the transmission of the packet has completed before returning.
+      * The packet is queued for transmission, and the call returns without waiting for transmission to complete.
       *
       * @param data The packet contents to transmit.
       *
-      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the packet could not be queued.
       */
     virtual int sendBuffer(ManagedBuffer b);
 };
@@ -48,6 +48,15 @@ class NRF52RadioDatagram
 {
     NRF52Radio   &radio;     // The underlying radio module used to send and receive data.
     FrameBuffer     *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
+    FrameBuffer     *rxTail;    // The last packet in rxQueue, so that packets can be appended without walking the list.
+    int             rxQueueDepth; // The number of packets in rxQueue.
+
+    /**
+      * Removes the packet at the head of the receive queue.
+      *
+      * @return The packet, or NULL if the queue is empty.
+      */
+    FrameBuffer* dequeue();
 
     public:
 
@@ -88,41 +97,41 @@ class NRF52RadioDatagram
     /**
       * Transmits the given buffer onto the broadcast radio.
       *
-      * This is a synchronous call that will wait until the transmission of the packet
-      * has completed before returning.
+      * The packet is queued for transmission, and this call returns without waiting for the transmission
+      * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
       *
       * @param buffer The packet contents to transmit.
       *
       * @param len The number of bytes to transmit.
       *
       * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-      *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+      *         or the number of bytes to transmit is greater than the radio's maximum packet size.
       */
     int send(uint8_t *buffer, int len);
 
     /**
       * Transmits the given string onto the broadcast radio.
       *
-      * This is a synchronous call that will wait until the transmission of the packet
-      * has completed before returning.
+      * The packet is queued for transmission, and this call returns without waiting for the transmission
+      * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
       *
       * @param data The packet contents to transmit.
       *
       * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-      *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+      *         or the number of bytes to transmit is greater than the radio's maximum packet size.
       */
     int send(ManagedBuffer data);
 
     /**
       * Transmits the given string onto the broadcast radio.
       *
-      * This is a synchronous call that will wait until the transmission of the packet
-      * has completed before returning.
+      * The packet is queued for transmission, and this call returns without waiting for the transmission
+      * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
       *
       * @param data The packet contents to transmit.
       *
       * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-      *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+      *         or the number of bytes to transmit is greater than the radio's maximum packet size.
       */
     int send(ManagedString data);
 
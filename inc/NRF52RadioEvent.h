@@ -50,7 +50,20 @@ namespace codal
 class NRF52RadioEvent
 {
     bool            suppressForwarding;     // A private flag used to prevent event forwarding loops.
+    bool            flushScheduled;         // true if a timer is running to transmit any coalesced events.
     NRF52Radio   &radio;                 // A reference to the underlying radio module to use.
+    FrameBuffer     *pending;               // A partially filled frame of coalesced events, awaiting transmission.
+    uint32_t        coalesceWindow;         // The time in microseconds events are held for coalescing, or zero if disabled.
+
+    /**
+      * Transmits any coalesced events held in the pending frame.
+      */
+    void flush();
+
+    /**
+      * Event handler callback, called when a coalescing window expires.
+      */
+    void flushTimeout(Event e);
 
     public:
 
@@ -128,10 +141,23 @@ class NRF52RadioEvent
       */
     int ignore(uint16_t id, uint16_t value, EventModel &eventBus);
 
+    /**
+      * Enables or disables coalescing of forwarded events.
+      *
+      * When enabled, events are gathered into a single frame which is transmitted when it is full, or once
+      * the given window has passed since the first event was gathered, whichever is sooner.
+      * This greatly reduces the airtime used by bursts of events, at the cost of some latency.
+      *
+      * @param window The maximum time in microseconds to hold an event before transmission, or zero to send each event immediately.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no default EventModel is available.
+      */
+    int setCoalescing(uint32_t window);
+
     /**
       * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
       *
-      * This function process this packet, and fires the event contained inside onto the default EventModel.
+      * This function process this packet, and fires the events contained inside onto the default EventModel, in order.
       */
     void packetReceived();
 
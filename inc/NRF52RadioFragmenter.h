@@ -0,0 +1,168 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NRF52_RADIO_FRAGMENTER_H
+#define NRF52_RADIO_FRAGMENTER_H
+
+#include "CodalConfig.h"
+#include "NRF52Radio.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+
+// The largest datagram that can be sent or reassembled, in bytes.
+#ifndef NRF52_RADIO_FRAGMENT_MAX_SIZE
+#define NRF52_RADIO_FRAGMENT_MAX_SIZE           4096
+#endif
+
+// The number of datagrams that can be reassembled at the same time.
+#ifndef NRF52_RADIO_FRAGMENT_CACHE_SIZE
+#define NRF52_RADIO_FRAGMENT_CACHE_SIZE         2
+#endif
+
+// The number of reassembled datagrams held awaiting collection by pull().
+#ifndef NRF52_RADIO_FRAGMENT_QUEUE_SIZE
+#define NRF52_RADIO_FRAGMENT_QUEUE_SIZE         2
+#endif
+
+// The time after which an incomplete datagram is discarded if no more fragments arrive, in milliseconds.
+#ifndef NRF52_RADIO_FRAGMENT_TIMEOUT
+#define NRF52_RADIO_FRAGMENT_TIMEOUT            500
+#endif
+
+#define NRF52_RADIO_FRAGMENT_MAX_FRAGMENTS      256
+#define NRF52_RADIO_FRAGMENT_HEADER_SIZE        9
+
+// Events
+#define NRF52_RADIO_EVT_REASSEMBLED             6       // A fragmented datagram has been reassembled, and can be pulled.
+
+namespace codal
+{
+    /**
+      * The header carried at the start of the payload of each fragment.
+      */
+    struct NRF52RadioFragmentHeader
+    {
+        uint32_t    sender;                     // The unique id of the sending device.
+        uint16_t    length;                     // The length of the complete datagram.
+        uint8_t     id;                         // The sender's sequence number for the datagram.
+        uint8_t     index;                      // The number of this fragment within the datagram. It starts at index * chunk.
+        uint8_t     chunk;                      // The length of every fragment of the datagram except (possibly) the last.
+    };
+
+    /**
+      * A datagram being reassembled.
+      */
+    struct NRF52RadioReassembly
+    {
+        ManagedBuffer   data;                   // The datagram, filled in as fragments arrive. Empty if this entry is unused.
+        CODAL_TIMESTAMP timestamp;              // The time the last fragment arrived.
+        uint32_t        sender;                 // The unique id of the sending device.
+        uint16_t        received;               // The number of bytes received so far.
+        uint8_t         group;                  // The group the datagram was received on.
+        uint8_t         id;                     // The sender's sequence number for the datagram.
+        uint8_t         chunk;                  // The fragment length used by the sender.
+        uint8_t         fragments[NRF52_RADIO_FRAGMENT_MAX_FRAGMENTS / 8];  // Bitmap of the fragments received so far.
+    };
+
+    /**
+      * Class definition for an NRF52RadioFragmenter
+      *
+      * Sends datagrams that are too large for a single radio frame as a sequence of fragments, and reassembles
+      * them on receipt. Reassembled datagrams are delivered as a DataSource, so they can be streamed straight into
+      * a DataSink without further copying.
+      *
+      * Fragments are reassembled directly into the ManagedBuffer that is eventually delivered. At most
+      * NRF52_RADIO_FRAGMENT_CACHE_SIZE datagrams are reassembled at once; the oldest is discarded to make room for another.
+      *
+      * Datagrams are identified by the group they are received on, the sender's unique id and an 8 bit sequence number.
+      * Each fragment covers a fixed range of the datagram given by its index, so a datagram is only delivered once every
+      * byte of it has been received.
+      */
+    class NRF52RadioFragmenter : public DataSource
+    {
+        NRF52Radio              &radio;         // The underlying radio module used to send and receive data.
+        DataSink                *downstream;    // The component that consumes reassembled datagrams, if any.
+        NRF52RadioReassembly    cache[NRF52_RADIO_FRAGMENT_CACHE_SIZE];  // Datagrams being reassembled.
+        ManagedBuffer           output[NRF52_RADIO_FRAGMENT_QUEUE_SIZE]; // A ring of reassembled datagrams awaiting collection.
+        uint8_t                 outputHead;     // The index of the oldest datagram in output.
+        uint8_t                 outputCount;    // The number of datagrams in output.
+        uint8_t                 txId;           // The sequence number of the next datagram we send.
+
+        /**
+          * Finds the reassembly entry for the given datagram, creating one if necessary.
+          *
+          * @return The entry, or NULL if memory for the datagram could not be allocated.
+          */
+        NRF52RadioReassembly* lookup(const NRF52RadioFragmentHeader &header, uint8_t group);
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * Registers a handler for NRF52_RADIO_PROTOCOL_FRAGMENT packets with the radio.
+          *
+          * @param r The underlying radio module used to send and receive data.
+          */
+        NRF52RadioFragmenter(NRF52Radio &r);
+
+        /**
+          * Destructor.
+          */
+        ~NRF52RadioFragmenter();
+
+        /**
+          * Transmits the given buffer onto the broadcast radio, split into as many frames as necessary.
+          *
+          * The fragments are queued for transmission, and this call returns once the last has been queued.
+          * If the transmit queue fills, the calling fiber is blocked until space is available.
+          *
+          * @param data The datagram to transmit, of up to NRF52_RADIO_FRAGMENT_MAX_SIZE bytes.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the datagram is empty or too large,
+          *         or DEVICE_NO_RESOURCES if a fragment could not be queued.
+          */
+        int send(ManagedBuffer data);
+
+        /**
+          * Provide the next reassembled datagram to our downstream caller, if available.
+          *
+          * @return The datagram, or an empty ManagedBuffer if none is available.
+          */
+        virtual ManagedBuffer pull();
+
+        /**
+          * Update our reference to a downstream component.
+          */
+        virtual void connect(DataSink &sink);
+
+        /**
+          * Protocol handler callback. This is called when the radio receives a fragment.
+          */
+        void packetReceived();
+    };
+}
+
+#endif
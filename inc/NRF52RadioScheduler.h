@@ -0,0 +1,203 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NRF52_RADIO_SCHEDULER_H
+#define NRF52_RADIO_SCHEDULER_H
+
+#include "CodalConfig.h"
+#include "NRF52Radio.h"
+#include "NRFLowLevelTimer.h"
+
+// Timing configuration (all in microseconds)
+#ifndef NRF52_RADIO_TDMA_GUARD_TIME
+#define NRF52_RADIO_TDMA_GUARD_TIME             200     // Time from the start of each slot to enabling the radio, allowing for clock drift between nodes.
+#endif
+
+#ifndef NRF52_RADIO_TDMA_BEACON_DELAY
+#define NRF52_RADIO_TDMA_BEACON_DELAY           (NRF52_RADIO_TDMA_GUARD_TIME + 140 + 40)    // Time from the start of the beacon slot to the beacon ADDRESS event (guard, TX ramp up, preamble and address).
+#endif
+
+#ifndef NRF52_RADIO_TDMA_MAX_MISSED_BEACONS
+#define NRF52_RADIO_TDMA_MAX_MISSED_BEACONS     4       // The number of consecutive beacons a node can miss before it is considered unsynchronised.
+#endif
+
+#define NRF52_RADIO_TDMA_MAXIMUM_SLOTS          32
+
+// The PPI channels used by the scheduler, as indices into NRF52RadioScheduler::ppi
+#define NRF52_RADIO_TDMA_PPI_DISABLE            0       // Slot boundary (COMPARE0) -> RADIO DISABLE
+#define NRF52_RADIO_TDMA_PPI_TXEN               1       // Slot start (COMPARE1) -> RADIO TXEN
+#define NRF52_RADIO_TDMA_PPI_RXEN               2       // Slot start (COMPARE1) -> RADIO RXEN
+#define NRF52_RADIO_TDMA_PPI_CAPTURE            3       // RADIO ADDRESS -> CAPTURE2, to timestamp beacons
+#define NRF52_RADIO_TDMA_PPI_CHANNELS           4
+
+// Events
+#define NRF52_RADIO_EVT_TDMA_SYNC               4       // The node has synchronised with a coordinator.
+#define NRF52_RADIO_EVT_TDMA_LOST               5       // The node has lost synchronisation with its coordinator.
+
+namespace codal
+{
+    /**
+      * The payload of a beacon, sent by the coordinator at the start of each superframe.
+      */
+    struct NRF52RadioBeacon
+    {
+        uint32_t    superframe;                 // A count of superframes since the coordinator started.
+        uint32_t    slotTime;                   // The length of each slot, in microseconds.
+        uint8_t     slotCount;                  // The number of slots in each superframe.
+    };
+
+    /**
+      * Class definition for an NRF52RadioScheduler
+      *
+      * Provides a deterministic, time division (TDMA) mode of operation for an NRF52Radio.
+      *
+      * Time is divided into superframes of a fixed number of equal length slots. Slot 0 carries a beacon from a coordinator,
+      * which other nodes use to keep their timers synchronised. Each node is assigned a slot in which it transmits
+      * (at most one packet from its transmit queue per superframe), and a set of slots in which it listens.
+      * A hardware timer drives the radio through PPI at each slot boundary, so the radio is switched on and off with
+      * microsecond precision, and remains off outside of the node's slots.
+      *
+      * Until it has received a beacon (and after missing NRF52_RADIO_TDMA_MAX_MISSED_BEACONS in a row), a node listens
+      * continuously and does not transmit.
+      */
+    class NRF52RadioScheduler
+    {
+        NRF52Radio&         radio;              // The radio being scheduled.
+        NRFLowLevelTimer&   timer;              // The timer module used to time slots.
+        FrameBuffer         *beacon;            // The frame used to transmit beacons (coordinator only).
+        uint32_t            slotTime;           // The length of each slot, in microseconds.
+        uint32_t            frameStart;         // The timer value at the start of the current superframe.
+        uint32_t            superframe;         // The number of superframes since the coordinator started.
+        uint32_t            listenMask;         // Bitmask of the slots in which we listen.
+        uint8_t             slotCount;          // The number of slots in each superframe.
+        uint8_t             txSlot;             // The slot in which we transmit.
+        uint8_t             slot;               // The current slot.
+        uint8_t             missedBeacons;      // The number of consecutive beacons we have not received.
+        bool                coordinator;        // true if we send the beacon.
+        bool                synchronised;       // true if our slot timing is aligned with the coordinator.
+        bool                beaconReceived;     // true if a beacon has been received in this superframe.
+        bool                running;            // true if the scheduler has been started.
+        int8_t              ppi[NRF52_RADIO_TDMA_PPI_CHANNELS]; // The PPI channels switching the radio, allocated while running.
+
+        /**
+          * Releases the PPI channels in use, if any.
+          */
+        void releasePpi();
+
+        /**
+          * Configures the radio to receive from the start of the current slot.
+          */
+        void prepareRx();
+
+        /**
+          * Configures the radio to transmit the given frame at the start of the current slot.
+          */
+        void prepareTx(FrameBuffer *buffer, uint8_t state);
+
+        /**
+          * Aligns our slots to the given superframe start time, and starts slotted operation.
+          *
+          * @param start The timer value at the start of the superframe.
+          *
+          * @param next The first slot boundary to schedule.
+          */
+        void synchronise(uint32_t start, uint8_t next);
+
+        /**
+          * Stops slotted operation, and listens continuously for a beacon.
+          */
+        void unsynchronise();
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * @param radio The radio to schedule.
+          *
+          * @param timer The timer module used to time slots. This is configured for 1MHz, 32 bit operation.
+          */
+        NRF52RadioScheduler(NRF52Radio &radio, NRFLowLevelTimer &timer);
+
+        /**
+          * Starts slotted operation of the radio. The radio is enabled if necessary.
+          *
+          * @param slotTime The length of each slot, in microseconds. This must be long enough to transmit a maximum length packet,
+          *                 plus NRF52_RADIO_TDMA_GUARD_TIME.
+          *
+          * @param slotCount The number of slots in each superframe, including the beacon slot, in the range 2..NRF52_RADIO_TDMA_MAXIMUM_SLOTS.
+          *
+          * @param txSlot The slot in which this node transmits, in the range 1..slotCount-1.
+          *
+          * @param coordinator true if this node should transmit the beacon that synchronises all other nodes.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_NOT_SUPPORTED if an encryption key
+          *         is set, or DEVICE_NO_RESOURCES if the radio could not be enabled or too few PPI channels are free.
+          *
+          * @note Slotted operation does not encrypt. Rather than silently send in the clear, it refuses to start while any group has a key.
+          */
+        int start(uint32_t slotTime, uint8_t slotCount, uint8_t txSlot, bool coordinator = false);
+
+        /**
+          * Stops slotted operation, returning the radio to continuous reception.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int stop();
+
+        /**
+          * Selects the slots in which this node listens.
+          * By default, a node listens in every slot other than its own.
+          *
+          * @param mask A bitmask of slots. Bit n enables reception in slot n. Slot 0 (the beacon) is always received by non-coordinators.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int setListenSlots(uint32_t mask);
+
+        /**
+          * Determines if this node's slot timing is aligned with the coordinator.
+          *
+          * @return true if synchronised (always true for the coordinator).
+          */
+        bool isSynchronised();
+
+        /**
+          * Timer interrupt handler, called at each slot boundary.
+          */
+        void onSlot();
+
+        /**
+          * Called by NRF52Radio when a beacon is received.
+          *
+          * @param buffer The frame containing the beacon.
+          *
+          * @note should only be called from RADIO_IRQHandler...
+          */
+        void onBeacon(FrameBuffer *buffer);
+    };
+}
+
+#endif
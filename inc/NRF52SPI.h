@@ -30,10 +30,43 @@ DEALINGS IN THE SOFTWARE.
 #include "hal/nrf_spim.h"
 #include "codal-core/inc/driver-models/SPI.h"
 #include "codal-core/inc/driver-models/Pin.h"
+#include "NRFLowLevelTimer.h"
+
+// The PPI channels used by periodic transfers, as indices into NRF52SPI::periodicPpi
+#define NRF52_SPI_PPI_TRIGGER           0       // Trigger TIMER COMPARE0 -> SPIM START
+#define NRF52_SPI_PPI_COUNT             1       // SPIM END -> counter TIMER COUNT
+#define NRF52_SPI_PPI_REWIND            2       // counter TIMER COMPARE1 -> periodicGroup DIS, disarming the trigger once both blocks are full
+#define NRF52_SPI_PPI_CHANNELS          3
 
 namespace codal
 {
 
+class NRF52SPI;
+
+/**
+ * A transfer queued with NRF52SPI::queueTransfer().
+ *
+ * The structure is owned by the caller, and must remain valid until its doneHandler has been called.
+ */
+struct NRF52SPITransaction
+{
+    NRF52SPITransaction *next;      // Used internally to link the queue.
+    const uint8_t *txBuffer;
+    uint32_t txSize;
+    uint8_t *rxBuffer;
+    uint32_t rxSize;
+    PVoidCallback doneHandler;      // Called (in IRQ context) once the transfer has completed. May be NULL.
+    void *doneHandlerArg;
+};
+
+/**
+ * Called (in IRQ context) each time a block of periodic samples is complete.
+ *
+ * @param arg The argument given to NRF52SPI::startPeriodic().
+ * @param block The first byte of the completed block.
+ */
+typedef void (*NRF52SPIBlockCallback)(void *arg, uint8_t *block);
+
 /**
  * Class definition for SPI service, derived from ARM mbed.
  */
@@ -53,12 +86,64 @@ class NRF52SPI : public codal::SPI
     PVoidCallback doneHandler;
     void *doneHandlerArg;
 
+    volatile bool busy;                 // true while the SPIM is running a transfer (or periodic transfers).
+    bool queueActive;                   // true if the transfer in progress is the head of the queue.
+    NRF52SPITransaction *queue;         // A linear list of queued transactions. The head is in progress.
+    NRF52SPITransaction *queueTail;     // The last transaction in the queue.
+
+    NRFLowLevelTimer *periodicTrigger;  // The timer starting each periodic transfer, or NULL if not in periodic mode.
+    NRFLowLevelTimer *periodicCounter;  // The timer counting completed periodic transfers.
+    uint8_t *periodicBuffer;            // The two blocks receiving periodic samples.
+    uint32_t periodicBlockSize;         // The size of each block, in bytes.
+    int8_t periodicPpi[NRF52_SPI_PPI_CHANNELS]; // The PPI channels driving periodic transfers, allocated while running.
+    int8_t periodicGroup;               // The PPI group holding the trigger channel, allocated while running.
+    NRF52SPIBlockCallback blockHandler;
+    void *blockHandlerArg;
+
+    const uint8_t *segTx;               // The start of the next segment to send.
+    uint32_t segTxRemaining;            // The number of bytes still to send, after the segment in progress.
+    uint8_t *segRx;                     // The start of the next segment to receive.
+    uint32_t segRxRemaining;            // The number of bytes still to receive, after the segment in progress.
+    uint8_t *bounce;                    // The RAM buffer staging data EasyDMA can't reach, or NULL if sending in place.
+    uint32_t bounceSize;                // The size of the bounce buffer.
+
     void config();
 
+    /**
+     * Starts the next segment of the transfer in progress, of at most one EasyDMA transfer in each direction.
+     */
+    void startSegment();
+
+    /**
+     * Starts a transfer of any length, split into segments if necessary.
+     */
+    void startDma(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer, uint32_t rxSize);
+
+    /**
+     * Obtains a RAM buffer to stage the data to send through, for data EasyDMA can't reach.
+     */
+    void acquireBounce(uint32_t size);
+
+    /**
+     * Returns the buffer obtained by acquireBounce(), if any.
+     */
+    void releaseBounce();
+
+    /**
+     * Programs the SPIM with the transaction at the head of the queue, and starts it.
+     */
+    void startQueued();
+
     int xfer(uint8_t const *p_tx_buffer, uint32_t tx_length, uint8_t *p_rx_buffer,
              uint32_t rx_length, PVoidCallback doneHandler, void *arg);
 
+    /**
+     * Handles the completion of one or both blocks of periodic samples, on the counter timer's interrupt.
+     */
+    void blockDone(uint16_t channels);
+
     static void _irqDoneHandler(void *self);
+    template <int timer> static void _blockDoneHandler(uint16_t channels);
 public:
 
     /**
@@ -107,7 +192,7 @@ public:
     /**
      * Writes and reads from the SPI bus concurrently. Waits (possibly un-scheduled) for transfer to finish.
      *
-     * Either buffer can be NULL.
+     * Either buffer can be NULL. txBuffer may be in flash, in which case it is sent in small chunks through RAM.
      */
     virtual int transfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer,
                          uint32_t rxSize);
@@ -119,6 +204,53 @@ public:
      */
     virtual int startTransfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer,
                          uint32_t rxSize, PVoidCallback doneHandler, void *arg);
+
+    /**
+     * Adds a transfer to the queue. Queued transfers run back to back, each started from the END interrupt
+     * of the one before, and never require a fiber to be scheduled.
+     *
+     * @param t The transaction.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the transaction is NULL,
+     *         or DEVICE_BUSY if periodic transfers are running.
+     */
+    int queueTransfer(NRF52SPITransaction *t);
+
+    /**
+     * Starts repeating the same transfer at a fixed rate, entirely in hardware.
+     *
+     * A timer compare starts the SPIM through PPI every period. The received bytes are stored back to back
+     * using EasyDMA ArrayList mode, and a second timer counts completed transfers through PPI, so the CPU is only
+     * interrupted once a block of samples is full. Reception alternates between two blocks, so the handler
+     * has a full block period to consume each one. Once the second block is full, PPI disarms the trigger until
+     * the interrupt has sent EasyDMA back to the first, so a late interrupt drops samples rather than overrunning
+     * rxBuffer. Each SPI in periodic mode needs its own pair of timers.
+     *
+     * @param trigger A timer dedicated to timing transfers. It is configured for 1MHz operation.
+     * @param counter A timer dedicated to counting transfers. It is placed in counter mode.
+     * @param period The time between transfers, in microseconds.
+     * @param txBuffer The bytes to send in each transfer (e.g. a register read command).
+     * @param txSize The number of bytes to send in each transfer.
+     * @param rxBuffer An array of 2 * samples * rxSize bytes, receiving two blocks of samples.
+     * @param rxSize The number of bytes to receive in each transfer.
+     * @param samples The number of transfers in each block.
+     * @param handler Called (in IRQ context) as each block is completed.
+     * @param arg An argument passed to handler.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_BUSY if
+     *         a transfer is in progress or the counter is in use by another SPI, or DEVICE_NO_RESOURCES if txBuffer is in flash and can't be copied to RAM,
+     *         or too few PPI channels or groups are free.
+     */
+    int startPeriodic(NRFLowLevelTimer &trigger, NRFLowLevelTimer &counter, uint32_t period, const uint8_t *txBuffer,
+                      uint32_t txSize, uint8_t *rxBuffer, uint32_t rxSize, uint32_t samples,
+                      NRF52SPIBlockCallback handler, void *arg);
+
+    /**
+     * Stops periodic transfers.
+     *
+     * @return DEVICE_OK on success.
+     */
+    int stopPeriodic();
 };
 }
 
@@ -0,0 +1,139 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef NRF52_SPI_SINK_H
+#define NRF52_SPI_SINK_H
+
+#include "CodalConfig.h"
+#include "NRF52SPI.h"
+#include "ManagedBuffer.h"
+#include "DataStream.h"
+#include "codal-core/inc/types/Event.h"
+
+// Events
+#define NRF52_SPI_EVT_SINK_READY        4       // An NRF52SPISink has finished sending a buffer, and has room for another.
+
+namespace codal
+{
+
+/**
+ * Class definition for an NRF52SPISink.
+ *
+ * Streams buffers pulled from a DataSource out over SPI, typically tiles of a display framebuffer.
+ *
+ * Up to two buffers are held: one being sent by EasyDMA, and the next waiting to go. Each buffer is started
+ * from the completion interrupt of the one before, so while they are sent the upstream component is free to
+ * render its next tile. Buffers are only ever pulled from upstream in fiber context, never in an interrupt.
+ * pullRequest() only blocks the calling fiber while both slots are full, so the frame rate is set by the bus
+ * speed rather than by the sum of rendering and transfer time.
+ *
+ * For the highest throughput, construct the NRF52SPI on NRF_SPIM3 (where available), which supports 16MHz and 32MHz.
+ *
+ * @note The NRF52SPI should not be used for queued or periodic transfers while a stream is running.
+ */
+class NRF52SPISink : public DataSink
+{
+    NRF52SPI &spi;                      // The bus we send on.
+    DataSource &upstream;               // The component providing buffers to send.
+    Pin *cs;                            // Chip select, driven low while each buffer is sent, or NULL.
+    Pin *dcx;                           // Data/command select, driven high while each buffer is sent, or NULL.
+    ManagedBuffer active;               // The buffer being sent, or empty.
+    ManagedBuffer pending;              // The buffer to send next, or empty.
+    NRF52SPITransaction transaction;    // The transfer of the active buffer, queued on the bus.
+    volatile bool pullPending;          // true if upstream has data we haven't pulled yet.
+
+    /**
+     * Adds a buffer to the stream, starting it if the bus is idle.
+     */
+    void queue(ManagedBuffer b);
+
+    /**
+     * Queues the active buffer on the bus. If the bus refuses it, the held buffers are dropped.
+     *
+     * @return DEVICE_OK on success, or DEVICE_BUSY if the bus is running periodic transfers.
+     */
+    int startActive();
+
+    /**
+     * Waits until fewer than the given number of buffers are held.
+     */
+    void waitFor(int count);
+
+    /**
+     * Pulls any buffer upstream signalled from interrupt context, in fiber context, once a slot is free.
+     */
+    void onReady(Event);
+
+    static void _transferDone(void *self);
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param spi The bus to send on.
+     * @param upstream The component providing buffers to send.
+     * @param cs The chip select pin, or NULL if it is managed elsewhere.
+     * @param dcx The data/command pin for displays with one, or NULL.
+     * @param frequency The bus frequency in hertz, or 0 to leave it unchanged.
+     */
+    NRF52SPISink(NRF52SPI &spi, DataSource &upstream, Pin *cs = NULL, Pin *dcx = NULL, uint32_t frequency = 0);
+
+    /**
+     * Callback provided when data is ready. Pulls the buffer from upstream, and queues it for transmission.
+     * If two buffers are already held, the calling fiber is blocked until a slot is free.
+     * When called from interrupt context, the buffer is instead pulled later by the event bus, in fiber context,
+     * once a slot is free.
+     */
+    virtual int pullRequest();
+
+    /**
+     * Sends a command to the device, waiting for any buffers being streamed to complete first.
+     * The command byte is sent with DCX low, and any parameters with DCX high, inside a single chip select.
+     *
+     * @param command The command byte.
+     * @param params The parameter bytes, or NULL. These may be in flash; NRF52SPI copies them through RAM.
+     * @param len The number of parameter bytes.
+     *
+     * @return DEVICE_OK on success.
+     */
+    int sendCommand(uint8_t command, const uint8_t *params = NULL, int len = 0);
+
+    /**
+     * Waits for all buffers to be sent.
+     */
+    void flush();
+
+    /**
+     * Determines if a buffer is being sent.
+     *
+     * @return true if the stream is running.
+     */
+    bool isBusy();
+};
+
+}
+
+#endif
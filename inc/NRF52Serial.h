@@ -6,20 +6,77 @@
 #include "CodalComponent.h"
 #include "CodalConfig.h"
 #include "Serial.h"
+#include "ManagedBuffer.h"
+#include "NRFLowLevelTimer.h"
+#include "DataStream.h"
 #include "hal/nrf_uarte.h"
 
 #ifndef CONFIG_SERIAL_DMA_BUFFER_SIZE
 #define CONFIG_SERIAL_DMA_BUFFER_SIZE   32
 #endif
 
+// The largest single EasyDMA transmission supported by the UARTE (the width of TXD.MAXCNT).
+#if defined(UARTE0_EASYDMA_MAXCNT_SIZE)
+#define NRF52_SERIAL_DMA_MAX_TX         ((1 << UARTE0_EASYDMA_MAXCNT_SIZE) - 1)
+#else
+#define NRF52_SERIAL_DMA_MAX_TX         255
+#endif
+
+#define NRF52_SERIAL_DMA_MAX_RX         NRF52_SERIAL_DMA_MAX_TX
+
+// Block receive mode (see setRxBlockMode())
+#ifndef NRF52_SERIAL_RX_BLOCK_SIZE
+#define NRF52_SERIAL_RX_BLOCK_SIZE      128     // The default size of each of the two DMA buffers.
+#endif
+
+#ifndef NRF52_SERIAL_RX_IDLE_TIMEOUT
+#define NRF52_SERIAL_RX_IDLE_TIMEOUT    1000    // The default time, in microseconds, the line must be quiet for a partial buffer to be passed on.
+#endif
+
+#ifndef NRF52_SERIAL_RX_QUEUE_SIZE
+#define NRF52_SERIAL_RX_QUEUE_SIZE      2       // The number of received blocks held awaiting collection by pull().
+#endif
+
+// The number of DMA buffers recycled in block receive mode: the two being filled, those queued, and one held downstream.
+#define NRF52_SERIAL_RX_POOL_SIZE       (NRF52_SERIAL_RX_QUEUE_SIZE + 3)
+
+// Events
+#define NRF52_SERIAL_EVT_TX_COMPLETE    8       // A buffer passed to send(ManagedBuffer) has been transmitted.
+
 namespace codal
 {
-    class NRF52Serial : public Serial
+    class NRF52Serial : public Serial, public DataSink, public DataSource
     {
         volatile bool is_tx_in_progress_;
         volatile int  bytesProcessed;
         uint8_t dmaBuffer[CONFIG_SERIAL_DMA_BUFFER_SIZE];
 
+        ManagedBuffer txBuffer;         // A buffer being sent by send(ManagedBuffer), or waiting for the TX ring to reach txMark.
+        uint16_t txOffset;              // The number of bytes of txBuffer already transmitted.
+        uint16_t txMark;                // The position in the TX ring at which txBuffer was queued.
+        uint16_t txChunk;               // The number of bytes in the DMA transfer in progress.
+        bool txFromBuffer;              // true if the DMA transfer in progress is from txBuffer, rather than the TX ring.
+        uint8_t *txBounce;              // A RAM buffer staging txBuffer if EasyDMA can't reach it (e.g. it is in flash), or NULL.
+        uint16_t txBounceSize;          // The size of txBounce.
+        uint8_t txByte;                 // Stages txBuffer one byte at a time if no bounce buffer can be allocated.
+        bool txPulling;                 // true while pulling from txSource, to guard against recursive pullRequest() calls.
+        uint8_t txDataReady;            // The number of buffers txSource has announced, but we have not yet pulled.
+        DataSource *txSource;           // The upstream component providing data to transmit, or NULL.
+
+        NRFLowLevelTimer *rxCounter;    // The timer counting received bytes in block receive mode, or NULL.
+        ManagedBuffer rxBlock[2];       // The two DMA buffers used in block receive mode.
+        ManagedBuffer rxPool[NRF52_SERIAL_RX_POOL_SIZE]; // DMA buffers, reused once released by rxDownstream.
+        uint16_t rxBlockSize;           // The size of each buffer in rxBlock.
+        uint8_t rxBlockIndex;           // The buffer in rxBlock currently being filled.
+        uint32_t rxBlockCount;          // The value of rxCounter when the current buffer started filling.
+        NRFLowLevelTimer *rxIdleTimer;  // The timer measuring the time since the last received byte in block receive mode, or NULL.
+        int8_t rxPpi;                   // The PPI channel counting received bytes (RXDRDY -> counter COUNT, fork -> idle timer START), or -1.
+        int8_t rxIdlePpi;               // The PPI channel restarting the idle timeout (RXDRDY -> idle timer CLEAR), or -1.
+        DataSink *rxDownstream;         // The component consuming received blocks, or NULL to use the codal Serial ringbuffer.
+        ManagedBuffer rxOutput[NRF52_SERIAL_RX_QUEUE_SIZE]; // A ring of received blocks awaiting collection by pull().
+        uint8_t rxOutputHead;           // The index of the oldest block in rxOutput.
+        uint8_t rxOutputCount;          // The number of blocks in rxOutput.
+
         NRF_UARTE_Type *p_uarte_;
         static void _irqHandler(void *self);
 
@@ -51,6 +108,55 @@ namespace codal
         **/
         void dataReceivedDMA();        
 
+        /**
+          * Returns the buffer staging txBuffer, if any.
+          */
+        void releaseTxBounce();
+
+        /**
+          * Starts a DMA transfer of the next contiguous span of data awaiting transmission, if the transmitter is idle.
+          *
+          * Data is taken from the TX ring up to its end (or txMark, if a ManagedBuffer is waiting), then from txBuffer.
+          *
+          * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+          */
+        void startTx();
+
+        /**
+          * Waits until no buffer passed to send(ManagedBuffer) is outstanding.
+          *
+          * @param mode SYNC_SLEEP to sleep the calling fiber, otherwise spin.
+          */
+        void waitForTxBuffer(SerialMode mode);
+
+        /**
+          * Queues a ManagedBuffer to be transmitted after the current contents of the TX ring.
+          *
+          * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+          */
+        void queueTxBuffer(ManagedBuffer buffer);
+
+        /**
+          * Pulls the next buffer from txSource, if one has been announced and the transmitter can take it.
+          *
+          * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+          */
+        void pullTxSource();
+
+        /**
+          * Passes bytes received by DMA to the codal Serial ringbuffer, or to rxDownstream if connected.
+          *
+          * @param index The DMA buffer (0 or 1).
+          *
+          * @param length The number of bytes in the buffer that have been received.
+          */
+        void processRxBlock(int index, int length);
+
+        /**
+          * Handles the ENDRX and RXSTARTED events in block receive mode.
+          */
+        void rxBlockIrq();
+
         protected:
         virtual int enableInterrupt(SerialInterruptType t) override;
         virtual int disableInterrupt(SerialInterruptType t) override;
@@ -58,6 +164,8 @@ namespace codal
 
         public:
 
+        NRF52Serial *nextRxIdle;        // The next instance sharing the idle timer interrupt handler.
+
         /**
          * Constructor
          *
@@ -68,10 +176,90 @@ namespace codal
          **/
         NRF52Serial(Pin& tx, Pin& rx, NRF_UARTE_Type* device = NULL);
 
+        using Serial::send;
+
         virtual int putc(char) override;
         virtual int getc() override;
         virtual int setBaudrate(uint32_t baudrate) override;
 
+        /**
+          * Transmits the given buffer directly from its own memory, without copying it into the TX ring.
+          *
+          * The buffer is sent after any data already in the TX ring, and is held until the transmission completes.
+          * Only one buffer can be outstanding at a time.
+          *
+          * @param buffer The data to transmit.
+          *
+          * @param mode ASYNC returns immediately (DEVICE_BUSY if another buffer is still being sent).
+          *             SYNC_SPINWAIT and SYNC_SLEEP wait for any earlier buffer, then for this one to be sent,
+          *             by spinning or by sleeping the calling fiber respectively.
+          *
+          * @return DEVICE_OK on success, or DEVICE_BUSY.
+          */
+        int send(ManagedBuffer buffer, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+
+        /**
+          * Switches reception to block mode, for sustained high baud rates.
+          *
+          * Rather than taking an interrupt for every byte, the UARTE receives alternately into two larger DMA
+          * buffers. Each is passed on to the codal Serial ringbuffer in one go once full. Received bytes are
+          * counted by a hardware timer (RXDRDY -> COUNT via PPI). Every byte also clears and restarts a second
+          * timer, which stops itself and interrupts once the line has been idle for a timeout, so that any
+          * partially filled buffer is passed on too, without polling.
+          *
+          * @param counter A timer dedicated to counting received bytes. It is placed in counter mode.
+          *
+          * @param idle A timer dedicated to timing the idle line. It is placed in 1MHz timer mode.
+          *
+          * @param bufferSize The size of each DMA buffer, in bytes.
+          *
+          * @param idleTimeout The time the line must be quiet before a partial buffer is passed on, in microseconds.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if bufferSize is out of range,
+          *         DEVICE_BUSY if block mode is already enabled or DEVICE_NO_RESOURCES if the buffers or PPI channels could not be allocated.
+          */
+        int setRxBlockMode(NRFLowLevelTimer &counter, NRFLowLevelTimer &idle, uint16_t bufferSize = NRF52_SERIAL_RX_BLOCK_SIZE, uint32_t idleTimeout = NRF52_SERIAL_RX_IDLE_TIMEOUT);
+
+        /**
+          * Transmits the buffers provided by the given DataSource, as they become available.
+          *
+          * Each buffer is sent directly from its own memory (see send(ManagedBuffer)), and the next is only pulled
+          * once the previous one has been transmitted.
+          *
+          * @param source The component providing data to transmit.
+          *
+          * @return DEVICE_OK on success.
+          */
+        int setUpstream(DataSource &source);
+
+        /**
+          * Passes on any partially filled DMA buffer once no bytes have been received for the idle timeout.
+          * Called from the idle timer interrupt in block receive mode.
+          */
+        void onRxIdle();
+
+        /**
+          * Callback provided when data is ready from our upstream component.
+          */
+        virtual int pullRequest() override;
+
+        /**
+          * Provide the next received block to our downstream caller, if available.
+          *
+          * Blocks are only produced in block receive mode (see setRxBlockMode()). Full DMA buffers are handed over
+          * without copying, and reused once released; blocks passed on after an idle timeout are copied out of the
+          * DMA buffer still in use. Hold on to no more than one block at a time, or later full blocks are dropped.
+          *
+          * @return The block, or an empty ManagedBuffer if none is available.
+          */
+        virtual ManagedBuffer pull() override;
+
+        /**
+          * Update our reference to a downstream component. Once connected, received data no longer enters the
+          * codal Serial ringbuffer.
+          */
+        virtual void connect(DataSink &sink) override;
+
         /**
           * Puts the component in (or out of) sleep (low power) mode.
           */
@@ -31,11 +31,22 @@ DEALINGS IN THE SOFTWARE.
 #include "Pin.h"
 #include "TouchSensor.h"
 #include "NRFLowLevelTimer.h"
+#include "ppi_alloc.h"
 
-#define NRF52_TOUCH_SENSOR_PERIOD           1000                             // The period between each sensing cycle (uS)
+#define NRF52_TOUCH_SENSOR_PERIOD           1000                             // The default period between each sensing cycle (uS)
 #define NRF52_TOUCH_SENSE_SAMPLE_MAX        (NRF52_TOUCH_SENSOR_PERIOD*16)   // The maximum sample value returned (if the pin never raises)
-#define NRF52_TOUCH_SENSOR_PPI_CHANNEL      2           
-#define NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL   0
+#define NRF52_TOUCH_SENSOR_MAX_PERIOD       4000                             // The longest period supported, keeping samples within 16 bits (uS)
+#define NRF52_TOUCH_SENSOR_PPI_CHANNEL      2           // The PPI channel preferred for the first pad, if free.
+#define NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL   0           // The GPIOTE channel preferred for the first pad, if free.
+
+// Parallel sensing. Each pad sensed at the same time uses its own GPIOTE channel, PPI channel (both claimed from
+// ppi_alloc) and timer capture register. CC0 of each timer is reserved for the period.
+#define NRF52_TOUCH_SENSOR_MAX_TIMERS       2
+#define NRF52_TOUCH_SENSOR_PADS_PER_TIMER   (TIMER_CHANNEL_COUNT - 1)
+#define NRF52_TOUCH_SENSOR_MAX_PARALLEL     (NRF52_TOUCH_SENSOR_MAX_TIMERS * NRF52_TOUCH_SENSOR_PADS_PER_TIMER)
+
+// The largest number of samples that can be averaged into each reported value.
+#define NRF52_TOUCH_SENSOR_MAX_AVERAGING    64
 
 
 namespace codal
@@ -44,11 +55,45 @@ namespace codal
       * Class definition for an NRF52TouchSensor
       *
       * Drives a number of single ended TouchButtons, based on a hardware supported implementation unsing a hardware timer and PPI.
+      *
+      * By default, one button is sensed in each period. In parallel mode, up to NRF52_TOUCH_SENSOR_MAX_PARALLEL buttons
+      * are sensed at the same time, each captured by its own GPIOTE channel, PPI channel and timer capture register,
+      * so the time taken to scan every button falls by the same factor.
       */
     class NRF52TouchSensor : public TouchSensor
     {
         NRFLowLevelTimer&   timer;              // The timer module used to capture results.
-        int                 channel;            // The channel being sampled.
+        NRFLowLevelTimer    *extraTimer;        // An additional timer used to capture results in parallel mode, or NULL.
+        int                 channel;            // The first button in the group being sampled, or -1 while pins drain.
+        int                 width;              // The number of buttons sampled at the same time.
+        int                 averaging;          // The number of samples averaged into each value reported.
+        uint32_t            sampleMax;          // The sample value returned if the pin never rises.
+        int8_t              gpioteChannel[NRF52_TOUCH_SENSOR_MAX_PARALLEL];     // The GPIOTE channel sensing each parallel pad.
+        int8_t              ppiChannel[NRF52_TOUCH_SENSOR_MAX_PARALLEL];        // The PPI channel capturing the result of each parallel pad.
+        uint32_t            sums[TOUCH_SENSOR_MAX_BUTTONS];     // The sum of the samples taken of each button since its last report.
+        uint8_t             counts[TOUCH_SENSOR_MAX_BUTTONS];   // The number of samples in each sum.
+
+        /**
+          * Determines the timer that captures the result for the given parallel pad.
+          */
+        NRF_TIMER_Type* getCaptureTimer(int pad);
+
+        /**
+          * Claims the GPIOTE and PPI channels for the given parallel pad, and routes its input event to its capture register.
+          *
+          * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no channel is free.
+          */
+        int claimPad(int pad, int preferredGpiote = -1, int preferredPpi = -1);
+
+        /**
+          * Releases the GPIOTE and PPI channels of the given parallel pad.
+          */
+        void releasePad(int pad);
+
+        /**
+          * Records a sample of the given button, reporting it once enough samples have been averaged.
+          */
+        void recordSample(int button, uint32_t sample);
 
         public:
 
@@ -67,6 +112,39 @@ namespace codal
           */
         virtual int addTouchButton(TouchButton *button);
 
+        /**
+          * Selects how many buttons are sensed at the same time.
+          *
+          * @param pads The number of buttons sensed at once. 1 (the default) senses one button at a time.
+          *             Values above NRF52_TOUCH_SENSOR_PADS_PER_TIMER require a second timer.
+          *
+          * @param t A second timer module, used to capture the results of the additional pads. This is configured to
+          *          match the first timer, and remains in use until sequential sensing is restored.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the number of pads cannot be supported, or
+          *         DEVICE_NO_RESOURCES if too few GPIOTE or PPI channels are free (in which case one button is sensed at a time).
+          */
+        int setParallel(int pads, NRFLowLevelTimer *t = NULL);
+
+        /**
+          * Defines the time given to each group of buttons to charge.
+          * Longer periods give greater sensitivity, at the cost of a slower scan.
+          *
+          * @param period The sensing period, in microseconds.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the period is zero or above NRF52_TOUCH_SENSOR_MAX_PERIOD.
+          */
+        int setPeriod(uint32_t period);
+
+        /**
+          * Defines the number of samples averaged into each value reported to a button.
+          *
+          * @param samples The number of samples, in the range 1..NRF52_TOUCH_SENSOR_MAX_AVERAGING. 1 (the default) reports every sample.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the number of samples is out of range.
+          */
+        int setAveraging(int samples);
+
         /**
          * Initiate a scan of the sensors.
          */
@@ -0,0 +1,121 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2021 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NRF52_USB_H
+#define NRF52_USB_H
+
+#include "CodalConfig.h"
+#include "CodalUSB.h"
+
+#if CONFIG_ENABLED(DEVICE_USB)
+
+// The time a blocking write waits for the host to take a packet before giving up, in milliseconds.
+#ifndef NRF52_USB_IN_TIMEOUT
+#define NRF52_USB_IN_TIMEOUT        50
+#endif
+
+// The number of the USBD's isochronous endpoint.
+#define USB_ISO_EP                  8
+
+namespace codal
+{
+
+/**
+ * Called (in IRQ context) as each buffer armed with usb_read_buffer() is completed.
+ *
+ * @param arg The argument given to usb_read_start().
+ * @param data The buffer.
+ * @param len The number of bytes received into it.
+ */
+typedef void (*UsbReadCallback)(void *arg, uint8_t *data, int len);
+
+/**
+ * Starts writing the given data to an IN endpoint, returning immediately. The data is sent packet by packet from
+ * the USB interrupt as the host polls the endpoint, ending with a zero length packet if the endpoint requires one.
+ *
+ * @param endpoint The endpoint to write to. Control endpoints are not supported.
+ * @param data The bytes to write. These must remain valid until the write has completed.
+ * @param len The number of bytes to write.
+ * @param doneHandler Called (in IRQ context) once the host has taken the last packet. May be NULL.
+ * @param arg An argument passed to doneHandler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint is invalid, DEVICE_BUSY if a write is
+ *         already in progress on the endpoint, or DEVICE_NO_RESOURCES if the packet buffers could not be allocated.
+ */
+int usb_write_async(UsbEndpointIn *endpoint, const void *data, int len, PVoidCallback doneHandler, void *arg);
+
+/**
+ * Determines if an asynchronous write is in progress on the given IN endpoint.
+ */
+bool usb_write_busy(UsbEndpointIn *endpoint);
+
+/**
+ * Directs the packets received on an OUT endpoint into buffers supplied through usb_read_buffer(), rather than
+ * through UsbEndpointOut::read(). Each buffer is passed to the given handler once it is full or, for bulk and
+ * interrupt endpoints, when a short packet ends the transfer.
+ *
+ * @param endpoint The endpoint to receive from. Control endpoints are not supported.
+ * @param handler Called (in IRQ context) with each completed buffer, and the number of bytes received into it.
+ * @param arg An argument passed to handler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint is invalid, or DEVICE_NO_RESOURCES if
+ *         the endpoint state could not be allocated.
+ */
+int usb_read_start(UsbEndpointOut *endpoint, UsbReadCallback handler, void *arg);
+
+/**
+ * Arms a buffer to receive into. Up to two buffers can be armed at a time, and they are filled in turn.
+ * May be called from the handler given to usb_read_start(), typically to re-arm the buffer just completed.
+ *
+ * @param endpoint The endpoint, which must have been started with usb_read_start().
+ * @param buffer A word aligned buffer in RAM. This must remain valid until it is passed to the handler, or
+ *               usb_read_stop() is called.
+ * @param size The size of the buffer. For bulk and interrupt endpoints, this must be a multiple of the packet size;
+ *             for the isochronous endpoint, it must hold at least one maximum size packet.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint or buffer are invalid, or DEVICE_BUSY if
+ *         two buffers are already armed.
+ */
+int usb_read_buffer(UsbEndpointOut *endpoint, uint8_t *buffer, int size);
+
+/**
+ * Returns an OUT endpoint to UsbEndpointOut::read(). Any armed buffers are released without being passed to the
+ * handler, and the data received into them so far is discarded.
+ *
+ * @param endpoint The endpoint.
+ *
+ * @return DEVICE_OK on success.
+ */
+int usb_read_stop(UsbEndpointOut *endpoint);
+
+/**
+ * Determines the number of isochronous packets dropped since usb_read_start(), for lack of an armed buffer.
+ */
+uint32_t usb_read_dropped(UsbEndpointOut *endpoint);
+
+} // namespace codal
+
+#endif
+
+#endif
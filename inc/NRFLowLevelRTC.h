@@ -0,0 +1,90 @@
+#ifndef NRF_RTC_TIMER_H
+#define NRF_RTC_TIMER_H
+
+#include "LowLevelTimer.h"
+#include "nrf.h"
+
+#define RTC_CHANNEL_COUNT                4
+#define RTC_FREQUENCY                    32768
+#define RTC_COUNTER_MASK                 0x00FFFFFF
+
+// The source used for the 32.768kHz clock, if it is not already running.
+#ifndef NRF_RTC_LFCLK_SOURCE
+#define NRF_RTC_LFCLK_SOURCE             CLOCK_LFCLKSRC_SRC_RC
+#endif
+
+// When the low frequency clock runs from the RC oscillator, calibrate it against the 16MHz crystal as the clock is started and on
+// each overflow of the counter (every 512 seconds). Uncalibrated, the RC oscillator is only accurate to ~2%.
+#ifndef NRF_RTC_LFCLK_CALIBRATE
+#define NRF_RTC_LFCLK_CALIBRATE          1
+#endif
+
+namespace codal
+{
+    /**
+      * A LowLevelTimer driven by one of the RTC peripherals, from the 32.768kHz low frequency clock.
+      *
+      * The counter is presented in microseconds with 32 bit wrap around, like an NRFLowLevelTimer at 1MHz, so it can drive
+      * the system Timer directly. The 24 bit hardware counter is extended in software on each overflow.
+      *
+      * As no TIMER peripheral is left running, the 16MHz clock is stopped whenever the CPU sleeps between scheduled
+      * events, so idle current falls to that of the low frequency clock. The resolution is ~30.5uS.
+      */
+    class NRFLowLevelRTC : public LowLevelTimer
+    {
+        IRQn_Type irqn;
+        volatile uint32_t overflows;                    // The number of times the 24 bit counter has wrapped.
+        uint32_t compare[RTC_CHANNEL_COUNT];            // The time at which each compare channel fires, in microseconds.
+
+        /**
+          * Reads the extended counter, in ticks of the 32.768kHz clock.
+          */
+        uint64_t getTicks();
+
+        /**
+          * Programs the hardware compare register of the given channel for the time held in compare[channel].
+          * Times further ahead than half the counter range are approached in steps.
+          */
+        void program(uint8_t channel);
+
+        public:
+        NRF_RTC_Type *rtc;
+
+        NRFLowLevelRTC(NRF_RTC_Type* rtc, IRQn_Type irqn);
+
+        virtual int setIRQPriority(int priority) override;
+
+        virtual int enable();
+
+        virtual int enableIRQ();
+
+        virtual int disable();
+
+        virtual int disableIRQ();
+
+        virtual int reset();
+
+        virtual int setMode(TimerMode t);
+
+        virtual int setCompare(uint8_t channel, uint32_t value);
+
+        virtual int offsetCompare(uint8_t channel, uint32_t value);
+
+        virtual int clearCompare(uint8_t channel);
+
+        virtual uint32_t captureCounter();
+
+        virtual int setClockSpeed(uint32_t speedKHz);
+
+        virtual int setBitMode(TimerBitMode t);
+
+        virtual int setSleep(bool doSleep) override;
+
+        /**
+          * Interrupt handler, called on each compare and overflow event.
+          */
+        void onInterrupt();
+    };
+}
+
+#endif
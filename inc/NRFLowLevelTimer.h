@@ -5,14 +5,18 @@
 #include "nrf.h"
 
 #define TIMER_CHANNEL_COUNT              4
+#define TIMER_NO_OVERFLOW_CHANNEL        0xFF
 namespace codal
 {
     class NRFLowLevelTimer : public LowLevelTimer
     {
         IRQn_Type irqn;
+        volatile uint32_t overflows;                    // The number of times the counter has wrapped, if tracked.
+        uint8_t overflowChannel;                        // The compare channel used to detect wrap around, or TIMER_NO_OVERFLOW_CHANNEL.
 
         public:
         NRF_TIMER_Type *timer;
+        bool capturing;                                 // true once captureCounter() has been used, which shows CC3 is kept for it.
 
         NRFLowLevelTimer(NRF_TIMER_Type* timer, IRQn_Type irqn);
 
@@ -43,6 +47,29 @@ namespace codal
         virtual int setBitMode(TimerBitMode t);
 
         virtual int setSleep(bool doSleep) override;
+
+        /**
+          * Dedicates a compare channel to detecting when the counter wraps around, so captureCounter64() can
+          * extend it to 64 bits. The channel is no longer reported to the IRQ handler set by setIRQ().
+          *
+          * @param channel The compare channel to use, or TIMER_NO_OVERFLOW_CHANNEL to stop tracking overflows.
+          *
+          * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the channel is out of range.
+          */
+        int setOverflowChannel(uint8_t channel);
+
+        /**
+          * Reads the counter, extended to 64 bits by the number of times it has wrapped around.
+          * This does not mask interrupts, and may be called from any context.
+          *
+          * @return The extended counter value. If no overflow channel is set, this is the same as captureCounter().
+          */
+        uint64_t captureCounter64();
+
+        /**
+          * Interrupt handler, called on each compare event.
+          */
+        void onInterrupt();
     };
 }
 
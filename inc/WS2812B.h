@@ -37,6 +37,17 @@ DEALINGS IN THE SOFTWARE.
 #define WS2812B_PWM_FREQ            500000
 #define WS2812B_ZERO_PADDING        50
 
+// The leading padding is rounded up to a whole number of bytes, so encoded bytes never straddle output buffers.
+#define WS2812B_LEAD_PADDING        ((WS2812B_ZERO_PADDING + 7) & ~7)
+
+// The number of output buffers kept for reuse. The PWM holds two while a third is filled.
+#ifndef WS2812B_POOL_SIZE
+#define WS2812B_POOL_SIZE           3
+#endif
+
+// The PWM samples for each nibble of input, most significant bit first, packed two per word.
+extern const uint32_t ws2812b_nibble[16][2];
+
 /**
  * A simple buffer class for encoding an streaming WS2812B (neopixel) data via a NRF52PWM peripheral
  */
@@ -55,6 +66,7 @@ namespace codal
         DataSink        *downstream;            // Pointer to our downstream component
         bool            blockingPlayout;        // Set to true if a blocking playout has been requested
         FiberLock       lock;                   // used to synchronise blocking play calls.
+        ManagedBuffer   pool[WS2812B_POOL_SIZE];  // Output buffers, reused once released by our downstream component.
 
         public:
 
@@ -89,7 +101,8 @@ namespace codal
 
         /**
          *  Defines the maximum size of the buffers streamed out of this component.
-         *  @param size the size of this component's output buffers, in bytes.
+         *  @param size the size of this component's output buffers, in bytes. This is rounded down to a multiple of
+         *  16 bytes (the encoding of one byte of input), with a minimum of 16.
          */
         int setBufferSize(int size);
 
@@ -126,6 +139,11 @@ namespace codal
 
         private:
         void _play(const void *data, int length, bool mode);
+
+        /**
+         * Obtain an output buffer from the pool, recycling one released by our downstream component where possible.
+         */
+        ManagedBuffer allocateBuffer();
     };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+#include "NRF52PWM.h"
+#include "WS2812B.h"
+
+#ifndef WS2812B_PARALLEL_H
+#define WS2812B_PARALLEL_H
+
+// The maximum number of strips driven at once: one per channel of a PWM module.
+#define WS2812B_PARALLEL_MAX_STRIPS     NRF52PWM_PWM_CHANNELS
+
+// Each PWM period carries one sample per strip, and each byte of input is encoded as 8 periods (64 bytes).
+#define WS2812B_PARALLEL_PERIOD_SIZE    (WS2812B_PARALLEL_MAX_STRIPS * 2)
+#define WS2812B_PARALLEL_BYTE_SIZE      (WS2812B_PARALLEL_PERIOD_SIZE * 8)
+
+// Two channels of padding, packed into a word.
+#define WS2812B_PARALLEL_PAD_PAIR       ((uint32_t) WS2812B_PAD | ((uint32_t) WS2812B_PAD << 16))
+
+#ifndef WS2812B_PARALLEL_BUFFER_SIZE
+#define WS2812B_PARALLEL_BUFFER_SIZE    512
+#endif
+
+/**
+ * Streams WS2812B (neopixel) data to several strips at once, through the individually loaded channels of a single
+ * NRF52PWM module. All strips are encoded together in a single pass, so the time taken to refresh them is that of
+ * the longest strip, rather than the sum of them all.
+ */
+namespace codal
+{
+    class WS2812BParallel : public DataSource
+    {
+        private:
+
+        NRF52PWM        *pwm;                   // The PWM module generating the output.
+        int             outputBufferSize;       // The maximum size of an output buffer.
+
+        ManagedBuffer   strips[WS2812B_PARALLEL_MAX_STRIPS];    // The data being played to each strip (immutable).
+        int             periodsToSend;          // The number of PWM periods of data in the current request.
+        int             periodsSent;            // The number of PWM periods sent so far in the current request.
+
+        DataSink        *downstream;            // Pointer to our downstream component
+        bool            blockingPlayout;        // Set to true if a blocking playout has been requested
+        FiberLock       lock;                   // used to synchronise blocking play calls.
+        ManagedBuffer   pool[WS2812B_POOL_SIZE];  // Output buffers, reused once released by our downstream component.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param module The PWM module to use to generate the output. This must not be in use by any other NRF52PWM instance,
+         * and remains claimed for the lifetime of the application.
+         */
+        WS2812BParallel(NRF_PWM_Type *module);
+
+        /**
+         * Connects the given pin to the given strip.
+         *
+         * @param pin The pin connected to the strip.
+         * @param strip The strip number, in the range 0..WS2812B_PARALLEL_MAX_STRIPS-1.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the strip number is out of range.
+         */
+        int connectPin(Pin &pin, int strip);
+
+        /**
+         * Disconnects the given pin from its strip.
+         *
+         * @param pin The pin to disconnect.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int disconnectPin(Pin &pin);
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull();
+
+        /**
+         *  Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat();
+
+        /*
+         * Allow out downstream component to register itself with us
+         */
+        virtual void connect(DataSink &sink);
+
+        /**
+         *  Determine the maximum size of the buffers streamed out of this component.
+         *  @return The maximum size of this component's output buffers, in bytes.
+         */
+        int getBufferSize();
+
+        /**
+         *  Defines the maximum size of the buffers streamed out of this component.
+         *  @param size the size of this component's output buffers, in bytes. This is rounded down to a multiple of
+         *  WS2812B_PARALLEL_BYTE_SIZE bytes (the encoding of one byte of input for every strip), with a minimum of one.
+         */
+        int setBufferSize(int size);
+
+        /**
+         * Perform a blocking playout of the given 24 bit RGB/GRB encoded datastreams, one per strip. This method performs
+         * no ordering of red/green/blue elements - it simply clocks out the data in the order provided.
+         * Strips may be of different lengths; the shorter strips are held low once their data has been sent.
+         *
+         * @param buffers The RGB buffers to playout. buffers[n] is sent to the pin connected to strip n.
+         * @param count The number of buffers, in the range 1..WS2812B_PARALLEL_MAX_STRIPS.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+         */
+        int play(ManagedBuffer *buffers, int count);
+
+        /**
+         * Perform a non-blocking playout of the given 24 bit RGB/GRB encoded datastreams, one per strip.
+         * The buffers are retained until the next playout, so may be released by the caller.
+         *
+         * @param buffers The RGB buffers to playout. buffers[n] is sent to the pin connected to strip n.
+         * @param count The number of buffers, in the range 1..WS2812B_PARALLEL_MAX_STRIPS.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+         */
+        int playAsync(ManagedBuffer *buffers, int count);
+
+        private:
+        int _play(ManagedBuffer *buffers, int count, bool mode);
+
+        /**
+         * Obtain an output buffer from the pool, recycling one released by our downstream component where possible.
+         */
+        ManagedBuffer allocateBuffer();
+    };
+}
+#endif
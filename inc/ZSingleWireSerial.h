@@ -7,14 +7,45 @@
 #include "DMASingleWireSerial.h"
 #include "codal_target_hal.h"
 #include "MemberFunctionCallback.h"
+#include "NRFLowLevelTimer.h"
 #include "nrf.h"
 
 #define SINGLE_WIRE_SERIAL_EVT_RX_FULL      1
 #define SINGLE_WIRE_SERIAL_EVT_TX_EMPTY     2020        // using shared notify id, hopefully no one else uses this...
 
+// The number of frames that can be queued for back-to-back transmission.
+#ifndef ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE
+#define ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE   4
+#endif
+
+// The minimum length of the low period generated by sendBreak(), in microseconds. It is stretched to 11 bit times at slower baud rates.
+#ifndef ZSINGLE_WIRE_SERIAL_BREAK_TIME
+#define ZSINGLE_WIRE_SERIAL_BREAK_TIME      11
+#endif
+
+// The longest that the blocking send(), receive() and sendBreak() wait for the UARTE, in milliseconds, before giving up.
+#ifndef ZSINGLE_WIRE_SERIAL_TIMEOUT
+#define ZSINGLE_WIRE_SERIAL_TIMEOUT         1000
+#endif
+
+// The PPI channels used to chain transmissions and detect the end of received frames, as indices into ZSingleWireSerial::ppi
+#define ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN    0       // ENDTX -> STARTTX, fork -> txGroup DIS, when another frame is loaded
+#define ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY 1       // RXDRDY -> idle TIMER CLEAR and START
+#define ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE     2       // idle TIMER COMPARE0 -> STOPRX
+#define ZSINGLE_WIRE_SERIAL_PPI_CHANNELS    3
+
 namespace codal
 {
 
+    /**
+      * A frame queued for transmission.
+      */
+    struct ZSingleWireFrame
+    {
+        uint8_t     *data;
+        int         len;
+    };
+
     class ZSingleWireSerial : public DMASingleWireSerial
     {
         protected:
@@ -24,6 +55,29 @@ namespace codal
         void irq_handler();
         NRF_UARTE_Type *uart;
 
+        ZSingleWireFrame    txQueue[ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE];   // A ring of frames awaiting transmission. The head is being sent.
+        volatile uint8_t    txHead;         // The index of the frame being transmitted.
+        volatile uint8_t    txCount;        // The number of frames in txQueue, including the one being transmitted.
+        volatile bool       txStarted;      // true once the UARTE has latched the frame at the head of txQueue (TXSTARTED).
+        volatile bool       txChained;      // true if the next frame has been loaded, and will be started by PPI at ENDTX.
+        volatile bool       rxActive;       // true while a reception started by receiveDMA() is in progress.
+        NRFLowLevelTimer    *idleTimer;     // The timer used to detect the end of received frames, or NULL.
+        int8_t              ppi[ZSINGLE_WIRE_SERIAL_PPI_CHANNELS];  // The PPI channels in use. Those for idle detection are only allocated while it is enabled.
+        int8_t              txGroup;        // The PPI group holding the TX chain channel, so it disarms itself once it has fired.
+
+        /**
+          * Disables the PPI channels detecting the end of received frames, if allocated.
+          */
+        void disableIdlePpi();
+
+        /**
+          * Loads the frame following the head of txQueue into the UARTE, to be started by PPI as soon as the
+          * current frame ends.
+          *
+          * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+          */
+        void chainTx();
+
         public:
 
         virtual void configureRxInterrupt(int enable);
@@ -49,6 +103,21 @@ namespace codal
 
 
         virtual int sendBreak();
+
+        /**
+          * Ends each reception once the line has been idle for the given time, rather than only once the
+          * buffer passed to receiveDMA() is full. getBytesReceived() then gives the length of the frame.
+          *
+          * Idle detection is done in hardware: every received byte restarts the timer through PPI, and the timer
+          * stops the receiver through PPI when it expires.
+          *
+          * @param timer A timer dedicated to idle detection. It is configured for 1MHz operation.
+          *
+          * @param idleTime The idle time that ends a frame, in microseconds, or 0 to disable idle detection.
+          *
+          * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if too few PPI channels are free.
+          */
+        int setIdleTimeout(NRFLowLevelTimer &timer, uint32_t idleTime);
     };
 }
 
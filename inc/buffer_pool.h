@@ -0,0 +1,62 @@
+#ifndef NRF_BUFFER_POOL_H
+#define NRF_BUFFER_POOL_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+
+namespace codal
+{
+
+/**
+ * Determines if the given reference is the only one held to a buffer, so it can be reused or modified in place.
+ *
+ * @param b The buffer.
+ *
+ * @return true if no other component holds a reference to the buffer, false otherwise.
+ */
+bool buffer_pool_unique(ManagedBuffer &b);
+
+/**
+ * Obtain a buffer of the given size from a pool, recycling one released by its consumers where possible.
+ * Buffers are only allocated from the heap when none of the right size is free. A newly allocated buffer
+ * takes an empty slot in the pool, or replaces a released buffer of the wrong size (e.g. after a
+ * configuration change), so the pool keeps track of it for reuse.
+ *
+ * @param pool The buffers of the pool. Unused entries are empty ManagedBuffers.
+ * @param poolSize The number of entries in pool.
+ * @param size The size of the buffer, in bytes.
+ *
+ * @return The buffer. Its contents are undefined.
+ */
+ManagedBuffer buffer_pool_allocate(ManagedBuffer *pool, int poolSize, int size);
+
+/**
+ * Obtain a released buffer of the given size from a pool, without ever allocating. For use in interrupt
+ * context, on a pool populated ahead of time with buffer_pool_reserve().
+ *
+ * @param pool The buffers of the pool. Unused entries are empty ManagedBuffers.
+ * @param poolSize The number of entries in pool.
+ * @param size The size of the buffer, in bytes.
+ *
+ * @return The buffer, or an empty ManagedBuffer if none of the right size is free. Its contents are undefined.
+ */
+ManagedBuffer buffer_pool_recycle(ManagedBuffer *pool, int poolSize, int size);
+
+/**
+ * Populates a pool ahead of use, so that later calls to buffer_pool_allocate() (e.g. from an interrupt)
+ * find buffers to recycle rather than allocating from the heap. Buffers of the given size already in the
+ * pool count towards the total. New buffers only take empty slots, so reserving several sizes in turn
+ * never discards one reserved before.
+ *
+ * @param pool The buffers of the pool. Unused entries are empty ManagedBuffers.
+ * @param poolSize The number of entries in pool.
+ * @param size The size of the buffers, in bytes.
+ * @param count The number of buffers of this size the pool should hold.
+ *
+ * @return The number of buffers of this size the pool now holds, which is less than count if it ran out of slots.
+ */
+int buffer_pool_reserve(ManagedBuffer *pool, int poolSize, int size, int count);
+
+} // namespace codal
+
+#endif
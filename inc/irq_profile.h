@@ -0,0 +1,112 @@
+#ifndef NRF52_IRQ_PROFILE_H
+#define NRF52_IRQ_PROFILE_H
+
+#include "CodalConfig.h"
+#include "nrf.h"
+
+/**
+ * Opt-in profiling of the interrupt handlers owned by this target.
+ *
+ * When DEVICE_IRQ_PROFILE is enabled, each instrumented handler records the number of CPU cycles it took to run,
+ * and where the driver can tell, how many cycles passed between its hardware event and the handler starting.
+ * Both are kept per source as a count, total and maximum, along with a histogram of power of two buckets:
+ * bucket n counts samples of less than 2^n cycles (and at least 2^(n-1)), with the last bucket catching the rest.
+ *
+ * Profiling is compiled out entirely by default. Nothing is recorded until irq_profile_start() is called.
+ */
+#ifndef DEVICE_IRQ_PROFILE
+#define DEVICE_IRQ_PROFILE                      0
+#endif
+
+#define IRQ_PROFILE_BUCKETS                     16
+
+// Profiled interrupt sources.
+#define IRQ_PROFILE_PERIPHERAL                  0       // The six shared SPI/I2C/UART vectors (peripheral_alloc ids 0..5).
+#define IRQ_PROFILE_TIMER                       6       // TIMER0..TIMER4.
+#define IRQ_PROFILE_GPIOTE                      11
+#define IRQ_PROFILE_RADIO                       12
+#define IRQ_PROFILE_SAADC                       13
+#define IRQ_PROFILE_PDM                         14
+#define IRQ_PROFILE_PWM                         15      // PWM0..PWM2.
+#define IRQ_PROFILE_SOURCES                     18
+
+/**
+ * The statistics gathered for one interrupt source.
+ */
+struct IrqProfile
+{
+    uint32_t    count;                                  // The number of times the handler has run.
+    uint64_t    cycles;                                 // The total cycles spent in the handler.
+    uint32_t    maxCycles;                              // The longest run of the handler, in cycles.
+    uint32_t    latencyCount;                           // The number of latency samples taken.
+    uint32_t    maxLatency;                             // The longest latency seen, in cycles.
+    uint32_t    execution[IRQ_PROFILE_BUCKETS];         // Histogram of handler run times.
+    uint32_t    latency[IRQ_PROFILE_BUCKETS];           // Histogram of entry latencies.
+};
+
+#if CONFIG_ENABLED(DEVICE_IRQ_PROFILE)
+
+// Place at the top of a handler, and IRQ_PROFILE_EXIT at each of its exits.
+#define IRQ_PROFILE_ENTER()                     uint32_t irq_profile_entry = DWT->CYCCNT
+#define IRQ_PROFILE_EXIT(source)                irq_profile_record(source, DWT->CYCCNT - irq_profile_entry)
+#define IRQ_PROFILE_LATENCY(source, cycles)     irq_profile_record_latency(source, cycles)
+
+#else
+
+#define IRQ_PROFILE_ENTER()                     do {} while (0)
+#define IRQ_PROFILE_EXIT(source)                do {} while (0)
+#define IRQ_PROFILE_LATENCY(source, cycles)     do {} while (0)
+
+#endif
+
+/**
+ * Enables the DWT cycle counter, clears all statistics, and starts recording.
+ */
+void irq_profile_start();
+
+/**
+ * Stops recording. The statistics gathered so far are kept.
+ */
+void irq_profile_stop();
+
+/**
+ * Clears the statistics of every source.
+ */
+void irq_profile_reset();
+
+/**
+ * Records one run of a handler. Called through IRQ_PROFILE_EXIT.
+ *
+ * @param source The IRQ_PROFILE_* id of the handler.
+ *
+ * @param cycles The number of cycles the handler took.
+ */
+void irq_profile_record(int source, uint32_t cycles);
+
+/**
+ * Records the delay between a hardware event and its handler running. Called through IRQ_PROFILE_LATENCY.
+ *
+ * @param source The IRQ_PROFILE_* id of the handler.
+ *
+ * @param cycles The delay, in cycles.
+ */
+void irq_profile_record_latency(int source, uint32_t cycles);
+
+/**
+ * Takes a consistent copy of the statistics of one source.
+ *
+ * @param source The IRQ_PROFILE_* id of the source.
+ *
+ * @param profile The structure to fill in.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the source is out of range,
+ *         or DEVICE_NOT_SUPPORTED if profiling is compiled out.
+ */
+int irq_profile_get(int source, IrqProfile &profile);
+
+/**
+ * Writes the statistics of every source that has run to DMESG.
+ */
+void irq_profile_dump();
+
+#endif
@@ -9,6 +9,12 @@
 #define HARDWARE_NEOPIXEL     0
 #endif
 
+// If set, neopixel_send_buffer() streams through any PWM module that is free, falling back to bit-banging only
+// when none is (or when it can't block). HARDWARE_NEOPIXEL instead always claims PWM2.
+#ifndef NEOPIXEL_HARDWARE_AUTO
+#define NEOPIXEL_HARDWARE_AUTO  1
+#endif
+
 #include "NRF52PWM.h"
 #include "WS2812B.h"
 
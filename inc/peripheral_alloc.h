@@ -4,6 +4,16 @@
 #include <stdint.h>
 #include "nrf.h"
 
+// The size of each buffer in the pool used to stage data that EasyDMA can't reach (e.g. constant data in flash).
+#ifndef DMA_BOUNCE_BUFFER_SIZE
+#define DMA_BOUNCE_BUFFER_SIZE      64
+#endif
+
+// The number of buffers in the pool.
+#ifndef DMA_BOUNCE_BUFFER_COUNT
+#define DMA_BOUNCE_BUFFER_COUNT     4
+#endif
+
 namespace codal
 {
 
@@ -24,6 +34,34 @@ void free_alloc_peri(void* device);
 IRQn_Type get_alloc_peri_irqn(void *device);
 void set_alloc_peri_irq(void *device, PUserCallback fn, void *userdata);
 
+/**
+ * Determines if EasyDMA can read the given bytes. EasyDMA only has access to data RAM.
+ *
+ * @param data The first byte.
+ * @param len The number of bytes.
+ *
+ * @return true if the bytes are all in data RAM (or len is zero), false otherwise.
+ */
+bool is_dma_capable(const void *data, uint32_t len);
+
+/**
+ * Allocates a buffer in data RAM, for use as the source or destination of an EasyDMA transfer.
+ * Requests of up to DMA_BOUNCE_BUFFER_SIZE bytes are served from a static pool. Larger requests, and small ones
+ * made while the pool is empty, are served from the heap, except in interrupt context, where they fail.
+ *
+ * @param len The number of bytes required.
+ *
+ * @return The buffer, or NULL if no memory is available (or, in interrupt context, no pool buffer was free).
+ */
+uint8_t *allocate_dma_buffer(uint32_t len);
+
+/**
+ * Releases a buffer obtained from allocate_dma_buffer().
+ *
+ * @param buffer The buffer. NULL is ignored.
+ */
+void free_dma_buffer(void *buffer);
+
 } // namespace codal
 
 #endif
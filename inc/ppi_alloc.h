@@ -0,0 +1,71 @@
+#ifndef NRF_PPI_ALLOC_H
+#define NRF_PPI_ALLOC_H
+
+#include <stdint.h>
+#include "nrf.h"
+
+// The number of programmable PPI channels, PPI channel groups, GPIOTE channels and channels of the allocated EGU.
+#define NRF_PPI_CHANNEL_COUNT       20
+#define NRF_PPI_GROUP_COUNT         6
+#define NRF_GPIOTE_CHANNEL_COUNT    8
+#define NRF_EGU_CHANNEL_COUNT       16
+
+// PPI channels and groups claimed at fixed numbers by drivers, which are never handed out by the allocator:
+// 0-1 ADC. Every other driver allocates the channels and groups it needs.
+#ifndef NRF_PPI_RESERVED_CHANNELS
+#define NRF_PPI_RESERVED_CHANNELS   0x00000003
+#endif
+
+#ifndef NRF_PPI_RESERVED_GROUPS
+#define NRF_PPI_RESERVED_GROUPS     0x00000000
+#endif
+
+#ifndef NRF_GPIOTE_RESERVED_CHANNELS
+#define NRF_GPIOTE_RESERVED_CHANNELS 0x00000000
+#endif
+
+// The event generator unit whose channels are allocated, providing software triggerable events and tasks.
+#ifndef NRF_PPI_ALLOC_EGU
+#define NRF_PPI_ALLOC_EGU           NRF_EGU5
+#endif
+
+namespace codal
+{
+
+typedef void (*GpioteCallback)(void *);
+
+typedef volatile uint32_t *HardwareEvent;
+typedef volatile uint32_t *HardwareTask;
+
+int allocate_ppi_channel();
+int allocate_ppi_channel(int channel);
+void free_ppi_channel(int channel);
+
+int allocate_ppi_group();
+void free_ppi_group(int group);
+
+int allocate_gpiote_channel();
+int allocate_gpiote_channel(int channel);
+void free_gpiote_channel(int channel);
+void set_gpiote_irq(int channel, GpioteCallback fn, void *userdata);
+void gpiote_channel_irq();
+
+int allocate_egu_channel();
+void free_egu_channel(int channel);
+HardwareEvent egu_event(int channel);
+HardwareTask egu_task(int channel);
+
+int ppi_connect(HardwareEvent event, HardwareTask task, HardwareTask fork = NULL);
+int ppi_route(int channel, HardwareEvent event, HardwareTask task, HardwareTask fork = NULL);
+void ppi_disconnect(int channel);
+void ppi_enable(int channel);
+void ppi_disable(int channel);
+
+int ppi_group_add(int group, int channel);
+int ppi_group_remove(int group, int channel);
+HardwareTask ppi_group_enable_task(int group);
+HardwareTask ppi_group_disable_task(int group);
+
+} // namespace codal
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef NRF52_RAMFUNC_H
+#define NRF52_RAMFUNC_H
+
+#include <stdint.h>
+
+/**
+ * Places a function in RAM, where it runs without flash wait states or instruction cache misses.
+ *
+ * The function is placed in its own executable ("ax") section, .ramfunc. The linker script must copy this to RAM
+ * along with .data, by listing it inside the .data output section (before the end of data symbol the startup code
+ * copies up to):
+ *
+ *     .data : { ... *(.ramfunc*) *(.data*) ... } > RAM AT > FLASH
+ *
+ * Without that hook, the linker places .ramfunc as an orphan section after the code in flash, where it still runs
+ * correctly, but from flash. Keeping it out of .data avoids the assembler warning about code in a data section.
+ *
+ * The function is never inlined into its (flash resident) callers, and is called through a long branch, as RAM
+ * is out of range of a direct branch from flash. Keep such functions small: they take RAM for their code.
+ *
+ * Define NRF52_RAMFUNC to nothing to leave everything in flash.
+ */
+#ifndef NRF52_RAMFUNC
+#define NRF52_RAMFUNC __attribute__((noinline, long_call, section(".ramfunc")))
+#endif
+
+/**
+ * Clears the instruction cache hit and miss counters, and starts counting.
+ * Profiling costs power, so should only be enabled while measuring.
+ */
+void icache_profile_start();
+
+/**
+ * Stops the instruction cache hit and miss counters. Their values are kept.
+ */
+void icache_profile_stop();
+
+/**
+ * Reads the number of instruction fetches served by the cache since icache_profile_start().
+ */
+uint32_t icache_hits();
+
+/**
+ * Reads the number of instruction fetches that missed the cache since icache_profile_start().
+ */
+uint32_t icache_misses();
+
+#endif
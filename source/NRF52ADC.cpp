@@ -26,8 +26,11 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalUtil.h"
 #include "CodalDmesg.h"
 #include "NRF52ADC.h"
+#include "buffer_pool.h"
 #include "nrf.h"
 #include "cmsis.h"
+#include "ramfunc.h"
+#include "irq_profile.h"
 
 // Calculation to determine the optimal usable space for a DMA buffer for the given number of channels
 #define NRF52ADC_DMA_ALIGNED_SIZED(c)   ((bufferSize - (bufferSize % (c * 2 * softwareOversample)))/2);
@@ -53,9 +56,13 @@ static NRF52ADC *nrf52_adc_driver = NULL;
 //void nrf52_adc_irq(void)
 extern "C" void SAADC_IRQHandler()
 {
+    IRQ_PROFILE_ENTER();
+
     // Simply pass on to the driver component handler.
     if (nrf52_adc_driver)
         nrf52_adc_driver->irq();
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_SAADC);
 }
 
 /**
@@ -72,6 +79,9 @@ NRF52ADCChannel::NRF52ADCChannel(NRF52ADC &adc, uint8_t channel) : adc(adc), out
     this->bias = 0;
     this->status = 0;
     this->lastSample = 0;
+    this->limitLow = 0;
+    this->limitHigh = 0;
+    this->limitState = NRF52_ADC_LIMIT_DISABLED;
 
     // Define our output stream as non-blocking.
     output.setBlocking(false);
@@ -258,6 +268,120 @@ void NRF52ADCChannel::configureGain()
         (SAADC_CH_CONFIG_BURST_Disabled << SAADC_CH_CONFIG_BURST_Pos );
 }
 
+/**
+ * Monitor this channel against a window of values. The SAADC compares every conversion against the window
+ * in hardware, and an event is raised (with the ADC's id) only as the input leaves or re-enters it:
+ * NRF52_ADC_EVT_LIMIT_HIGH(channel), NRF52_ADC_EVT_LIMIT_LOW(channel) or NRF52_ADC_EVT_LIMIT_IN(channel).
+ *
+ * Use NRF52ADC::setMonitorMode() to avoid waking the CPU for anything other than these events.
+ *
+ * @param low The lowest raw sample value considered inside the window.
+ * @param high The highest raw sample value considered inside the window.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if low > high.
+ */
+int NRF52ADCChannel::setLimits(int16_t low, int16_t high)
+{
+    if (low > high)
+        return DEVICE_INVALID_PARAMETER;
+
+    NVIC_DisableIRQ(SAADC_IRQn);
+
+    limitLow = low;
+    limitHigh = high;
+    limitState = NRF52_ADC_LIMIT_INSIDE;
+    configureLimits();
+
+    NVIC_EnableIRQ(SAADC_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop monitoring this channel against a window of values.
+ *
+ * @return DEVICE_OK on success.
+ */
+int NRF52ADCChannel::clearLimits()
+{
+    NVIC_DisableIRQ(SAADC_IRQn);
+
+    limitState = NRF52_ADC_LIMIT_DISABLED;
+    configureLimits();
+
+    NVIC_EnableIRQ(SAADC_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Program the SAADC limit comparators for this channel.
+ *
+ * The hardware events are level triggered (every conversion outside the limits raises one), so once the
+ * input has left the window, the limits are moved to detect it coming back instead.
+ */
+void NRF52ADCChannel::configureLimits()
+{
+    uint32_t limith = SAADC_INTENSET_CH0LIMITH_Msk << (2 * channel);
+    uint32_t limitl = SAADC_INTENSET_CH0LIMITL_Msk << (2 * channel);
+    int16_t low = -32768;
+    int16_t high = 32767;
+
+    NRF_SAADC->INTENCLR = limith | limitl;
+    NRF_SAADC->EVENTS_CH[channel].LIMITH = 0;
+    NRF_SAADC->EVENTS_CH[channel].LIMITL = 0;
+
+    switch (limitState)
+    {
+        case NRF52_ADC_LIMIT_INSIDE:
+            low = limitLow;
+            high = limitHigh;
+            NRF_SAADC->INTENSET = limith | limitl;
+            break;
+
+        case NRF52_ADC_LIMIT_ABOVE:
+            low = limitHigh;
+            NRF_SAADC->INTENSET = limitl;
+            break;
+
+        case NRF52_ADC_LIMIT_BELOW:
+            high = limitLow;
+            NRF_SAADC->INTENSET = limith;
+            break;
+    }
+
+    NRF_SAADC->CH[channel].LIMIT = ((uint32_t)(uint16_t)high << SAADC_CH_LIMIT_HIGH_Pos) | (uint16_t)low;
+}
+
+/**
+ * Called by the ADC interrupt handler to process this channel's limit events.
+ */
+void NRF52ADCChannel::limitIrq()
+{
+    bool above = NRF_SAADC->EVENTS_CH[channel].LIMITH && (NRF_SAADC->INTEN & (SAADC_INTENSET_CH0LIMITH_Msk << (2 * channel)));
+    bool below = NRF_SAADC->EVENTS_CH[channel].LIMITL && (NRF_SAADC->INTEN & (SAADC_INTENSET_CH0LIMITL_Msk << (2 * channel)));
+    int evt = 0;
+
+    if (!above && !below)
+        return;
+
+    if (limitState == NRF52_ADC_LIMIT_INSIDE)
+    {
+        limitState = above ? NRF52_ADC_LIMIT_ABOVE : NRF52_ADC_LIMIT_BELOW;
+        evt = above ? NRF52_ADC_EVT_LIMIT_HIGH(channel) : NRF52_ADC_EVT_LIMIT_LOW(channel);
+    }
+    else if (limitState != NRF52_ADC_LIMIT_DISABLED)
+    {
+        limitState = NRF52_ADC_LIMIT_INSIDE;
+        evt = NRF52_ADC_EVT_LIMIT_IN(channel);
+    }
+
+    configureLimits();
+
+    if (evt)
+        Event(adc.id, evt);
+}
+
 /**
   * Determine the gain level for the analog input.
   *
@@ -330,7 +454,7 @@ void NRF52ADCChannel::demux(ManagedBuffer dmaBuffer, int offset, int skip, int o
             {
                 if (size == l)
                 {
-                    buffer = ManagedBuffer(bufferSize);
+                    buffer = adc.allocateBuffer(bufferSize);
                     size = 0;
                     ptr = (int16_t *) &buffer[0];
                     l = buffer.length();
@@ -355,6 +479,176 @@ void NRF52ADCChannel::demux(ManagedBuffer dmaBuffer, int offset, int skip, int o
     }
 }
 
+/**
+ * Sums count interleaved frames of n samples, one total per channel.
+ *
+ * With the DSP extension, samples from two adjacent channels are added with a single SADD16. SADD16 wraps
+ * rather than saturating, and a 14 bit single ended result reaches 16383, so only two samples fit in each
+ * 16 bit lane without overflow. Lanes are therefore widened into the 32 bit sums every two frames.
+ */
+static inline void nrf52_adc_accumulate(const int16_t *data, int n, int count, int32_t *sum)
+{
+    for (int i = 0; i < n; i++)
+        sum[i] = 0;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    int pairs = n >> 1;
+
+    for (int f = 0; f < count; f += 2)
+    {
+        int chunk = min(2, count - f);
+        const int16_t *frame = data + f * n;
+
+        for (int p = 0; p < pairs; p++)
+        {
+            const int16_t *q = frame + 2 * p;
+            uint32_t acc = 0;
+
+            for (int k = 0; k < chunk; k++, q += n)
+                acc = __SADD16(acc, __UNALIGNED_UINT32_READ(q));
+
+            sum[2 * p] += (int16_t) acc;
+            sum[2 * p + 1] += (int16_t) (acc >> 16);
+        }
+
+        if (n & 1)
+        {
+            for (int k = 0; k < chunk; k++)
+                sum[n - 1] += frame[k * n + n - 1];
+        }
+    }
+#else
+    for (int f = 0; f < count; f++, data += n)
+        for (int i = 0; i < n; i++)
+            sum[i] += data[i];
+#endif
+}
+
+/**
+ * Demultiplexes a completed DMA buffer into the buffers of all enabled channels, in a single pass.
+ *
+ * @param dmaBuffer the DMA buffer to read from
+ */
+void NRF52ADC::demux(ManagedBuffer dmaBuffer)
+{
+    NRF52ADCChannel *active[NRF52_ADC_CHANNELS];
+    int16_t *out[NRF52_ADC_CHANNELS];
+    int32_t sum[NRF52_ADC_CHANNELS];
+    int n = 0;
+
+    // Channels appear in the DMA buffer in channel number order.
+    for (int channel = 0; channel < NRF52_ADC_CHANNELS; channel++)
+    {
+        if (NRF_SAADC->CH[channel].PSELP)
+            active[n++] = &channels[channel];
+    }
+
+    if (n == 0)
+        return;
+
+    // A single channel can use its zero copy path.
+    if (n == 1)
+    {
+        active[0]->demux(dmaBuffer, 0, 1, softwareOversample);
+        return;
+    }
+
+    int16_t *data = (int16_t *) &dmaBuffer[0];
+    int frames = dmaBuffer.length() / (2 * n);
+
+    // If this buffer is too short to contain a full frame, ignore it. Each lastSample is already up to date.
+    if (frames == 0)
+        return;
+
+    // softwareOversample is always a power of two, so scale the totals with a shift rather than a divide.
+    int shift = 0;
+    while ((1 << shift) < softwareOversample)
+        shift++;
+
+    int outputs = frames >> shift;
+    bool connected = false;
+
+    // Record the most recent sample of each channel, in case we're asked later.
+    int16_t *last = data + (frames - 1) * n;
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((active[i]->status & NRF52_ADC_CHANNEL_STATUS_ENABLED) == 0)
+        {
+            active[i] = NULL;
+            continue;
+        }
+
+        active[i]->lastSample = last[i];
+
+        if (active[i]->status & NRF52_ADC_CHANNEL_STATUS_CONNECTED)
+            connected = true;
+        else
+            active[i] = NULL;
+    }
+
+    if (!connected)
+        return;
+
+    while (outputs > 0)
+    {
+        // Find how many samples every connected channel has room for, so the inner loop needs no checks.
+        int run = outputs;
+
+        for (int i = 0; i < n; i++)
+        {
+            NRF52ADCChannel *c = active[i];
+
+            if (c == NULL)
+                continue;
+
+            if (c->size >= c->buffer.length())
+            {
+                c->buffer = allocateBuffer(c->bufferSize);
+                c->size = 0;
+            }
+
+            out[i] = (int16_t *) &c->buffer[c->size];
+            run = min(run, (c->buffer.length() - c->size) / 2);
+        }
+
+        for (int r = 0; r < run; r++)
+        {
+            if (shift == 0)
+            {
+                for (int i = 0; i < n; i++)
+                    if (active[i])
+                        *out[i]++ = data[i];
+            }
+            else
+            {
+                nrf52_adc_accumulate(data, n, 1 << shift, sum);
+
+                for (int i = 0; i < n; i++)
+                    if (active[i])
+                        *out[i]++ = (int16_t) (sum[i] >> shift);
+            }
+
+            data += n << shift;
+        }
+
+        outputs -= run;
+
+        for (int i = 0; i < n; i++)
+        {
+            NRF52ADCChannel *c = active[i];
+
+            if (c == NULL)
+                continue;
+
+            c->size += run * 2;
+
+            if (c->size >= c->buffer.length())
+                c->output.pullRequest();
+        }
+    }
+}
+
 /**
  * Constructor for an instance of an analog to digital converter,
  *
@@ -371,6 +665,11 @@ NRF52ADC::NRF52ADC(NRFLowLevelTimer &adcTimer, int samplePeriod, uint16_t id) :
     this->bufferSize = NRF52_ADC_DMA_SIZE;
     this->enabledChannels = 0;
     this->running = false;
+    this->monitoring = false;
+    this->pool = NULL;
+    this->poolSize = 0;
+
+    reservePool();
 
     // Initialise receive buffers
     dma[0] = allocateDMABuffer();
@@ -416,38 +715,121 @@ NRF52ADC::NRF52ADC(NRFLowLevelTimer &adcTimer, int samplePeriod, uint16_t id) :
  */
 ManagedBuffer NRF52ADC::allocateDMABuffer()
 {
-    ManagedBuffer b(bufferSize, BufferInitialize::None);
+    // Size the buffer to exactly the region the DMA will fill, so it never needs to be truncated.
+    int size = bufferSize;
+
+    if (enabledChannels)
+    {
+        size = NRF52ADC_DMA_ALIGNED_SIZED(enabledChannels);
+        size *= 2;
+    }
+
+    ManagedBuffer b = allocateBuffer(size);
 
     // Fill the buffer with values unused by the ADC hardware. We can use this to perform demuxing 
     // of a live DMA buffer as it is being filled. :)
     // We choose 0x88 as a 16 bit signed 0x8888 is an invalid 14 bit sample (either +ve or -ve)
-    b.fill(0x88);
+    memset(b.getBytes(), 0x88, b.length());
 
     return b;
 }
 
-void NRF52ADC::irq()
+/**
+ * Obtain a buffer of the given size from the pool, recycling one released by its consumers where possible.
+ * Buffers are only allocated from the heap when none of the right size is free.
+ *
+ * @param size The size of the buffer, in bytes.
+ * @return The buffer. Its contents are undefined.
+ */
+ManagedBuffer NRF52ADC::allocateBuffer(int size)
+{
+    return buffer_pool_allocate(pool, poolSize, size);
+}
+
+/**
+ * Grows the pool to suit the enabled channels, and fills it with buffers of the sizes they will use,
+ * so that the SAADC interrupt recycles buffers rather than allocating them. Called before sampling starts.
+ */
+void NRF52ADC::reservePool()
+{
+    int size = max(NRF52_ADC_POOL_SIZE, 2 * enabledChannels + 2 + NRF52_ADC_POOL_HEADROOM);
+
+    if (size > poolSize)
+    {
+        ManagedBuffer *p = new ManagedBuffer[size];
+
+        int wasEnabled = NVIC_GetEnableIRQ(SAADC_IRQn);
+        NVIC_DisableIRQ(SAADC_IRQn);
+
+        for (int i = 0; i < poolSize; i++)
+            p[i] = pool[i];
+
+        delete[] pool;
+        pool = p;
+        poolSize = size;
+
+        if (wasEnabled)
+            NVIC_EnableIRQ(SAADC_IRQn);
+    }
+
+    // Two DMA buffers are always in flight, and a single streamed channel is handed a third.
+    int dmaSize = bufferSize;
+
+    if (enabledChannels)
+    {
+        dmaSize = NRF52ADC_DMA_ALIGNED_SIZED(enabledChannels);
+        dmaSize *= 2;
+    }
+
+    buffer_pool_reserve(pool, poolSize, dmaSize, 3);
+
+    // With several channels, each fills one output buffer while its consumer holds the last.
+    if (enabledChannels > 1)
+    {
+        for (int i = 0; i < NRF52_ADC_CHANNELS; i++)
+            if (channels[i].isEnabled() && (channels[i].status & NRF52_ADC_CHANNEL_STATUS_CONNECTED))
+                buffer_pool_reserve(pool, poolSize, channels[i].bufferSize, 2);
+    }
+}
+
+NRF52_RAMFUNC void NRF52ADC::irq()
 {
+    for (int channel = 0; channel < NRF52_ADC_CHANNELS; channel++)
+        channels[channel].limitIrq();
+
+    // In monitor mode, the SAADC cycles through a scratch buffer and nothing is streamed.
+    if (monitoring)
+    {
+        NRF_SAADC->EVENTS_END = 0;
+        NRF_SAADC->EVENTS_STARTED = 0;
+
+        if (NRF_SAADC->EVENTS_STOPPED)
+        {
+            NRF_SAADC->EVENTS_STOPPED = 0;
+            this->running = false;
+        }
+
+        return;
+    }
+
     if (NRF_SAADC->EVENTS_END || NRF_SAADC->EVENTS_STOPPED)
     {
         // Snapshot the buffer we just received into
         int completeBuffer = activeDMA;
-        int offset = 0;
 
         // Flip to our other buffer.
         activeDMA = (activeDMA + 1) % 2;
 
-        // truncate the buffer if we didn't fill it...
-        dma[completeBuffer].truncate(NRF_SAADC->RESULT.AMOUNT*2);
+        // Trim the buffer if we didn't fill it (i.e. when stopped)...
+        // Pooled buffers must keep their length, so take a copy rather than truncating.
+        int amount = NRF_SAADC->RESULT.AMOUNT*2;
+        if (amount < dma[completeBuffer].length())
+            dma[completeBuffer] = ManagedBuffer(dma[completeBuffer].getBytes(), amount);
 
         // Process the buffer.
         // TODO: Consider moving this outside the interrupt context...
 
-        for (int channel = 0; channel < NRF52_ADC_CHANNELS; channel++)
-        {
-            if (NRF_SAADC->CH[channel].PSELP)
-                channels[channel].demux(dma[completeBuffer], offset++, enabledChannels, softwareOversample);
-        }
+        demux(dma[completeBuffer]);
 
         // Indicate we've processed the interrupt
         if(NRF_SAADC->EVENTS_END)
@@ -615,6 +997,10 @@ ManagedBuffer NRF52ADC::getActiveDMABuffer()
 {
     ManagedBuffer b;
 
+    // In monitor mode, the scratch buffer always holds the latest frame.
+    if (monitoring)
+        return ManagedBuffer((uint8_t *) monitorBuffer, enabledChannels * 2);
+
     target_disable_irq();
     b = dma[activeDMA];
     target_enable_irq();
@@ -699,6 +1085,95 @@ int NRF52ADC::releaseChannel(Pin& pin)
     return DEVICE_OK;
 }
 
+/**
+ * Take a single sample from the given pin.
+ *
+ * If the ADC is already streaming, this is the most recent sample from the pin's channel (which is added to the
+ * stream if necessary). Otherwise, a one-shot conversion is performed with the SAADC's IRQ masked, and the SAADC
+ * is powered back down afterwards. The conversion takes around 10us, and leaves no timer, DMA or IRQ activity behind.
+ *
+ * @param pin The pin to sample.
+ * @return The raw sample, clipped at zero, or DEVICE_NOT_SUPPORTED if the given pin does not support analogue input.
+ */
+int NRF52ADC::getSampleOnce(Pin& pin)
+{
+    int c;
+    volatile int16_t result = 0;
+
+    if (!nrf52_saadc_id.hasKey(pin.name))
+        return DEVICE_NOT_SUPPORTED;
+
+    c = nrf52_saadc_id.get(pin.name) - 1;
+
+    // Streaming owns the SAADC, so just take the latest value from the stream.
+    if (running)
+    {
+        NRF52ADCChannel *channel = getChannel(pin);
+        return channel ? channel->getSample() : DEVICE_NOT_SUPPORTED;
+    }
+
+    // Run the conversion by polling, so the IRQ handler never sees our events.
+    NVIC_DisableIRQ(SAADC_IRQn);
+
+    NRF_SAADC->ENABLE = 0;
+    NRF_SAADC->RESOLUTION = (SAADC_RESOLUTION_VAL_14bit << SAADC_RESOLUTION_VAL_Pos);
+    NRF_SAADC->OVERSAMPLE = 0;
+
+    // Connect only the requested channel. Any others may still be configured for a stream that is asleep.
+    uint32_t psel[NRF52_ADC_CHANNELS];
+
+    for (int i = 0; i < NRF52_ADC_CHANNELS; i++)
+    {
+        psel[i] = NRF_SAADC->CH[i].PSELP;
+        NRF_SAADC->CH[i].PSELP = 0;
+    }
+
+    channels[c].configureGain();
+    NRF_SAADC->CH[c].PSELP = c+1;
+    NRF_SAADC->CH[c].PSELN = 0;
+
+    NRF_SAADC->RESULT.PTR = (uint32_t) &result;
+    NRF_SAADC->RESULT.MAXCNT = 1;
+
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->EVENTS_END = 0;
+    NRF_SAADC->EVENTS_STOPPED = 0;
+
+    NRF_SAADC->ENABLE = 1;
+
+    NRF_SAADC->TASKS_START = 1;
+    while (!NRF_SAADC->EVENTS_STARTED);
+
+    NRF_SAADC->TASKS_SAMPLE = 1;
+    while (!NRF_SAADC->EVENTS_END);
+
+    NRF_SAADC->TASKS_STOP = 1;
+    while (!NRF_SAADC->EVENTS_STOPPED);
+
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->EVENTS_END = 0;
+    NRF_SAADC->EVENTS_STOPPED = 0;
+
+    // Power the SAADC back down, and restore any sleeping stream's configuration.
+    NRF_SAADC->ENABLE = 0;
+
+    for (int i = 0; i < NRF52_ADC_CHANNELS; i++)
+    {
+        NRF_SAADC->EVENTS_CH[i].LIMITH = 0;
+        NRF_SAADC->EVENTS_CH[i].LIMITL = 0;
+        NRF_SAADC->CH[i].PSELP = psel[i];
+        if (channels[i].isEnabled())
+            channels[i].configureGain();
+    }
+
+    NVIC_ClearPendingIRQ(SAADC_IRQn);
+    NVIC_EnableIRQ(SAADC_IRQn);
+
+    channels[c].lastSample = result;
+
+    return result < 0 ? 0 : result;
+}
+
 bool NRF52ADC::stopRunning()
 {
     if ( !running)
@@ -781,12 +1256,36 @@ bool NRF52ADC::startRunning()
     // Recalculate OVERSAMPLE and timer settings accordingly.
     configureSampling();
 
-    // TODO: define MAXCNT to be a multiple of the number of active channels, to keep DMA transfers easy to manage.
-    dma[activeDMA] = allocateDMABuffer();
-    volatile uint16_t *dmaLast = ((uint16_t *) &dma[activeDMA][0]) + (enabledChannels - 1);
+    for (int channel = 0; channel < NRF52_ADC_CHANNELS; channel++)
+        channels[channel].configureLimits();
+
+    volatile uint16_t *dmaLast;
+
+    if (monitoring)
+    {
+        // Cycle through a single frame of scratch memory, with the END -> START PPI link restarting each time.
+        // Only the limit (and STOPPED) interrupts remain, so the CPU sleeps until a channel leaves its window.
+        NRF_SAADC->INTENCLR = SAADC_INTENCLR_STARTED_Msk | SAADC_INTENCLR_END_Msk;
+
+        memset(monitorBuffer, 0x88, sizeof(monitorBuffer));
+        dmaLast = ((uint16_t *) monitorBuffer) + (enabledChannels - 1);
+
+        NRF_SAADC->RESULT.PTR = (uint32_t) monitorBuffer;
+        NRF_SAADC->RESULT.MAXCNT = enabledChannels;
+    }
+    else
+    {
+        // Get hold of all the buffers this configuration needs now, rather than in the interrupt.
+        reservePool();
+
+        // TODO: define MAXCNT to be a multiple of the number of active channels, to keep DMA transfers easy to manage.
+        dma[activeDMA] = allocateDMABuffer();
+        dmaLast = ((uint16_t *) &dma[activeDMA][0]) + (enabledChannels - 1);
+
+        NRF_SAADC->RESULT.PTR = (uint32_t) &dma[activeDMA][0];
+        NRF_SAADC->RESULT.MAXCNT = NRF52ADC_DMA_ALIGNED_SIZED(enabledChannels); 
+    }
 
-    NRF_SAADC->RESULT.PTR = (uint32_t) &dma[activeDMA][0];
-    NRF_SAADC->RESULT.MAXCNT = NRF52ADC_DMA_ALIGNED_SIZED(enabledChannels); 
     NRF_SAADC->TASKS_START = 1;
 
     //Enable PPI links
@@ -799,6 +1298,32 @@ bool NRF52ADC::startRunning()
     return true;
 }
 
+/**
+ * Enable or disable monitor mode. In monitor mode, no data is streamed. The SAADC repeatedly samples
+ * the enabled channels into a single frame of scratch memory, and the CPU is only woken when a channel
+ * configured with NRF52ADCChannel::setLimits() leaves or re-enters its window.
+ * getSample() continues to return the latest value of each channel.
+ *
+ * The sample period remains that given by setSamplePeriod(); a long period minimises power. Sampling stops
+ * while the ADC is put to sleep with setSleep(), and resumes in the same mode when it wakes.
+ *
+ * @param enable true to enter monitor mode, false to return to streaming.
+ * @return DEVICE_OK on success.
+ */
+int NRF52ADC::setMonitorMode(bool enable)
+{
+    if (monitoring == enable)
+        return DEVICE_OK;
+
+    bool wasRunning = stopRunning();
+    monitoring = enable;
+
+    if (wasRunning)
+        startRunning();
+
+    return DEVICE_OK;
+}
+
 /**
  * Puts the component in (or out of) sleep (low power) mode.
  */
@@ -0,0 +1,416 @@
+#include "CodalConfig.h"
+#include "NRF52Benchmark.h"
+
+#if CONFIG_ENABLED(DEVICE_BENCHMARK)
+
+#include "CodalCompat.h"
+#include "CodalDmesg.h"
+#include "CodalFiber.h"
+#include "ErrorNo.h"
+#include "ManagedString.h"
+#include "Timer.h"
+#include "WS2812B.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+#define BENCHMARK_BUFFER_SIZE       256
+
+static Serial *benchmark_output = NULL;
+
+// Scratch data for the transfer benchmarks. static, so it is always in RAM and usable by EasyDMA.
+static uint8_t tx_data[BENCHMARK_BUFFER_SIZE];
+static uint8_t rx_data[BENCHMARK_BUFFER_SIZE];
+
+static inline uint32_t cycles()
+{
+    return DWT->CYCCNT;
+}
+
+// Converts a count of events over a number of cycles into events per second.
+static uint32_t per_second(uint32_t count, uint32_t elapsed)
+{
+    return elapsed ? (uint32_t)(((uint64_t) count * SystemCoreClock) / elapsed) : 0;
+}
+
+static uint32_t to_us(uint32_t elapsed)
+{
+    return (uint32_t)(((uint64_t) elapsed * 1000000) / SystemCoreClock);
+}
+
+void benchmark_start(Serial *output)
+{
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    for (int i = 0; i < BENCHMARK_BUFFER_SIZE; i++)
+        tx_data[i] = i;
+
+    benchmark_output = output;
+    benchmark_report("core_clock", 0, SystemCoreClock, "Hz");
+}
+
+void benchmark_report(const char *name, int parameter, uint32_t value, const char *unit)
+{
+    if (benchmark_output == NULL)
+    {
+        DMESG("BENCH,%s,%d,%d,%s", name, parameter, value, unit);
+        return;
+    }
+
+    ManagedString line = ManagedString("BENCH,") + name + "," + ManagedString(parameter) + "," + ManagedString((int) value) + "," + unit + "\r\n";
+    benchmark_output->send(line, SYNC_SLEEP);
+}
+
+int benchmark_spi(NRF52SPI &spi, int size)
+{
+    static const uint32_t frequencies[] = { 125000, 250000, 500000, 1000000, 2000000, 4000000, 8000000 };
+
+    if (size < 1 || size > BENCHMARK_BUFFER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (unsigned f = 0; f < sizeof(frequencies) / sizeof(frequencies[0]); f++)
+    {
+        spi.setFrequency(frequencies[f]);
+
+        // The first transfer after a change of frequency also reconfigures the peripheral, so is not timed.
+        spi.transfer(tx_data, size, rx_data, size);
+
+        int transfers = max(1, (int)(frequencies[f] / (8 * size * 20)));
+        uint32_t start = cycles();
+
+        for (int i = 0; i < transfers; i++)
+            spi.transfer(tx_data, size, rx_data, size);
+
+        benchmark_report("spi_bytes_per_s", frequencies[f], per_second(transfers * size, cycles() - start), "B/s");
+    }
+
+    // At 8MHz a byte takes a microsecond on the wire. Whatever a single byte transfer takes beyond that is overhead.
+    uint32_t start = cycles();
+
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+        spi.transfer(tx_data, 1, rx_data, 1);
+
+    uint32_t elapsed = (cycles() - start) / BENCHMARK_ITERATIONS;
+    uint32_t wire = SystemCoreClock / 1000000;
+
+    benchmark_report("spi_setup_cycles", 8000000, elapsed > wire ? elapsed - wire : 0, "cycles");
+
+    return DEVICE_OK;
+}
+
+static ManagedBuffer serial_data;
+
+static void serial_sender(void *serial)
+{
+    ((NRF52Serial *) serial)->send(serial_data, SYNC_SLEEP);
+}
+
+int benchmark_serial(NRF52Serial &serial, uint32_t baud, int size)
+{
+    if (size < 1 || size >= BENCHMARK_BUFFER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    serial.setBaud(baud);
+    serial.setRxBufferSize(size);
+
+    // Transmit, straight from the buffer, and waiting for the last byte to leave.
+    serial_data = ManagedBuffer(tx_data, size);
+
+    uint32_t start = cycles();
+    serial.send(serial_data, SYNC_SLEEP);
+    benchmark_report("uart_tx_bytes_per_s", baud, per_second(size, cycles() - start), "B/s");
+
+    // Receive the same data looped back, sent from another fiber so this one can collect it as it arrives.
+    serial.clearRxBuffer();
+
+    int received = 0;
+    CODAL_TIMESTAMP last = system_timer_current_time();
+
+    start = cycles();
+    create_fiber(serial_sender, &serial);
+
+    while (received < size && system_timer_current_time() - last < BENCHMARK_TIMEOUT)
+    {
+        int r = serial.read(rx_data + received, size - received, ASYNC);
+
+        if (r > 0)
+        {
+            received += r;
+            last = system_timer_current_time();
+        }
+        else
+        {
+            schedule();
+        }
+    }
+
+    benchmark_report("uart_rx_bytes_per_s", baud, received ? per_second(received, cycles() - start) : 0, "B/s");
+    benchmark_report("uart_rx_lost", baud, size - received, "B");
+
+    // Let the sender finish before reusing the port.
+    fiber_sleep(BENCHMARK_TIMEOUT);
+    serial_data = ManagedBuffer();
+
+    return DEVICE_OK;
+}
+
+int benchmark_radio(NRF52Radio &radio, int packets, int size)
+{
+    if (packets < 1 || size < 1 || size > radio.getMaxPacketSize())
+        return DEVICE_INVALID_PARAMETER;
+
+    uint32_t start = cycles();
+
+    for (int i = 0; i < packets; i++)
+    {
+        // This blocks while the transmit queue is full, so the radio stays busy without us overrunning it.
+        FrameBuffer *buf = radio.getTxBuf();
+
+        if (buf == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        // Protocol 0 has no handler, so receivers (including any running benchmark_radio_echo()) discard these frames.
+        buf->length = size + NRF52_RADIO_HEADER_SIZE - 1;
+        buf->version = 1;
+        buf->group = 0;
+        buf->protocol = 0;
+        memcpy(buf->payload, tx_data, size);
+
+        int result = radio.queueTxBuf(buf);
+
+        if (result != DEVICE_OK)
+            return result;
+    }
+
+    fiber_wait_for_event(radio.id, NRF52_RADIO_EVT_TX_COMPLETE);
+
+    benchmark_report("radio_packets_per_s", size, per_second(packets, cycles() - start), "pkt/s");
+
+    return DEVICE_OK;
+}
+
+static volatile uint32_t probe_reply;
+static volatile uint32_t probe_reply_time;
+
+static void radio_probe_received(void *arg)
+{
+    NRF52Radio *radio = (NRF52Radio *) arg;
+    FrameBuffer *packet = radio->recv();
+
+    if (packet == NULL)
+        return;
+
+    uint32_t sequence;
+    memcpy(&sequence, packet->payload, sizeof(sequence));
+    radio->releaseFrameBuffer(packet);
+
+    probe_reply_time = cycles();
+    probe_reply = sequence;
+}
+
+static void radio_probe_echo(void *arg)
+{
+    NRF52Radio *radio = (NRF52Radio *) arg;
+    FrameBuffer *packet = radio->recv();
+
+    // Send the frame straight back. queueTxBuf() releases it if it cannot be queued.
+    if (packet)
+        radio->queueTxBuf(packet);
+}
+
+int benchmark_radio_latency(NRF52Radio &radio, int probes)
+{
+    uint32_t total = 0;
+    uint32_t longest = 0;
+    int lost = 0;
+
+    radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_BENCHMARK, radio_probe_received, &radio);
+
+    for (int i = 1; i <= probes; i++)
+    {
+        FrameBuffer *buf = radio.getTxBuf();
+
+        if (buf == NULL)
+        {
+            radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_BENCHMARK, NULL, NULL);
+            return DEVICE_NO_RESOURCES;
+        }
+
+        uint32_t sequence = i;
+
+        buf->length = sizeof(sequence) + NRF52_RADIO_HEADER_SIZE - 1;
+        buf->version = 1;
+        buf->group = 0;
+        buf->protocol = NRF52_RADIO_PROTOCOL_BENCHMARK;
+        memcpy(buf->payload, &sequence, sizeof(sequence));
+
+        CODAL_TIMESTAMP sent = system_timer_current_time();
+        uint32_t start = cycles();
+
+        if (radio.queueTxBuf(buf) != DEVICE_OK)
+        {
+            lost++;
+            continue;
+        }
+
+        // Replies are delivered from the idle fiber, so sleep rather than spin. The reply is timestamped on arrival.
+        while (probe_reply != sequence && system_timer_current_time() - sent < BENCHMARK_TIMEOUT)
+            fiber_sleep(1);
+
+        if (probe_reply != sequence)
+        {
+            lost++;
+            continue;
+        }
+
+        uint32_t rtt = probe_reply_time - start;
+        total += rtt;
+
+        if (rtt > longest)
+            longest = rtt;
+    }
+
+    radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_BENCHMARK, NULL, NULL);
+
+    benchmark_report("radio_rtt_us", probes, probes > lost ? to_us(total / (probes - lost)) : 0, "us");
+    benchmark_report("radio_rtt_max_us", probes, to_us(longest), "us");
+    benchmark_report("radio_rtt_lost", probes, lost, "pkt");
+
+    return DEVICE_OK;
+}
+
+void benchmark_radio_echo(NRF52Radio &radio, bool enable)
+{
+    if (enable)
+        radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_BENCHMARK, radio_probe_echo, &radio);
+    else
+        radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_BENCHMARK, NULL, NULL);
+}
+
+int benchmark_adc(NRF52ADC &adc, int iterations)
+{
+    ManagedBuffer buffer = adc.getActiveDMABuffer();
+    int channels = adc.getActiveChannelCount();
+    int samples = buffer.length() / 2;
+
+    if (channels == 0 || samples == 0)
+        return DEVICE_INVALID_STATE;
+
+    // Keep the ADC's own interrupt from demultiplexing into the same channel buffers while we measure.
+    NVIC_DisableIRQ(SAADC_IRQn);
+
+    uint32_t start = cycles();
+
+    for (int i = 0; i < iterations; i++)
+        adc.demux(buffer);
+
+    uint32_t elapsed = cycles() - start;
+
+    NVIC_EnableIRQ(SAADC_IRQn);
+
+    benchmark_report("adc_demux_cycles_per_sample", channels, elapsed / ((uint32_t) iterations * samples), "cycles");
+
+    return DEVICE_OK;
+}
+
+/**
+ * A DataSink that times each buffer pulled from its upstream component.
+ */
+class BenchmarkSink : public DataSink
+{
+    public:
+    DataSource  &source;
+    bool        pending;
+    uint32_t    elapsed;
+
+    BenchmarkSink(DataSource &s) : source(s), pending(false), elapsed(0)
+    {
+        source.connect(*this);
+    }
+
+    // Only note that data is ready: pulling here would recurse, as WS2812B requests the next pull from pull().
+    virtual int pullRequest()
+    {
+        pending = true;
+        return DEVICE_OK;
+    }
+
+    void drain()
+    {
+        while (pending)
+        {
+            pending = false;
+
+            uint32_t start = cycles();
+            source.pull();
+            elapsed += cycles() - start;
+        }
+    }
+};
+
+int benchmark_ws2812b(int size)
+{
+    ManagedBuffer pixels(size);
+
+    if (size <= 0 || pixels.length() != size)
+        return DEVICE_NO_RESOURCES;
+
+    for (int i = 0; i < size; i++)
+        pixels[i] = i;
+
+    WS2812B encoder;
+    BenchmarkSink sink(encoder);
+
+    for (int i = 0; i < BENCHMARK_ITERATIONS / 10; i++)
+    {
+        encoder.playAsync(&pixels[0], size);
+        sink.drain();
+    }
+
+    benchmark_report("ws2812b_encode_cycles_per_byte", size, sink.elapsed / ((uint32_t) (BENCHMARK_ITERATIONS / 10) * size), "cycles");
+
+    return DEVICE_OK;
+}
+
+static volatile bool switch_peer_running;
+
+static void switch_peer(void *)
+{
+    while (switch_peer_running)
+        schedule();
+}
+
+int benchmark_fiber_switch(int iterations)
+{
+    if (!fiber_scheduler_running())
+        return DEVICE_INVALID_STATE;
+
+    switch_peer_running = true;
+    create_fiber(switch_peer, NULL);
+
+    // Let the peer start, so the loop below only ever switches between the two of us.
+    schedule();
+
+    uint32_t start = cycles();
+
+    for (int i = 0; i < iterations; i++)
+        schedule();
+
+    uint32_t elapsed = cycles() - start;
+
+    switch_peer_running = false;
+    schedule();
+
+    // Each iteration is two switches: to the peer, and back.
+    benchmark_report("fiber_switch_cycles", iterations, elapsed / (2 * (uint32_t) iterations), "cycles");
+
+    return DEVICE_OK;
+}
+
+#endif
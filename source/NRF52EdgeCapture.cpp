@@ -0,0 +1,453 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "NRF52EdgeCapture.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+static NRF52EdgeCapture *edge_capture_instances = NULL;
+
+static void edge_capture_irq(void *capture)
+{
+    ((NRF52EdgeCapture *)capture)->onEdge();
+}
+
+// The timer handler is not told which timer fired, so every instance checks its own idle timeout.
+static void edge_capture_timer_irq(uint16_t mask)
+{
+    for (NRF52EdgeCapture *c = edge_capture_instances; c; c = c->nextCapture)
+        c->onTimer();
+}
+
+/**
+  * Constructor.
+  *
+  * @param pin The pin to sense.
+  *
+  * @param timer A timer dedicated to edge capture. This is configured as a free running, 16MHz, 32 bit timer.
+  *
+  * @param channel The first of the two consecutive capture registers to use: 0 or 1. Only channel 0 leaves
+  *                a register free for the idle timeout.
+  */
+NRF52EdgeCapture::NRF52EdgeCapture(Pin &pin, NRFLowLevelTimer &timer, uint8_t channel) : pin(pin), timer(timer)
+{
+    this->downstream = NULL;
+    this->head = 0;
+    this->tail = 0;
+    this->batchSize = NRF52_EDGE_CAPTURE_BATCH_SIZE;
+    this->overruns = 0;
+    this->gpiote = -1;
+    this->cc = channel;
+    this->next = 0;
+    this->discard = false;
+    this->initialLevel = false;
+    this->requested = false;
+    this->idle = true;
+    this->idleTimeout = 0;
+    this->lastEdge = 0;
+
+    target_disable_irq();
+    this->nextCapture = edge_capture_instances;
+    edge_capture_instances = this;
+    target_enable_irq();
+
+    for (int i = 0; i < 4; i++)
+        ppi[i] = -1;
+
+    group[0] = group[1] = -1;
+
+    // The timer only runs while we are capturing, and never interrupts.
+    timer.disable();
+    timer.setMode(TimerMode::TimerModeTimer);
+    timer.setClockSpeed(16000);
+    timer.setBitMode(BitMode32);
+    timer.setIRQ(edge_capture_timer_irq);
+}
+
+/**
+  * Destructor.
+  */
+NRF52EdgeCapture::~NRF52EdgeCapture()
+{
+    stop();
+
+    target_disable_irq();
+
+    for (NRF52EdgeCapture **c = &edge_capture_instances; *c; c = &(*c)->nextCapture)
+    {
+        if (*c == this)
+        {
+            *c = nextCapture;
+            break;
+        }
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Releases the GPIOTE and PPI resources in use, if any.
+  */
+void NRF52EdgeCapture::release()
+{
+    if (gpiote >= 0)
+        free_gpiote_channel(gpiote);
+
+    for (int i = 0; i < 4; i++)
+        if (ppi[i] >= 0)
+            ppi_disconnect(ppi[i]);
+
+    for (int i = 0; i < 2; i++)
+        if (group[i] >= 0)
+            free_ppi_group(group[i]);
+
+    gpiote = -1;
+    ppi[0] = ppi[1] = ppi[2] = ppi[3] = -1;
+    group[0] = group[1] = -1;
+}
+
+/**
+  * Starts timestamping edges, discarding any not yet collected. The pin is configured as a digital input.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the channel given to the constructor is out of range,
+  *         or DEVICE_NO_RESOURCES if no GPIOTE channel, or too few PPI channels or groups, are free.
+  */
+int NRF52EdgeCapture::start()
+{
+    // Neither capture register may be the one captureCounter() overwrites.
+    if (cc + 1 >= NRF52_EDGE_CAPTURE_COUNTER_CC)
+        return DEVICE_INVALID_PARAMETER;
+
+    stop();
+
+    gpiote = allocate_gpiote_channel();
+    group[0] = allocate_ppi_group();
+    group[1] = allocate_ppi_group();
+
+    for (int i = 0; i < 4; i++)
+        ppi[i] = allocate_ppi_channel();
+
+    if (gpiote < 0 || group[0] < 0 || group[1] < 0 || ppi[0] < 0 || ppi[1] < 0 || ppi[2] < 0 || ppi[3] < 0)
+    {
+        release();
+        return DEVICE_NO_RESOURCES;
+    }
+
+    HardwareEvent edge = &NRF_GPIOTE->EVENTS_IN[gpiote];
+
+    // Each edge captures into the register whose group is enabled, then swaps the groups over, so the next
+    // edge captures into the other register.
+    ppi_route(ppi[0], edge, &timer.timer->TASKS_CAPTURE[cc], ppi_group_enable_task(group[1]));
+    ppi_route(ppi[1], edge, ppi_group_disable_task(group[0]));
+    ppi_route(ppi[2], edge, &timer.timer->TASKS_CAPTURE[cc + 1], ppi_group_enable_task(group[0]));
+    ppi_route(ppi[3], edge, ppi_group_disable_task(group[1]));
+
+    ppi_group_add(group[0], ppi[0]);
+    ppi_group_add(group[0], ppi[1]);
+    ppi_group_add(group[1], ppi[2]);
+    ppi_group_add(group[1], ppi[3]);
+
+    timer.timer->CC[cc] = NRF52_EDGE_CAPTURE_EMPTY;
+    timer.timer->CC[cc + 1] = NRF52_EDGE_CAPTURE_EMPTY;
+
+    head = 0;
+    tail = 0;
+    next = 0;
+    discard = false;
+    requested = false;
+    idle = true;
+
+    // Record the level before the first edge, so the polarity of every edge is known.
+    initialLevel = pin.getDigitalValue();
+
+    *ppi_group_enable_task(group[0]) = 1;
+    set_gpiote_irq(gpiote, edge_capture_irq, this);
+
+    NRF_GPIOTE->CONFIG[gpiote] = (GPIOTE_CONFIG_MODE_Event << GPIOTE_CONFIG_MODE_Pos) |
+                                 ((pin.name & 31) << GPIOTE_CONFIG_PSEL_Pos) |
+#ifdef GPIOTE_CONFIG_PORT_Pos
+                                 ((pin.name >> 5) << GPIOTE_CONFIG_PORT_Pos) |
+#endif
+                                 (GPIOTE_CONFIG_POLARITY_Toggle << GPIOTE_CONFIG_POLARITY_Pos);
+
+    timer.reset();
+    timer.enable();
+
+    if (idleTimeout)
+        timer.enableIRQ();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops timestamping edges. Timestamps already captured may still be pulled.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52EdgeCapture::stop()
+{
+    if (gpiote >= 0)
+    {
+        // Collect anything captured since the last interrupt. The timer handler may run this too.
+        set_gpiote_irq(gpiote, NULL, NULL);
+
+        target_disable_irq();
+        onEdge();
+        target_enable_irq();
+    }
+
+    release();
+    timer.disable();
+
+    if (cc + 2 < NRF52_EDGE_CAPTURE_COUNTER_CC)
+        timer.clearCompare(cc + 2);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Defines the number of timestamps collected before our downstream component is asked to pull them.
+  *
+  * @param size The batch size, in the range 1..NRF52_EDGE_CAPTURE_RING_SIZE.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is out of range.
+  */
+int NRF52EdgeCapture::setBatchSize(int size)
+{
+    if (size < 1 || size > NRF52_EDGE_CAPTURE_RING_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    batchSize = size;
+    return DEVICE_OK;
+}
+
+/**
+  * Defines the time without an edge after which the pin is considered idle. When it becomes idle, our downstream
+  * component is asked to pull whatever has been captured, even if less than a batch, so the end of a burst of
+  * edges (such as an IR frame) is delivered promptly. This uses the compare register after the two capture registers.
+  *
+  * @param timeout The idle timeout, in microseconds, or 0 to disable it.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if there is no compare register free
+  *         (the channel given to the constructor was not 0).
+  */
+int NRF52EdgeCapture::setIdleTimeout(uint32_t timeout)
+{
+    // onTimer() reads the time with captureCounter(), which would overwrite a compare held in its register.
+    if (cc + 2 >= NRF52_EDGE_CAPTURE_COUNTER_CC)
+        return DEVICE_INVALID_PARAMETER;
+
+    timer.disableIRQ();
+    timer.clearCompare(cc + 2);
+
+    // The timer counts at 16MHz.
+    idleTimeout = timeout * 16;
+
+    if (idleTimeout)
+    {
+        if (!idle)
+            timer.setCompare(cc + 2, lastEdge + idleTimeout);
+
+        timer.enableIRQ();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if no edge has arrived within the idle timeout.
+  */
+bool NRF52EdgeCapture::isIdle()
+{
+    return idle;
+}
+
+/**
+  * Determines the level of the pin when capture started, from which the polarity of each edge follows.
+  */
+bool NRF52EdgeCapture::getInitialLevel()
+{
+    return initialLevel;
+}
+
+/**
+  * Determines the number of edges lost because the ring was full, or because they arrived faster than they could be collected.
+  */
+uint32_t NRF52EdgeCapture::getOverrunCount()
+{
+    return overruns;
+}
+
+/**
+  * Moves the captured timestamps into the ring.
+  *
+  * @return The number of timestamps collected.
+  */
+int NRF52EdgeCapture::collect()
+{
+    int collected = 0;
+
+    // Collect the registers in the order the hardware fills them, until we reach one not yet written.
+    while (true)
+    {
+        volatile uint32_t *r = &timer.timer->CC[cc + next];
+        uint32_t t = *r;
+
+        if (t == NRF52_EDGE_CAPTURE_EMPTY)
+            break;
+
+        *r = NRF52_EDGE_CAPTURE_EMPTY;
+
+        // A timestamp older than the last means more edges arrived than the two registers could hold, and one was
+        // overwritten, so an odd number of edges has been lost. This stale edge preceded the one just collected, so
+        // drop it to keep the total lost even. The hardware's next edge goes to this register, so expect it here.
+        if (collected && (int32_t) (t - lastEdge) < 0)
+        {
+            overruns += 2;
+            continue;
+        }
+
+        next ^= 1;
+        lastEdge = t;
+        collected++;
+
+        // Edges are only ever dropped in pairs, so the polarity of those delivered still alternates.
+        if (discard)
+        {
+            discard = false;
+            overruns++;
+            continue;
+        }
+
+        if ((uint16_t) (head - tail) >= NRF52_EDGE_CAPTURE_RING_SIZE)
+        {
+            discard = true;
+            overruns++;
+            continue;
+        }
+
+        ring[head & (NRF52_EDGE_CAPTURE_RING_SIZE - 1)] = t;
+        head++;
+    }
+
+    return collected;
+}
+
+/**
+  * Interrupt handler, called on each edge to collect the captured timestamps.
+  */
+void NRF52EdgeCapture::onEdge()
+{
+    // Restart the idle timeout from the latest edge.
+    if (collect() && idleTimeout)
+    {
+        idle = false;
+        timer.setCompare(cc + 2, lastEdge + idleTimeout);
+    }
+
+    // Only involve our downstream component once there is a batch worth processing.
+    if (downstream && !requested && (uint16_t) (head - tail) >= batchSize)
+    {
+        requested = true;
+        downstream->pullRequest();
+    }
+}
+
+/**
+  * Timer interrupt handler, called when the idle timeout may have expired.
+  */
+void NRF52EdgeCapture::onTimer()
+{
+    if (gpiote < 0 || idle || idleTimeout == 0)
+        return;
+
+    // The timer interrupt runs at a lower priority than GPIOTE, which would otherwise preempt us part way
+    // through collecting the capture registers or updating the ring.
+    target_disable_irq();
+
+    // Pick up any edge whose interrupt is still pending, as it would restart the timeout.
+    onEdge();
+
+    if (!idle && timer.captureCounter() - lastEdge >= idleTimeout)
+    {
+        idle = true;
+        timer.clearCompare(cc + 2);
+
+        // Deliver the end of the burst, even if it is less than a batch (or nothing at all, so the idle state is seen).
+        if (downstream)
+        {
+            requested = true;
+            downstream->pullRequest();
+        }
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Provide the timestamps captured since the last pull to our downstream caller.
+  *
+  * @return A buffer of 32 bit timestamps, or an empty ManagedBuffer if none are available.
+  */
+ManagedBuffer NRF52EdgeCapture::pull()
+{
+    uint16_t count = head - tail;
+
+    if (count == 0)
+    {
+        requested = false;
+        return ManagedBuffer();
+    }
+
+    ManagedBuffer b(count * sizeof(uint32_t));
+    uint32_t *out = (uint32_t *) &b[0];
+
+    for (int i = 0; i < count; i++)
+        out[i] = ring[(tail + i) & (NRF52_EDGE_CAPTURE_RING_SIZE - 1)];
+
+    tail += count;
+    requested = false;
+
+    return b;
+}
+
+/**
+  * Update our reference to a downstream component.
+  */
+void NRF52EdgeCapture::connect(DataSink &sink)
+{
+    downstream = &sink;
+}
+
+/**
+  *  Determine the data format of the buffers streamed out of this component.
+  */
+int NRF52EdgeCapture::getFormat()
+{
+    return DATASTREAM_FORMAT_32BIT_UNSIGNED;
+}
@@ -0,0 +1,362 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "CodalCompat.h"
+#include "NRF52Filter.h"
+#include "buffer_pool.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+#include "cmsis.h"
+
+namespace codal
+{
+
+/**
+ * Saturates a Q15 accumulator to 16 bits.
+ */
+static inline int16_t nrf52_filter_clip(int64_t v)
+{
+    if (v > 32767)
+        return 32767;
+
+    if (v < -32768)
+        return -32768;
+
+    return (int16_t) v;
+}
+
+/**
+ * Constructor.
+ *
+ * Connects to the given upstream component. Until a filter is configured, buffers are passed through unchanged.
+ *
+ * @param upstream The component providing 16 bit signed samples.
+ */
+NRF52Filter::NRF52Filter(DataSource &upstream) : upstream(upstream)
+{
+    downstream = NULL;
+
+    firCoefficients = NULL;
+    firState = NULL;
+    firTaps = 0;
+    decimation = 1;
+    phase = 0;
+
+    biquadCoefficients = NULL;
+    biquadState = NULL;
+    biquadStages = 0;
+    postShift = 0;
+
+    upstream.setFormat(DATASTREAM_FORMAT_16BIT_SIGNED);
+    upstream.connect(*this);
+}
+
+/**
+ * Destructor.
+ */
+NRF52Filter::~NRF52Filter()
+{
+    free(firState);
+    free(biquadState);
+}
+
+/**
+ * Configures the FIR decimator. The state of the filter is reset.
+ *
+ * @param coefficients The Q15 filter taps, in time reversed order (as for arm_fir_decimate_q15()), or NULL to remove the FIR.
+ *                     These are not copied, and must remain valid while the filter is in use.
+ * @param taps The number of taps.
+ * @param factor The decimation factor, in the range 1..NRF52_FILTER_MAX_DECIMATION. 1 applies the FIR without decimating.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES if the state could not be allocated.
+ */
+int NRF52Filter::setDecimator(const int16_t *coefficients, int taps, int factor)
+{
+    if (coefficients && (taps <= 0 || taps > 0xFFFF || factor < 1 || factor > NRF52_FILTER_MAX_DECIMATION))
+        return DEVICE_INVALID_PARAMETER;
+
+    free(firState);
+    firState = NULL;
+    firCoefficients = NULL;
+    firTaps = 0;
+    decimation = 1;
+
+    if (coefficients == NULL)
+        return DEVICE_OK;
+
+    firState = (int16_t *) malloc((taps - 1 + NRF52_FILTER_BLOCK_SIZE) * sizeof(int16_t));
+
+    if (firState == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    firCoefficients = coefficients;
+    firTaps = taps;
+    decimation = factor;
+
+    reset();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures the biquad cascade. The state of the filter is reset.
+ *
+ * @param coefficients NRF52_FILTER_BIQUAD_COEFFS Q15 coefficients per stage, {b0, 0, b1, b2, a1, a2}, with the feedback
+ *                     coefficients already negated (as for arm_biquad_cascade_df1_q15()), or NULL to remove the cascade.
+ *                     These are not copied, and must remain valid while the filter is in use.
+ * @param stages The number of stages.
+ * @param postShift The left shift applied to the output of each stage, in the range 0..15.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES if the state could not be allocated.
+ */
+int NRF52Filter::setBiquad(const int16_t *coefficients, int stages, int postShift)
+{
+    if (coefficients && (stages <= 0 || stages > 0xFF || postShift < 0 || postShift > 15))
+        return DEVICE_INVALID_PARAMETER;
+
+    free(biquadState);
+    biquadState = NULL;
+    biquadCoefficients = NULL;
+    biquadStages = 0;
+
+    if (coefficients == NULL)
+        return DEVICE_OK;
+
+    biquadState = (int16_t *) malloc(stages * 4 * sizeof(int16_t));
+
+    if (biquadState == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    biquadCoefficients = coefficients;
+    biquadStages = stages;
+    this->postShift = postShift;
+
+    reset();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Clears the history of the filter, as though silence had preceded the next buffer.
+ */
+void NRF52Filter::reset()
+{
+    phase = 0;
+
+    if (firState)
+        memset(firState, 0, (firTaps - 1) * sizeof(int16_t));
+
+    if (biquadState)
+        memset(biquadState, 0, biquadStages * 4 * sizeof(int16_t));
+}
+
+/**
+ * Applies the FIR decimator to the given samples.
+ *
+ * @return The number of output samples written. dst may equal src.
+ */
+int NRF52Filter::decimate(const int16_t *src, int16_t *dst, int count)
+{
+    int history = firTaps - 1;
+    int out = 0;
+
+    while (count > 0)
+    {
+        int n = min(count, NRF52_FILTER_BLOCK_SIZE);
+
+        // Append this block to the history. Outputs never overtake the input, so dst can safely alias src.
+        memcpy(firState + history, src, n * sizeof(int16_t));
+
+        for (int i = 0; i < n; i++)
+        {
+            if (++phase < decimation)
+                continue;
+
+            phase = 0;
+
+            const int16_t *x = firState + i;
+            const int16_t *h = firCoefficients;
+            int64_t acc = 0;
+            int k = 0;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+            for (; k + 1 < firTaps; k += 2)
+                acc = (int64_t) __SMLALD(__UNALIGNED_UINT32_READ(h + k), __UNALIGNED_UINT32_READ(x + k), (uint64_t) acc);
+#endif
+            for (; k < firTaps; k++)
+                acc += (int32_t) h[k] * x[k];
+
+            dst[out++] = nrf52_filter_clip(acc >> 15);
+        }
+
+        memmove(firState, firState + n, history * sizeof(int16_t));
+
+        src += n;
+        count -= n;
+    }
+
+    return out;
+}
+
+/**
+ * Applies the biquad cascade to the given samples, in place.
+ */
+void NRF52Filter::biquad(int16_t *data, int count)
+{
+    int shift = 15 - postShift;
+
+    for (int s = 0; s < biquadStages; s++)
+    {
+        const int16_t *c = biquadCoefficients + s * NRF52_FILTER_BIQUAD_COEFFS;
+        int16_t *state = biquadState + s * 4;
+        int32_t b0 = c[0];
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+        // Hold {x[n-1], x[n-2]} and {y[n-1], y[n-2]} as packed pairs, so each pair of taps is a single SMLALD.
+        uint32_t b = __UNALIGNED_UINT32_READ(c + 2);
+        uint32_t a = __UNALIGNED_UINT32_READ(c + 4);
+        uint32_t xs = __UNALIGNED_UINT32_READ(state);
+        uint32_t ys = __UNALIGNED_UINT32_READ(state + 2);
+
+        for (int i = 0; i < count; i++)
+        {
+            int32_t x = data[i];
+            int64_t acc = (int64_t) b0 * x;
+
+            acc = (int64_t) __SMLALD(b, xs, (uint64_t) acc);
+            acc = (int64_t) __SMLALD(a, ys, (uint64_t) acc);
+
+            int16_t y = nrf52_filter_clip(acc >> shift);
+
+            xs = (xs << 16) | (uint16_t) x;
+            ys = (ys << 16) | (uint16_t) y;
+            data[i] = y;
+        }
+
+        state[0] = (int16_t) xs;
+        state[1] = (int16_t) (xs >> 16);
+        state[2] = (int16_t) ys;
+        state[3] = (int16_t) (ys >> 16);
+#else
+        int32_t b1 = c[2], b2 = c[3], a1 = c[4], a2 = c[5];
+        int32_t x1 = state[0], x2 = state[1], y1 = state[2], y2 = state[3];
+
+        for (int i = 0; i < count; i++)
+        {
+            int32_t x = data[i];
+            int64_t acc = (int64_t) b0 * x + (int64_t) b1 * x1 + (int64_t) b2 * x2 + (int64_t) a1 * y1 + (int64_t) a2 * y2;
+            int16_t y = nrf52_filter_clip(acc >> shift);
+
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            data[i] = y;
+        }
+
+        state[0] = x1;
+        state[1] = x2;
+        state[2] = y1;
+        state[3] = y2;
+#endif
+    }
+}
+
+/**
+ * Callback provided when data is ready upstream. Passed on to our downstream component.
+ */
+int NRF52Filter::pullRequest()
+{
+    if (downstream)
+        return downstream->pullRequest();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Provide the next filtered buffer to our downstream caller, if available.
+ */
+ManagedBuffer NRF52Filter::pull()
+{
+    ManagedBuffer in = upstream.pull();
+    int count = in.length() / sizeof(int16_t);
+
+    if (count == 0 || (firCoefficients == NULL && biquadCoefficients == NULL))
+        return in;
+
+    // Work in place if nobody else can see the buffer. Otherwise (e.g. if upstream keeps a reference), filter into a new one.
+    bool inPlace = buffer_pool_unique(in);
+    ManagedBuffer out = in;
+
+    if (!inPlace)
+    {
+        int outCount = firCoefficients ? (count + phase) / decimation : count;
+        out = ManagedBuffer(outCount * sizeof(int16_t));
+    }
+
+    int16_t *dst = (int16_t *) out.getBytes();
+
+    if (firCoefficients)
+        count = decimate((int16_t *) in.getBytes(), dst, count);
+    else if (out.getBytes() != in.getBytes())
+        memcpy(dst, in.getBytes(), count * sizeof(int16_t));
+
+    if (biquadCoefficients)
+        biquad(dst, count);
+
+    // A decimated buffer filtered in place is shortened. Nobody else holds it, so it can simply be truncated.
+    if (inPlace && count * (int) sizeof(int16_t) != out.length())
+        out.truncate(count * sizeof(int16_t));
+
+    return out;
+}
+
+/**
+ * Update our reference to a downstream component.
+ */
+void NRF52Filter::connect(DataSink &sink)
+{
+    downstream = &sink;
+}
+
+/**
+ * Determine the data format of the buffers streamed out of this component.
+ */
+int NRF52Filter::getFormat()
+{
+    return DATASTREAM_FORMAT_16BIT_SIGNED;
+}
+
+/**
+ * Defines the data format of the buffers streamed out of this component.
+ * @param format only DATASTREAM_FORMAT_16BIT_SIGNED is supported.
+ */
+int NRF52Filter::setFormat(int format)
+{
+    return format == DATASTREAM_FORMAT_16BIT_SIGNED ? DEVICE_OK : DEVICE_NOT_SUPPORTED;
+}
+
+}
@@ -2,6 +2,10 @@
 #include "codal_target_hal.h"
 #include "CodalDmesg.h"
 #include "peripheral_alloc.h"
+#include "ppi_alloc.h"
+#include "NotifyEvents.h"
+#include "CodalFiber.h"
+#include "Event.h"
 
 using namespace codal;
 
@@ -13,6 +17,24 @@ using namespace codal;
 NRF52I2C::NRF52I2C(NRF52Pin &sda, NRF52Pin &scl, NRF_TWIM_Type *device) : codal::I2C(sda, scl), sda(sda), scl(scl)
 {
     minimumBusIdlePeriod = 0;
+    owner = NULL;
+    inFlight = false;
+    failed = false;
+    status = DEVICE_OK;
+    waitEvent = NRF_TWIM_EVENT_STOPPED;
+    suspendOnLastRx = false;
+    doneHandler = NULL;
+    doneHandlerArg = NULL;
+    doneEvent = allocateNotifyEvent();
+    batch = NULL;
+    batchCount = 0;
+    batchIndex = 0;
+    batchTimer = NULL;
+    batchPpi = -1;
+    batchGroup = -1;
+    batchHandler = NULL;
+    batchHandlerArg = NULL;
+    txCopy = NULL;
 
 #ifdef NRF52I2C_BUS_IDLE_PERIOD
     minimumBusIdlePeriod = NRF52I2C_BUS_IDLE_PERIOD;
@@ -43,6 +65,13 @@ NRF52I2C::NRF52I2C(NRF52Pin &sda, NRF52Pin &scl, NRF_TWIM_Type *device) : codal:
     nrf_twim_frequency_set(p_twim, NRF_TWIM_FREQ_100K);
     nrf_twim_enable(p_twim);
 
+    IRQn = get_alloc_peri_irqn(p_twim);
+    set_alloc_peri_irq(p_twim, &_irqHandler, this);
+    nrf_twim_int_disable(p_twim, 0xFFFFFFFF);
+    NVIC_SetPriority(IRQn, 7);
+    NVIC_ClearPendingIRQ(IRQn);
+    NVIC_EnableIRQ(IRQn);
+
     target_wait_us(10);
 }
 
@@ -106,6 +135,201 @@ int NRF52I2C::setFrequency(uint32_t frequency)
     return DEVICE_OK;
 }
 
+/**
+ * Interrupt handler. Drives an operation started by waitForCompletion(), an asynchronous call or a batch through to completion.
+ */
+void NRF52I2C::_irqHandler(void *p)
+{
+    NRF52I2C *self = (NRF52I2C *)p;
+    NRF_TWIM_Type *twim = self->p_twim;
+
+    if (nrf_twim_event_check(twim, NRF_TWIM_EVENT_ERROR))
+    {
+        auto err = twim->ERRORSRC;
+        twim->ERRORSRC = err;
+
+        nrf_twim_event_clear(twim, NRF_TWIM_EVENT_ERROR);
+        nrf_twim_task_trigger(twim, NRF_TWIM_TASK_RESUME);
+        nrf_twim_task_trigger(twim, NRF_TWIM_TASK_STOP);
+
+        // Complete once the STOP task has brought the hardware back to idle.
+        self->failed = true;
+        self->waitEvent = NRF_TWIM_EVENT_STOPPED;
+        self->suspendOnLastRx = false;
+        nrf_twim_int_enable(twim, NRF_TWIM_INT_STOPPED_MASK);
+    }
+
+    // Some SHORTS appear not to trigger their tasks under heavy interrupt load (see waitForStop()).
+    // Triggering the same task again from here is harmless, and avoids the need for a timeout.
+    if ((twim->INTEN & NRF_TWIM_INT_LASTTX_MASK) && nrf_twim_event_check(twim, NRF_TWIM_EVENT_LASTTX))
+    {
+        nrf_twim_event_clear(twim, NRF_TWIM_EVENT_LASTTX);
+
+        if (twim->SHORTS & NRF_TWIM_SHORT_LASTTX_SUSPEND_MASK)
+            nrf_twim_task_trigger(twim, NRF_TWIM_TASK_SUSPEND);
+
+        if (twim->SHORTS & NRF_TWIM_SHORT_LASTTX_STOP_MASK)
+            nrf_twim_task_trigger(twim, NRF_TWIM_TASK_STOP);
+    }
+
+    if (self->suspendOnLastRx && nrf_twim_event_check(twim, NRF_TWIM_EVENT_LASTRX))
+    {
+        nrf_twim_event_clear(twim, NRF_TWIM_EVENT_LASTRX);
+        nrf_twim_task_trigger(twim, NRF_TWIM_TASK_SUSPEND);
+        self->suspendOnLastRx = false;
+    }
+
+    if (self->inFlight && nrf_twim_event_check(twim, (nrf_twim_event_t)self->waitEvent))
+    {
+        nrf_twim_int_disable(twim, 0xFFFFFFFF);
+
+        self->status = self->failed ? DEVICE_I2C_ERROR : DEVICE_OK;
+        self->inFlight = false;
+        self->releaseTx();
+
+        if (self->batch)
+        {
+            self->batchStep();
+            return;
+        }
+
+        // The bus is free for others once a STOP condition has been sent.
+        if (self->waitEvent == NRF_TWIM_EVENT_STOPPED)
+            self->owner = NULL;
+
+        if (self->doneHandler)
+        {
+            PVoidCallback done = self->doneHandler;
+            self->doneHandler = NULL;
+            done(self->doneHandlerArg);
+        }
+
+        Event(DEVICE_ID_NOTIFY, self->doneEvent);
+    }
+}
+
+/**
+ * Waits until no other fiber (or interrupt handler) is part way through a transaction on this bus,
+ * including the gap between the operations of a repeated START sequence, and then claims the bus.
+ *
+ * @param token Identifies the claimant: the current fiber for blocking operations, or this object for asynchronous ones.
+ *
+ * @return DEVICE_OK on success, or DEVICE_BUSY if the bus is in use and we can't wait (e.g. in IRQ context).
+ */
+int NRF52I2C::acquire(void *token)
+{
+    while (true)
+    {
+        NVIC_DisableIRQ(IRQn);
+
+        if ((owner == NULL || owner == token) && !inFlight)
+            break;
+
+        if (__get_IPSR() || !fiber_scheduler_running())
+        {
+            NVIC_EnableIRQ(IRQn);
+            return DEVICE_BUSY;
+        }
+
+        fiber_wake_on_event(DEVICE_ID_NOTIFY, doneEvent);
+        NVIC_EnableIRQ(IRQn);
+        schedule();
+    }
+
+    owner = token;
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Enables the interrupts that drive the operation just started on the bus through to completion.
+ *
+ * @param evt The TWIM event that completes the operation.
+ * @param lastRxSuspend true to suspend the bus once the last byte is received (ending a repeated read).
+ *
+ * @note Must be called with the TWIM interrupt masked.
+ */
+void NRF52I2C::armIrq(int evt, bool lastRxSuspend)
+{
+    uint32_t mask = NRF_TWIM_INT_ERROR_MASK | NRF_TWIM_INT_LASTTX_MASK;
+
+    if (evt == NRF_TWIM_EVENT_SUSPENDED)
+        mask |= NRF_TWIM_INT_SUSPENDED_MASK;
+    else
+        mask |= NRF_TWIM_INT_STOPPED_MASK;
+
+    if (lastRxSuspend)
+        mask |= NRF_TWIM_INT_LASTRX_MASK;
+
+    inFlight = true;
+    failed = false;
+    waitEvent = evt;
+    suspendOnLastRx = lastRxSuspend;
+
+    nrf_twim_int_enable(p_twim, mask);
+}
+
+/**
+ * Waits for the operation just started on the bus to complete.
+ *
+ * Where possible, the calling fiber sleeps until the TWIM interrupt reports completion, so other fibers
+ * can run for the duration of the transaction. Otherwise (before the scheduler is running, in IRQ context,
+ * or for a zero length bus probe, which never signals completion) the hardware is polled.
+ *
+ * @param evt The TWIM event that completes the operation (STOPPED or SUSPENDED).
+ * @param lastRxSuspend true to suspend the bus once the last byte is received (ending a repeated read).
+ * @param poll true to always poll.
+ *
+ * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the operation failed.
+ */
+int NRF52I2C::waitForCompletion(int evt, bool lastRxSuspend, bool poll)
+{
+    int res;
+
+    if (poll || __get_IPSR() || !fiber_scheduler_running())
+    {
+        if (lastRxSuspend)
+        {
+            res = waitForStop(NRF_TWIM_EVENT_LASTRX);
+
+            if (res == DEVICE_OK)
+            {
+                nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_SUSPEND);
+                res = waitForStop(NRF_TWIM_EVENT_SUSPENDED);
+            }
+        }
+        else
+        {
+            res = waitForStop(evt);
+        }
+
+        if (res != DEVICE_OK || evt == NRF_TWIM_EVENT_STOPPED)
+            owner = NULL;
+
+        return res;
+    }
+
+    NVIC_DisableIRQ(IRQn);
+    armIrq(evt, lastRxSuspend);
+
+    // The interrupt may fire as soon as it is unmasked, so register for the wakeup first.
+    while (inFlight)
+    {
+        fiber_wake_on_event(DEVICE_ID_NOTIFY, doneEvent);
+        NVIC_EnableIRQ(IRQn);
+        schedule();
+        NVIC_DisableIRQ(IRQn);
+    }
+
+    NVIC_EnableIRQ(IRQn);
+
+    if (minimumBusIdlePeriod)
+        target_wait_us(minimumBusIdlePeriod);
+
+    return status;
+}
+
 int NRF52I2C::waitForStop(int evt)
 {
     int res = DEVICE_OK;
@@ -163,23 +387,41 @@ int NRF52I2C::waitForStop(int evt)
 }
 
 /**
- * Issues a standard, I2C command write to the I2C bus.
- * This consists of:
- *  - Asserting a Start condition on the bus
- *  - Selecting the Slave address (as an 8 bit address)
- *  - Writing a number of raw data bytes provided
- *  - Asserting a Stop condition on the bus
- *
- * The CPU will busy wait until the transmission is complete.
- *
- * @param address The 8bit I2C address of the device to write to
- * @param data pointer to the bytes to write
- * @param len the number of bytes to write
- * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
+ * Provides a copy of the given bytes in RAM if EasyDMA can't reach them (e.g. constant data in flash).
+ * The copy is held until releaseTx() is called.
  *
- * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed.
+ * @return The bytes to hand to EasyDMA, or NULL if no memory is available for the copy.
  */
-int NRF52I2C::write(uint16_t address, uint8_t *data, int len, bool repeated)
+uint8_t *NRF52I2C::stageTx(uint8_t *data, int len)
+{
+    if (is_dma_capable(data, len))
+        return data;
+
+    txCopy = allocate_dma_buffer(len);
+
+    if (txCopy)
+        memcpy(txCopy, data, len);
+
+    return txCopy;
+}
+
+/**
+ * Releases any copy made by stageTx().
+ */
+void NRF52I2C::releaseTx()
+{
+    target_disable_irq();
+    uint8_t *b = txCopy;
+    txCopy = NULL;
+    target_enable_irq();
+
+    free_dma_buffer(b);
+}
+
+/**
+ * Programs the TWIM for a write operation, and starts it.
+ */
+void NRF52I2C::startWrite(uint16_t address, uint8_t *data, int len, bool repeated)
 {
     address = address >> 1;
 
@@ -206,28 +448,89 @@ int NRF52I2C::write(uint16_t address, uint8_t *data, int len, bool repeated)
         nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_RESUME);
         nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_SUSPENDED);
     }
+}
+
+/**
+ * Programs the TWIM for a write followed by a repeated START read, and starts it (unless start is false).
+ * The shorts take the transaction through to a STOP condition with no further intervention.
+ */
+void NRF52I2C::startWriteRead(uint16_t address, uint8_t *txData, int txLen, uint8_t *rxData, int rxLen, bool start)
+{
+    address = address >> 1;
 
-    return waitForStop(repeated ? NRF_TWIM_EVENT_SUSPENDED : NRF_TWIM_EVENT_STOPPED);
+    nrf_twim_address_set(p_twim, address);
+
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_STOPPED);
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_ERROR);
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_LASTTX);
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_LASTRX);
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_TXSTARTED);
+    nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_RXSTARTED);
+
+    nrf_twim_tx_buffer_set(p_twim, txData, txLen);
+    nrf_twim_rx_buffer_set(p_twim, rxData, rxLen);
+    nrf_twim_shorts_set(p_twim, NRF_TWIM_SHORT_LASTTX_STARTRX_MASK | NRF_TWIM_SHORT_LASTRX_STOP_MASK);
+
+    // Leave the transaction armed, to be started through PPI.
+    if (!start)
+        return;
+
+    nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_STARTTX);
+
+    if (p_twim->EVENTS_SUSPENDED)
+    {
+        nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_RESUME);
+        nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_SUSPENDED);
+    }
 }
 
 /**
- * Issues a standard, 2 byte I2C command read to the I2C bus.
+ * Issues a standard, I2C command write to the I2C bus.
  * This consists of:
  *  - Asserting a Start condition on the bus
  *  - Selecting the Slave address (as an 8 bit address)
- *  - reading "len" bytes of raw 8 bit data into the buffer provided
+ *  - Writing a number of raw data bytes provided
  *  - Asserting a Stop condition on the bus
  *
- * The CPU will busy wait until the transmission is complete.
+ * The calling fiber sleeps until the transmission is complete, so other fibers can run in the meantime.
+ * If called before the scheduler is running, or from interrupt context, the CPU busy waits instead.
  *
- * @param address The 8bit I2C address of the device to read from
- * @param data pointer to store the the bytes read
- * @param len the number of bytes to read into the buffer
+ * @param address The 8bit I2C address of the device to write to
+ * @param data pointer to the bytes to write
+ * @param len the number of bytes to write
  * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
  *
- * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the read request failed.
+ * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed, or DEVICE_NO_RESOURCES
+ *         if data is in flash and can't be copied to RAM.
  */
-int NRF52I2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
+int NRF52I2C::write(uint16_t address, uint8_t *data, int len, bool repeated)
+{
+    int r = acquire(__get_IPSR() ? (void *)this : (void *)currentFiber);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    uint8_t *tx = stageTx(data, len);
+
+    if (tx == NULL)
+    {
+        owner = NULL;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    startWrite(address, tx, len, repeated);
+
+    // Zero length writes (typically bus probes) never signal completion, so are timed out by polling.
+    r = waitForCompletion(repeated ? NRF_TWIM_EVENT_SUSPENDED : NRF_TWIM_EVENT_STOPPED, false, len == 0);
+    releaseTx();
+
+    return r;
+}
+
+/**
+ * Programs the TWIM for a read operation, and starts it.
+ */
+void NRF52I2C::startRead(uint16_t address, uint8_t *data, int len, bool repeated)
 {
     address = address >> 1;
 
@@ -252,19 +555,128 @@ int NRF52I2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
         nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_RESUME);
         nrf_twim_event_clear(p_twim, NRF_TWIM_EVENT_SUSPENDED);
     }
+}
 
-    if (!repeated)
-    {
-        return waitForStop(NRF_TWIM_EVENT_STOPPED);
-    }
-    else
+/**
+ * Issues a standard, 2 byte I2C command read to the I2C bus.
+ * This consists of:
+ *  - Asserting a Start condition on the bus
+ *  - Selecting the Slave address (as an 8 bit address)
+ *  - reading "len" bytes of raw 8 bit data into the buffer provided
+ *  - Asserting a Stop condition on the bus
+ *
+ * The calling fiber sleeps until the transmission is complete, so other fibers can run in the meantime.
+ * If called before the scheduler is running, or from interrupt context, the CPU busy waits instead.
+ *
+ * @param address The 8bit I2C address of the device to read from
+ * @param data pointer to store the the bytes read
+ * @param len the number of bytes to read into the buffer
+ * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
+ *
+ * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the read request failed.
+ */
+int NRF52I2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
+{
+    int r = acquire(__get_IPSR() ? (void *)this : (void *)currentFiber);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    startRead(address, data, len, repeated);
+
+    return waitForCompletion(repeated ? NRF_TWIM_EVENT_SUSPENDED : NRF_TWIM_EVENT_STOPPED, repeated, false);
+}
+
+/**
+ * Starts a write to the I2C bus, returning immediately. The given handler is called (in IRQ context) once the
+ * write has completed, and its result can then be read with getTransferResult().
+ *
+ * @param address The 8bit I2C address of the device to write to
+ * @param data pointer to the bytes to write. This must remain valid until the write has completed, unless it is
+ *             in flash, in which case it is copied to RAM first.
+ * @param len the number of bytes to write
+ * @param repeated Suppresses the generation of a STOP condition if set.
+ * @param doneHandler The function to call once the write has completed.
+ * @param arg An argument passed to doneHandler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if len or doneHandler are invalid,
+ *         DEVICE_BUSY if the bus is in use and we can't wait for it, or DEVICE_NO_RESOURCES if data is in flash
+ *         and can't be copied to RAM.
+ */
+int NRF52I2C::writeAsync(uint16_t address, uint8_t *data, int len, bool repeated, PVoidCallback doneHandler, void *arg)
+{
+    if (len <= 0 || doneHandler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    int r = acquire(this);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    uint8_t *tx = stageTx(data, len);
+
+    if (tx == NULL)
     {
-        int r = waitForStop(NRF_TWIM_EVENT_LASTRX);
-        if (r != DEVICE_OK)
-            return r;
-        nrf_twim_task_trigger(p_twim, NRF_TWIM_TASK_SUSPEND);
-        return waitForStop(NRF_TWIM_EVENT_SUSPENDED);
+        owner = NULL;
+        return DEVICE_NO_RESOURCES;
     }
+
+    NVIC_DisableIRQ(IRQn);
+
+    this->doneHandler = doneHandler;
+    this->doneHandlerArg = arg;
+    startWrite(address, tx, len, repeated);
+    armIrq(repeated ? NRF_TWIM_EVENT_SUSPENDED : NRF_TWIM_EVENT_STOPPED, false);
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Starts a read from the I2C bus, returning immediately. The given handler is called (in IRQ context) once the
+ * read has completed, and its result can then be read with getTransferResult().
+ *
+ * @param address The 8bit I2C address of the device to read from
+ * @param data pointer to store the the bytes read. This must remain valid until the read has completed.
+ * @param len the number of bytes to read into the buffer
+ * @param repeated Suppresses the generation of a STOP condition if set.
+ * @param doneHandler The function to call once the read has completed.
+ * @param arg An argument passed to doneHandler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if len or doneHandler are invalid,
+ *         or DEVICE_BUSY if the bus is in use and we can't wait for it.
+ */
+int NRF52I2C::readAsync(uint16_t address, uint8_t *data, int len, bool repeated, PVoidCallback doneHandler, void *arg)
+{
+    if (len <= 0 || doneHandler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    int r = acquire(this);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    NVIC_DisableIRQ(IRQn);
+
+    this->doneHandler = doneHandler;
+    this->doneHandlerArg = arg;
+    startRead(address, data, len, repeated);
+    armIrq(repeated ? NRF_TWIM_EVENT_SUSPENDED : NRF_TWIM_EVENT_STOPPED, repeated);
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the result of the last operation on the bus.
+ *
+ * @return DEVICE_OK if it succeeded, DEVICE_I2C_ERROR if it failed, or DEVICE_BUSY if it is still in progress.
+ */
+int NRF52I2C::getTransferResult()
+{
+    return inFlight ? DEVICE_BUSY : status;
 }
 
 /**
@@ -279,7 +691,9 @@ int NRF52I2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
  *  - Performing an 8 bit read operation (of the requested register)
  *  - Asserting a Stop condition on the bus
  *
- * The CPU will busy wait until the transmission is complete..
+ * A repeated START read runs as a single hardware transaction: the TWIM is programmed with both buffers up front,
+ * and the LASTTX_STARTRX and LASTRX_STOP shorts carry it from the write, through the repeated START, to the final STOP.
+ * The calling fiber sleeps until it is complete.
  *
  * @param address 8bit I2C address of the device to read from
  * @param reg The 8bit register address of the to read.
@@ -292,6 +706,19 @@ int NRF52I2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
  */
 int NRF52I2C::readRegister(uint16_t address, uint8_t reg, uint8_t *data, int length, bool repeated)
 {
+    if (repeated && length > 0)
+    {
+        int r = acquire(__get_IPSR() ? (void *)this : (void *)currentFiber);
+
+        if (r != DEVICE_OK)
+            return r;
+
+        regAddress = reg;
+        startWriteRead(address, &regAddress, 1, data, length);
+
+        return waitForCompletion(NRF_TWIM_EVENT_STOPPED, false, false);
+    }
+
     // write followed by a read...
     int ret = write(address, &reg, 1, repeated);
 
@@ -302,6 +729,44 @@ int NRF52I2C::readRegister(uint16_t address, uint8_t reg, uint8_t *data, int len
     return ret;
 }
 
+/**
+ * Starts a register read from the I2C slave device provided, returning immediately. The transaction runs entirely
+ * in hardware, as a write of the register address followed by a repeated START read. The given handler is called
+ * (in IRQ context) once it has completed, and its result can then be read with getTransferResult().
+ *
+ * @param address 8bit I2C address of the device to read from
+ * @param reg The 8bit register address of the to read.
+ * @param data A pointer to a memory location to store the result of the read operation. This must remain valid until the read has completed.
+ * @param length The number of bytes to read
+ * @param doneHandler The function to call once the read has completed.
+ * @param arg An argument passed to doneHandler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if length or doneHandler are invalid,
+ *         or DEVICE_BUSY if the bus is in use and we can't wait for it.
+ */
+int NRF52I2C::readRegisterAsync(uint16_t address, uint8_t reg, uint8_t *data, int length, PVoidCallback doneHandler, void *arg)
+{
+    if (length <= 0 || doneHandler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    int r = acquire(this);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    NVIC_DisableIRQ(IRQn);
+
+    this->doneHandler = doneHandler;
+    this->doneHandlerArg = arg;
+    regAddress = reg;
+    startWriteRead(address, &regAddress, 1, data, length);
+    armIrq(NRF_TWIM_EVENT_STOPPED, false);
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
 /**
  * Define the minimum bus idle period for this I2C bus.
  * Thise controls the period of time the bus will remain idle between I2C transactions,
@@ -318,3 +783,261 @@ int NRF52I2C::setBusIdlePeriod(int period)
     minimumBusIdlePeriod = period;
     return DEVICE_OK;
 }
+
+/**
+ * Programs the given read of the batch into the TWIM, starting it unless start is false.
+ */
+void NRF52I2C::startBatchRead(int index, bool start)
+{
+    NRF52I2CRead *r = &batch[index];
+
+    batchIndex = index;
+    startWriteRead(r->address, &r->reg, 1, r->data, r->length, start);
+    armIrq(NRF_TWIM_EVENT_STOPPED, false);
+}
+
+/**
+ * Called (in IRQ context) as each read of a batch completes. Starts the next read, or completes the batch.
+ */
+void NRF52I2C::batchStep()
+{
+    batch[batchIndex].result = status;
+
+    if (batchIndex + 1 < batchCount)
+    {
+        startBatchRead(batchIndex + 1, true);
+        return;
+    }
+
+    if (batchTimer)
+    {
+        // Arm the first read of the next batch, and let the timer start it.
+        startBatchRead(0, false);
+        *ppi_group_enable_task(batchGroup) = 1;
+    }
+    else
+    {
+        batch = NULL;
+        owner = NULL;
+    }
+
+    if (batchHandler)
+        batchHandler(batchHandlerArg);
+
+    Event(DEVICE_ID_NOTIFY, doneEvent);
+}
+
+/**
+ * Starts executing a list of register reads back to back, returning immediately.
+ * Each read is a single repeated START transaction (see readRegisterAsync()), and each is started from
+ * the completion interrupt of the one before, so the batch runs without any fiber scheduling.
+ * The result of each read is stored in its descriptor.
+ *
+ * @param reads The reads to perform. These must remain valid until the batch has completed.
+ * @param count The number of reads.
+ * @param handler A function to call (in IRQ context) once all reads have completed, or NULL.
+ * @param arg An argument passed to handler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the reads are invalid, or DEVICE_BUSY if the
+ *         bus is in use and we can't wait for it.
+ */
+int NRF52I2C::startBatch(NRF52I2CRead *reads, int count, PVoidCallback handler, void *arg)
+{
+    if (reads == NULL || count <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < count; i++)
+        if (reads[i].length == 0 || reads[i].data == NULL)
+            return DEVICE_INVALID_PARAMETER;
+
+    int r = acquire(this);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    NVIC_DisableIRQ(IRQn);
+
+    batch = reads;
+    batchCount = count;
+    batchHandler = handler;
+    batchHandlerArg = arg;
+    startBatchRead(0, true);
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Executes a list of register reads back to back, as a single operation. The calling fiber sleeps until
+ * all reads are complete.
+ *
+ * @param reads The reads to perform. The result of each is stored in its descriptor.
+ * @param count The number of reads.
+ *
+ * @return DEVICE_OK if all reads succeeded, DEVICE_I2C_ERROR if any failed, DEVICE_INVALID_PARAMETER if the
+ *         reads are invalid, or DEVICE_BUSY if the bus is in use and we can't wait for it.
+ */
+int NRF52I2C::readBatch(NRF52I2CRead *reads, int count)
+{
+    int r = startBatch(reads, count, NULL, NULL);
+
+    if (r != DEVICE_OK)
+        return r;
+
+    while (true)
+    {
+        NVIC_DisableIRQ(IRQn);
+
+        if (batch != reads)
+            break;
+
+        if (fiber_scheduler_running() && !__get_IPSR())
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, doneEvent);
+
+        NVIC_EnableIRQ(IRQn);
+
+        if (fiber_scheduler_running() && !__get_IPSR())
+            schedule();
+    }
+
+    NVIC_EnableIRQ(IRQn);
+
+    for (int i = 0; i < count; i++)
+        if (reads[i].result != DEVICE_OK)
+            return DEVICE_I2C_ERROR;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Executes a list of register reads periodically. A timer compare starts the first read of each batch through
+ * PPI, so the sampling instant is free of interrupt and scheduling jitter. The rest of the batch follows
+ * back to back, as with startBatch().
+ *
+ * While periodic reads are running, the bus is dedicated to them, and other operations wait until
+ * stopPeriodicBatch() is called. If a batch overruns the period, the trigger is ignored until it completes.
+ *
+ * @param timer A timer dedicated to timing the batches. It is configured for 1MHz operation.
+ * @param period The time between batches, in microseconds.
+ * @param reads The reads to perform. These must remain valid until stopPeriodicBatch() is called.
+ * @param count The number of reads.
+ * @param handler A function to call (in IRQ context) as each batch completes, or NULL.
+ * @param arg An argument passed to handler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_BUSY if the
+ *         bus is in use and we can't wait for it, or DEVICE_NO_RESOURCES if no PPI channel or group is free.
+ */
+int NRF52I2C::startPeriodicBatch(NRFLowLevelTimer &timer, uint32_t period, NRF52I2CRead *reads, int count, PVoidCallback handler, void *arg)
+{
+    if (period == 0 || reads == NULL || count <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < count; i++)
+        if (reads[i].length == 0 || reads[i].data == NULL)
+            return DEVICE_INVALID_PARAMETER;
+
+    // Replace any periodic reads already running, rather than leaking their PPI resources.
+    stopPeriodicBatch();
+
+    int ppi = allocate_ppi_channel();
+    int group = allocate_ppi_group();
+
+    if (ppi < 0 || group < 0)
+    {
+        free_ppi_channel(ppi);
+        free_ppi_group(group);
+        return DEVICE_NO_RESOURCES;
+    }
+
+    int r = acquire(this);
+
+    if (r != DEVICE_OK)
+    {
+        free_ppi_channel(ppi);
+        free_ppi_group(group);
+        return r;
+    }
+
+    batchPpi = ppi;
+    batchGroup = group;
+
+    timer.disable();
+    timer.setMode(TimerMode::TimerModeTimer);
+    timer.setClockSpeed(1000);
+    timer.setBitMode(BitMode32);
+    timer.reset();
+    timer.timer->CC[0] = period;
+    timer.timer->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+
+    // Each trigger starts the armed read, and disables itself until the batch completes and re-enables it.
+    ppi_route(batchPpi, &timer.timer->EVENTS_COMPARE[0], &p_twim->TASKS_STARTTX, ppi_group_disable_task(batchGroup));
+    ppi_group_add(batchGroup, batchPpi);
+
+    NVIC_DisableIRQ(IRQn);
+
+    batch = reads;
+    batchCount = count;
+    batchHandler = handler;
+    batchHandlerArg = arg;
+    batchTimer = &timer;
+    startBatchRead(0, false);
+    *ppi_group_enable_task(batchGroup) = 1;
+
+    NVIC_EnableIRQ(IRQn);
+
+    timer.enable();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops periodic reads started by startPeriodicBatch(), waiting for any batch in progress to complete.
+ *
+ * @return DEVICE_OK on success.
+ */
+int NRF52I2C::stopPeriodicBatch()
+{
+    if (batchTimer == NULL)
+        return DEVICE_OK;
+
+    *ppi_group_disable_task(batchGroup) = 1;
+    ppi_disable(batchPpi);
+    batchTimer->disable();
+    batchTimer->timer->SHORTS = 0;
+
+    // The first read of the next batch is armed but not started, unless the timer has just fired.
+    while (true)
+    {
+        NVIC_DisableIRQ(IRQn);
+
+        if (batchIndex == 0 && !nrf_twim_event_check(p_twim, NRF_TWIM_EVENT_TXSTARTED))
+            break;
+
+        if (fiber_scheduler_running() && !__get_IPSR())
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, doneEvent);
+
+        NVIC_EnableIRQ(IRQn);
+
+        if (fiber_scheduler_running() && !__get_IPSR())
+            schedule();
+    }
+
+    // A batch completing above may have re-enabled the (now idle) trigger channel.
+    ppi_disconnect(batchPpi);
+    free_ppi_group(batchGroup);
+    batchPpi = -1;
+    batchGroup = -1;
+
+    nrf_twim_int_disable(p_twim, 0xFFFFFFFF);
+    inFlight = false;
+    batch = NULL;
+    batchTimer = NULL;
+    owner = NULL;
+
+    NVIC_EnableIRQ(IRQn);
+
+    Event(DEVICE_ID_NOTIFY, doneEvent);
+
+    return DEVICE_OK;
+}
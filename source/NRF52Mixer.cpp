@@ -0,0 +1,410 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "CodalCompat.h"
+#include "NRF52Mixer.h"
+#include "buffer_pool.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+#include "cmsis.h"
+
+namespace codal
+{
+
+// Sources are connected to this once their input is removed, so any later pull request has somewhere harmless to go.
+static DataSink disconnected;
+
+/**
+ * Scales a sample by a gain, where NRF52_MIXER_UNITY_GAIN is 1.0, saturating to 16 bits.
+ */
+static inline int32_t nrf52_mixer_scale(int32_t v, uint32_t gain, bool isSigned)
+{
+    // A 16 bit unsigned sample times a gain above 32768 overflows 32 bits, so multiply into 64 (a single SMULL).
+    v = (int32_t) (((int64_t) v * gain) >> 10);
+
+    if (isSigned)
+        return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+
+    return v > 65535 ? 65535 : v;
+}
+
+/**
+ * Scales n samples from in, and either writes them to out (if first) or adds them to out with saturation.
+ */
+static void nrf52_mixer_add(int16_t *out, const int16_t *in, int n, uint32_t gain, bool first, bool isSigned)
+{
+    int i = 0;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    // Bring the output to a word boundary, then mix two samples per instruction.
+    if (((uint32_t) out & 2) && n > 0)
+    {
+        int32_t v = nrf52_mixer_scale(isSigned ? in[0] : (uint16_t) in[0], gain, isSigned);
+        int32_t o = isSigned ? out[0] : (uint16_t) out[0];
+
+        if (!first)
+            v = nrf52_mixer_scale(o + v, NRF52_MIXER_UNITY_GAIN, isSigned);
+
+        out[0] = v;
+        i = 1;
+    }
+
+    for (; i + 1 < n; i += 2)
+    {
+        uint32_t x = __UNALIGNED_UINT32_READ(in + i);
+
+        if (gain != NRF52_MIXER_UNITY_GAIN)
+        {
+            if (isSigned)
+                x = __PKHBT(nrf52_mixer_scale((int16_t) x, gain, true), nrf52_mixer_scale((int32_t) x >> 16, gain, true), 16);
+            else
+                x = __PKHBT(nrf52_mixer_scale(x & 0xFFFF, gain, false), nrf52_mixer_scale(x >> 16, gain, false), 16);
+        }
+
+        uint32_t *o = (uint32_t *) (out + i);
+        *o = first ? x : isSigned ? __QADD16(*o, x) : __UQADD16(*o, x);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        int32_t v = nrf52_mixer_scale(isSigned ? in[i] : (uint16_t) in[i], gain, isSigned);
+        int32_t o = isSigned ? out[i] : (uint16_t) out[i];
+
+        if (!first)
+            v = nrf52_mixer_scale(o + v, NRF52_MIXER_UNITY_GAIN, isSigned);
+
+        out[i] = v;
+    }
+}
+
+/**
+ * Constructor.
+ *
+ * @param mixer The mixer this input belongs to.
+ * @param source The component providing samples. We connect ourselves to it.
+ * @param gain The initial gain, where NRF52_MIXER_UNITY_GAIN is 1.0.
+ */
+NRF52MixerInput::NRF52MixerInput(NRF52Mixer &mixer, DataSource &source, int gain) : mixer(mixer), source(source)
+{
+    this->offset = 0;
+    this->gain = gain;
+    this->ready = 0;
+
+    source.connect(*this);
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int NRF52MixerInput::pullRequest()
+{
+    ready++;
+    mixer.inputReady();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Constructor.
+ *
+ * @param format The format of the samples to mix: DATASTREAM_FORMAT_16BIT_SIGNED or DATASTREAM_FORMAT_16BIT_UNSIGNED.
+ */
+NRF52Mixer::NRF52Mixer(int format)
+{
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+        inputs[i] = NULL;
+
+    this->downstream = NULL;
+    this->bufferSize = NRF52_MIXER_BUFFER_SIZE;
+    this->outputRange = 0;
+    this->format = format == DATASTREAM_FORMAT_16BIT_UNSIGNED ? DATASTREAM_FORMAT_16BIT_UNSIGNED : DATASTREAM_FORMAT_16BIT_SIGNED;
+    this->active = false;
+}
+
+/**
+ * Destructor.
+ */
+NRF52Mixer::~NRF52Mixer()
+{
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+        if (inputs[i])
+            removeInput(inputs[i]->source);
+}
+
+/**
+ * Start mixing the given source.
+ *
+ * @param source The component providing samples, in the format of this mixer.
+ * @param gain The gain to apply, where NRF52_MIXER_UNITY_GAIN is 1.0.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the source is already mixed,
+ *         or DEVICE_NO_RESOURCES if NRF52_MIXER_MAX_INPUTS sources are already mixed.
+ */
+int NRF52Mixer::addInput(DataSource &source, int gain)
+{
+    int slot = -1;
+
+    if (gain < 0 || gain > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+    {
+        if (inputs[i] && &inputs[i]->source == &source)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (inputs[i] == NULL && slot < 0)
+            slot = i;
+    }
+
+    if (slot < 0)
+        return DEVICE_NO_RESOURCES;
+
+    // Connecting may cause the source to announce data straight away, so only do so once the input is in place.
+    NRF52MixerInput *input = new NRF52MixerInput(*this, source, gain);
+    inputs[slot] = input;
+
+    if (input->ready)
+        inputReady();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop mixing the given source.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the source is not mixed.
+ */
+int NRF52Mixer::removeInput(DataSource &source)
+{
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+    {
+        if (inputs[i] && &inputs[i]->source == &source)
+        {
+            target_disable_irq();
+            NRF52MixerInput *input = inputs[i];
+            inputs[i] = NULL;
+
+            // The source still holds the input as its downstream, so point it elsewhere before the input goes.
+            source.connect(disconnected);
+            target_enable_irq();
+
+            delete input;
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Change the gain applied to the given source.
+ *
+ * @param gain The gain to apply, where NRF52_MIXER_UNITY_GAIN is 1.0, in the range 0..0xFFFF.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the source is not mixed or the gain is out of range.
+ */
+int NRF52Mixer::setGain(DataSource &source, int gain)
+{
+    if (gain < 0 || gain > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+    {
+        if (inputs[i] && &inputs[i]->source == &source)
+        {
+            inputs[i]->gain = gain;
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Map signed samples onto the range 0..range as they are mixed, so that they can be played directly by an NRF52PWM.
+ * Silence is mapped to range / 2.
+ *
+ * @param range The range to map onto (typically NRF52PWM::getSampleRange()), or 0 to leave samples unchanged.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mixer is unsigned or the range is invalid.
+ */
+int NRF52Mixer::setOutputRange(int range)
+{
+    if (range < 0 || range > 0xFFFF || (range && format != DATASTREAM_FORMAT_16BIT_SIGNED))
+        return DEVICE_INVALID_PARAMETER;
+
+    outputRange = range;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Define the size of each output buffer.
+ *
+ * @param size The size of each buffer in bytes. This must be even, and non-zero.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is invalid.
+ */
+int NRF52Mixer::setBufferSize(int size)
+{
+    if (size <= 0 || size > 0xFFFF || (size & 1))
+        return DEVICE_INVALID_PARAMETER;
+
+    bufferSize = size;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Called when an input has data ready. Notifies downstream if we are idle.
+ */
+void NRF52Mixer::inputReady()
+{
+    target_disable_irq();
+
+    bool notify = !active && downstream;
+
+    if (notify)
+        active = true;
+
+    target_enable_irq();
+
+    if (notify)
+        downstream->pullRequest();
+}
+
+/**
+ * Obtain an output buffer from the pool, recycling one released by the downstream component where possible.
+ */
+ManagedBuffer NRF52Mixer::allocateBuffer()
+{
+    return buffer_pool_allocate(pool, NRF52_MIXER_POOL_SIZE, bufferSize);
+}
+
+/**
+ * Mixes samples from the given input into the output, until the output or the input runs out.
+ *
+ * @param first true if this is the first input mixed into this buffer, in which case the output is overwritten.
+ * @return The number of samples mixed.
+ */
+int NRF52Mixer::mix(NRF52MixerInput *input, int16_t *out, int count, bool first)
+{
+    int done = 0;
+
+    while (done < count)
+    {
+        // Move on to the next buffer from this source, if it has announced one.
+        if (input->offset + 1 >= input->current.length())
+        {
+            input->current = ManagedBuffer();
+            input->offset = 0;
+
+            if (input->ready == 0)
+                break;
+
+            input->ready--;
+            input->current = input->source.pull();
+            continue;
+        }
+
+        int n = min(count - done, (input->current.length() - input->offset) / 2);
+        const int16_t *in = (const int16_t *) (input->current.getBytes() + input->offset);
+
+        nrf52_mixer_add(out + done, in, n, input->gain, first, format == DATASTREAM_FORMAT_16BIT_SIGNED);
+
+        input->offset += n * 2;
+        done += n;
+    }
+
+    return done;
+}
+
+/**
+ * Provide the next mixed buffer to our downstream caller, if any source has data.
+ */
+ManagedBuffer NRF52Mixer::pull()
+{
+    ManagedBuffer b = allocateBuffer();
+    int16_t *out = (int16_t *) b.getBytes();
+    int count = b.length() / 2;
+    bool first = true;
+    bool more = false;
+
+    active = false;
+
+    for (int i = 0; i < NRF52_MIXER_MAX_INPUTS; i++)
+    {
+        NRF52MixerInput *input = inputs[i];
+
+        if (input == NULL)
+            continue;
+
+        int done = mix(input, out, count, first);
+
+        // Anything the first input didn't cover is silence, for the others to be added to.
+        if (first)
+            memset(out + done, 0, (count - done) * 2);
+
+        first = false;
+
+        if (input->ready || input->offset + 1 < input->current.length())
+            more = true;
+    }
+
+    if (first)
+        memset(out, 0, count * 2);
+
+    if (outputRange)
+    {
+        for (int i = 0; i < count; i++)
+            out[i] = (uint16_t) (((uint32_t) (out[i] + 32768) * outputRange) >> 16);
+    }
+
+    // Keep the stream going while any source has more to give.
+    if (more)
+        inputReady();
+
+    return b;
+}
+
+/**
+ * Update our reference to a downstream component.
+ */
+void NRF52Mixer::connect(DataSink &sink)
+{
+    downstream = &sink;
+}
+
+/**
+ * Determine the data format of the buffers streamed out of this component.
+ */
+int NRF52Mixer::getFormat()
+{
+    return outputRange ? DATASTREAM_FORMAT_16BIT_UNSIGNED : format;
+}
+
+}
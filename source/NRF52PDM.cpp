@@ -24,16 +24,22 @@ DEALINGS IN THE SOFTWARE.
 
 #include "CodalCompat.h"
 #include "NRF52PDM.h"
+#include "buffer_pool.h"
 #include "nrf.h"
+#include "irq_profile.h"
 
 // Handle on the last (and probably only) instance of this class (NRF52 has only one PDM module)
 static NRF52PDM *nrf52_pdm_driver = NULL;
 
 static void nrf52_pdm_irq(void)
 {
+    IRQ_PROFILE_ENTER();
+
     // Simply pass on to the driver component handler.
     if (nrf52_pdm_driver)
         nrf52_pdm_driver->irq();
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_PDM);
 }
 
 /**
@@ -55,10 +61,13 @@ void NRF52PDM::connect(DataSink& component)
  * @param sampleRate the rate at which samples are generated in the output buffer (in Hz)
  * @param id The id to use for the message bus when transmitting events.
  */
-NRF52PDM::NRF52PDM(Pin &sd, Pin &sck, uint16_t id) : output(*this)
+NRF52PDM::NRF52PDM(Pin &sd, Pin &sck, uint16_t id) : output(*this), left(*this, NRF52_PDM_LEFT), right(*this, NRF52_PDM_RIGHT)
 {
     // Store our component ID.
     this->id = id;
+    this->bufferSize = NRF52_PDM_BUFFER_SIZE;
+    this->bufferCount = NRF52_PDM_BUFFER_COUNT;
+    this->stereo = false;
 
     // Record a handle to this driver object, fo ruse by the IRQ handler.
     nrf52_pdm_driver = this;
@@ -94,6 +103,10 @@ NRF52PDM::NRF52PDM(Pin &sd, Pin &sck, uint16_t id) : output(*this)
     // Configure for a 1.032MHz PDM clock.
     NRF_PDM->PDMCLKCTRL = (PDM_PDMCLKCTRL_FREQ_Default << PDM_PDMCLKCTRL_FREQ_Pos );
 
+#ifdef PDM_RATIO_RATIO_Msk
+    NRF_PDM->RATIO = (PDM_RATIO_RATIO_Ratio64 << PDM_RATIO_RATIO_Pos);
+#endif
+
     // Mono operation.
     NRF_PDM->MODE = ( PDM_MODE_EDGE_LeftRising  << PDM_MODE_EDGE_Pos ) |
         (PDM_MODE_OPERATION_Mono << PDM_MODE_OPERATION_Pos);
@@ -101,10 +114,6 @@ NRF52PDM::NRF52PDM(Pin &sd, Pin &sck, uint16_t id) : output(*this)
     // Set default gain of 0dbm.
     this->setGain(40);
 
-
-    // Configure buffer size - samples are 2 bytes each
-    NRF_PDM->SAMPLE.MAXCNT = NRF52_PDM_BUFFER_SIZE / 2;
-
     // Record our sample rate for future computation.
     // This is a constant of the PDM samplerate / 64 (as defined in nrf52 specification, seciton 44).
     // For the configuration above, this translates to approx 16kHz.
@@ -134,8 +143,16 @@ void NRF52PDM::irq()
     if (NRF_PDM->EVENTS_END)
     {
         if (outputBuffer.length() > 0)
+        {
             output.pullRequest();
 
+            if (left.downstream)
+                left.downstream->pullRequest();
+
+            if (right.downstream && stereo)
+                right.downstream->pullRequest();
+        }
+
         NRF_PDM->EVENTS_END = 0;
     }
 
@@ -166,6 +183,174 @@ int NRF52PDM::setGain(int gain)
     return DEVICE_OK;
 }
 
+/**
+ * Define the size of each block of samples DMA'd from the microphone, and delivered downstream.
+ * Small blocks reduce latency, and large blocks reduce the interrupt rate. The change takes effect
+ * from the next block to be queued.
+ *
+ * @param size The block size in bytes. This must be even, and at most NRF52_PDM_MAX_BUFFER_SIZE.
+ * Each sample is 2 bytes, so the default of 512 bytes is 16ms of audio.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the size is invalid.
+ */
+int NRF52PDM::setBufferSize(int size)
+{
+    if (size < 2 || size > NRF52_PDM_MAX_BUFFER_SIZE || (size & 1))
+        return DEVICE_INVALID_PARAMETER;
+
+    this->bufferSize = size;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the size of each block of samples delivered downstream.
+ *
+ * @return The block size, in bytes.
+ */
+int NRF52PDM::getBufferSize()
+{
+    return bufferSize;
+}
+
+/**
+ * Define the number of DMA buffers kept for reuse. Two are always held by the PDM hardware, so
+ * any more allow downstream components to hold on to blocks without a heap allocation being made
+ * for each new block.
+ *
+ * @param count The number of buffers, in the range 2..NRF52_PDM_POOL_SIZE.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the count is invalid.
+ */
+int NRF52PDM::setBufferCount(int count)
+{
+    if (count < 2 || count > NRF52_PDM_POOL_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    NVIC_DisableIRQ(PDM_IRQn);
+
+    // Drop any buffers beyond the new count. Those still in use are simply freed by their last consumer.
+    for (int i = count; i < NRF52_PDM_POOL_SIZE; i++)
+    {
+        pool[i] = ManagedBuffer();
+        left.pool[i] = ManagedBuffer();
+        right.pool[i] = ManagedBuffer();
+    }
+
+    this->bufferCount = count;
+
+    NVIC_EnableIRQ(PDM_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Select mono or stereo operation. In stereo mode, the left and right samples are interleaved in
+ * each block delivered by output, and are also available separately through left and right.
+ * If the PDM is running, it is restarted.
+ *
+ * @param stereo true to sample both microphones, false for the left microphone only.
+ *
+ * @return DEVICE_OK on success.
+ */
+int NRF52PDM::setStereo(bool stereo)
+{
+    bool wasEnabled = enabled;
+
+    if (wasEnabled)
+        disable();
+
+    this->stereo = stereo;
+
+    NRF_PDM->MODE = ( PDM_MODE_EDGE_LeftRising  << PDM_MODE_EDGE_Pos ) |
+        ((stereo ? PDM_MODE_OPERATION_Stereo : PDM_MODE_OPERATION_Mono) << PDM_MODE_OPERATION_Pos);
+
+    if (wasEnabled)
+        enable();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine if the PDM is operating in stereo.
+ *
+ * @return true if in stereo mode.
+ */
+bool NRF52PDM::isStereo()
+{
+    return stereo;
+}
+
+/**
+ * Select the sample rate, by choosing a PDM clock frequency and decimation ratio (RATIO is only
+ * available on the nRF52833/840). The clock is kept between NRF52_PDM_MIN_CLOCK and NRF52_PDM_MAX_CLOCK.
+ * If the PDM is running, it is restarted.
+ *
+ * @param rate The target rate of each channel, in Hz (e.g. 8000 or 16000).
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate can't be reached with a supported clock.
+ */
+int NRF52PDM::setSampleRate(int rate)
+{
+    uint32_t ratio = 64;
+
+    if (rate <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+#ifdef PDM_RATIO_RATIO_Msk
+    // Prefer the higher ratio where the clock allows, as it gives better SNR.
+    if ((uint32_t) rate * 80 <= NRF52_PDM_MAX_CLOCK)
+        ratio = 80;
+#endif
+
+    uint32_t clock = rate * ratio;
+
+    if (clock < NRF52_PDM_MIN_CLOCK || clock > NRF52_PDM_MAX_CLOCK)
+        return DEVICE_INVALID_PARAMETER;
+
+    // PDMCLKCTRL is a fractional divider of the 32MHz clock: f = 32MHz * FREQ / 2^32.
+    // The documented values (e.g. PDM_PDMCLKCTRL_FREQ_Default for 1.032MHz) are all of this form.
+    uint32_t freq = (uint32_t) ((((uint64_t) clock << 32) + 16000000) / 32000000);
+
+    bool wasEnabled = enabled;
+
+    if (wasEnabled)
+        disable();
+
+    NRF_PDM->PDMCLKCTRL = freq;
+
+#ifdef PDM_RATIO_RATIO_Msk
+    NRF_PDM->RATIO = ((ratio == 80 ? PDM_RATIO_RATIO_Ratio80 : PDM_RATIO_RATIO_Ratio64) << PDM_RATIO_RATIO_Pos);
+#endif
+
+    // Record the rate actually achieved.
+    this->sampleRate = (uint32_t) (((uint64_t) freq * 32000000) >> 32) / ratio;
+
+    if (wasEnabled)
+        enable();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the rate at which samples are generated in each channel.
+ *
+ * @return The sample rate, in Hz.
+ */
+int NRF52PDM::getSampleRate()
+{
+    return sampleRate;
+}
+
+/**
+ * Obtain a DMA buffer from the pool, recycling one released by its consumers where possible.
+ * Buffers are only allocated from the heap when none of the right size is free.
+ */
+ManagedBuffer NRF52PDM::allocateBuffer()
+{
+    return buffer_pool_allocate(pool, bufferCount, bufferSize);
+}
+
 /**
  * Enable this component
  */
@@ -198,8 +383,55 @@ void NRF52PDM::disable()
  */
 void NRF52PDM::startDMA()
 {
+    // Release our hold on the oldest buffer before choosing the next, so it can be recycled if downstream is done with it.
     outputBuffer = inputBuffer;
-    inputBuffer = ManagedBuffer(NRF52_PDM_BUFFER_SIZE);
+    inputBuffer = allocateBuffer();
 
+    // Both registers are latched on the next STARTED event, so a new block size applies from this buffer on.
     NRF_PDM->SAMPLE.PTR = (uint32_t)&inputBuffer[0];
+    // In stereo mode, keep each block a whole number of L/R pairs.
+    NRF_PDM->SAMPLE.MAXCNT = (inputBuffer.length() / 2) & (stereo ? ~1 : ~0);
+}
+
+/**
+ * Constructor.
+ *
+ * @param pdm The PDM module to take samples from.
+ * @param side NRF52_PDM_LEFT or NRF52_PDM_RIGHT.
+ */
+NRF52PDMChannel::NRF52PDMChannel(NRF52PDM &pdm, int side) : pdm(pdm)
+{
+    this->downstream = NULL;
+    this->side = side;
+}
+
+/**
+ * Provide the samples of this side from the PDM's most recent block. In mono mode, this is the whole block.
+ */
+ManagedBuffer NRF52PDMChannel::pull()
+{
+    ManagedBuffer b = pdm.outputBuffer;
+
+    if (!pdm.stereo)
+        return side == NRF52_PDM_LEFT ? b : ManagedBuffer();
+
+    // Split blocks are recycled in the same way as DMA buffers, so each block costs no heap allocation.
+    int count = b.length() / 4;
+    ManagedBuffer out = buffer_pool_allocate(pool, pdm.bufferCount, count * 2);
+
+    const int16_t *src = (const int16_t *) b.getBytes() + side;
+    int16_t *dst = (int16_t *) out.getBytes();
+
+    for (int i = 0; i < count; i++, src += 2)
+        dst[i] = *src;
+
+    return out;
+}
+
+/**
+ * Update our reference to a downstream component.
+ */
+void NRF52PDMChannel::connect(DataSink &sink)
+{
+    downstream = &sink;
 }
@@ -1,29 +1,44 @@
 #include "NRF52PWM.h"
 #include "nrf.h"
 #include "cmsis.h"
+#include "peripheral_alloc.h"
+#include "irq_profile.h"
+#include "EventModel.h"
 
 #define  NRF52PWM_EMPTY_BUFFERSIZE  8
 static uint16_t emptyBuffer[NRF52PWM_EMPTY_BUFFERSIZE];
 
 void nrf52_pwm0_irq(void)
 {
+    IRQ_PROFILE_ENTER();
+
     // Simply pass on to the driver component handler.
     if (NRF52PWM::nrf52_pwm_driver[0])
         NRF52PWM::nrf52_pwm_driver[0]->irq();
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_PWM + 0);
 }
 
 void nrf52_pwm1_irq(void)
 {
+    IRQ_PROFILE_ENTER();
+
     // Simply pass on to the driver component handler.
     if (NRF52PWM::nrf52_pwm_driver[1])
         NRF52PWM::nrf52_pwm_driver[1]->irq();
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_PWM + 1);
 }
 
 void nrf52_pwm2_irq(void)
 {
+    IRQ_PROFILE_ENTER();
+
     // Simply pass on to the driver component handler.
     if (NRF52PWM::nrf52_pwm_driver[2])
         NRF52PWM::nrf52_pwm_driver[2]->irq();
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_PWM + 2);
 }
 
 // Handles on the instances of this class used the three PWM modules (if present)
@@ -39,6 +54,14 @@ NRF52PWM::NRF52PWM(NRF_PWM_Type *module, DataSource &source, float sampleRate, u
     this->repeatOnEmpty = true;
     this->bufferPlaying = 0;
     this->stopStreamingAfterBuf = 0;
+    this->queueHead = 0;
+    this->queueCount = 0;
+    this->queueDepth = 0;
+    this->valuesPerPeriod = 4;
+    this->filling = false;
+    this->underruns = 0;
+    this->prerolling = false;
+    this->prerollFlush = false;
 
     // Clear empty buffer
     for (int i=0; i<NRF52PWM_EMPTY_BUFFERSIZE; i++)
@@ -65,6 +88,9 @@ NRF52PWM::NRF52PWM(NRF_PWM_Type *module, DataSource &source, float sampleRate, u
     // Default to streaming mode.
     setStreamingMode(true);
 
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, NRF52PWM_EVT_PREROLL, this, &NRF52PWM::onPreroll);
+
     // Route an interrupt to this object
     // This is heavily unwound, but non trivial to remove this duplication given all the constants...
     // TODO: build up some lookup table to deduplicate this.
@@ -186,6 +212,9 @@ int NRF52PWM::setDecoderMode(uint32_t mode)
 {
     PWM.DECODER = (mode << PWM_DECODER_LOAD_Pos ) | (PWM_DECODER_MODE_RefreshCount << PWM_DECODER_MODE_Pos );
 
+    // Common mode consumes one value per period, Grouped two, and Individual and WaveForm four.
+    valuesPerPeriod = mode == PWM_DECODER_LOAD_Common ? 1 : mode == PWM_DECODER_LOAD_Grouped ? 2 : 4;
+
     return DEVICE_OK;
 }
  
@@ -214,6 +243,247 @@ void NRF52PWM::setStreamingMode(bool streamingMode, bool repeatOnEmpty)
     }
 }
 
+/**
+ * Repeatedly play the given values from RAM, with no CPU involvement. The values are re-read by EasyDMA every period,
+ * so changes written to them take effect from the next period, without restarting playback. Any stream is stopped.
+ *
+ * @param values The values to play, interpreted according to the decoder mode. These must remain valid while playing.
+ * @param count The number of 16 bit values.
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER.
+ */
+int NRF52PWM::playLive(uint16_t *values, int count)
+{
+    if (values == NULL || count <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Play with no interrupts: both sequences point at the same values, and LOOPSDONE restarts the pair indefinitely.
+    streaming = false;
+    active = false;
+    PWM.INTENCLR = (PWM_INTEN_SEQEND0_Enabled << PWM_INTEN_SEQEND0_Pos ) | (PWM_INTEN_SEQEND1_Enabled << PWM_INTEN_SEQEND1_Pos);
+
+    for (int b = 0; b < 2; b++)
+    {
+        PWM.SEQ[b].PTR = (uint32_t) values;
+        PWM.SEQ[b].CNT = count;
+        PWM.SEQ[b].REFRESH = 0;
+        PWM.SEQ[b].ENDDELAY = 0;
+    }
+
+    PWM.LOOP = 1;
+    PWM.SHORTS = PWM_SHORTS_LOOPSDONE_SEQSTART0_Enabled << PWM_SHORTS_LOOPSDONE_SEQSTART0_Pos;
+    PWM.TASKS_SEQSTART[0] = 1;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Defines how many buffers are pulled from upstream ahead of the two being played by the hardware.
+ * A deeper queue rides out longer delays in the upstream component (e.g. under fiber or radio load) without an underrun,
+ * at the cost of latency. In streaming mode, playout starts once the hardware slots and the queue are full, or
+ * with whatever has been queued if upstream returns an empty buffer or NRF52PWM_PREROLL_TIMEOUT passes first,
+ * so short sounds are still played.
+ *
+ * @param depth The number of buffers, in the range 0..NRF52PWM_MAX_QUEUE_DEPTH. The default of 0 is plain double buffering.
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER.
+ */
+int NRF52PWM::setQueueDepth(int depth)
+{
+    if (depth < 0 || depth > NRF52PWM_MAX_QUEUE_DEPTH)
+        return DEVICE_INVALID_PARAMETER;
+
+    // A shallower queue simply drains to the new depth as it plays.
+    queueDepth = depth;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the number of sequences that have ended in streaming mode with no new buffer ready to play.
+ * An NRF52PWM_EVT_UNDERRUN event is also raised each time this happens.
+ *
+ * @return The number of underruns since this component was created.
+ */
+uint32_t NRF52PWM::getUnderrunCount()
+{
+    return underruns;
+}
+
+/**
+ * Determine the time a buffer pulled now will take to reach the output: the duration of all the
+ * data queued and held by the hardware. This is an upper bound, as part of the playing buffer may already have been output.
+ *
+ * @return The playout latency, in microseconds.
+ */
+int NRF52PWM::getLatencyUs()
+{
+    int values = 0;
+
+    target_disable_irq();
+
+    for (int i = 0; i < queueCount; i++)
+        values += queue[(queueHead + i) % (NRF52PWM_MAX_QUEUE_DEPTH + 2)].length() / 2;
+
+    if (active)
+        values += PWM.SEQ[0].CNT + PWM.SEQ[1].CNT;
+
+    target_enable_irq();
+
+    return (int) (values / valuesPerPeriod * periodUs);
+}
+
+/**
+ * EasyDMA can only read from RAM, so buffers held in flash (e.g. constant sample data) are copied before playback.
+ * Buffers in RAM are played in place.
+ */
+static ManagedBuffer dmaBuffer(ManagedBuffer b)
+{
+    if (is_dma_capable(b.getBytes(), b.length()))
+        return b;
+
+    return ManagedBuffer(b.getBytes(), b.length());
+}
+
+/**
+ * Pull buffers that upstream has announced into the queue, until it holds the given number.
+ * The upstream component may call pullRequest() again from within pull(), so this is guarded against re-entry.
+ */
+void NRF52PWM::fillQueue(int limit)
+{
+    if (filling)
+        return;
+
+    filling = true;
+
+    while (true)
+    {
+        target_disable_irq();
+
+        if (dataReady == 0 || queueCount >= limit)
+        {
+            target_enable_irq();
+            break;
+        }
+
+        dataReady--;
+        target_enable_irq();
+
+        // Pull with interrupts enabled, as upstream may take some time to generate the buffer.
+        ManagedBuffer b = dmaBuffer(upstream.pull());
+
+        // An empty buffer marks the end of the data, so there is no point waiting for more before playing.
+        if (b.length() == 0)
+        {
+            if (!active)
+                prerollFlush = true;
+
+            continue;
+        }
+
+        target_disable_irq();
+        queue[(queueHead + queueCount) % (NRF52PWM_MAX_QUEUE_DEPTH + 2)] = b;
+        queueCount++;
+        target_enable_irq();
+    }
+
+    filling = false;
+}
+
+/**
+ * Take the oldest buffer from the queue or, if it is empty, directly from upstream.
+ * @return true if a buffer was obtained.
+ */
+bool NRF52PWM::nextBuffer(ManagedBuffer &b)
+{
+    if (queueCount)
+    {
+        b = queue[queueHead];
+        queue[queueHead] = ManagedBuffer();
+        queueHead = (queueHead + 1) % (NRF52PWM_MAX_QUEUE_DEPTH + 2);
+        queueCount--;
+
+        return true;
+    }
+
+    // A buffer being pulled into the queue must be played before anything announced after it.
+    if (dataReady && !filling)
+    {
+        // Any pull request made by upstream from within pull() is simply counted, so buffers stay in order.
+        filling = true;
+        dataReady--;
+        b = dmaBuffer(upstream.pull());
+        filling = false;
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Pre-roll the queue, and start streamed playout once the hardware slots and the queue are full, or the preroll ends early.
+ */
+void NRF52PWM::preload()
+{
+    fillQueue(queueDepth + 2);
+
+    if (active || queueCount == 0)
+        return;
+
+    if (queueCount < queueDepth + 2 && !prerollFlush)
+    {
+        // Don't hold a sound shorter than the queue back forever: start with what we have if no more arrives in time.
+        if (!prerolling)
+        {
+            prerolling = true;
+            system_timer_event_after_us(NRF52PWM_PREROLL_TIMEOUT, id, NRF52PWM_EVT_PREROLL);
+        }
+
+        return;
+    }
+
+    if (prerolling)
+    {
+        prerolling = false;
+        system_timer_cancel_event(id, NRF52PWM_EVT_PREROLL);
+    }
+
+    prerollFlush = false;
+    active = true;
+
+    for (int b = 0; b < 2; b++)
+    {
+        // A short sound may not fill both slots. Play silence in the other, after which playout stops as on any underrun.
+        if (nextBuffer(buffer[b]))
+        {
+            PWM.SEQ[b].PTR = (uint32_t) buffer[b].getBytes();
+            PWM.SEQ[b].CNT = buffer[b].length() / 2;
+        }
+        else
+        {
+            PWM.SEQ[b].PTR = (uint32_t) emptyBuffer;
+            PWM.SEQ[b].CNT = (uint32_t) NRF52PWM_EMPTY_BUFFERSIZE;
+        }
+    }
+
+    bufferPlaying = 0;
+    PWM.TASKS_SEQSTART[0] = 1;
+}
+
+/**
+ * Starts streamed playout with whatever is queued, once the preroll timeout expires.
+ */
+void NRF52PWM::onPreroll(Event)
+{
+    if (!prerolling)
+        return;
+
+    prerolling = false;
+    prerollFlush = true;
+
+    if (streaming && !active)
+        preload();
+}
+
 /**
  * Pull a buffer into the given double buffer slot, if one is available.
  * @param b The buffer to fill (either 0 or 1)
@@ -233,23 +503,28 @@ int NRF52PWM::tryPull(uint8_t b)
         // If a Pull request has been made since we decided to stop, start to fill up the
         // hardware double buffer so that we don't stall.
         if(dataReady)
-        {
-            dataReady--;
-            pullRequest();
-        }
+            preload();
+
         return 0;
     }
 
-    if (dataReady){
-        buffer[b] = upstream.pull();
+    if (nextBuffer(buffer[b])){
         PWM.SEQ[b].PTR = (uint32_t) buffer[b].getBytes();
         PWM.SEQ[b].CNT = buffer[b].length() / 2;
 
-        dataReady--;
+        // Top the queue back up, so that the next slot is already waiting when this one ends.
+        if (streaming)
+            fillQueue(queueDepth);
 
         return 1;
     }
 
+    if (streaming && active)
+    {
+        underruns++;
+        Event(id, NRF52PWM_EVT_UNDERRUN);
+    }
+
     // If we're in active streaming mode, and have requested a buffer and failed to get one, we have an underflow.
     // Streaming mode is double buffered, so schedule ourself to stop after the next buffer is played, if we're so configured.
     if (streaming && active && !repeatOnEmpty)
@@ -278,27 +553,16 @@ int NRF52PWM::pullRequest()
             PWM.TASKS_SEQSTART[0] = 1;
     }
 
-    // If we're in streaming mode, ensure that we've preloaded both double buffers before initiating playout.
+    // If we're in streaming mode, ensure that we've preloaded both double buffers (and the queue) before initiating playout.
+    // Once playing, pull the buffer straight away rather than waiting for a sequence to end, so it is ready in good time.
     // note: care needed here, as our upstream data source MAY recursively call pullRequest() again in response to us
     // pulling the first buffer...
-    if (streaming && !active)
+    if (streaming)
     {
-        active = true;
-
-        tryPull(bufferPlaying);
-        bufferPlaying = (bufferPlaying + 1) % 2;
-
-        if (bufferPlaying !=0 && dataReady)
-        {
-            tryPull(bufferPlaying);
-            bufferPlaying = (bufferPlaying + 1) % 2;
-        }
-
-        // Check if we've preloaded both buffers
-        if (bufferPlaying == 0)
-            PWM.TASKS_SEQSTART[0] = 1;
+        if (active)
+            fillQueue(queueDepth);
         else
-            active = false;
+            preload();
     }
 
     return DEVICE_OK;
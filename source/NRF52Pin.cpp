@@ -37,6 +37,8 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalDmesg.h"
 #include "codal_target_hal.h"
 #include "NotifyEvents.h"
+#include "ppi_alloc.h"
+#include "irq_profile.h"
 
 
 using namespace codal;
@@ -53,11 +55,13 @@ using namespace codal;
 
 static NRF52Pin *irq_pins[NUM_PINS];
 
+static NRF_PWM_Type * const pwm_modules[NRF52PWM_PWM_PERIPHERALS] = { NRF_PWM0, NRF_PWM1, NRF_PWM2 };
+
 MemorySource* NRF52Pin::pwmSource = NULL;
-NRF52PWM* NRF52Pin::pwm = NULL;
-uint16_t NRF52Pin::pwmBuffer[NRF52PIN_PWM_CHANNEL_MAP_SIZE] = {0,0,0,0};
-int8_t NRF52Pin::pwmChannelMap[NRF52PIN_PWM_CHANNEL_MAP_SIZE] = {-1,-1,-1,-1};
-uint8_t NRF52Pin::lastUsedChannel = 3;
+NRF52PWM* NRF52Pin::pwm[NRF52PIN_PWM_MODULES] = { NULL };
+uint16_t NRF52Pin::pwmBuffer[NRF52PIN_PWM_MODULES][NRF52PIN_PWM_CHANNEL_MAP_SIZE];
+int8_t NRF52Pin::pwmChannelMap[NRF52PIN_PWM_MODULES][NRF52PIN_PWM_CHANNEL_MAP_SIZE];
+uint32_t NRF52Pin::pwmPeriod[NRF52PIN_PWM_MODULES];
 
 NRF52ADC* NRF52Pin::adc = NULL;
 TouchSensor* NRF52Pin::touchSensor = NULL;
@@ -122,6 +126,11 @@ static void process_gpio_irq(NRF_GPIO_Type* GPIO_PORT, int pinNumberOffset)
 
 void GPIOTE_IRQHandler(void)
 {
+    IRQ_PROFILE_ENTER();
+
+    // Channels claimed through the allocator (e.g. for edge capture) have their own handlers.
+    gpiote_channel_irq();
+
     if (NRF_GPIOTE->EVENTS_PORT)
     {
         // Acknowledge the interrupt
@@ -130,6 +139,8 @@ void GPIOTE_IRQHandler(void)
         process_gpio_irq(NRF_P0, 0);
         process_gpio_irq(NRF_P1, 32);
     }
+
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_GPIOTE);
 }
 
 #ifdef __cplusplus
@@ -181,10 +192,23 @@ void NRF52Pin::disconnect()
                 NRF52PWM::nrf52_pwm_driver[p]->disconnectPin(*this);
 
                 // If this pin was attaced to the analog funcitons in this class, clear any cached state.
-                if ( NRF52PWM::nrf52_pwm_driver[p] == pwm)
-                    for (int i = 0; i < NRF52PWM_PWM_CHANNELS; i++)
-                        if (pwmChannelMap[i] == name)
-                            pwmChannelMap[i] = -1;
+                // A module left with no pins is disabled, to save power.
+                if (p < NRF52PIN_PWM_MODULES && pwm[p] && NRF52PWM::nrf52_pwm_driver[p] == pwm[p])
+                {
+                    bool idle = true;
+
+                    for (int i = 0; i < NRF52PIN_PWM_CHANNEL_MAP_SIZE; i++)
+                    {
+                        if (pwmChannelMap[p][i] == name)
+                            pwmChannelMap[p][i] = -1;
+
+                        if (pwmChannelMap[p][i] != -1)
+                            idle = false;
+                    }
+
+                    if (idle)
+                        pwm[p]->disable();
+                }
             }
         }
     }
@@ -326,23 +350,187 @@ int NRF52Pin::getDigitalValue(PullMode pull)
     return getDigitalValue();
 }
 /**
- * Instantiates the components required for PWM if not previously created
+ * Instantiates the components required for PWM on the given module if not previously created.
+ * If the module is idle, it is configured for the given period and its live sequence is started.
+ */
+int NRF52Pin::initialisePWM(int module, uint32_t period)
+{
+    if (pwm[module] == NULL)
+    {
+        pwm[module] = new NRF52PWM(pwm_modules[module], *pwmSource, 1000000 / NRF52PIN_PWM_DEFAULT_PERIOD);
+        pwm[module]->setStreamingMode(false);
+        pwmPeriod[module] = NRF52PIN_PWM_DEFAULT_PERIOD;
+    }
+
+    for (int c = 0; c < NRF52PIN_PWM_CHANNEL_MAP_SIZE; c++)
+        if (pwmChannelMap[module][c] != -1)
+            return DEVICE_OK;
+
+    if (pwmPeriod[module] != period)
+    {
+        pwm[module]->setPeriodUs(period);
+        pwmPeriod[module] = period;
+    }
+
+    // Each channel's value is read from pwmBuffer every period, so duty changes need no restart.
+    pwm[module]->enable();
+    pwm[module]->playLive(pwmBuffer[module], NRF52PIN_PWM_CHANNEL_MAP_SIZE);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Finds the PWM channel driving this pin.
+ *
+ * @return The index of the channel (module * NRF52PIN_PWM_CHANNEL_MAP_SIZE + channel), or -1 if none is allocated.
+ */
+int NRF52Pin::findPWMChannel()
+{
+    if (pwmSource == NULL)
+        return -1;
+
+    for (int p = 0; p < NRF52PIN_PWM_MODULES; p++)
+        for (int c = 0; c < NRF52PIN_PWM_CHANNEL_MAP_SIZE; c++)
+            if (pwmChannelMap[p][c] == name)
+                return p * NRF52PIN_PWM_CHANNEL_MAP_SIZE + c;
+
+    return -1;
+}
+
+/**
+ * Allocates a PWM channel for this pin, on a module running at the given period.
+ * Modules already running at that period are preferred, then idle modules (which are configured for it).
+ * If flexible, any module with a free channel is used as a last resort, and the pin adopts its period.
+ *
+ * @param exclude A module not to consider, or -1.
+ *
+ * @return The index of the channel, or -1 if none is free.
  */
-int NRF52Pin::initialisePWM()
+int NRF52Pin::allocatePWMChannel(uint32_t period, bool flexible, int exclude)
 {
+    int best = -1;
+    int bestRank = 3;
+
+    // All modules share a single (idle) upstream component, as playback is driven by playLive().
     if (pwmSource == NULL)
     {
         pwmSource = new MemorySource();
         pwmSource->setFormat(DATASTREAM_FORMAT_16BIT_UNSIGNED);
+
+        memset(pwmChannelMap, -1, sizeof(pwmChannelMap));
     }
 
-    if (pwm == NULL)
+    for (int p = 0; p < NRF52PIN_PWM_MODULES; p++)
     {
-        pwm = new NRF52PWM(NRF_PWM0, *pwmSource, 50);
-        pwm->setStreamingMode(false);
+        // Leave alone any module driven by another NRF52PWM instance (e.g. audio or neopixel).
+        if (p == exclude || (NRF52PWM::nrf52_pwm_driver[p] && NRF52PWM::nrf52_pwm_driver[p] != pwm[p]))
+            continue;
+
+        int used = 0;
+
+        for (int c = 0; c < NRF52PIN_PWM_CHANNEL_MAP_SIZE; c++)
+            if (pwmChannelMap[p][c] != -1)
+                used++;
+
+        if (used == NRF52PIN_PWM_CHANNEL_MAP_SIZE)
+            continue;
+
+        int rank = (used && pwmPeriod[p] == period) ? 0 : used == 0 ? 1 : 2;
+
+        if (rank < bestRank && (rank < 2 || flexible))
+        {
+            best = p;
+            bestRank = rank;
+        }
     }
 
-    return DEVICE_OK;
+    if (best < 0)
+        return -1;
+
+    // Release any channel this pin held before, now rather than from within connectPin(). Otherwise its teardown of
+    // modules left without pins would disable the module just started below, which has no pins recorded yet.
+    disconnect();
+    initialisePWM(best, period);
+
+    for (int c = 0; c < NRF52PIN_PWM_CHANNEL_MAP_SIZE; c++)
+    {
+        if (pwmChannelMap[best][c] == -1)
+        {
+            // Start with the output off.
+            pwmBuffer[best][c] = pwm[best]->getSampleRange();
+            pwmChannelMap[best][c] = name;
+            pwm[best]->connectPin(*this, c);
+
+            return best * NRF52PIN_PWM_CHANNEL_MAP_SIZE + c;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Changes the period of the PWM channel driving this pin, moving the pin to another module if
+ * the one it is on is shared with pins at other periods. The duty cycle is preserved.
+ *
+ * @param index The channel currently driving this pin.
+ *
+ * @return The index of the channel now driving this pin.
+ */
+int NRF52Pin::setPWMPeriod(int index, uint32_t period)
+{
+    int p = index / NRF52PIN_PWM_CHANNEL_MAP_SIZE;
+    int c = index % NRF52PIN_PWM_CHANNEL_MAP_SIZE;
+    int others = 0;
+
+    if (pwmPeriod[p] == period)
+        return index;
+
+    for (int i = 0; i < NRF52PIN_PWM_CHANNEL_MAP_SIZE; i++)
+        if (i != c && pwmChannelMap[p][i] != -1)
+            others++;
+
+    uint32_t oldRange = pwm[p]->getSampleRange();
+    uint32_t value = pwmBuffer[p][c];
+
+    // If other pins share this module, join (or start) a group at the new period instead, so theirs is unchanged.
+    if (others)
+    {
+        int moved = allocatePWMChannel(period, false, p);
+
+        if (moved >= 0)
+        {
+            int q = moved / NRF52PIN_PWM_CHANNEL_MAP_SIZE;
+            pwmBuffer[q][moved % NRF52PIN_PWM_CHANNEL_MAP_SIZE] = value * pwm[q]->getSampleRange() / oldRange;
+
+            return moved;
+        }
+    }
+
+    // Otherwise retune the module, as all modules are in use. The duty cycle of every pin on it is preserved.
+    pwm[p]->setPeriodUs(period);
+    pwmPeriod[p] = period;
+
+    uint32_t newRange = pwm[p]->getSampleRange();
+
+    for (int i = 0; i < NRF52PIN_PWM_CHANNEL_MAP_SIZE; i++)
+        pwmBuffer[p][i] = pwmBuffer[p][i] * newRange / oldRange;
+
+    return index;
+}
+
+/**
+ * Sets the duty cycle of the given PWM channel to numerator / denominator, by updating its value in the live sequence.
+ */
+void NRF52Pin::setPWMDuty(int index, uint32_t numerator, uint32_t denominator)
+{
+    int p = index / NRF52PIN_PWM_CHANNEL_MAP_SIZE;
+    uint32_t range = pwm[p]->getSampleRange();
+
+    if (numerator > denominator)
+        numerator = denominator;
+
+    // The output is inverted, so the sequence holds the length of the low part of each period.
+    pwmBuffer[p][index % NRF52PIN_PWM_CHANNEL_MAP_SIZE] = range - (range * numerator) / denominator;
 }
 
 /**
@@ -350,8 +538,8 @@ int NRF52Pin::initialisePWM()
   *
   * @param value the level to set on the output pin, in the range 0 - 1024
   *
-  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if value is out of range, or DEVICE_NOT_SUPPORTED
-  *         if the given pin does not have analog capability.
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if value is out of range, DEVICE_NOT_SUPPORTED
+  *         if the given pin does not have analog capability, or DEVICE_NO_RESOURCES if all PWM channels are in use.
   */
 int NRF52Pin::setAnalogValue(int value)
 {
@@ -363,30 +551,19 @@ int NRF52Pin::setAnalogValue(int value)
     if(value < 0 || value > DEVICE_PIN_MAX_OUTPUT)
          return DEVICE_INVALID_PARAMETER;
 
-    int channel = -1;
-
-    // find existing channel
-    for (int i = 0; i < NRF52PIN_PWM_CHANNEL_MAP_SIZE; i++)
-        if (pwmChannelMap[i] == name)
-            channel = i;
+    // find existing channel, or allocate a new one without taking it from another pin
+    int channel = findPWMChannel();
 
-    // no existing channel found
     if (channel == -1)
-    {
-        initialisePWM();
+        channel = allocatePWMChannel(NRF52PIN_PWM_DEFAULT_PERIOD, true);
 
-        // alloc new channel by round robin allocation
-        channel = (lastUsedChannel + 1) % NRF52PIN_PWM_CHANNEL_MAP_SIZE;
-        pwmChannelMap[channel] = name;
-        lastUsedChannel = channel;
-        pwm->connectPin(*this, channel);
-    }
+    if (channel == -1)
+        return DEVICE_NO_RESOURCES;
 
     status |= IO_STATUS_ANALOG_OUT;
 
     // set new value
-    pwmBuffer[channel] = (int)((float)pwm->getSampleRange() * (1 - (float)value / (float)(DEVICE_PIN_MAX_OUTPUT+1)));
-    pwmSource->playAsync(pwmBuffer, NRF52PIN_PWM_CHANNEL_MAP_SIZE * sizeof(uint16_t));
+    setPWMDuty(channel, value, DEVICE_PIN_MAX_OUTPUT+1);
 
     return DEVICE_OK;
 }
@@ -458,12 +635,13 @@ int NRF52Pin::getAnalogValue()
          status |= IO_STATUS_ANALOG_IN;
     }
 
+    // Only sample continuously if the ADC is already streaming. Occasional reads use a one-shot conversion.
     if (adc)
     {
-        NRF52ADCChannel *c = adc->getChannel(*this);
+        int sample = adc->getSampleOnce(*this);
 
-        if (c)
-            return c->getSample() / 16;
+        if (sample >= 0)
+            return sample / 16;
     }
 
     return DEVICE_NOT_SUPPORTED;
@@ -620,12 +798,27 @@ void NRF52Pin::touchCalibrate()
   */
 int NRF52Pin::setServoPulseUs(uint32_t pulseWidth)
 {
-    initialisePWM();
+    if(!(PIN_CAPABILITY_ANALOG & capability))
+        return DEVICE_NOT_SUPPORTED;
+
+    int channel = findPWMChannel();
+
+    // Prefer a module already running at the servo period, so no other pin's period is disturbed.
+    if (channel == -1)
+        channel = allocatePWMChannel(NRF52PIN_PWM_DEFAULT_PERIOD, false);
+
+    if (channel == -1)
+        channel = allocatePWMChannel(NRF52PIN_PWM_DEFAULT_PERIOD, true);
+
+    if (channel == -1)
+        return DEVICE_NO_RESOURCES;
 
-    if (pwm->getPeriodUs() != 20000)
-        pwm->setPeriodUs(20000);
+    status |= IO_STATUS_ANALOG_OUT;
+
+    channel = setPWMPeriod(channel, NRF52PIN_PWM_DEFAULT_PERIOD);
+    setPWMDuty(channel, pulseWidth, NRF52PIN_PWM_DEFAULT_PERIOD);
 
-    return setAnalogValue((int) (1024.0f * (float) pulseWidth / 20000.0f));
+    return DEVICE_OK;
 }
 
 /**
@@ -637,22 +830,11 @@ int NRF52Pin::setServoPulseUs(uint32_t pulseWidth)
   */
 int NRF52Pin::setAnalogPeriodUs(uint32_t period)
 {
-    if (status & IO_STATUS_ANALOG_OUT)
-    {
-        int oldRange = pwm->getSampleRange();
-        pwm->setPeriodUs(period);
-
-        for (int i = 0; i < NRF52PIN_PWM_CHANNEL_MAP_SIZE; i++)
-        {
-            float v = (float) pwmBuffer[i];
-            v = v * (float)pwm->getSampleRange();
-            v = v / (float) oldRange;
-
-            pwmBuffer[i] = (uint16_t) v;
-        }
-
-        pwmSource->playAsync(pwmBuffer, NRF52PIN_PWM_CHANNEL_MAP_SIZE * sizeof(uint16_t));
+    int channel = findPWMChannel();
 
+    if ((status & IO_STATUS_ANALOG_OUT) && channel != -1)
+    {
+        setPWMPeriod(channel, period);
         return DEVICE_OK;
     }
 
@@ -680,8 +862,10 @@ int NRF52Pin::setAnalogPeriod(int period)
   */
 uint32_t NRF52Pin::getAnalogPeriodUs()
 {
-    if (status & IO_STATUS_ANALOG_OUT)
-        return pwm->getPeriodUs();
+    int channel = findPWMChannel();
+
+    if ((status & IO_STATUS_ANALOG_OUT) && channel != -1)
+        return pwm[channel / NRF52PIN_PWM_CHANNEL_MAP_SIZE]->getPeriodUs();
 
     return DEVICE_NOT_SUPPORTED;
 }
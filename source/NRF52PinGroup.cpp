@@ -0,0 +1,242 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "NRF52PinGroup.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+static NRF_GPIO_Type * const pin_group_ports[NRF52_PIN_GROUP_PORTS] = {
+    NRF_P0,
+#ifdef NRF_P1
+    NRF_P1
+#endif
+};
+
+/**
+  * Constructor.
+  *
+  * @param pins The pins in the group. Bit n of each value corresponds to pins[n]. The array must remain valid
+  *             for the lifetime of the group.
+  *
+  * @param count The number of pins, in the range 1..NRF52_PIN_GROUP_MAX_PINS.
+  */
+NRF52PinGroup::NRF52PinGroup(Pin **pins, int count)
+{
+    this->pins = pins;
+    this->count = min(max(count, 0), NRF52_PIN_GROUP_MAX_PINS);
+    this->table = NULL;
+    this->contiguousPort = pins[0]->name >> 5;
+    this->shift = (pins[0]->name & 31);
+
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        mask[p] = 0;
+
+    for (int i = 0; i < this->count; i++)
+    {
+        int port = pins[i]->name >> 5;
+        int bit = pins[i]->name & 31;
+
+        mask[port] |= 1U << bit;
+
+        // The common case of consecutive pins on one port is a simple shift.
+        if (port != contiguousPort || bit != shift + i)
+            shift = -1;
+    }
+
+    if (shift >= 0)
+        return;
+
+    // Otherwise, build a table of the port bits set by each value of each nibble.
+    int nibbles = (this->count + 3) / 4;
+    table = (uint32_t *) malloc(nibbles * 16 * NRF52_PIN_GROUP_PORTS * sizeof(uint32_t));
+
+    if (table == NULL)
+        return;
+
+    for (int n = 0; n < nibbles; n++)
+    {
+        for (int v = 0; v < 16; v++)
+        {
+            uint32_t *entry = &table[(n * 16 + v) * NRF52_PIN_GROUP_PORTS];
+
+            for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+                entry[p] = 0;
+
+            for (int b = 0; b < 4 && n * 4 + b < this->count; b++)
+                if (v & (1U << b))
+                    entry[pins[n * 4 + b]->name >> 5] |= 1U << (pins[n * 4 + b]->name & 31);
+        }
+    }
+}
+
+/**
+  * Destructor.
+  */
+NRF52PinGroup::~NRF52PinGroup()
+{
+    free(table);
+}
+
+/**
+  * Determines the bits to set on each port for the given value.
+  */
+void NRF52PinGroup::scatter(uint32_t value, uint32_t *bits)
+{
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        bits[p] = 0;
+
+    if (shift >= 0)
+    {
+        bits[contiguousPort] = (value << shift) & mask[contiguousPort];
+        return;
+    }
+
+    if (table)
+    {
+        for (int n = 0; value && n * 4 < count; n++, value >>= 4)
+        {
+            const uint32_t *entry = &table[(n * 16 + (value & 0x0F)) * NRF52_PIN_GROUP_PORTS];
+
+            for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+                bits[p] |= entry[p];
+        }
+
+        return;
+    }
+
+    // If the table could not be allocated, fall back to a bit at a time.
+    for (int i = 0; i < count; i++)
+        if (value & (1U << i))
+            bits[pins[i]->name >> 5] |= 1U << (pins[i]->name & 31);
+}
+
+/**
+  * Configures every pin in the group as a digital output.
+  *
+  * @param value The initial value of the group.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52PinGroup::setOutput(uint32_t value)
+{
+    for (int i = 0; i < count; i++)
+        pins[i]->setDigitalValue((value >> i) & 1);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Configures every pin in the group as a digital input.
+  *
+  * @param pull The pull mode applied to each pin.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52PinGroup::setInput(PullMode pull)
+{
+    for (int i = 0; i < count; i++)
+        pins[i]->getDigitalValue(pull);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Writes the given value to the group, changing every pin on each port at once.
+  *
+  * @param value The value to write.
+  */
+void NRF52PinGroup::write(uint32_t value)
+{
+    uint32_t bits[NRF52_PIN_GROUP_PORTS];
+
+    scatter(value, bits);
+
+    // A read-modify-write of OUT changes every pin of the port in the same cycle. Interrupts are held off so
+    // changes to other pins on the port are not lost.
+    target_disable_irq();
+
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        if (mask[p])
+            pin_group_ports[p]->OUT = (pin_group_ports[p]->OUT & ~mask[p]) | bits[p];
+
+    target_enable_irq();
+}
+
+/**
+  * Sets the pins corresponding to the 1 bits of the given value, leaving the others unchanged.
+  * This is a single OUTSET write per port, so is safe from any context.
+  */
+void NRF52PinGroup::set(uint32_t bits)
+{
+    uint32_t b[NRF52_PIN_GROUP_PORTS];
+
+    scatter(bits, b);
+
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        if (b[p])
+            pin_group_ports[p]->OUTSET = b[p];
+}
+
+/**
+  * Clears the pins corresponding to the 1 bits of the given value, leaving the others unchanged.
+  * This is a single OUTCLR write per port, so is safe from any context.
+  */
+void NRF52PinGroup::clear(uint32_t bits)
+{
+    uint32_t b[NRF52_PIN_GROUP_PORTS];
+
+    scatter(bits, b);
+
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        if (b[p])
+            pin_group_ports[p]->OUTCLR = b[p];
+}
+
+/**
+  * Reads the current level of every pin in the group.
+  *
+  * @return The value of the group.
+  */
+uint32_t NRF52PinGroup::read()
+{
+    uint32_t in[NRF52_PIN_GROUP_PORTS];
+    uint32_t value = 0;
+
+    // Sample every port first, so the value is as close to a single moment as possible.
+    for (int p = 0; p < NRF52_PIN_GROUP_PORTS; p++)
+        in[p] = mask[p] ? pin_group_ports[p]->IN : 0;
+
+    if (shift >= 0)
+        return (in[contiguousPort] & mask[contiguousPort]) >> shift;
+
+    for (int i = 0; i < count; i++)
+        if (in[pins[i]->name >> 5] & (1U << (pins[i]->name & 31)))
+            value |= 1U << i;
+
+    return value;
+}
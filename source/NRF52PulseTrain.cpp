@@ -0,0 +1,187 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "NRF52PulseTrain.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * Connects to the given edge capture, and sets its idle timeout to match the frame timeout.
+  * The edge capture is started and stopped by the caller.
+  *
+  * @param capture The source of edge timestamps.
+  *
+  * @param timeout The time without an edge that ends a frame, in microseconds.
+  */
+NRF52PulseTrain::NRF52PulseTrain(NRF52EdgeCapture &capture, uint32_t timeout) : upstream(capture)
+{
+    this->downstream = NULL;
+    this->lastEdge = 0;
+    this->inFrame = false;
+    this->pulseCount = 0;
+    this->outputHead = 0;
+    this->outputCount = 0;
+    this->dropped = 0;
+
+    setTimeout(timeout);
+    upstream.connect(*this);
+}
+
+/**
+  * Defines the time without an edge that ends a frame.
+  *
+  * @param timeout The timeout, in microseconds.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the timeout is zero.
+  */
+int NRF52PulseTrain::setTimeout(uint32_t timeout)
+{
+    if (timeout == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Edge timestamps are in ticks of a 16MHz timer.
+    this->timeout = timeout * 16;
+    upstream.setIdleTimeout(timeout);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the number of frames lost because they were not pulled in time.
+  */
+uint32_t NRF52PulseTrain::getDroppedCount()
+{
+    return dropped;
+}
+
+/**
+  * Completes the current frame, if it has any pulses, and queues it for collection.
+  */
+void NRF52PulseTrain::endFrame()
+{
+    if (pulseCount == 0)
+        return;
+
+    if (outputCount >= NRF52_PULSE_TRAIN_QUEUE_SIZE)
+    {
+        dropped++;
+        pulseCount = 0;
+        return;
+    }
+
+    ManagedBuffer b((uint8_t *) pulses, pulseCount * sizeof(uint32_t));
+
+    output[(outputHead + outputCount) % NRF52_PULSE_TRAIN_QUEUE_SIZE] = b;
+    outputCount++;
+    pulseCount = 0;
+
+    if (downstream)
+        downstream->pullRequest();
+}
+
+/**
+  * Callback provided when data is ready.
+  */
+int NRF52PulseTrain::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+    uint32_t *edges = (uint32_t *) b.getBytes();
+    int count = b.length() / sizeof(uint32_t);
+
+    // Convert the timestamps into pulse widths, splitting frames at each gap longer than the timeout.
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t width = edges[i] - lastEdge;
+
+        if (inFrame && width <= timeout)
+        {
+            pulses[pulseCount++] = (width + 8) / 16;
+
+            if (pulseCount == NRF52_PULSE_TRAIN_MAX_PULSES)
+                endFrame();
+        }
+        else
+        {
+            endFrame();
+            inFrame = true;
+        }
+
+        lastEdge = edges[i];
+    }
+
+    // Once the pin has been idle for the timeout, the frame is complete.
+    if (inFrame && upstream.isIdle())
+    {
+        endFrame();
+        inFrame = false;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Provide the next completed frame to our downstream caller, if available.
+  *
+  * @return A buffer of uint32_t pulse widths in microseconds, or an empty ManagedBuffer if no frame is available.
+  */
+ManagedBuffer NRF52PulseTrain::pull()
+{
+    ManagedBuffer b;
+
+    target_disable_irq();
+
+    if (outputCount)
+    {
+        b = output[outputHead];
+        output[outputHead] = ManagedBuffer();
+        outputHead = (outputHead + 1) % NRF52_PULSE_TRAIN_QUEUE_SIZE;
+        outputCount--;
+    }
+
+    target_enable_irq();
+
+    return b;
+}
+
+/**
+  * Update our reference to a downstream component.
+  */
+void NRF52PulseTrain::connect(DataSink &sink)
+{
+    downstream = &sink;
+}
+
+/**
+  *  Determine the data format of the buffers streamed out of this component.
+  */
+int NRF52PulseTrain::getFormat()
+{
+    return DATASTREAM_FORMAT_32BIT_UNSIGNED;
+}
@@ -24,11 +24,18 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "NRF52Radio.h"
+#include "NRF52RadioScheduler.h"
 #include "Radio.h"
 #include "EventModel.h"
 #include "Event.h"
+#include "CodalFiber.h"
+#include "codal_target_hal.h"
 #include "ErrorNo.h"
+#include "ppi_alloc.h"
 #include "nrf.h"
+#include "ramfunc.h"
+#include "irq_profile.h"
+#include <stddef.h>
 
 const int8_t NRF52_BLE_POWER_LEVEL[] = {-30, -20, -16, -12, -8, -4, 0, 4};
 
@@ -59,160 +66,1068 @@ using namespace codal;
 
 NRF52Radio* NRF52Radio::instance = NULL;
 
-extern "C" void RADIO_IRQHandler(void)
+static void datagram_packet_received(void *radio)
 {
-    if(NRF_RADIO->EVENTS_READY)
+    ((NRF52Radio *)radio)->datagram.packetReceived();
+}
+
+static void event_packet_received(void *radio)
+{
+    ((NRF52Radio *)radio)->event.packetReceived();
+}
+
+extern "C" NRF52_RAMFUNC void RADIO_IRQHandler(void)
+{
+    uint32_t start = DWT->CYCCNT;
+    IRQ_PROFILE_ENTER();
+
+    if(NRF_RADIO->EVENTS_END)
+    {
+        NRF_RADIO->EVENTS_END = 0;
+        NRF52Radio::instance->onEnd();
+    }
+
+    if(NRF_RADIO->EVENTS_DISABLED)
+    {
+        NRF_RADIO->EVENTS_DISABLED = 0;
+        NRF52Radio::instance->onDisabled();
+    }
+
+    if(NRF52Radio::instance->ccmResult)
+        NRF52Radio::instance->onCcmComplete();
+
+    NRF52Radio::instance->recordInterrupt(DWT->CYCCNT - start);
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_RADIO);
+}
+
+extern "C" void CCM_AAR_IRQHandler(void)
+{
+    if(NRF_CCM->EVENTS_ENDCRYPT || NRF_CCM->EVENTS_ERROR)
+    {
+        bool error = NRF_CCM->EVENTS_ERROR != 0;
+
+        NRF_CCM->EVENTS_ENDCRYPT = 0;
+        NRF_CCM->EVENTS_ERROR = 0;
+        NRF52Radio::instance->onCcmEnd(error);
+    }
+}
+
+/**
+  * Constructor.
+  *
+  * Initialise the NRF52Radio.
+  *
+  * @note This class is demand activated, as a result most resources are only
+  *       committed if send/recv or event registrations calls are made.
+  */
+NRF52Radio::NRF52Radio(uint16_t id) : datagram(*this), event (*this)
+{
+    this->id = id;
+    this->status = 0;
+    memset(this->groups, 0, sizeof(this->groups));
+    this->groups[0] = NRF52_RADIO_DEFAULT_GROUP;
+    this->groupMask = 0x01;
+	this->queueDepth = 0;
+    this->rxHead = 0;
+    this->rssi = 0;
+    this->rxBuf = NULL;
+    this->pool = NULL;
+    this->frameSize = 0;
+    this->poolFree = 0;
+    this->maxPacketSize = NRF52_RADIO_MAX_PACKET_SIZE;
+    this->mode = NRF52_RADIO_DEFAULT_MODE;
+    this->freeList = NULL;
+    this->txQueue = NULL;
+    this->txTail = NULL;
+    this->txQueueDepth = 0;
+    this->txState = NRF52_RADIO_TX_IDLE;
+    this->txChained = false;
+    this->txWaiting = false;
+    this->txHandler = NULL;
+    this->txHandlerArg = NULL;
+    this->txStartCycles = 0;
+
+    resetStatistics();
+
+    memset(this->keys, 0, sizeof(this->keys));
+    this->ccmScratch = NULL;
+    this->txCipher = NULL;
+    this->ccmPlain = NULL;
+    this->txCounter = 0;
+    this->deviceId = 0;
+    this->ccmEnabled = false;
+    this->ccmPpi = -1;
+    this->ccmBusy = false;
+    this->ccmResult = NRF52_RADIO_CCM_IDLE;
+    this->txDeferred = false;
+    this->scheduler = NULL;
+
+    this->protocolCount = 0;
+    setProtocolHandler(NRF52_RADIO_PROTOCOL_DATAGRAM, datagram_packet_received, this);
+    setProtocolHandler(NRF52_RADIO_PROTOCOL_EVENTBUS, event_packet_received, this);
+
+    instance = this;
+}
+
+/**
+  * Change the output power level of the transmitter to the given value.
+  *
+  * @param power a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range.
+  */
+int NRF52Radio::setTransmitPower(int power)
+{
+    if (power < 0 || power >= NRF52_BLE_POWER_LEVELS)
+        return DEVICE_INVALID_PARAMETER;
+
+    NRF_RADIO->TXPOWER = (uint32_t)NRF52_BLE_POWER_LEVEL[power];
+
+    return DEVICE_OK;
+}
+
+/**
+  * Change the transmission and reception band of the radio to the given channel
+  *
+  * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int NRF52Radio::setFrequencyBand(int band)
+{
+    // if (ble_running())
+    //     return DEVICE_NOT_SUPPORTED;
+
+    if (band < 0 || band > 100)
+        return DEVICE_INVALID_PARAMETER;
+
+    NRF_RADIO->FREQUENCY = (uint32_t)band;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Selects the on-air data rate and modulation used by the radio.
+  * If the radio is already enabled, it is restarted in the new mode. Any packets awaiting transmission are discarded.
+  *
+  * @param mode One of RADIO_MODE_MODE_Nrf_1Mbit, RADIO_MODE_MODE_Nrf_2Mbit, RADIO_MODE_MODE_Ble_1Mbit
+  *             or RADIO_MODE_MODE_Ble_2Mbit (where supported by the device).
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not supported.
+  */
+int NRF52Radio::setMode(uint32_t mode)
+{
+    if (mode != RADIO_MODE_MODE_Nrf_1Mbit && mode != RADIO_MODE_MODE_Nrf_2Mbit &&
+        mode != RADIO_MODE_MODE_Ble_1Mbit && mode != RADIO_MODE_MODE_Ble_2Mbit)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->mode = mode;
+
+    // The MODE register can only be changed while the RADIO is disabled.
+    if (status & NRF52_RADIO_STATUS_INITIALISED)
+    {
+        disable();
+        return enable();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Retrieves the on-air data rate and modulation used by the radio.
+  *
+  * @return The RADIO_MODE_MODE_* value currently selected.
+  */
+uint32_t NRF52Radio::getMode()
+{
+    return mode;
+}
+
+/**
+  * Changes the largest payload that can be sent or received, up to NRF52_RADIO_MAX_PACKET_SIZE_LIMIT bytes.
+  * FrameBuffers in the pool are sized to match, so memory is not wasted on larger packets than needed.
+  * Devices can only receive packets from peers using the same, or a smaller, maximum size.
+  * At the default size, the radio keeps the legacy on-air length limit, so it interoperates with unmodified peers.
+  *
+  * @param size The maximum payload size, in bytes.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the size is out of range, or DEVICE_BUSY
+  *         if the radio is enabled or FrameBuffers are still in use.
+  */
+int NRF52Radio::setMaxPacketSize(int size)
+{
+    if (size <= 0 || size > NRF52_RADIO_MAX_PACKET_SIZE_LIMIT)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (size == maxPacketSize)
+        return DEVICE_OK;
+
+    if (status & NRF52_RADIO_STATUS_INITIALISED)
+        return DEVICE_BUSY;
+
+    // The pool is recreated at the new size the next time we're enabled. This is only safe once every FrameBuffer has been returned.
+    if (pool)
+    {
+        if (poolFree + (rxBuf ? 1 : 0) != NRF52_RADIO_FRAMEBUFFER_POOL_SIZE)
+            return DEVICE_BUSY;
+
+        free(pool);
+        pool = NULL;
+
+        // txCipher is sized to match the pool.
+        free(txCipher);
+        txCipher = NULL;
+        rxBuf = NULL;
+        freeList = NULL;
+        poolFree = 0;
+    }
+
+    maxPacketSize = size;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Retrieves the largest payload that can be sent or received.
+  *
+  * @return The maximum payload size, in bytes.
+  */
+int NRF52Radio::getMaxPacketSize()
+{
+    return maxPacketSize;
+}
+
+/**
+  * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
+  * actively being used by the radio hardware to store incoming data.
+  *
+  * @return a pointer to the current receive buffer.
+  */
+FrameBuffer* NRF52Radio::getRxBuf()
+{
+    return rxBuf;
+}
+
+/**
+  * Takes a FrameBuffer from the pool of preallocated buffers.
+  * This never touches the heap, and so is safe to call from RADIO_IRQHandler.
+  *
+  * @return a pointer to a FrameBuffer, or NULL if the pool is exhausted.
+  */
+FrameBuffer* NRF52Radio::allocateFrameBuffer()
+{
+    // Protect shared resource from ISR activity (unless we are the ISR)
+    int wasEnabled = NVIC_GetEnableIRQ(RADIO_IRQn);
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    FrameBuffer *p = freeList;
+
+    if (p)
+    {
+        freeList = p->next;
+        poolFree--;
+    }
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(RADIO_IRQn);
+
+    return p;
+}
+
+/**
+  * Returns a FrameBuffer to the pool of preallocated buffers, once it is no longer needed.
+  *
+  * @param buffer A FrameBuffer previously obtained from recv() or allocateFrameBuffer().
+  */
+void NRF52Radio::releaseFrameBuffer(FrameBuffer *buffer)
+{
+    if (buffer == NULL)
+        return;
+
+    int wasEnabled = NVIC_GetEnableIRQ(RADIO_IRQn);
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    buffer->next = freeList;
+    freeList = buffer;
+    poolFree++;
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+/**
+  * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
+  *         could not be allocated (either by policy or pool exhaustion).
+  */
+int NRF52Radio::queueRxBuf()
+{
+    if (rxBuf == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (queueDepth >= NRF52_RADIO_MAXIMUM_RX_BUFFERS)
+    {
+        stats.rxDropQueueFull++;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    // Store the received RSSI value and logical address in the frame
+    rxBuf->rssi = getRSSI();
+    rxBuf->address = NRF_RADIO->RXMATCH;
+
+    // Ensure that a replacement buffer is available before queuing.
+    // We're called in interrupt context, so this only ever pops a pointer from the free list.
+    FrameBuffer *newRxBuf = freeList;
+
+    if (newRxBuf == NULL)
+    {
+        stats.rxDropNoBuffer++;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    freeList = newRxBuf->next;
+    poolFree--;
+
+    // We add to the tail of the queue to preserve causal ordering.
+    rxBuf->next = NULL;
+    rxQueue[(rxHead + queueDepth) % NRF52_RADIO_MAXIMUM_RX_BUFFERS] = rxBuf;
+
+    // Increase our received packet count
+    queueDepth++;
+
+    if (queueDepth > stats.rxQueueHighWater)
+        stats.rxQueueHighWater = queueDepth;
+
+    // Use the new buffer for the receiver hardware. the old one will be passed on to higher layer protocols/apps.
+    rxBuf = newRxBuf;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Interrupt service routine for the END event. Hands the packet to the receive queue, or
+  * completes the packet at the head of the transmit queue.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void NRF52Radio::onEnd()
+{
+    if (txState == NRF52_RADIO_TX_BEACON)
+    {
+        // The scheduler's beacon has been sent. It keeps the frame for the next superframe.
+        NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
+        txState = NRF52_RADIO_TX_IDLE;
+        return;
+    }
+
+    if (txState == NRF52_RADIO_TX_ACTIVE)
+    {
+        // The packet at the head of the transmit queue has been sent. The END_DISABLE short is already
+        // turning off the transmitter, so set up the buffer for whatever the hardware does next.
+        FrameBuffer *p = txQueue;
+
+        txQueue = p->next;
+        if (txQueue == NULL)
+            txTail = NULL;
+        txQueueDepth--;
+
+        releaseFrameBuffer(p);
+
+        stats.txPackets++;
+        stats.txTime += (DWT->CYCCNT - txStartCycles) / (SystemCoreClock / 1000000);
+        txStartCycles = DWT->CYCCNT;
+
+        if (!txChained)
+        {
+            // The DISABLED_RXEN short will bring the receiver back up. Make sure it has a buffer to use.
+            NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
+
+            // If more packets arrived while we were transmitting, we'll need to come back for them
+            // (unless the scheduler is deciding when we transmit).
+            txState = (txQueue && scheduler == NULL) ? NRF52_RADIO_TX_PENDING : NRF52_RADIO_TX_IDLE;
+        }
+
+        if (txHandler)
+            txHandler(txHandlerArg);
+
+        if (txWaiting || txQueue == NULL)
+        {
+            txWaiting = false;
+            Event(id, NRF52_RADIO_EVT_TX_COMPLETE);
+        }
+
+        return;
+    }
+
+    if(NRF_RADIO->CRCSTATUS == 1)
+    {
+        int sample = (int)NRF_RADIO->RSSISAMPLE;
+
+        stats.rxPackets++;
+
+        // Associate this packet's rssi value with the data just
+        // transferred by DMA receive
+        setRSSI(-sample);
+
+        if (rxBuf->version == NRF52_RADIO_VERSION_ENCRYPTED)
+        {
+            // The CCM decrypts the packet into a new frame, directly from rxBuf. It resumes the receiver once complete.
+            if (decrypt() == DEVICE_OK)
+                return;
+        }
+        else if (scheduler && rxBuf->protocol == NRF52_RADIO_PROTOCOL_BEACON)
+        {
+            // Beacons are consumed by the scheduler straight away, so rxBuf can be reused.
+            scheduler->onBeacon(rxBuf);
+        }
+        else
+        {
+            // Now move on to the next buffer, if possible.
+            // The queued packet will get the rssi value set above.
+            queueRxBuf();
+
+            // Set the new buffer for DMA
+            NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
+        }
+    }
+    else
+    {
+        stats.rxCrcErrors++;
+        setRSSI(0);
+    }
+
+    // Start listening and wait for the END event, unless we're about to transmit.
+    if (txState == NRF52_RADIO_TX_IDLE)
+        NRF_RADIO->TASKS_START = 1;
+}
+
+/**
+  * Interrupt service routine for the DISABLED event. Moves the radio between the transmitter and the receiver.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void NRF52Radio::onDisabled()
+{
+    // When slotted, the scheduler turns the radio on and off at slot boundaries.
+    if (scheduler)
+        return;
+
+    if (txState == NRF52_RADIO_TX_IDLE)
+    {
+        // The final packet has been sent, and the DISABLED_RXEN short has already enabled the receiver.
+        NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+        return;
+    }
+
+    if (txState == NRF52_RADIO_TX_PENDING && NRF_RADIO->STATE != RADIO_STATE_STATE_Disabled)
+    {
+        // The hardware returned to the receiver before we knew more packets were waiting. Turn it off again.
+        NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk;
+        NRF_RADIO->TASKS_DISABLE = 1;
+        return;
+    }
+
+    startTx();
+}
+
+/**
+  * Configures the RADIO hardware to transmit the packet at the head of the transmit queue.
+  *
+  * @note should only be called with the RADIO interrupt disabled, or from RADIO_IRQHandler.
+  */
+void NRF52Radio::startTx()
+{
+    const uint8_t *key = getEncryptionKey(groups[0]);
+
+    if (key && ccmBusy)
+    {
+        // The CCM is still decrypting a received packet. onCcmEnd() will call us again once it's done.
+        txDeferred = true;
+        return;
+    }
+
+    // Chain straight through to the receiver in hardware if this is the last packet we have.
+    // Otherwise, leave the radio disabled so we can load the next packet.
+    txChained = txQueue->next != NULL;
+
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk | (txChained ? 0 : RADIO_SHORTS_DISABLED_RXEN_Msk);
+
+    txState = NRF52_RADIO_TX_ACTIVE;
+    txStartCycles = DWT->CYCCNT;
+
+    if (key)
+    {
+        encrypt(txQueue, key);
+        return;
+    }
+
+    NRF_RADIO->PACKETPTR = (uint32_t) &txQueue->length;
+    NRF_RADIO->TASKS_TXEN = 1;
+}
+
+/**
+  * Takes a FrameBuffer from the pool for use in transmission.
+  *
+  * If the transmit queue is full and the caller is a fiber, the calling fiber is blocked until space is available.
+  * The caller should fill in the returned FrameBuffer, and pass it to queueTxBuf().
+  *
+  * @return a pointer to a FrameBuffer, or NULL if none is available (or the radio is not enabled).
+  */
+FrameBuffer* NRF52Radio::getTxBuf()
+{
+    if (!(status & NRF52_RADIO_STATUS_INITIALISED))
+    {
+        stats.txDropped++;
+        return NULL;
+    }
+
+    // Only block if we're a fiber, and we know a transmission is going to free up some space.
+    while (txQueueDepth >= NRF52_RADIO_MAXIMUM_TX_BUFFERS && fiber_scheduler_running() && __get_IPSR() == 0)
+    {
+        // Register for the completion event before the ISR can raise it, so the wakeup can't be lost.
+        NVIC_DisableIRQ(RADIO_IRQn);
+
+        if (txQueueDepth < NRF52_RADIO_MAXIMUM_TX_BUFFERS)
+        {
+            NVIC_EnableIRQ(RADIO_IRQn);
+            break;
+        }
+
+        txWaiting = true;
+        fiber_wake_on_event(id, NRF52_RADIO_EVT_TX_COMPLETE);
+        NVIC_EnableIRQ(RADIO_IRQn);
+
+        schedule();
+    }
+
+    FrameBuffer *buffer = txQueueDepth < NRF52_RADIO_MAXIMUM_TX_BUFFERS ? allocateFrameBuffer() : NULL;
+
+    // The caller can't send what it can't build, so count this as a drop just as queueTxBuf() would.
+    if (buffer == NULL)
+        stats.txDropped++;
+
+    return buffer;
+}
+
+/**
+  * Adds the given FrameBuffer to the transmit queue, and starts the transmitter if necessary.
+  * This call returns immediately - the buffer is returned to the pool once the packet has been transmitted.
+  *
+  * @param buffer A FrameBuffer obtained from getTxBuf().
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or DEVICE_NO_RESOURCES if the transmit queue is full (in which case the buffer is released).
+  */
+int NRF52Radio::queueTxBuf(FrameBuffer *buffer)
+{
+    if (buffer == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    int limit = maxPacketSize + NRF52_RADIO_HEADER_SIZE - 1;
+
+    if (getEncryptionKey(groups[0]))
+        limit -= NRF52_RADIO_CCM_OVERHEAD;
+
+    if (buffer->length > limit || !(status & NRF52_RADIO_STATUS_INITIALISED))
+    {
+        releaseFrameBuffer(buffer);
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    // Protect shared resource from ISR activity (unless we are the ISR)
+    int wasEnabled = NVIC_GetEnableIRQ(RADIO_IRQn);
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    if (txQueueDepth >= NRF52_RADIO_MAXIMUM_TX_BUFFERS)
+    {
+        if (wasEnabled)
+            NVIC_EnableIRQ(RADIO_IRQn);
+
+        stats.txDropped++;
+        releaseFrameBuffer(buffer);
+        return DEVICE_NO_RESOURCES;
+    }
+
+    // We add to the tail of the queue to preserve causal ordering.
+    buffer->next = NULL;
+
+    if (txTail)
+        txTail->next = buffer;
+    else
+        txQueue = buffer;
+
+    txTail = buffer;
+    txQueueDepth++;
+
+    if (txQueueDepth > stats.txQueueHighWater)
+        stats.txQueueHighWater = txQueueDepth;
+
+    // If the radio is listening, turn off the receiver. The DISABLED interrupt then starts the transmitter.
+    // When slotted, the packet waits in the queue for our next slot instead.
+    if (txState == NRF52_RADIO_TX_IDLE && scheduler == NULL)
+    {
+        txState = NRF52_RADIO_TX_PENDING;
+        NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk;
+
+        if (NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled)
+            startTx();
+        else
+            NRF_RADIO->TASKS_DISABLE = 1;
+    }
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(RADIO_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Looks up the AES key associated with a group.
+  *
+  * @param group The group.
+  *
+  * @return A pointer to the key, or NULL if packets for this group are not encrypted.
+  */
+const uint8_t* NRF52Radio::getEncryptionKey(uint8_t group)
+{
+    for (int i = 0; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+        if (keys[i].valid && keys[i].group == group)
+            return keys[i].key;
+
+    return NULL;
+}
+
+/**
+  * Enables hardware AES-CCM encryption of packets sent to, and received from, the given group.
+  *
+  * Encrypted packets are encrypted and authenticated by the CCM peripheral using EasyDMA, and are otherwise
+  * handled exactly as unencrypted packets. Packets received for a group without a key that claim to be encrypted
+  * are discarded, as are those that fail authentication.
+  *
+  * Encryption uses NRF52_RADIO_CCM_OVERHEAD bytes of each packet, reducing the space available for payload.
+  * There is no protection against replayed packets.
+  *
+  * @param group The group.
+  *
+  * @param key A pointer to a 16 byte AES key, or NULL to stop encrypting packets for this group.
+  *
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if a key is given while NRF52RadioScheduler is running (slotted
+  *         operation does not encrypt), or DEVICE_NO_RESOURCES if keys are already held for NRF52_RADIO_MAXIMUM_GROUPS groups
+  *         or memory could not be allocated.
+  */
+int NRF52Radio::setEncryptionKey(uint8_t group, const uint8_t *key)
+{
+    NRF52RadioKey *k = NULL;
+
+    if (key && scheduler)
+        return DEVICE_NOT_SUPPORTED;
+
+    for (int i = 0; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+    {
+        if (keys[i].valid && keys[i].group == group)
+        {
+            k = &keys[i];
+            break;
+        }
+
+        if (k == NULL && !keys[i].valid)
+            k = &keys[i];
+    }
+
+    if (key && k == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    if (key && (status & NRF52_RADIO_STATUS_INITIALISED))
+    {
+        int result = initialiseCrypto();
+        if (result != DEVICE_OK)
+            return result;
+    }
+
+    // Keys are used from interrupt context.
+    target_disable_irq();
+
+    if (key)
+    {
+        memcpy(k->key, key, 16);
+        k->group = group;
+        k->valid = true;
+    }
+    else if (k && k->valid && k->group == group)
+    {
+        k->valid = false;
+    }
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Allocates the memory used for encryption, and configures the CCM peripheral.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if memory could not be allocated.
+  */
+int NRF52Radio::initialiseCrypto()
+{
+    if (ccmScratch == NULL)
+        ccmScratch = (uint8_t *) malloc(NRF52_RADIO_CCM_SCRATCH_SIZE);
+
+    if (txCipher == NULL)
+        txCipher = (FrameBuffer *) malloc(frameSize);
+
+    if (ccmScratch == NULL || txCipher == NULL)
+        return DEVICE_NO_RESOURCES;
+
+#ifdef CCM_MAXPACKETSIZE_MAXPACKETSIZE_Pos
+    // Generate only as much keystream as a frame can hold. This also bounds what the CCM will write on decryption.
+    NRF_CCM->MAXPACKETSIZE = maxPacketSize < 0x1B ? 0x1B : maxPacketSize > 0xFB ? 0xFB : maxPacketSize;
+#endif
+
+    if (ccmEnabled)
+        return DEVICE_OK;
+
+    // Start the transmitter as soon as the CCM has finished encrypting.
+    if (ccmPpi < 0)
+        ccmPpi = allocate_ppi_channel();
+
+    if (ccmPpi < 0)
+        return DEVICE_NO_RESOURCES;
+
+    ppi_disable(ccmPpi);
+    ppi_route(ccmPpi, &NRF_CCM->EVENTS_ENDCRYPT, &NRF_RADIO->TASKS_TXEN);
+
+    // Nonces are formed from our unique id and a packet counter. Start the counter at a random point,
+    // so that we don't reuse nonces after a restart.
+    deviceId = NRF_FICR->DEVICEID[0];
+
+    NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;
+    NRF_RNG->TASKS_START = 1;
+
+    for (int i = 0; i < 4; i++)
+    {
+        NRF_RNG->EVENTS_VALRDY = 0;
+        while (NRF_RNG->EVENTS_VALRDY == 0);
+        txCounter = (txCounter << 8) | NRF_RNG->VALUE;
+    }
+
+    NRF_RNG->TASKS_STOP = 1;
+
+    NRF_CCM->ENABLE = CCM_ENABLE_ENABLE_Enabled << CCM_ENABLE_ENABLE_Pos;
+    NRF_CCM->SCRATCHPTR = (uint32_t) ccmScratch;
+    NRF_CCM->CNFPTR = (uint32_t) &ccmConfig;
+    NRF_CCM->SHORTS = CCM_SHORTS_ENDKSGEN_CRYPT_Msk;
+    NRF_CCM->INTENSET = CCM_INTENSET_ENDCRYPT_Msk | CCM_INTENSET_ERROR_Msk;
+
+    // Run at the same priority as the RADIO, so the two handlers never preempt each other.
+    NVIC_ClearPendingIRQ(CCM_AAR_IRQn);
+    NVIC_SetPriority(CCM_AAR_IRQn, 2);
+    NVIC_EnableIRQ(CCM_AAR_IRQn);
+
+    ccmEnabled = true;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Prepares ccmConfig for a CCM operation.
+  */
+void NRF52Radio::setNonce(const uint8_t *key, uint32_t counter, uint32_t sender)
+{
+    memcpy(ccmConfig.key, key, 16);
+
+    memset(ccmConfig.counter, 0, sizeof(ccmConfig.counter));
+    memcpy(ccmConfig.counter, &counter, 4);
+    ccmConfig.direction = 1;
+
+    memcpy(ccmConfig.iv, &sender, 4);
+    ccmConfig.iv[4] = NRF52_RADIO_BASE_ADDRESS >> 24;
+    ccmConfig.iv[5] = NRF52_RADIO_BASE_ADDRESS >> 16;
+    ccmConfig.iv[6] = NRF52_RADIO_BASE_ADDRESS >> 8;
+    ccmConfig.iv[7] = NRF52_RADIO_BASE_ADDRESS;
+}
+
+/**
+  * Encrypts the given packet into txCipher. The CCM starts the transmitter through PPI once complete.
+  */
+void NRF52Radio::encrypt(FrameBuffer *buffer, const uint8_t *key)
+{
+    int len = buffer->length - (NRF52_RADIO_HEADER_SIZE - 1);
+
+    // The header and nonce are sent in the clear.
+    txCipher->length = buffer->length + NRF52_RADIO_CCM_OVERHEAD;
+    txCipher->version = NRF52_RADIO_VERSION_ENCRYPTED;
+    txCipher->group = buffer->group;
+    txCipher->protocol = buffer->protocol;
+    memcpy(&txCipher->payload[0], &deviceId, 4);
+    memcpy(&txCipher->payload[4], &txCounter, 4);
+
+    // The CCM expects a BLE style header (S0, LENGTH, RFU) followed by the payload. The version field serves as S0,
+    // and we reuse the group and protocol fields (already copied above) in place for the LENGTH and RFU fields.
+    buffer->group = len;
+    buffer->protocol = 0;
+
+    setNonce(key, txCounter, deviceId);
+    txCounter++;
+
+    NRF_CCM->MODE = (CCM_MODE_MODE_Encryption << CCM_MODE_MODE_Pos) | (CCM_MODE_LENGTH_Extended << CCM_MODE_LENGTH_Pos);
+    NRF_CCM->INPTR = (uint32_t) &buffer->version;
+    NRF_CCM->OUTPTR = (uint32_t) &txCipher->payload[NRF52_RADIO_CCM_NONCE_SIZE];
+
+    NRF_RADIO->PACKETPTR = (uint32_t) &txCipher->length;
+    ppi_enable(ccmPpi);
+
+    ccmPlain = NULL;
+    ccmBusy = true;
+    NRF_CCM->EVENTS_ENDKSGEN = 0;
+    NRF_CCM->EVENTS_ENDCRYPT = 0;
+    NRF_CCM->TASKS_KSGEN = 1;
+}
+
+/**
+  * Starts decryption of the packet held in rxBuf into a new frame from the pool.
+  *
+  * @return DEVICE_OK if decryption has started, or an error code if the packet has been dropped.
+  */
+int NRF52Radio::decrypt()
+{
+    uint8_t address = NRF_RADIO->RXMATCH;
+    const uint8_t *key = getEncryptionKey(groups[address]);
+
+    if (key == NULL || ccmBusy || !ccmEnabled || rxBuf->length < NRF52_RADIO_HEADER_SIZE - 1 + NRF52_RADIO_CCM_OVERHEAD)
+    {
+        stats.rxDropNoKey++;
+        return DEVICE_NOT_SUPPORTED;
+    }
+
+    // The CCM trusts the LENGTH byte of its (S0, LENGTH, RFU) header, which arrives before the MIC has been checked.
+    // It must describe exactly the ciphertext we received (payload plus MIC), and its plaintext must fit in a frame,
+    // or a forged packet could have the CCM write beyond the end of the frame it decrypts into.
+    int length = rxBuf->payload[NRF52_RADIO_CCM_NONCE_SIZE + 1];
+    int expected = rxBuf->length - (NRF52_RADIO_HEADER_SIZE - 1) - (NRF52_RADIO_CCM_OVERHEAD - NRF52_RADIO_CCM_MIC_SIZE);
+
+    if (length != expected || length < NRF52_RADIO_CCM_MIC_SIZE || length - NRF52_RADIO_CCM_MIC_SIZE > maxPacketSize)
+    {
+        stats.rxMicErrors++;
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    if (queueDepth >= NRF52_RADIO_MAXIMUM_RX_BUFFERS)
+    {
+        stats.rxDropQueueFull++;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    FrameBuffer *plain = freeList;
+
+    if (plain == NULL)
+    {
+        stats.rxDropNoBuffer++;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    freeList = plain->next;
+    poolFree--;
+
+    plain->rssi = getRSSI();
+    plain->address = address;
+
+    uint32_t sender, counter;
+    memcpy(&sender, &rxBuf->payload[0], 4);
+    memcpy(&counter, &rxBuf->payload[4], 4);
+    setNonce(key, counter, sender);
+
+    // Make sure the result of decryption doesn't start the transmitter.
+    ppi_disable(ccmPpi);
+
+    NRF_CCM->MODE = (CCM_MODE_MODE_Decryption << CCM_MODE_MODE_Pos) | (CCM_MODE_LENGTH_Extended << CCM_MODE_LENGTH_Pos);
+    NRF_CCM->INPTR = (uint32_t) &rxBuf->payload[NRF52_RADIO_CCM_NONCE_SIZE];
+    NRF_CCM->OUTPTR = (uint32_t) &plain->version;
+
+    ccmPlain = plain;
+    ccmBusy = true;
+    NRF_CCM->EVENTS_ENDKSGEN = 0;
+    NRF_CCM->EVENTS_ENDCRYPT = 0;
+    NRF_CCM->TASKS_KSGEN = 1;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Interrupt service routine for the CCM ENDCRYPT and ERROR events.
+  *
+  * @param error true if the CCM reported an error.
+  *
+  * @note should only be called from CCM_AAR_IRQHandler...
+  */
+void NRF52Radio::onCcmEnd(bool error)
+{
+    // The result is handled in RADIO_IRQHandler, so that the receive queue is only ever modified there
+    // (and remains protected by masking the RADIO interrupt alone).
+    ccmResult = error ? NRF52_RADIO_CCM_ERROR : NRF52_RADIO_CCM_DONE;
+    NVIC_SetPendingIRQ(RADIO_IRQn);
+}
+
+/**
+  * Handles completion of a CCM operation. Queues a decrypted packet, and resumes the radio.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void NRF52Radio::onCcmComplete()
+{
+    FrameBuffer *plain = ccmPlain;
+    bool error = ccmResult == NRF52_RADIO_CCM_ERROR;
+
+    ccmResult = NRF52_RADIO_CCM_IDLE;
+    ccmPlain = NULL;
+    ccmBusy = false;
+
+    if (plain == NULL && error)
     {
-        NRF_RADIO->EVENTS_READY = 0;
+        // Encryption failed, so the CCM will never start the transmitter. Drop the packet, rather than stall the queue.
+        ppi_disable(ccmPpi);
 
-        // Start listening and wait for the END event
-        NRF_RADIO->TASKS_START = 1;
+        FrameBuffer *p = txQueue;
+
+        txQueue = p->next;
+        if (txQueue == NULL)
+            txTail = NULL;
+        txQueueDepth--;
+
+        releaseFrameBuffer(p);
+        stats.txDropped++;
+
+        if (txQueue && scheduler == NULL)
+        {
+            startTx();
+        }
+        else
+        {
+            // Return to the receiver.
+            txState = NRF52_RADIO_TX_IDLE;
+            NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+            NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
+            NRF_RADIO->TASKS_RXEN = 1;
+        }
+
+        if (txWaiting || txQueue == NULL)
+        {
+            txWaiting = false;
+            Event(id, NRF52_RADIO_EVT_TX_COMPLETE);
+        }
     }
 
-    if(NRF_RADIO->EVENTS_END)
+    if (plain)
     {
-        NRF_RADIO->EVENTS_END = 0;
-        if(NRF_RADIO->CRCSTATUS == 1)
+        if (!error && NRF_CCM->MICSTATUS == CCM_MICSTATUS_MICSTATUS_CheckPassed)
         {
-            int sample = (int)NRF_RADIO->RSSISAMPLE;
-
-            // Associate this packet's rssi value with the data just
-            // transferred by DMA receive
-            NRF52Radio::instance->setRSSI(-sample);
+            // Restore the FrameBuffer header from the LENGTH field written by the CCM, and the cleartext header.
+            plain->length = plain->group + NRF52_RADIO_HEADER_SIZE - 1;
+            plain->group = rxBuf->group;
+            plain->protocol = rxBuf->protocol;
+            plain->next = NULL;
 
-            // Now move on to the next buffer, if possible.
-            // The queued packet will get the rssi value set above.
-            NRF52Radio::instance->queueRxBuf();
+            rxQueue[(rxHead + queueDepth) % NRF52_RADIO_MAXIMUM_RX_BUFFERS] = plain;
+            queueDepth++;
 
-            // Set the new buffer for DMA
-            NRF_RADIO->PACKETPTR = (uint32_t) NRF52Radio::instance->getRxBuf();
+            if (queueDepth > stats.rxQueueHighWater)
+                stats.rxQueueHighWater = queueDepth;
         }
         else
         {
-            NRF52Radio::instance->setRSSI(0);
+            stats.rxMicErrors++;
+            releaseFrameBuffer(plain);
         }
 
-        // Start listening and wait for the END event
-        NRF_RADIO->TASKS_START = 1;
+        // We're finished with rxBuf, so we can listen for the next packet.
+        if (txState == NRF52_RADIO_TX_IDLE)
+            NRF_RADIO->TASKS_START = 1;
+    }
+
+    if (txDeferred)
+    {
+        txDeferred = false;
+        startTx();
     }
 }
 
 /**
-  * Constructor.
+  * Registers a callback to be invoked as each queued packet has been transmitted.
   *
-  * Initialise the NRF52Radio.
+  * @param handler The function to call (in interrupt context), or NULL to remove any existing handler.
   *
-  * @note This class is demand activated, as a result most resources are only
-  *       committed if send/recv or event registrations calls are made.
+  * @param arg An argument passed to handler.
   */
-NRF52Radio::NRF52Radio(uint16_t id) : datagram(*this), event (*this)
+void NRF52Radio::setTxCompleteHandler(PVoidCallback handler, void *arg)
 {
-    this->id = id;
-    this->status = 0;
-	this->group = NRF52_RADIO_DEFAULT_GROUP;
-	this->queueDepth = 0;
-    this->rssi = 0;
-    this->rxQueue = NULL;
-    this->rxBuf = NULL;
+    NVIC_DisableIRQ(RADIO_IRQn);
 
-    instance = this;
+    txHandler = handler;
+    txHandlerArg = arg;
+
+    if (status & NRF52_RADIO_STATUS_INITIALISED)
+        NVIC_EnableIRQ(RADIO_IRQn);
 }
 
 /**
-  * Change the output power level of the transmitter to the given value.
+  * Records the duration of a single run of RADIO_IRQHandler.
   *
-  * @param power a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+  * @param cycles The number of processor cycles taken.
   *
-  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range.
+  * @note should only be called from RADIO_IRQHandler...
   */
-int NRF52Radio::setTransmitPower(int power)
+void NRF52Radio::recordInterrupt(uint32_t cycles)
 {
-    if (power < 0 || power >= NRF52_BLE_POWER_LEVELS)
-        return DEVICE_INVALID_PARAMETER;
+    stats.isrCount++;
 
-    NRF_RADIO->TXPOWER = (uint32_t)NRF52_BLE_POWER_LEVEL[power];
+    if (cycles < stats.isrCyclesMin)
+        stats.isrCyclesMin = cycles;
 
-    return DEVICE_OK;
+    if (cycles > stats.isrCyclesMax)
+        stats.isrCyclesMax = cycles;
 }
 
 /**
-  * Change the transmission and reception band of the radio to the given channel
+  * Takes a snapshot of the radio statistics.
   *
-  * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
-  *
-  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
-  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @param s The structure to fill in.
   */
-int NRF52Radio::setFrequencyBand(int band)
+void NRF52Radio::getStatistics(NRF52RadioStatistics &s)
 {
-    // if (ble_running())
-    //     return DEVICE_NOT_SUPPORTED;
-
-    if (band < 0 || band > 100)
-        return DEVICE_INVALID_PARAMETER;
+    int wasEnabled = NVIC_GetEnableIRQ(RADIO_IRQn);
+    NVIC_DisableIRQ(RADIO_IRQn);
 
-    NRF_RADIO->FREQUENCY = (uint32_t)band;
+    s = stats;
 
-    return DEVICE_OK;
+    if (wasEnabled)
+        NVIC_EnableIRQ(RADIO_IRQn);
 }
 
 /**
-  * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
-  * actively being used by the radio hardware to store incoming data.
-  *
-  * @return a pointer to the current receive buffer.
+  * Resets all radio statistics to zero.
   */
-FrameBuffer* NRF52Radio::getRxBuf()
+void NRF52Radio::resetStatistics()
 {
-    return rxBuf;
+    int wasEnabled = NVIC_GetEnableIRQ(RADIO_IRQn);
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.isrCyclesMin = 0xFFFFFFFF;
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(RADIO_IRQn);
 }
 
 /**
-  * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+  * Determines the number of packets awaiting transmission.
   *
-  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
-  *         could not be allocated (either by policy or memory exhaustion).
+  * @return The number of packets in the transmit queue.
   */
-int NRF52Radio::queueRxBuf()
+int NRF52Radio::txPending()
 {
-    if (rxBuf == NULL)
-        return DEVICE_INVALID_PARAMETER;
-
-    if (queueDepth >= NRF52_RADIO_MAXIMUM_RX_BUFFERS)
-        return DEVICE_NO_RESOURCES;
-
-    // Store the received RSSI value in the frame
-    rxBuf->rssi = getRSSI();
-
-    // Ensure that a replacement buffer is available before queuing.
-    FrameBuffer *newRxBuf = new FrameBuffer();
-
-    if (newRxBuf == NULL)
-        return DEVICE_NO_RESOURCES;
-
-    // We add to the tail of the queue to preserve causal ordering.
-    rxBuf->next = NULL;
-
-    if (rxQueue == NULL)
-    {
-        rxQueue = rxBuf;
-    }
-    else
-    {
-        FrameBuffer *p = rxQueue;
-        while (p->next != NULL)
-            p = p->next;
-
-        p->next = rxBuf;
-    }
-
-    // Increase our received packet count
-    queueDepth++;
-
-    // Allocate a new buffer for the receiver hardware to use. the old on will be passed on to higher layer protocols/apps.
-    rxBuf = newRxBuf;
-
-    return DEVICE_OK;
+    return txQueueDepth;
 }
 
 /**
@@ -264,13 +1179,45 @@ int NRF52Radio::enable()
     // if (ble_running())
     //     return DEVICE_NOT_SUPPORTED;
 
-    // If this is the first time we've been enable, allocate out receive buffers.
+    // If this is the first time we've been enabled, allocate our pool of buffers.
+    // This is the only point at which the radio uses the heap - thereafter frames are recycled through the pool.
+    // Each FrameBuffer is only as large as the maximum payload requires (rounded up to keep them word aligned).
+    if (pool == NULL)
+    {
+        frameSize = (offsetof(FrameBuffer, payload) + maxPacketSize + 3) & ~3;
+        pool = (uint8_t *) malloc(frameSize * NRF52_RADIO_FRAMEBUFFER_POOL_SIZE);
+
+        if (pool == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        for (int i = 0; i < NRF52_RADIO_FRAMEBUFFER_POOL_SIZE; i++)
+            releaseFrameBuffer((FrameBuffer *) (pool + i * frameSize));
+    }
+
     if (rxBuf == NULL)
-        rxBuf = new FrameBuffer();
+        rxBuf = allocateFrameBuffer();
 
     if (rxBuf == NULL)
         return DEVICE_NO_RESOURCES;
 
+    for (int i = 0; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+    {
+        if (keys[i].valid)
+        {
+            if (initialiseCrypto() != DEVICE_OK)
+                return DEVICE_NO_RESOURCES;
+            break;
+        }
+    }
+
+    // Enable the DWT cycle counter, used to time our interrupt handler and transmissions.
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
     // Enable the High Frequency clock on the processor. This is a pre-requisite for
     // the RADIO module. Without this clock, no communication is possible.
     NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
@@ -281,30 +1228,39 @@ int NRF52Radio::enable()
     setTransmitPower(NRF52_RADIO_DEFAULT_TX_POWER);
     setFrequencyBand(NRF52_RADIO_DEFAULT_FREQUENCY);
 
-    // Configure for 1Mbps throughput.
+    // Configure for 1Mbps throughput by default, or whatever has been selected through setMode().
     // This may sound excessive, but running a high data rates reduces the chances of collisions...
-    NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_1Mbit;
+    NRF_RADIO->MODE = mode;
 
     // Configure the addresses we use for this protocol. We run ANONYMOUSLY at the core.
     // A 40 bit addresses is used. The first 32 bits match the ASCII character code for "uBit".
     // Statistically, this provides assurance to avoid other similar 2.4GHz protocols that may be in the vicinity.
     // We also map the assigned 8-bit GROUP id into the PREFIX field. This allows the RADIO hardware to perform
     // address matching for us, and only generate an interrupt when a packet matching our group is received.
+    // Logical addresses 1-7 share BASE1, so we use the same base address there to allow additional groups to be joined.
     NRF_RADIO->BASE0 = NRF52_RADIO_BASE_ADDRESS;
+    NRF_RADIO->BASE1 = NRF52_RADIO_BASE_ADDRESS;
 
-    // Join the default group. This will configure the remaining byte in the RADIO hardware module.
-    setGroup(this->group);
-
-    // The RADIO hardware module supports the use of multiple addresses, but as we're running anonymously, we only need one.
-    // Configure the RADIO module to use the default address (address 0) for both send and receive operations.
+    // The RADIO hardware module supports the use of multiple addresses, one per joined group.
+    // Configure the RADIO module to use the default address (address 0) for send operations, and all joined groups for receive.
+    // This will configure the remaining byte of each address in the RADIO hardware module.
     NRF_RADIO->TXADDRESS = 0;
-    NRF_RADIO->RXADDRESSES = 1;
+    updateAddresses();
 
     // Packet layout configuration. The nrf51822 has a highly capable and flexible RADIO module that, in addition to transmission
     // and reception of data, also contains a LENGTH field, two optional additional 1 byte fields (S0 and S1) and a CRC calculation.
     // Configure the packet format for a simple 8 bit length field and no additional fields.
+    // The 2Mbps modes use a 16 bit preamble, to give the receiver time to lock on at the higher rate.
     NRF_RADIO->PCNF0 = 0x00000008;
-    NRF_RADIO->PCNF1 = 0x02040000 | NRF52_RADIO_MAX_PACKET_SIZE;
+#ifdef RADIO_PCNF0_PLEN_Pos
+    if (mode == RADIO_MODE_MODE_Nrf_2Mbit || mode == RADIO_MODE_MODE_Ble_2Mbit)
+        NRF_RADIO->PCNF0 |= RADIO_PCNF0_PLEN_16bit << RADIO_PCNF0_PLEN_Pos;
+#endif
+    // Unless a different payload size has been chosen, keep the legacy MAXLEN, so we accept exactly what unmodified peers do.
+    if (maxPacketSize == NRF52_RADIO_MAX_PACKET_SIZE)
+        NRF_RADIO->PCNF1 = 0x02040000 | NRF52_RADIO_MAX_PACKET_SIZE;
+    else
+        NRF_RADIO->PCNF1 = 0x02040000 | (maxPacketSize + NRF52_RADIO_HEADER_SIZE - 1);
 
     // Most communication channels contain some form of checksum - a mathematical calculation taken based on all the data
     // in a packet, that is also sent as part of the packet. When received, this calculation can be repeated, and the results
@@ -320,23 +1276,21 @@ int NRF52Radio::enable()
     NRF_RADIO->DATAWHITEIV = 0x18;
 
     // Set up the RADIO module to read and write from our internal buffer.
-    NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
+    NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
 
-    // Configure the hardware to issue an interrupt whenever a task is complete (e.g. send/receive).
-    NRF_RADIO->INTENSET = 0x00000008;
+    // Configure the hardware to issue an interrupt whenever a packet is complete (END),
+    // or the transceiver is switched off ready for a change of direction (DISABLED).
+    NRF_RADIO->INTENSET = RADIO_INTENSET_END_Msk | RADIO_INTENSET_DISABLED_Msk;
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_SetPriority(RADIO_IRQn, 2);
     NVIC_EnableIRQ(RADIO_IRQn);
 
-    NRF_RADIO->SHORTS |= RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
-
-    // Start listening for the next packet
-    NRF_RADIO->EVENTS_READY = 0;
-    NRF_RADIO->TASKS_RXEN = 1;
-    while(NRF_RADIO->EVENTS_READY == 0);
-
+    // Start listening for the next packet. The READY_START short begins reception as soon as the receiver is ready.
+    txState = NRF52_RADIO_TX_IDLE;
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
     NRF_RADIO->EVENTS_END = 0;
-    NRF_RADIO->TASKS_START = 1;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_RXEN = 1;
 
     // register ourselves for a callback event, in order to empty the receive queue.
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
@@ -364,9 +1318,49 @@ int NRF52Radio::disable()
     // Disable interrupts and STOP any ongoing packet reception.
     NVIC_DisableIRQ(RADIO_IRQn);
 
+    NRF_RADIO->SHORTS = 0;
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->TASKS_DISABLE = 1;
     while(NRF_RADIO->EVENTS_DISABLED == 0);
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->EVENTS_END = 0;
+
+    // Abandon any encryption or decryption in progress.
+    if (ccmEnabled)
+    {
+        NVIC_DisableIRQ(CCM_AAR_IRQn);
+        ppi_disable(ccmPpi);
+        NRF_CCM->TASKS_STOP = 1;
+        NRF_CCM->EVENTS_ENDCRYPT = 0;
+        NRF_CCM->EVENTS_ERROR = 0;
+        NVIC_ClearPendingIRQ(CCM_AAR_IRQn);
+
+        releaseFrameBuffer(ccmPlain);
+        ccmPlain = NULL;
+        ccmBusy = false;
+        ccmResult = NRF52_RADIO_CCM_IDLE;
+        txDeferred = false;
+
+        NVIC_EnableIRQ(CCM_AAR_IRQn);
+    }
+
+    // Discard anything still waiting to be sent.
+    while (txQueue)
+    {
+        FrameBuffer *p = txQueue;
+        txQueue = p->next;
+        releaseFrameBuffer(p);
+    }
+
+    txTail = NULL;
+    txQueueDepth = 0;
+    txState = NRF52_RADIO_TX_IDLE;
+
+    if (txWaiting)
+    {
+        txWaiting = false;
+        Event(id, NRF52_RADIO_EVT_TX_COMPLETE);
+    }
 
     // deregister ourselves from the callback event used to empty the receive queue.
     status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
@@ -377,10 +1371,21 @@ int NRF52Radio::disable()
     return DEVICE_OK;
 }
 
+/**
+  * Writes the groups in use to the PREFIX and RXADDRESSES registers of the RADIO hardware.
+  */
+void NRF52Radio::updateAddresses()
+{
+    NRF_RADIO->PREFIX0 = (uint32_t)groups[0] | ((uint32_t)groups[1] << 8) | ((uint32_t)groups[2] << 16) | ((uint32_t)groups[3] << 24);
+    NRF_RADIO->PREFIX1 = (uint32_t)groups[4] | ((uint32_t)groups[5] << 8) | ((uint32_t)groups[6] << 16) | ((uint32_t)groups[7] << 24);
+    NRF_RADIO->RXADDRESSES = groupMask;
+}
+
 /**
   * Sets the radio to listen to packets sent with the given group id.
+  * This is the group used for transmission. Additional groups can be received by using joinGroup().
   *
-  * @param group The group to join. A micro:bit can only listen to one group ID at any time.
+  * @param group The group to join.
   *
   * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
   */
@@ -390,10 +1395,129 @@ int NRF52Radio::setGroup(uint8_t group)
     //     return DEVICE_NOT_SUPPORTED;
 
     // Record our group id locally
-    this->group = group;
+    this->groups[0] = group;
 
     // Also append it to the address of this device, to allow the RADIO module to filter for us.
-    NRF_RADIO->PREFIX0 = (uint32_t)group;
+    updateAddresses();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Additionally listens to packets sent with the given group id.
+  * Up to NRF52_RADIO_MAXIMUM_GROUPS groups (including that given to setGroup()) can be received at once.
+  * Filtering is performed by the RADIO hardware, so packets for other groups never reach the processor.
+  *
+  * @param group The group to join.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no logical addresses are free.
+  */
+int NRF52Radio::joinGroup(uint8_t group)
+{
+    int address = -1;
+
+    for (int i = 0; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+    {
+        if ((groupMask & (1 << i)) && groups[i] == group)
+            return DEVICE_OK;
+
+        if (address < 0 && !(groupMask & (1 << i)))
+            address = i;
+    }
+
+    if (address < 0)
+        return DEVICE_NO_RESOURCES;
+
+    groups[address] = group;
+    groupMask |= (1 << address);
+    updateAddresses();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops listening to packets sent with the given group id, previously joined using joinGroup().
+  *
+  * @param group The group to leave.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the group has not been joined with joinGroup().
+  */
+int NRF52Radio::leaveGroup(uint8_t group)
+{
+    // Address 0 always remains in use, as the group we transmit on.
+    for (int i = 1; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+    {
+        if ((groupMask & (1 << i)) && groups[i] == group)
+        {
+            groupMask &= ~(1 << i);
+            updateAddresses();
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+  * Retrieves the group associated with a logical address, such as that recorded in a received FrameBuffer.
+  *
+  * @param address The logical address, in the range 0..NRF52_RADIO_MAXIMUM_GROUPS-1. Address 0 is the group given to setGroup().
+  *
+  * @return The group id, or DEVICE_INVALID_PARAMETER if the address is not in use.
+  */
+int NRF52Radio::getGroup(int address)
+{
+    if (address < 0 || address >= NRF52_RADIO_MAXIMUM_GROUPS || !(groupMask & (1 << address)))
+        return DEVICE_INVALID_PARAMETER;
+
+    return groups[address];
+}
+
+/**
+  * Registers a handler for packets of the given protocol, replacing any existing handler for that protocol.
+  *
+  * The handler is called from idleCallback() when a packet for the protocol reaches the head of the receive queue.
+  * It should take the packet using recv() and return it to the pool using releaseFrameBuffer() once done.
+  * If it does not call recv(), the packet is discarded on its return.
+  *
+  * Packets for protocols without a handler raise an event with id DEVICE_ID_RADIO_DATA_READY and the protocol number as its value.
+  *
+  * @param protocol The protocol number, as carried in FrameBuffer::protocol.
+  *
+  * @param handler The function to call, or NULL to remove the handler.
+  *
+  * @param arg An argument passed to handler.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if NRF52_RADIO_MAXIMUM_PROTOCOLS handlers are already registered.
+  */
+int NRF52Radio::setProtocolHandler(uint8_t protocol, PVoidCallback handler, void *arg)
+{
+    int i;
+
+    for (i = 0; i < protocolCount; i++)
+        if (protocols[i].protocol == protocol)
+            break;
+
+    if (handler == NULL)
+    {
+        // Keep the table packed, so idleCallback() only scans entries in use.
+        if (i < protocolCount)
+            protocols[i] = protocols[--protocolCount];
+
+        return DEVICE_OK;
+    }
+
+    if (i == protocolCount)
+    {
+        if (protocolCount >= NRF52_RADIO_MAXIMUM_PROTOCOLS)
+            return DEVICE_NO_RESOURCES;
+
+        protocolCount++;
+    }
+
+    protocols[i].protocol = protocol;
+    protocols[i].handler = handler;
+    protocols[i].arg = arg;
 
     return DEVICE_OK;
 }
@@ -402,38 +1526,37 @@ int NRF52Radio::setGroup(uint8_t group)
   * A background, low priority callback that is triggered whenever the processor is idle.
   * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
   */
-
-#include "CodalDmesg.h"
 void NRF52Radio::idleCallback()
 {
     // Walk the list of packets and process each one.
-    while(rxQueue)
+    while(queueDepth)
     {
-        FrameBuffer *p = rxQueue;
+        FrameBuffer *p = rxQueue[rxHead];
+        NRF52RadioProtocol *handler = NULL;
 
-        switch (p->protocol)
+        for (int i = 0; i < protocolCount; i++)
         {
-            case NRF52_RADIO_PROTOCOL_DATAGRAM:
-                datagram.packetReceived();
-                break;
-
-            case NRF52_RADIO_PROTOCOL_EVENTBUS:
-                event.packetReceived();
+            if (protocols[i].protocol == p->protocol)
+            {
+                handler = &protocols[i];
                 break;
-
-            default:
-                Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
+            }
         }
 
+        if (handler)
+            handler->handler(handler->arg);
+        else
+            Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
+
         // If the packet was processed, it will have been recv'd, and taken from the queue.
-        // If this was a packet for an unknown protocol, it will still be there, so simply free it.
-        if (p == rxQueue)
+        // If this was a packet for an unknown protocol, it will still be there, so simply return it to the pool.
+        if (queueDepth && p == rxQueue[rxHead])
         {
             recv();
-            delete p;
+            releaseFrameBuffer(p);
         }
 
-        DMESG("POORECV");
+        NRF52_RADIO_TRACE("POORECV");
         // this is perhaps the wrong event to fire... will do for now.
         Event(this->id, RADIO_EVT_DATA_READY);
     }
@@ -457,34 +1580,36 @@ int NRF52Radio::dataReady()
   * @return The buffer containing the the packet. If no data is available, NULL is returned.
   *
   * @note Once recv() has been called, it is the callers responsibility to
-  *       delete the buffer when appropriate.
+  *       return the buffer to the pool using releaseFrameBuffer() when appropriate.
   */
 FrameBuffer* NRF52Radio::recv()
 {
-    FrameBuffer *p = rxQueue;
+    FrameBuffer *p = NULL;
 
-    if (p)
-    {
-         // Protect shared resource from ISR activity
-        NVIC_DisableIRQ(RADIO_IRQn);
+    // Protect shared resource from ISR activity
+    NVIC_DisableIRQ(RADIO_IRQn);
 
-        rxQueue = rxQueue->next;
+    if (queueDepth)
+    {
+        p = rxQueue[rxHead];
+        rxHead = (rxHead + 1) % NRF52_RADIO_MAXIMUM_RX_BUFFERS;
         queueDepth--;
-
-        // Allow ISR access to shared resource
-        NVIC_EnableIRQ(RADIO_IRQn);
     }
 
+    // Allow ISR access to shared resource
+    NVIC_EnableIRQ(RADIO_IRQn);
+
     return p;
 }
 
 /**
   * Transmits the given buffer onto the broadcast radio.
-  * The call will wait until the transmission of the packet has completed before returning.
+  * The packet is copied into the transmit queue, and the call returns without waiting for transmission to complete.
   *
   * @param data The packet contents to transmit.
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or DEVICE_NO_RESOURCES if the packet could not be queued.
   */
 int NRF52Radio::send(FrameBuffer *buffer)
 {
@@ -494,51 +1619,17 @@ int NRF52Radio::send(FrameBuffer *buffer)
     if (buffer == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (buffer->length > NRF52_RADIO_MAX_PACKET_SIZE + NRF52_RADIO_HEADER_SIZE - 1)
+    if (buffer->length > maxPacketSize + NRF52_RADIO_HEADER_SIZE - 1)
         return DEVICE_INVALID_PARAMETER;
 
-    // Firstly, disable the Radio interrupt. We want to wait until the trasmission completes.
-    NVIC_DisableIRQ(RADIO_IRQn);
-
-    // Turn off the transceiver.
-    NRF_RADIO->EVENTS_DISABLED = 0;
-    NRF_RADIO->TASKS_DISABLE = 1;
-    while(NRF_RADIO->EVENTS_DISABLED == 0);
-
-    // Configure the radio to send the buffer provided.
-    NRF_RADIO->PACKETPTR = (uint32_t) buffer;
+    FrameBuffer *p = getTxBuf();
 
-    // Turn on the transmitter, and wait for it to signal that it's ready to use.
-    NRF_RADIO->EVENTS_READY = 0;
-    NRF_RADIO->TASKS_TXEN = 1;
-    while (NRF_RADIO->EVENTS_READY == 0);
-
-    // Start transmission and wait for end of packet.
-    NRF_RADIO->TASKS_START = 1;
-    NRF_RADIO->EVENTS_END = 0;
-    while(NRF_RADIO->EVENTS_END == 0);
-
-    // Return the radio to using the default receive buffer
-    NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
-
-    // Turn off the transmitter.
-    NRF_RADIO->EVENTS_DISABLED = 0;
-    NRF_RADIO->TASKS_DISABLE = 1;
-    while(NRF_RADIO->EVENTS_DISABLED == 0);
-
-    // Start listening for the next packet
-    NRF_RADIO->EVENTS_READY = 0;
-    NRF_RADIO->TASKS_RXEN = 1;
-    while(NRF_RADIO->EVENTS_READY == 0);
-
-    NRF_RADIO->EVENTS_END = 0;
-    NRF_RADIO->TASKS_START = 1;
+    if (p == NULL)
+        return DEVICE_NO_RESOURCES;
 
-    // Re-enable the Radio interrupt.
-    NVIC_ClearPendingIRQ(RADIO_IRQn);
-    NVIC_EnableIRQ(RADIO_IRQn);
+    memcpy(&p->length, &buffer->length, buffer->length + 1);
 
-    return DEVICE_OK;
+    return queueTxBuf(p);
 }
 
 ManagedBuffer NRF52Radio::recvBuffer()
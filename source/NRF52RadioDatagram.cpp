@@ -52,6 +52,29 @@ using namespace codal;
 NRF52RadioDatagram::NRF52RadioDatagram(NRF52Radio &r) : radio(r)
 {
     this->rxQueue = NULL;
+    this->rxTail = NULL;
+    this->rxQueueDepth = 0;
+}
+
+/**
+  * Removes the packet at the head of the receive queue.
+  *
+  * @return The packet, or NULL if the queue is empty.
+  */
+FrameBuffer* NRF52RadioDatagram::dequeue()
+{
+    FrameBuffer *p = rxQueue;
+
+    if (p)
+    {
+        rxQueue = p->next;
+        rxQueueDepth--;
+
+        if (rxQueue == NULL)
+            rxTail = NULL;
+    }
+
+    return p;
 }
 
 /**
@@ -72,15 +95,14 @@ int NRF52RadioDatagram::recv(uint8_t *buf, int len)
         return DEVICE_INVALID_PARAMETER;
 
     // Take the first buffer from the queue.
-    FrameBuffer *p = rxQueue;
-    rxQueue = rxQueue->next;
+    FrameBuffer *p = dequeue();
 
     int l = min(len, p->length - (NRF52_RADIO_HEADER_SIZE - 1));
 
     // Fill in the buffer provided, if possible.
     memcpy(buf, p->payload, l);
 
-    delete p;
+    radio.releaseFrameBuffer(p);
     return l;
 }
 
@@ -100,55 +122,60 @@ ManagedBuffer NRF52RadioDatagram::recv()
         return ManagedBuffer();
     }
 
-    FrameBuffer *p = rxQueue;
-    rxQueue = rxQueue->next;
+    FrameBuffer *p = dequeue();
 
     DMESG("MAKING buff: %d", p->length - (NRF52_RADIO_HEADER_SIZE - 1));
     ManagedBuffer packet(p->payload, p->length - (NRF52_RADIO_HEADER_SIZE - 1));
     DMESG("DONE");
-    delete p;
+    radio.releaseFrameBuffer(p);
     return packet;
 }
 
 /**
   * Transmits the given buffer onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns without waiting for the transmission
+  * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
   *
   * @param buffer The packet contents to transmit.
   *
   * @param len The number of bytes to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than the radio's maximum packet size,
+  *         or DEVICE_NO_RESOURCES if the packet could not be queued.
   */
 int NRF52RadioDatagram::send(uint8_t *buffer, int len)
 {
-    if (buffer == NULL || len < 0 || len > NRF52_RADIO_MAX_PACKET_SIZE + NRF52_RADIO_HEADER_SIZE - 1)
+    if (buffer == NULL || len < 0 || len > radio.getMaxPacketSize())
         return DEVICE_INVALID_PARAMETER;
 
-    FrameBuffer buf;
+    // Build the packet directly in a buffer from the radio's transmit pool, to avoid an additional copy.
+    FrameBuffer *buf = radio.getTxBuf();
+
+    if (buf == NULL)
+        return DEVICE_NO_RESOURCES;
 
-    buf.length = len + NRF52_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
-    buf.group = 0;
-    buf.protocol = NRF52_RADIO_PROTOCOL_DATAGRAM;
-    memcpy(buf.payload, buffer, len);
+    buf->length = len + NRF52_RADIO_HEADER_SIZE - 1;
+    buf->version = 1;
+    buf->group = 0;
+    buf->protocol = NRF52_RADIO_PROTOCOL_DATAGRAM;
+    memcpy(buf->payload, buffer, len);
 
-    return radio.send(&buf);
+    return radio.queueTxBuf(buf);
 }
 
 /**
   * Transmits the given string onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns without waiting for the transmission
+  * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
   *
   * @param data The packet contents to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than the radio's maximum packet size,
+  *         or DEVICE_NO_RESOURCES if the packet could not be queued.
   */
  #include "CodalDmesg.h"
 int NRF52RadioDatagram::send(ManagedBuffer data)
@@ -164,13 +191,14 @@ int NRF52RadioDatagram::send(ManagedBuffer data)
 /**
   * Transmits the given string onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns without waiting for the transmission
+  * to complete. If the transmit queue is full, the calling fiber is blocked until space is available.
   *
   * @param data The packet contents to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `DEVICE_RADIO_MAX_PACKET_SIZE + DEVICE_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than the radio's maximum packet size,
+  *         or DEVICE_NO_RESOURCES if the packet could not be queued.
   */
 int NRF52RadioDatagram::send(ManagedString data)
 {
@@ -185,32 +213,24 @@ int NRF52RadioDatagram::send(ManagedString data)
 void NRF52RadioDatagram::packetReceived()
 {
     FrameBuffer *packet = radio.recv();
-    int queueDepth = 0;
+
+    if (rxQueueDepth >= NRF52_RADIO_MAXIMUM_RX_BUFFERS)
+    {
+        radio.stats.rxDropProtocol++;
+        radio.releaseFrameBuffer(packet);
+        return;
+    }
 
     // We add to the tail of the queue to preserve causal ordering.
     packet->next = NULL;
 
-    if (rxQueue == NULL)
-    {
-        rxQueue = packet;
-    }
+    if (rxTail)
+        rxTail->next = packet;
     else
-    {
-        FrameBuffer *p = rxQueue;
-        while (p->next != NULL)
-        {
-            p = p->next;
-            queueDepth++;
-        }
-
-        if (queueDepth >= NRF52_RADIO_MAXIMUM_RX_BUFFERS)
-        {
-            delete packet;
-            return;
-        }
-
-        p->next = packet;
-    }
+        rxQueue = packet;
+
+    rxTail = packet;
+    rxQueueDepth++;
 
     Event(DEVICE_ID_RADIO, NRF52_RADIO_EVT_DATAGRAM);
 }
@@ -25,6 +25,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "CodalConfig.h"
 #include "NRF52Radio.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -53,6 +54,9 @@ using namespace codal;
 NRF52RadioEvent::NRF52RadioEvent(NRF52Radio &r) : radio(r)
 {
     this->suppressForwarding = false;
+    this->flushScheduled = false;
+    this->pending = NULL;
+    this->coalesceWindow = 0;
 }
 
 /**
@@ -138,21 +142,91 @@ int NRF52RadioEvent::ignore(uint16_t id, uint16_t value, EventModel &eventBus)
 }
 
 
+/**
+  * Enables or disables coalescing of forwarded events.
+  *
+  * When enabled, events are gathered into a single frame which is transmitted when it is full, or once
+  * the given window has passed since the first event was gathered, whichever is sooner.
+  * This greatly reduces the airtime used by bursts of events, at the cost of some latency.
+  *
+  * @param window The maximum time in microseconds to hold an event before transmission, or zero to send each event immediately.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no default EventModel is available.
+  */
+int NRF52RadioEvent::setCoalescing(uint32_t window)
+{
+    if (EventModel::defaultEventBus == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    if (window && !coalesceWindow)
+        EventModel::defaultEventBus->listen(radio.id, NRF52_RADIO_EVT_EVENT_FLUSH, this, &NRF52RadioEvent::flushTimeout, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+    if (!window && coalesceWindow)
+    {
+        EventModel::defaultEventBus->ignore(radio.id, NRF52_RADIO_EVT_EVENT_FLUSH, this, &NRF52RadioEvent::flushTimeout);
+
+        if (flushScheduled)
+        {
+            system_timer_cancel_event(radio.id, NRF52_RADIO_EVT_EVENT_FLUSH);
+            flushScheduled = false;
+        }
+    }
+
+    coalesceWindow = window;
+
+    // Don't leave anything stranded if coalescing is being turned off.
+    if (!window)
+        flush();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Transmits any coalesced events held in the pending frame.
+  */
+void NRF52RadioEvent::flush()
+{
+    target_disable_irq();
+    FrameBuffer *p = pending;
+    pending = NULL;
+    target_enable_irq();
+
+    if (p)
+        radio.queueTxBuf(p);
+}
+
+/**
+  * Event handler callback, called when a coalescing window expires.
+  */
+void NRF52RadioEvent::flushTimeout(Event)
+{
+    flushScheduled = false;
+    flush();
+}
+
 /**
   * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
   *
-  * This function process this packet, and fires the event contained inside onto the default EventModel.
+  * This function process this packet, and fires the events contained inside onto the default EventModel, in order.
   */
 void NRF52RadioEvent::packetReceived()
 {
     FrameBuffer *p = radio.recv();
-    Event *e = (Event *) p->payload;
+    int count = (p->length - (NRF52_RADIO_HEADER_SIZE - 1)) / sizeof(Event);
 
     suppressForwarding = true;
-    e->fire();
+
+    // Frames from senders not using coalescing simply contain a single event.
+    for (int i = 0; i < count; i++)
+    {
+        Event e;
+        memcpy(&e, p->payload + i * sizeof(Event), sizeof(Event));
+        e.fire();
+    }
+
     suppressForwarding = false;
 
-    delete p;
+    radio.releaseFrameBuffer(p);
 }
 
 /**
@@ -165,13 +239,65 @@ void NRF52RadioEvent::eventReceived(Event e)
     if(suppressForwarding)
         return;
 
-    FrameBuffer buf;
+    // Our own coalescing timer is never forwarded.
+    if (e.source == radio.id && e.value == NRF52_RADIO_EVT_EVENT_FLUSH)
+        return;
+
+    if (coalesceWindow)
+    {
+        target_disable_irq();
+
+        // Append to the frame being gathered, if any.
+        if (pending && pending->length + sizeof(Event) <= (uint32_t) radio.getMaxPacketSize() + NRF52_RADIO_HEADER_SIZE - 1)
+        {
+            memcpy(&pending->version + pending->length, (const uint8_t *)&e, sizeof(Event));
+            pending->length += sizeof(Event);
+
+            bool full = pending->length + sizeof(Event) > (uint32_t) radio.getMaxPacketSize() + NRF52_RADIO_HEADER_SIZE - 1;
+            target_enable_irq();
+
+            if (full)
+                flush();
+
+            return;
+        }
+
+        target_enable_irq();
+
+        // Otherwise, transmit anything already gathered and start a new frame with this event.
+        flush();
+    }
+
+    // We may be called from interrupt context, where we cannot wait for space in the transmit queue. If none is available, the event is dropped.
+    FrameBuffer *buf = radio.getTxBuf();
+
+    if (buf == NULL)
+        return;
+
+    buf->length = sizeof(Event) + NRF52_RADIO_HEADER_SIZE - 1;
+    buf->version = 1;
+    buf->group = 0;
+    buf->protocol = NRF52_RADIO_PROTOCOL_EVENTBUS;
+    memcpy(buf->payload, (const uint8_t *)&e, sizeof(Event));
+
+    if (coalesceWindow)
+    {
+        target_disable_irq();
+        if (pending == NULL)
+        {
+            pending = buf;
+            buf = NULL;
+        }
+        target_enable_irq();
 
-    buf.length = sizeof(Event) + NRF52_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
-    buf.group = 0;
-    buf.protocol = NRF52_RADIO_PROTOCOL_EVENTBUS;
-    memcpy(buf.payload, (const uint8_t *)&e, sizeof(Event));
+        // An earlier window may still be running, in which case this frame goes out when it expires.
+        if (buf == NULL && !flushScheduled)
+        {
+            flushScheduled = true;
+            system_timer_event_after_us(coalesceWindow, radio.id, NRF52_RADIO_EVT_EVENT_FLUSH);
+        }
+    }
 
-    radio.send(&buf);
+    if (buf)
+        radio.queueTxBuf(buf);
 }
@@ -0,0 +1,270 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "NRF52RadioFragmenter.h"
+#include "Event.h"
+#include "Timer.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+
+using namespace codal;
+
+static void fragment_received(void *fragmenter)
+{
+    ((NRF52RadioFragmenter *)fragmenter)->packetReceived();
+}
+
+/**
+  * Constructor.
+  *
+  * Registers a handler for NRF52_RADIO_PROTOCOL_FRAGMENT packets with the radio.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+NRF52RadioFragmenter::NRF52RadioFragmenter(NRF52Radio &r) : radio(r)
+{
+    this->downstream = NULL;
+    this->outputHead = 0;
+    this->outputCount = 0;
+    this->txId = 0;
+
+    radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_FRAGMENT, fragment_received, this);
+}
+
+/**
+  * Destructor.
+  */
+NRF52RadioFragmenter::~NRF52RadioFragmenter()
+{
+    radio.setProtocolHandler(NRF52_RADIO_PROTOCOL_FRAGMENT, NULL, NULL);
+}
+
+/**
+  * Transmits the given buffer onto the broadcast radio, split into as many frames as necessary.
+  *
+  * The fragments are queued for transmission, and this call returns once the last has been queued.
+  * If the transmit queue fills, the calling fiber is blocked until space is available.
+  *
+  * @param data The datagram to transmit, of up to NRF52_RADIO_FRAGMENT_MAX_SIZE bytes.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the datagram is empty or too large,
+  *         or DEVICE_NO_RESOURCES if a fragment could not be queued.
+  */
+int NRF52RadioFragmenter::send(ManagedBuffer data)
+{
+    NRF52RadioFragmentHeader header;
+    int length = data.length();
+    int chunk = radio.getMaxPacketSize() - NRF52_RADIO_FRAGMENT_HEADER_SIZE;
+
+    // Leave room for the MIC and nonce if the radio is going to encrypt the fragments.
+    if (radio.getEncryptionKey(radio.groups[0]))
+        chunk -= NRF52_RADIO_CCM_OVERHEAD;
+
+    if (length == 0 || length > NRF52_RADIO_FRAGMENT_MAX_SIZE || chunk <= 0 || (length + chunk - 1) / chunk > NRF52_RADIO_FRAGMENT_MAX_FRAGMENTS)
+        return DEVICE_INVALID_PARAMETER;
+
+    header.sender = NRF_FICR->DEVICEID[0];
+    header.length = length;
+    header.id = txId++;
+    header.index = 0;
+    header.chunk = chunk;
+
+    for (int offset = 0; offset < length; offset += chunk)
+    {
+        int len = min(chunk, length - offset);
+
+        // Build each fragment directly in a buffer from the radio's transmit pool. This blocks if the queue is full.
+        FrameBuffer *buf = radio.getTxBuf();
+
+        if (buf == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        buf->length = NRF52_RADIO_FRAGMENT_HEADER_SIZE + len + NRF52_RADIO_HEADER_SIZE - 1;
+        buf->version = 1;
+        buf->group = 0;
+        buf->protocol = NRF52_RADIO_PROTOCOL_FRAGMENT;
+        memcpy(buf->payload, &header, NRF52_RADIO_FRAGMENT_HEADER_SIZE);
+        memcpy(buf->payload + NRF52_RADIO_FRAGMENT_HEADER_SIZE, data.getBytes() + offset, len);
+
+        int result = radio.queueTxBuf(buf);
+
+        if (result != DEVICE_OK)
+            return result;
+
+        header.index++;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Finds the reassembly entry for the given datagram, creating one if necessary.
+  *
+  * @return The entry, or NULL if memory for the datagram could not be allocated.
+  */
+NRF52RadioReassembly* NRF52RadioFragmenter::lookup(const NRF52RadioFragmentHeader &header, uint8_t group)
+{
+    uint16_t length = header.length;
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    NRF52RadioReassembly *oldest = NULL;
+
+    for (int i = 0; i < NRF52_RADIO_FRAGMENT_CACHE_SIZE; i++)
+    {
+        NRF52RadioReassembly *r = &cache[i];
+
+        // Discard any datagram that has stopped arriving.
+        if (r->data.length() && now - r->timestamp > NRF52_RADIO_FRAGMENT_TIMEOUT)
+            r->data = ManagedBuffer();
+
+        if (r->data.length() && r->group == group && r->sender == header.sender && r->id == header.id)
+        {
+            if (r->data.length() == length && r->chunk == header.chunk)
+                return r;
+
+            // The sender has reused the sequence number for a different datagram, so abandon the old one.
+            r->data = ManagedBuffer();
+            oldest = r;
+            break;
+        }
+
+        if (oldest == NULL || r->data.length() == 0 || (oldest->data.length() && r->timestamp < oldest->timestamp))
+            oldest = r;
+    }
+
+    // Start a new datagram, evicting the least recently active one if the cache is full.
+    oldest->data = ManagedBuffer(length);
+
+    if (oldest->data.length() != length)
+    {
+        oldest->data = ManagedBuffer();
+        return NULL;
+    }
+
+    oldest->sender = header.sender;
+    oldest->group = group;
+    oldest->id = header.id;
+    oldest->chunk = header.chunk;
+    oldest->received = 0;
+    oldest->timestamp = now;
+    memset(oldest->fragments, 0, sizeof(oldest->fragments));
+
+    return oldest;
+}
+
+/**
+  * Provide the next reassembled datagram to our downstream caller, if available.
+  *
+  * @return The datagram, or an empty ManagedBuffer if none is available.
+  */
+ManagedBuffer NRF52RadioFragmenter::pull()
+{
+    ManagedBuffer b;
+
+    if (outputCount)
+    {
+        b = output[outputHead];
+        output[outputHead] = ManagedBuffer();
+        outputHead = (outputHead + 1) % NRF52_RADIO_FRAGMENT_QUEUE_SIZE;
+        outputCount--;
+    }
+
+    return b;
+}
+
+/**
+  * Update our reference to a downstream component.
+  */
+void NRF52RadioFragmenter::connect(DataSink &sink)
+{
+    downstream = &sink;
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a fragment.
+  */
+void NRF52RadioFragmenter::packetReceived()
+{
+    NRF52RadioFragmentHeader header;
+    FrameBuffer *packet = radio.recv();
+    int len = packet->length - (NRF52_RADIO_HEADER_SIZE - 1) - NRF52_RADIO_FRAGMENT_HEADER_SIZE;
+
+    if (len <= 0)
+    {
+        radio.stats.rxDropProtocol++;
+        radio.releaseFrameBuffer(packet);
+        return;
+    }
+
+    memcpy(&header, packet->payload, NRF52_RADIO_FRAGMENT_HEADER_SIZE);
+
+    // Each fragment must exactly fill its slot in the datagram, so distinct fragments can never overlap.
+    int offset = header.index * header.chunk;
+    int group = radio.getGroup(packet->address);
+
+    if (group < 0 || header.length > NRF52_RADIO_FRAGMENT_MAX_SIZE || offset >= header.length || len != min((int)header.chunk, header.length - offset))
+    {
+        radio.stats.rxDropProtocol++;
+        radio.releaseFrameBuffer(packet);
+        return;
+    }
+
+    NRF52RadioReassembly *r = lookup(header, group);
+    uint8_t bit = 1 << (header.index & 7);
+
+    // Ignore fragments we can't store, or have already seen (e.g. a retransmission).
+    if (r == NULL || (r->fragments[header.index >> 3] & bit))
+    {
+        radio.releaseFrameBuffer(packet);
+        return;
+    }
+
+    memcpy(r->data.getBytes() + offset, packet->payload + NRF52_RADIO_FRAGMENT_HEADER_SIZE, len);
+    radio.releaseFrameBuffer(packet);
+
+    r->fragments[header.index >> 3] |= bit;
+    r->received += len;
+    r->timestamp = system_timer_current_time();
+
+    if (r->received < header.length)
+        return;
+
+    // The datagram is complete. Hand over the buffer we reassembled into, rather than copying it.
+    if (outputCount >= NRF52_RADIO_FRAGMENT_QUEUE_SIZE)
+    {
+        radio.stats.rxDropQueueFull++;
+        r->data = ManagedBuffer();
+        return;
+    }
+
+    output[(outputHead + outputCount) % NRF52_RADIO_FRAGMENT_QUEUE_SIZE] = r->data;
+    outputCount++;
+    r->data = ManagedBuffer();
+
+    Event(radio.id, NRF52_RADIO_EVT_REASSEMBLED);
+
+    if (downstream)
+        downstream->pullRequest();
+}
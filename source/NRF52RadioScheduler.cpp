@@ -0,0 +1,421 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "NRF52RadioScheduler.h"
+#include "Event.h"
+#include "ErrorNo.h"
+#include "ppi_alloc.h"
+#include "nrf.h"
+
+using namespace codal;
+
+static NRF52RadioScheduler *instance = NULL;
+
+static void tdma_slot_irq(uint16_t mask)
+{
+    if (instance && (mask & 0x01))
+        instance->onSlot();
+}
+
+/**
+  * Constructor.
+  *
+  * @param radio The radio to schedule.
+  *
+  * @param timer The timer module used to time slots. This is configured for 1MHz, 32 bit operation.
+  */
+NRF52RadioScheduler::NRF52RadioScheduler(NRF52Radio &radio, NRFLowLevelTimer &timer) : radio(radio), timer(timer)
+{
+    this->beacon = NULL;
+    this->slotTime = 0;
+    this->frameStart = 0;
+    this->superframe = 0;
+    this->listenMask = 0xFFFFFFFF;
+    this->slotCount = 0;
+    this->txSlot = 0;
+    this->slot = 0;
+    this->missedBeacons = 0;
+    this->coordinator = false;
+    this->synchronised = false;
+    this->beaconReceived = false;
+    this->running = false;
+
+    for (int i = 0; i < NRF52_RADIO_TDMA_PPI_CHANNELS; i++)
+        ppi[i] = -1;
+
+    instance = this;
+}
+
+/**
+  * Releases the PPI channels in use, if any.
+  */
+void NRF52RadioScheduler::releasePpi()
+{
+    for (int i = 0; i < NRF52_RADIO_TDMA_PPI_CHANNELS; i++)
+    {
+        if (ppi[i] >= 0)
+            ppi_disconnect(ppi[i]);
+
+        ppi[i] = -1;
+    }
+}
+
+/**
+  * Starts slotted operation of the radio. The radio is enabled if necessary.
+  *
+  * @param slotTime The length of each slot, in microseconds. This must be long enough to transmit a maximum length packet,
+  *                 plus NRF52_RADIO_TDMA_GUARD_TIME.
+  *
+  * @param slotCount The number of slots in each superframe, including the beacon slot, in the range 2..NRF52_RADIO_TDMA_MAXIMUM_SLOTS.
+  *
+  * @param txSlot The slot in which this node transmits, in the range 1..slotCount-1.
+  *
+  * @param coordinator true if this node should transmit the beacon that synchronises all other nodes.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_NOT_SUPPORTED if an encryption key
+  *         is set, or DEVICE_NO_RESOURCES if the radio could not be enabled.
+  *
+  * @note Slotted operation does not encrypt. Rather than silently send in the clear, it refuses to start while any group has a key.
+  */
+int NRF52RadioScheduler::start(uint32_t slotTime, uint8_t slotCount, uint8_t txSlot, bool coordinator)
+{
+    if (slotTime <= NRF52_RADIO_TDMA_GUARD_TIME || slotCount < 2 || slotCount > NRF52_RADIO_TDMA_MAXIMUM_SLOTS || txSlot == 0 || txSlot >= slotCount)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < NRF52_RADIO_MAXIMUM_GROUPS; i++)
+        if (radio.keys[i].valid)
+            return DEVICE_NOT_SUPPORTED;
+
+    if (running)
+        stop();
+
+    if (radio.enable() != DEVICE_OK)
+        return DEVICE_NO_RESOURCES;
+
+    for (int i = 0; i < NRF52_RADIO_TDMA_PPI_CHANNELS; i++)
+    {
+        ppi[i] = allocate_ppi_channel();
+
+        if (ppi[i] < 0)
+        {
+            releasePpi();
+            return DEVICE_NO_RESOURCES;
+        }
+    }
+
+    if (coordinator)
+    {
+        beacon = radio.allocateFrameBuffer();
+
+        if (beacon == NULL)
+        {
+            releasePpi();
+            return DEVICE_NO_RESOURCES;
+        }
+    }
+
+    this->slotTime = slotTime;
+    this->slotCount = slotCount;
+    this->txSlot = txSlot;
+    this->coordinator = coordinator;
+    this->superframe = 0;
+    this->synchronised = false;
+
+    // Configure as a free running 1MHz timer. Slot boundaries are scheduled on CC0, and the radio is enabled on CC1.
+    timer.disable();
+    timer.setMode(TimerMode::TimerModeTimer);
+    timer.setClockSpeed(1000);
+    timer.setBitMode(BitMode32);
+    timer.setIRQ(tdma_slot_irq);
+
+    // Use PPI to switch the radio at slot boundaries, and to timestamp incoming beacons.
+    for (int i = 0; i < NRF52_RADIO_TDMA_PPI_CHANNELS; i++)
+        ppi_disable(ppi[i]);
+
+    ppi_route(ppi[NRF52_RADIO_TDMA_PPI_DISABLE], &timer.timer->EVENTS_COMPARE[0], &NRF_RADIO->TASKS_DISABLE);
+    ppi_route(ppi[NRF52_RADIO_TDMA_PPI_TXEN], &timer.timer->EVENTS_COMPARE[1], &NRF_RADIO->TASKS_TXEN);
+    ppi_route(ppi[NRF52_RADIO_TDMA_PPI_RXEN], &timer.timer->EVENTS_COMPARE[1], &NRF_RADIO->TASKS_RXEN);
+    ppi_route(ppi[NRF52_RADIO_TDMA_PPI_CAPTURE], &NRF_RADIO->EVENTS_ADDRESS, &timer.timer->TASKS_CAPTURE[2]);
+    ppi_enable(ppi[NRF52_RADIO_TDMA_PPI_CAPTURE]);
+
+    timer.reset();
+    timer.enable();
+
+    // From here on, the radio no longer transmits on demand.
+    NVIC_DisableIRQ(RADIO_IRQn);
+    radio.scheduler = this;
+    running = true;
+
+    // The coordinator defines the timing, so starts the first superframe straight away.
+    // Other nodes listen continuously until they hear a beacon.
+    if (coordinator)
+        synchronise(timer.captureCounter() + slotTime, 0);
+
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops slotted operation, returning the radio to continuous reception.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52RadioScheduler::stop()
+{
+    if (!running)
+        return DEVICE_OK;
+
+    timer.disable();
+    timer.clearCompare(0);
+    releasePpi();
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    radio.scheduler = NULL;
+    radio.releaseFrameBuffer(beacon);
+    beacon = NULL;
+    synchronised = false;
+    running = false;
+
+    // Return to continuous reception, and send anything that queued up while we were waiting for our slot.
+    if (radio.status & NRF52_RADIO_STATUS_INITIALISED)
+    {
+        radio.txState = NRF52_RADIO_TX_IDLE;
+        NRF_RADIO->PACKETPTR = (uint32_t) &radio.rxBuf->length;
+        NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+
+        if (radio.txQueue)
+        {
+            radio.txState = NRF52_RADIO_TX_PENDING;
+            NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk;
+
+            if (NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled)
+                radio.startTx();
+            else
+                NRF_RADIO->TASKS_DISABLE = 1;
+        }
+        else if (NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled)
+        {
+            NRF_RADIO->TASKS_RXEN = 1;
+        }
+    }
+
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Selects the slots in which this node listens.
+  * By default, a node listens in every slot other than its own.
+  *
+  * @param mask A bitmask of slots. Bit n enables reception in slot n. Slot 0 (the beacon) is always received by non-coordinators.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52RadioScheduler::setListenSlots(uint32_t mask)
+{
+    listenMask = mask;
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if this node's slot timing is aligned with the coordinator.
+  *
+  * @return true if synchronised (always true for the coordinator).
+  */
+bool NRF52RadioScheduler::isSynchronised()
+{
+    return running && synchronised;
+}
+
+/**
+  * Configures the radio to receive from the start of the current slot.
+  */
+void NRF52RadioScheduler::prepareRx()
+{
+    NRF_RADIO->PACKETPTR = (uint32_t) &radio.rxBuf->length;
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+    ppi_enable(ppi[NRF52_RADIO_TDMA_PPI_RXEN]);
+}
+
+/**
+  * Configures the radio to transmit the given frame at the start of the current slot.
+  */
+void NRF52RadioScheduler::prepareTx(FrameBuffer *buffer, uint8_t state)
+{
+    // The radio turns itself off once the packet is sent, and stays off until the next slot we're interested in.
+    NRF_RADIO->PACKETPTR = (uint32_t) &buffer->length;
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk;
+
+    radio.txChained = false;
+    radio.txState = state;
+    radio.txStartCycles = DWT->CYCCNT;
+
+    ppi_enable(ppi[NRF52_RADIO_TDMA_PPI_TXEN]);
+}
+
+/**
+  * Aligns our slots to the given superframe start time, and starts slotted operation.
+  *
+  * @param start The timer value at the start of the superframe.
+  *
+  * @param next The first slot boundary to schedule.
+  */
+void NRF52RadioScheduler::synchronise(uint32_t start, uint8_t next)
+{
+    frameStart = start;
+    slot = next;
+    missedBeacons = 0;
+    beaconReceived = true;
+
+    // Continuous reception stops at the next slot boundary. From then on, the radio is driven by the timer.
+    ppi_enable(ppi[NRF52_RADIO_TDMA_PPI_DISABLE]);
+    timer.setCompare(0, frameStart + slot * slotTime);
+    timer.enableIRQ();
+
+    if (!synchronised)
+    {
+        synchronised = true;
+        Event(radio.id, NRF52_RADIO_EVT_TDMA_SYNC);
+    }
+}
+
+/**
+  * Stops slotted operation, and listens continuously for a beacon.
+  */
+void NRF52RadioScheduler::unsynchronise()
+{
+    synchronised = false;
+
+    timer.clearCompare(0);
+    NRF_PPI->CHENCLR = (1 << ppi[NRF52_RADIO_TDMA_PPI_DISABLE]) | (1 << ppi[NRF52_RADIO_TDMA_PPI_TXEN]) | (1 << ppi[NRF52_RADIO_TDMA_PPI_RXEN]);
+
+    radio.txState = NRF52_RADIO_TX_IDLE;
+    NRF_RADIO->PACKETPTR = (uint32_t) &radio.rxBuf->length;
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+
+    if (NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled)
+        NRF_RADIO->TASKS_RXEN = 1;
+
+    Event(radio.id, NRF52_RADIO_EVT_TDMA_LOST);
+}
+
+/**
+  * Timer interrupt handler, called at each slot boundary.
+  */
+void NRF52RadioScheduler::onSlot()
+{
+    // The radio has just been disabled by PPI. Decide what it should do in the slot that is starting.
+    uint32_t boundary = frameStart + slot * slotTime;
+
+    NRF_PPI->CHENCLR = (1 << ppi[NRF52_RADIO_TDMA_PPI_TXEN]) | (1 << ppi[NRF52_RADIO_TDMA_PPI_RXEN]);
+    timer.timer->CC[1] = boundary + NRF52_RADIO_TDMA_GUARD_TIME;
+
+    // Anything still transmitting overran its slot. It remains in the queue, and is retried in our next slot.
+    radio.txState = NRF52_RADIO_TX_IDLE;
+
+    if (slot == 0)
+    {
+        if (coordinator)
+        {
+            NRF52RadioBeacon b;
+
+            b.superframe = superframe++;
+            b.slotTime = slotTime;
+            b.slotCount = slotCount;
+
+            beacon->length = sizeof(NRF52RadioBeacon) + NRF52_RADIO_HEADER_SIZE - 1;
+            beacon->version = 1;
+            beacon->group = 0;
+            beacon->protocol = NRF52_RADIO_PROTOCOL_BEACON;
+            memcpy(beacon->payload, &b, sizeof(NRF52RadioBeacon));
+
+            prepareTx(beacon, NRF52_RADIO_TX_BEACON);
+        }
+        else
+        {
+            if (!beaconReceived && ++missedBeacons >= NRF52_RADIO_TDMA_MAX_MISSED_BEACONS)
+            {
+                unsynchronise();
+                return;
+            }
+
+            beaconReceived = false;
+            prepareRx();
+        }
+    }
+    else if (slot == txSlot)
+    {
+        if (radio.txQueue)
+            prepareTx(radio.txQueue, NRF52_RADIO_TX_ACTIVE);
+    }
+    else if (listenMask & (1 << slot))
+    {
+        prepareRx();
+    }
+
+    // Schedule the next slot boundary.
+    slot++;
+
+    if (slot >= slotCount)
+    {
+        slot = 0;
+        frameStart += slotCount * slotTime;
+    }
+
+    timer.setCompare(0, frameStart + slot * slotTime);
+}
+
+/**
+  * Called by NRF52Radio when a beacon is received.
+  *
+  * @param buffer The frame containing the beacon.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void NRF52RadioScheduler::onBeacon(FrameBuffer *buffer)
+{
+    NRF52RadioBeacon b;
+
+    // The timer captured the time of the ADDRESS event for us, through PPI.
+    uint32_t capture = timer.timer->CC[2];
+
+    if (coordinator || buffer->length < sizeof(NRF52RadioBeacon) + NRF52_RADIO_HEADER_SIZE - 1)
+        return;
+
+    memcpy(&b, buffer->payload, sizeof(NRF52RadioBeacon));
+
+    // Ignore coordinators running a different schedule.
+    if (b.slotTime != slotTime || b.slotCount != slotCount)
+        return;
+
+    superframe = b.superframe;
+
+    // Beacons are sent in slot 0, so the next boundary is the start of slot 1.
+    synchronise(capture - NRF52_RADIO_TDMA_BEACON_DELAY, 1);
+}
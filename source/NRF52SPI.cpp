@@ -30,6 +30,7 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/types/Event.h"
 #include "CodalFiber.h"
 #include "peripheral_alloc.h"
+#include "ppi_alloc.h"
 
 #if defined(NRF52840_XXAA) || defined(NRF52833_XXAA)
 #define SZLIMIT 0xffff
@@ -40,6 +41,23 @@ DEALINGS IN THE SOFTWARE.
 namespace codal
 {
 
+// The counter timer's interrupt handler is not told which timer fired, so each timer has its own handler,
+// dispatching to the SPI (if any) that is counting transfers with it.
+#define PERIODIC_TIMERS     5
+
+static NRF52SPI *periodic_instances[PERIODIC_TIMERS] = { NULL };
+
+static int periodic_slot(NRFLowLevelTimer &counter)
+{
+    NRF_TIMER_Type *const timers[PERIODIC_TIMERS] = { NRF_TIMER0, NRF_TIMER1, NRF_TIMER2, NRF_TIMER3, NRF_TIMER4 };
+
+    for (int i = 0; i < PERIODIC_TIMERS; i++)
+        if (counter.timer == timers[i])
+            return i;
+
+    return -1;
+}
+
 /**
  * Constructor.
  */
@@ -58,6 +76,25 @@ NRF52SPI::NRF52SPI(Pin &mosi, Pin &miso, Pin &sclk, NRF_SPIM_Type *device)
     setFrequency(1000000);
     setMode(0);
     doneHandler = NULL;
+    busy = false;
+    queueActive = false;
+    queue = NULL;
+    queueTail = NULL;
+    periodicTrigger = NULL;
+    for (int i = 0; i < NRF52_SPI_PPI_CHANNELS; i++)
+        periodicPpi[i] = -1;
+    periodicGroup = -1;
+    periodicCounter = NULL;
+    periodicBuffer = NULL;
+    periodicBlockSize = 0;
+    blockHandler = NULL;
+    blockHandlerArg = NULL;
+    segTx = NULL;
+    segTxRemaining = 0;
+    segRx = NULL;
+    segRxRemaining = 0;
+    bounce = NULL;
+    bounceSize = 0;
     set_alloc_peri_irq(p_spim, &_irqDoneHandler, this);
 }
 
@@ -69,7 +106,38 @@ void NRF52SPI::_irqDoneHandler(void *self_)
     {
         nrf_spim_event_clear(self->p_spim, NRF_SPIM_EVENT_END);
 
-        if (self->doneHandler)
+        // Move straight on to the next segment of a large transfer.
+        if (self->segTxRemaining || self->segRxRemaining)
+        {
+            self->startSegment();
+            return;
+        }
+
+        self->releaseBounce();
+
+        NRF52SPITransaction *t = NULL;
+
+        if (self->queueActive)
+        {
+            t = self->queue;
+            self->queue = t->next;
+            if (self->queue == NULL)
+                self->queueTail = NULL;
+            self->queueActive = false;
+        }
+
+        self->busy = false;
+
+        // Keep the bus busy: start the next queued transfer before running any completion handler.
+        if (self->queue)
+            self->startQueued();
+
+        if (t)
+        {
+            if (t->doneHandler)
+                t->doneHandler(t->doneHandlerArg);
+        }
+        else if (self->doneHandler)
         {
             PVoidCallback done = self->doneHandler;
             self->doneHandler = NULL;
@@ -82,19 +150,394 @@ void NRF52SPI::_irqDoneHandler(void *self_)
     }
 }
 
-int NRF52SPI::xfer(uint8_t const *p_tx_buffer, uint32_t tx_length, uint8_t *p_rx_buffer,
-                   uint32_t rx_length, PVoidCallback doneHandler, void *arg)
+/**
+ * Starts the next segment of the transfer in progress, of at most SZLIMIT bytes in each direction.
+ *
+ * Both directions advance together, so the bytes clocked in each segment line up with those in a single
+ * transfer of the whole buffers. If the data to send is out of reach of EasyDMA, each segment is limited to
+ * the size of the bounce buffer, and copied into it first.
+ */
+void NRF52SPI::startSegment()
+{
+    uint32_t limit = bounce ? bounceSize : (uint32_t)SZLIMIT;
+    uint32_t txLen = min(segTxRemaining, limit);
+    uint32_t rxLen = min(segRxRemaining, limit);
+    const uint8_t *tx = segTx;
+
+    if (bounce)
+    {
+        memcpy(bounce, segTx, txLen);
+        tx = bounce;
+    }
+
+    nrf_spim_tx_buffer_set(p_spim, tx, txLen);
+    nrf_spim_rx_buffer_set(p_spim, segRx, rxLen);
+
+    segTx += txLen;
+    segTxRemaining -= txLen;
+    segRx += rxLen;
+    segRxRemaining -= rxLen;
+
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
+    nrf_spim_task_trigger(p_spim, NRF_SPIM_TASK_START);
+}
+
+/**
+ * Starts a transfer of any length. Transfers larger than a single EasyDMA transfer are split into segments,
+ * each started from the END interrupt of the one before.
+ */
+void NRF52SPI::startDma(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer, uint32_t rxSize)
+{
+    if (!is_dma_capable(txBuffer, txSize))
+        acquireBounce(min(txSize, (uint32_t)DMA_BOUNCE_BUFFER_SIZE));
+
+    segTx = txBuffer;
+    segTxRemaining = txSize;
+    segRx = rxBuffer;
+    segRxRemaining = rxSize;
+
+    nrf_spim_tx_list_disable(p_spim);
+    nrf_spim_rx_list_disable(p_spim);
+
+    startSegment();
+    nrf_spim_int_enable(p_spim, NRF_SPIM_INT_END_MASK);
+}
+
+/**
+ * Obtains a RAM buffer to stage the data to send through, for data EasyDMA can't reach.
+ * If no memory is available, the data is sent one byte at a time through sendCh instead.
+ */
+void NRF52SPI::acquireBounce(uint32_t size)
+{
+    bounce = allocate_dma_buffer(size);
+    bounceSize = size;
+
+    if (bounce == NULL)
+    {
+        bounce = &sendCh;
+        bounceSize = 1;
+    }
+}
+
+/**
+ * Returns the buffer obtained by acquireBounce(), if any.
+ */
+void NRF52SPI::releaseBounce()
+{
+    if (bounce != &sendCh)
+        free_dma_buffer(bounce);
+
+    bounce = NULL;
+    bounceSize = 0;
+}
+
+/**
+ * Programs the SPIM with the transaction at the head of the queue, and starts it.
+ */
+void NRF52SPI::startQueued()
+{
+    NRF52SPITransaction *t = queue;
+
+    busy = true;
+    queueActive = true;
+
+    startDma(t->txBuffer, t->txSize, t->rxBuffer, t->rxSize);
+}
+
+/**
+ * Adds a transfer to the queue. Queued transfers run back to back, each started from the END interrupt
+ * of the one before, and never require a fiber to be scheduled.
+ *
+ * @param t The transaction.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the transaction is NULL,
+ *         or DEVICE_BUSY if periodic transfers are running.
+ */
+int NRF52SPI::queueTransfer(NRF52SPITransaction *t)
 {
+    if (t == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (periodicTrigger)
+        return DEVICE_BUSY;
+
     config();
 
-    if (tx_length > SZLIMIT || rx_length > SZLIMIT)
+    t->next = NULL;
+
+    NVIC_DisableIRQ(IRQn);
+
+    if (queueTail)
+        queueTail->next = t;
+    else
+        queue = t;
+
+    queueTail = t;
+
+    if (!busy)
+        startQueued();
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Counter timer interrupt handler, called as each block of periodic samples is completed.
+ */
+template <int timer>
+void NRF52SPI::_blockDoneHandler(uint16_t channels)
+{
+    if (periodic_instances[timer])
+        periodic_instances[timer]->blockDone(channels);
+}
+
+/**
+ * Handles the completion of one or both blocks of periodic samples, on the counter timer's interrupt.
+ *
+ * COMPARE0 marks the end of the first block, and COMPARE1 the end of the second.
+ */
+void NRF52SPI::blockDone(uint16_t channels)
+{
+    if (channels & 0x01)
+    {
+        // ArrayList mode moves straight on from the first block into the second.
+        if (blockHandler)
+            blockHandler(blockHandlerArg, periodicBuffer);
+    }
+
+    if (channels & 0x02)
+    {
+        // PPI disarmed the trigger as the second block filled, so the SPIM is idle. Send it back to the start
+        // of the first block, and rearm. If we were late, the triggers missed in the meantime are simply dropped.
+        p_spim->RXD.PTR = (uint32_t)periodicBuffer;
+        ppi_enable(periodicPpi[NRF52_SPI_PPI_TRIGGER]);
+
+        if (blockHandler)
+            blockHandler(blockHandlerArg, periodicBuffer + periodicBlockSize);
+    }
+}
+
+/**
+ * Starts repeating the same transfer at a fixed rate, entirely in hardware.
+ *
+ * A timer compare starts the SPIM through PPI every period. The received bytes are stored back to back
+ * using EasyDMA ArrayList mode, and a second timer counts completed transfers through PPI, so the CPU is only
+ * interrupted once a block of samples is full. Reception alternates between two blocks, so the handler
+ * has a full block period to consume each one.
+ *
+ * @param trigger A timer dedicated to timing transfers. It is configured for 1MHz operation.
+ * @param counter A timer dedicated to counting transfers. It is placed in counter mode.
+ * @param period The time between transfers, in microseconds.
+ * @param txBuffer The bytes to send in each transfer (e.g. a register read command).
+ * @param txSize The number of bytes to send in each transfer.
+ * @param rxBuffer An array of 2 * samples * rxSize bytes, receiving two blocks of samples.
+ * @param rxSize The number of bytes to receive in each transfer.
+ * @param samples The number of transfers in each block.
+ * @param handler Called (in IRQ context) as each block is completed.
+ * @param arg An argument passed to handler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_BUSY if
+ *         a transfer is in progress, or DEVICE_NO_RESOURCES if txBuffer is in flash and can't be copied to RAM,
+ *         or too few PPI channels are free.
+ */
+int NRF52SPI::startPeriodic(NRFLowLevelTimer &trigger, NRFLowLevelTimer &counter, uint32_t period, const uint8_t *txBuffer,
+                            uint32_t txSize, uint8_t *rxBuffer, uint32_t rxSize, uint32_t samples,
+                            NRF52SPIBlockCallback handler, void *arg)
+{
+    if (period == 0 || samples == 0 || rxBuffer == NULL || rxSize == 0 || txSize > SZLIMIT || rxSize > SZLIMIT)
         return DEVICE_INVALID_PARAMETER;
 
-    nrf_spim_tx_buffer_set(p_spim, p_tx_buffer, tx_length);
-    nrf_spim_rx_buffer_set(p_spim, p_rx_buffer, rx_length);
-    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
+    static void (*const handlers[PERIODIC_TIMERS])(uint16_t) = {
+        _blockDoneHandler<0>, _blockDoneHandler<1>, _blockDoneHandler<2>, _blockDoneHandler<3>, _blockDoneHandler<4>
+    };
+
+    int slot = periodic_slot(counter);
+
+    if (slot < 0 || &trigger == &counter)
+        return DEVICE_INVALID_PARAMETER;
+
+    config();
+
+    NVIC_DisableIRQ(IRQn);
+
+    if (busy || periodic_instances[slot])
+    {
+        NVIC_EnableIRQ(IRQn);
+        return DEVICE_BUSY;
+    }
+
+    busy = true;
+    NVIC_EnableIRQ(IRQn);
+
+    periodic_instances[slot] = this;
+    periodicTrigger = &trigger;
+    periodicCounter = &counter;
+    periodicBuffer = rxBuffer;
+    periodicBlockSize = samples * rxSize;
+    blockHandler = handler;
+    blockHandlerArg = arg;
+
+    // Don't wake the CPU for each transfer.
+    nrf_spim_int_disable(p_spim, NRF_SPIM_INT_END_MASK);
+
+    // The command is sent for every transfer, so keep a copy in RAM for the duration if EasyDMA can't reach it.
+    if (!is_dma_capable(txBuffer, txSize))
+    {
+        bounce = allocate_dma_buffer(txSize);
+
+        if (bounce == NULL)
+        {
+            periodic_instances[slot] = NULL;
+            periodicTrigger = NULL;
+            busy = false;
+            return DEVICE_NO_RESOURCES;
+        }
+
+        memcpy(bounce, txBuffer, txSize);
+        txBuffer = bounce;
+    }
+
+    bool allocated = true;
+
+    for (int i = 0; i < NRF52_SPI_PPI_CHANNELS; i++)
+        if ((periodicPpi[i] = allocate_ppi_channel()) < 0)
+            allocated = false;
+
+    periodicGroup = allocate_ppi_group();
+
+    if (!allocated || periodicGroup < 0)
+    {
+        for (int i = 0; i < NRF52_SPI_PPI_CHANNELS; i++)
+        {
+            free_ppi_channel(periodicPpi[i]);
+            periodicPpi[i] = -1;
+        }
+
+        free_ppi_group(periodicGroup);
+        periodicGroup = -1;
+
+        free_dma_buffer(bounce);
+        bounce = NULL;
+        periodic_instances[slot] = NULL;
+        periodicTrigger = NULL;
+        busy = false;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    // Send the same bytes every time, but store what we receive back to back.
+    nrf_spim_tx_buffer_set(p_spim, txBuffer, txSize);
+    nrf_spim_rx_buffer_set(p_spim, rxBuffer, rxSize);
     nrf_spim_tx_list_disable(p_spim);
+    nrf_spim_rx_list_enable(p_spim);
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
+
+    // Interrupt once per block, counting over both blocks.
+    counter.disable();
+    counter.setMode(TimerMode::TimerModeCounter);
+    counter.setBitMode(BitMode32);
+    counter.reset();
+    counter.timer->SHORTS = TIMER_SHORTS_COMPARE1_CLEAR_Msk;
+    counter.setIRQ(handlers[slot]);
+    counter.setCompare(0, samples);
+    counter.setCompare(1, 2 * samples);
+    counter.enable();
+    counter.enableIRQ();
+
+    // Start a transfer every period.
+    trigger.disable();
+    trigger.setMode(TimerMode::TimerModeTimer);
+    trigger.setClockSpeed(1000);
+    trigger.setBitMode(BitMode32);
+    trigger.reset();
+    trigger.timer->CC[0] = period;
+    trigger.timer->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+
+    ppi_route(periodicPpi[NRF52_SPI_PPI_TRIGGER], &trigger.timer->EVENTS_COMPARE[0], &p_spim->TASKS_START);
+    ppi_route(periodicPpi[NRF52_SPI_PPI_COUNT], &p_spim->EVENTS_END, &counter.timer->TASKS_COUNT);
+
+    // Disarm the trigger as soon as the second block is full, until the interrupt has rewound RXD.PTR.
+    ppi_route(periodicPpi[NRF52_SPI_PPI_REWIND], &counter.timer->EVENTS_COMPARE[1], ppi_group_disable_task(periodicGroup));
+    ppi_group_add(periodicGroup, periodicPpi[NRF52_SPI_PPI_TRIGGER]);
+
+    ppi_enable(periodicPpi[NRF52_SPI_PPI_TRIGGER]);
+    ppi_enable(periodicPpi[NRF52_SPI_PPI_COUNT]);
+    ppi_enable(periodicPpi[NRF52_SPI_PPI_REWIND]);
+
+    trigger.enable();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops periodic transfers.
+ *
+ * @return DEVICE_OK on success.
+ */
+int NRF52SPI::stopPeriodic()
+{
+    if (periodicTrigger == NULL)
+        return DEVICE_OK;
+
+    for (int i = 0; i < NRF52_SPI_PPI_CHANNELS; i++)
+    {
+        ppi_disconnect(periodicPpi[i]);
+        periodicPpi[i] = -1;
+    }
+
+    free_ppi_group(periodicGroup);
+    periodicGroup = -1;
+
+    periodicTrigger->disable();
+    periodicTrigger->timer->SHORTS = 0;
+    periodicCounter->disable();
+    periodicCounter->clearCompare(0);
+    periodicCounter->clearCompare(1);
+    periodicCounter->timer->SHORTS = 0;
+
+    // Let any transfer in flight finish, so its END isn't mistaken for the end of a later transfer.
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_STOPPED);
+    nrf_spim_task_trigger(p_spim, NRF_SPIM_TASK_STOP);
+    while (!nrf_spim_event_check(p_spim, NRF_SPIM_EVENT_STOPPED));
+
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_STOPPED);
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
     nrf_spim_rx_list_disable(p_spim);
+    nrf_spim_int_enable(p_spim, NRF_SPIM_INT_END_MASK);
+
+    periodic_instances[periodic_slot(*periodicCounter)] = NULL;
+    periodicTrigger = NULL;
+    periodicCounter = NULL;
+    free_dma_buffer(bounce);
+    bounce = NULL;
+    busy = false;
+
+    return DEVICE_OK;
+}
+
+int NRF52SPI::xfer(uint8_t const *p_tx_buffer, uint32_t tx_length, uint8_t *p_rx_buffer,
+                   uint32_t rx_length, PVoidCallback doneHandler, void *arg)
+{
+    config();
+
+    // Wait for any queued or periodic transfers to complete. We can't wait in IRQ context.
+    for (;;)
+    {
+        NVIC_DisableIRQ(IRQn);
+
+        if (!busy)
+            break;
+
+        NVIC_EnableIRQ(IRQn);
+
+        if (__get_IPSR() != 0)
+            return DEVICE_BUSY;
+
+        if (fiber_scheduler_running())
+            schedule();
+    }
+
+    busy = true;
 
     if (doneHandler == NULL)
     {
@@ -106,8 +549,9 @@ int NRF52SPI::xfer(uint8_t const *p_tx_buffer, uint32_t tx_length, uint8_t *p_rx
         this->doneHandlerArg = arg;
     }
 
-    nrf_spim_task_trigger(p_spim, NRF_SPIM_TASK_START);
-    nrf_spim_int_enable(p_spim, NRF_SPIM_INT_END_MASK);
+    startDma(p_tx_buffer, tx_length, p_rx_buffer, rx_length);
+
+    NVIC_EnableIRQ(IRQn);
 
     if (doneHandler == NULL)
         schedule();
@@ -117,10 +561,7 @@ int NRF52SPI::xfer(uint8_t const *p_tx_buffer, uint32_t tx_length, uint8_t *p_rx
 
 int NRF52SPI::transfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer, uint32_t rxSize)
 {
-    if (txSize <= SZLIMIT && rxSize <= SZLIMIT)
-        return xfer(txBuffer, txSize, rxBuffer, rxSize, NULL, NULL);
-    else
-        return codal::SPI::transfer(txBuffer, txSize, rxBuffer, rxSize);
+    return xfer(txBuffer, txSize, rxBuffer, rxSize, NULL, NULL);
 }
 
 int NRF52SPI::startTransfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *rxBuffer,
@@ -129,10 +570,7 @@ int NRF52SPI::startTransfer(const uint8_t *txBuffer, uint32_t txSize, uint8_t *r
     if (doneHandler == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (txSize <= SZLIMIT && rxSize <= SZLIMIT)
-        return xfer(txBuffer, txSize, rxBuffer, rxSize, doneHandler, arg);
-    else
-        return codal::SPI::startTransfer(txBuffer, txSize, rxBuffer, rxSize, doneHandler, arg);
+    return xfer(txBuffer, txSize, rxBuffer, rxSize, doneHandler, arg);
 }
 
 static void setDrive(Pin *p)
@@ -175,7 +613,9 @@ void NRF52SPI::config()
     nrf_spim_frequency_set(p_spim, (nrf_spim_frequency_t)freq);
     nrf_spim_configure(p_spim, (nrf_spim_mode_t)mode, NRF_SPIM_BIT_ORDER_MSB_FIRST);
     nrf_spim_orc_set(p_spim, 0);
-    nrf_spim_int_enable(p_spim, NRF_SPIM_INT_END_MASK | NRF_SPIM_INT_STOPPED_MASK);
+    // Only END is handled. STOPPED is polled by stopPeriodic(), and would otherwise interrupt continuously.
+    nrf_spim_int_disable(p_spim, NRF_SPIM_INT_STOPPED_MASK);
+    nrf_spim_int_enable(p_spim, NRF_SPIM_INT_END_MASK);
     nrf_spim_enable(p_spim);
 
     NVIC_SetPriority(IRQn, 7);
@@ -0,0 +1,278 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "NRF52SPISink.h"
+#include "ErrorNo.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "codal-core/inc/types/Event.h"
+
+namespace codal
+{
+
+/**
+ * Constructor.
+ *
+ * @param spi The bus to send on.
+ * @param upstream The component providing buffers to send.
+ * @param cs The chip select pin, or NULL if it is managed elsewhere.
+ * @param dcx The data/command pin for displays with one, or NULL.
+ * @param frequency The bus frequency in hertz, or 0 to leave it unchanged.
+ */
+NRF52SPISink::NRF52SPISink(NRF52SPI &spi, DataSource &upstream, Pin *cs, Pin *dcx, uint32_t frequency)
+    : spi(spi), upstream(upstream), cs(cs), dcx(dcx)
+{
+    pullPending = false;
+
+    if (frequency)
+        spi.setFrequency(frequency);
+
+    if (cs)
+        cs->setDigitalValue(1);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(DEVICE_ID_SPI, NRF52_SPI_EVT_SINK_READY, this, &NRF52SPISink::onReady);
+
+    upstream.connect(*this);
+}
+
+/**
+ * Queues the active buffer on the bus. If the bus refuses it, the held buffers are dropped.
+ *
+ * @return DEVICE_OK on success, or DEVICE_BUSY if the bus is running periodic transfers.
+ */
+int NRF52SPISink::startActive()
+{
+    if (dcx)
+        dcx->setDigitalValue(1);
+
+    if (cs)
+        cs->setDigitalValue(0);
+
+    // Queue rather than start the transfer, so it waits its turn behind any other user of the bus
+    // instead of failing with DEVICE_BUSY, even from the completion interrupt.
+    transaction.txBuffer = active.getBytes();
+    transaction.txSize = active.length();
+    transaction.rxBuffer = NULL;
+    transaction.rxSize = 0;
+    transaction.doneHandler = _transferDone;
+    transaction.doneHandlerArg = this;
+
+    int result = spi.queueTransfer(&transaction);
+
+    if (result != DEVICE_OK)
+    {
+        if (cs)
+            cs->setDigitalValue(1);
+
+        // Nothing will complete, so release the buffers and wake anyone waiting for a slot.
+        target_disable_irq();
+        active = ManagedBuffer();
+        pending = ManagedBuffer();
+        target_enable_irq();
+
+        Event(DEVICE_ID_SPI, NRF52_SPI_EVT_SINK_READY);
+    }
+
+    return result;
+}
+
+/**
+ * Adds a buffer to the stream, starting it if the bus is idle.
+ */
+void NRF52SPISink::queue(ManagedBuffer b)
+{
+    if (b.length() == 0)
+        return;
+
+    target_disable_irq();
+
+    if (active.length() == 0)
+    {
+        active = b;
+        target_enable_irq();
+        startActive();
+        return;
+    }
+
+    pending = b;
+    target_enable_irq();
+}
+
+/**
+ * Called (in IRQ context) as each buffer is sent.
+ */
+void NRF52SPISink::_transferDone(void *p)
+{
+    NRF52SPISink *self = (NRF52SPISink *)p;
+
+    if (self->cs)
+        self->cs->setDigitalValue(1);
+
+    // Get the next buffer going before doing anything else.
+    self->active = self->pending;
+    self->pending = ManagedBuffer();
+
+    if (self->active.length())
+        self->startActive();
+
+    // Any buffer upstream has waiting is pulled by onReady(), in fiber context.
+    Event(DEVICE_ID_SPI, NRF52_SPI_EVT_SINK_READY);
+}
+
+/**
+ * Pulls any buffer upstream signalled from interrupt context, in fiber context, once a slot is free.
+ */
+void NRF52SPISink::onReady(Event)
+{
+    target_disable_irq();
+
+    if (!pullPending || pending.length())
+    {
+        target_enable_irq();
+        return;
+    }
+
+    pullPending = false;
+    target_enable_irq();
+
+    queue(upstream.pull());
+}
+
+/**
+ * Waits until fewer than the given number of buffers are held.
+ */
+void NRF52SPISink::waitFor(int count)
+{
+    while (true)
+    {
+        target_disable_irq();
+
+        int held = (active.length() ? 1 : 0) + (pending.length() ? 1 : 0);
+
+        if (held < count)
+        {
+            target_enable_irq();
+            return;
+        }
+
+        if (fiber_scheduler_running())
+        {
+            fiber_wake_on_event(DEVICE_ID_SPI, NRF52_SPI_EVT_SINK_READY);
+            target_enable_irq();
+            schedule();
+        }
+        else
+        {
+            target_enable_irq();
+        }
+    }
+}
+
+/**
+ * Callback provided when data is ready. Pulls the buffer from upstream, and queues it for transmission.
+ * If two buffers are already held, the calling fiber is blocked until a slot is free.
+ * When called from interrupt context, the buffer is instead pulled later by the event bus, in fiber context,
+ * once a slot is free.
+ */
+int NRF52SPISink::pullRequest()
+{
+    if (__get_IPSR() != 0)
+    {
+        // Don't run upstream's pull() in an interrupt. If a slot is already free, have onReady() pull straight away,
+        // otherwise it will when the buffer being sent completes.
+        target_disable_irq();
+        pullPending = true;
+        bool ready = pending.length() == 0;
+        target_enable_irq();
+
+        if (ready)
+            Event(DEVICE_ID_SPI, NRF52_SPI_EVT_SINK_READY);
+
+        return DEVICE_OK;
+    }
+
+    waitFor(2);
+    queue(upstream.pull());
+
+    return DEVICE_OK;
+}
+
+/**
+ * Sends a command to the device, waiting for any buffers being streamed to complete first.
+ * The command byte is sent with DCX low, and any parameters with DCX high, inside a single chip select.
+ *
+ * @param command The command byte.
+ * @param params The parameter bytes, or NULL. These may be in flash; NRF52SPI copies them through RAM.
+ * @param len The number of parameter bytes.
+ *
+ * @return DEVICE_OK on success.
+ */
+int NRF52SPISink::sendCommand(uint8_t command, const uint8_t *params, int len)
+{
+    int result;
+
+    flush();
+
+    if (cs)
+        cs->setDigitalValue(0);
+
+    if (dcx)
+        dcx->setDigitalValue(0);
+
+    result = spi.transfer(&command, 1, NULL, 0);
+
+    if (dcx)
+        dcx->setDigitalValue(1);
+
+    if (result == DEVICE_OK && params && len > 0)
+        result = spi.transfer(params, len, NULL, 0);
+
+    if (cs)
+        cs->setDigitalValue(1);
+
+    return result;
+}
+
+/**
+ * Waits for all buffers to be sent.
+ */
+void NRF52SPISink::flush()
+{
+    waitFor(1);
+}
+
+/**
+ * Determines if a buffer is being sent.
+ *
+ * @return true if the stream is running.
+ */
+bool NRF52SPISink::isBusy()
+{
+    return active.length() != 0;
+}
+
+}
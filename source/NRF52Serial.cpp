@@ -1,11 +1,26 @@
 #include "NRF52Serial.h"
 #include "peripheral_alloc.h"
+#include "ppi_alloc.h"
 #include "NotifyEvents.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include "ramfunc.h"
+#include "buffer_pool.h"
 
 using namespace codal;
 
 extern int8_t target_get_irq_disabled();
 
+static NRF52Serial *rx_idle_instances = NULL;
+
+// The timer handler is not told which timer fired, so every instance in block receive mode checks its own idle timer.
+static void rx_idle_timer_irq(uint16_t mask)
+{
+    for (NRF52Serial *s = rx_idle_instances; s; s = s->nextRxIdle)
+        s->onRxIdle();
+}
+
 /**
  * Constructor
  *
@@ -15,7 +30,8 @@ extern int8_t target_get_irq_disabled();
  *
  **/
 NRF52Serial::NRF52Serial(Pin& tx, Pin& rx, NRF_UARTE_Type* device) 
- : Serial(tx, rx), is_tx_in_progress_(false), bytesProcessed(0), p_uarte_(NULL)
+ : Serial(tx, rx), is_tx_in_progress_(false), bytesProcessed(0), txOffset(0), txMark(0), txChunk(0), txFromBuffer(false), txBounce(NULL), txBounceSize(0), txPulling(false), txDataReady(0), txSource(NULL),
+   rxCounter(NULL), rxBlockSize(0), rxBlockIndex(0), rxBlockCount(0), rxIdleTimer(NULL), rxPpi(-1), rxIdlePpi(-1), rxDownstream(NULL), rxOutputHead(0), rxOutputCount(0), p_uarte_(NULL), nextRxIdle(NULL)
 {
     if(device != NULL)
         p_uarte_ = (NRF_UARTE_Type*)allocate_peripheral((void*)device);
@@ -70,6 +86,7 @@ NRF52Serial::NRF52Serial(Pin& tx, Pin& rx, NRF_UARTE_Type* device)
 NRF52Serial::~NRF52Serial()
 {
     nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK|
+                                    NRF_UARTE_INT_RXSTARTED_MASK |
                                     NRF_UARTE_INT_ENDRX_MASK |
                                     NRF_UARTE_INT_ENDTX_MASK |
                                     NRF_UARTE_INT_ERROR_MASK |
@@ -89,27 +106,54 @@ NRF52Serial::~NRF52Serial()
     nrf_uarte_disable(p_uarte_);
     nrf_uarte_txrx_pins_disconnect(p_uarte_);
 
+    if (rxCounter)
+    {
+        ppi_disconnect(rxPpi);
+        ppi_disconnect(rxIdlePpi);
+        rxPpi = -1;
+        rxIdlePpi = -1;
+        rxCounter->disable();
+        rxIdleTimer->disable();
+
+        target_disable_irq();
+
+        for (NRF52Serial **s = &rx_idle_instances; *s; s = &(*s)->nextRxIdle)
+        {
+            if (*s == this)
+            {
+                *s = nextRxIdle;
+                break;
+            }
+        }
+
+        target_enable_irq();
+    }
+
     free_alloc_peri(p_uarte_);
 }
 
-void NRF52Serial::_irqHandler(void *self_)
+NRF52_RAMFUNC void NRF52Serial::_irqHandler(void *self_)
 {
     NRF52Serial *self = (NRF52Serial *)self_;
     NRF_UARTE_Type *p_uarte = self->p_uarte_;
 
-    while (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXDRDY) && self->bytesProcessed < CONFIG_SERIAL_DMA_BUFFER_SIZE){
-        nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXDRDY);
-        self->dataReceivedDMA();
-    }
+    if (self->rxCounter){
+        self->rxBlockIrq();
+    }else{
+        while (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXDRDY) && self->bytesProcessed < CONFIG_SERIAL_DMA_BUFFER_SIZE){
+            nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXDRDY);
+            self->dataReceivedDMA();
+        }
 
-    if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ENDRX)){
-        nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ENDRX);
-        self->updateRxBufferAfterENDRX();
-    }
+        if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ENDRX)){
+            nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ENDRX);
+            self->updateRxBufferAfterENDRX();
+        }
 
-    if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXSTARTED)){
-        nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXSTARTED);
-        self->updateRxBufferAfterRXSTARTED();
+        if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXSTARTED)){
+            nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXSTARTED);
+            self->updateRxBufferAfterRXSTARTED();
+        }
     }
 
     if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ERROR)){
@@ -125,9 +169,28 @@ void NRF52Serial::_irqHandler(void *self_)
         nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ENDTX);
 
         self->is_tx_in_progress_ = false;
-        if(self->txBufferedSize() > 0){
-            self->dataTransmitted();
-        }else{
+
+        // Only now the DMA has finished reading the data can we release it to the writer.
+        if(self->txFromBuffer){
+            self->txOffset += self->txChunk;
+            if(self->txOffset >= self->txBuffer.length()){
+                self->txBuffer = ManagedBuffer();
+                self->releaseTxBounce();
+                self->txOffset = 0;
+                Event(self->id, NRF52_SERIAL_EVT_TX_COMPLETE);
+                self->pullTxSource();
+            }
+        }else if(self->txChunk){
+            self->txBuffTail = (self->txBuffTail + self->txChunk) % self->txBuffSize;
+            if(self->txBuffTail == self->txBuffHead){
+                Event(DEVICE_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
+            }
+        }
+
+        self->txChunk = 0;
+        self->startTx();
+
+        if(!self->is_tx_in_progress_){
             // Transmitter has to be stopped by triggering STOPTX task to achieve
             // the lowest possible level of the UARTE power consumption.
             nrf_uarte_task_trigger(p_uarte, NRF_UARTE_TASK_STOPTX);
@@ -147,26 +210,33 @@ int NRF52Serial::enableInterrupt(SerialInterruptType t)
         if(!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
             initialiseRx();
 
-        if(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT){
+        if(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT && rxCounter){
+            rxBlockIndex = 0;
+            rxBlockCount = rxCounter->captureCounter();
+            nrf_uarte_rx_buffer_set(p_uarte_, rxBlock[0].getBytes(), rxBlockSize);
+            bytesProcessed = 0;
+            nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_ERROR_MASK |
+                                            NRF_UARTE_INT_ENDRX_MASK |
+                                            NRF_UARTE_INT_RXSTARTED_MASK);
+            nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTRX);
+        }else if(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT){
             nrf_uarte_rx_buffer_set(p_uarte_, dmaBuffer, CONFIG_SERIAL_DMA_BUFFER_SIZE);
             bytesProcessed = 0;
             nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_ERROR_MASK |
-                                            NRF_UARTE_INT_ENDRX_MASK);
+                                            NRF_UARTE_INT_ENDRX_MASK |
+                                            NRF_UARTE_INT_RXSTARTED_MASK);
             nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTRX);
         }           
     }else if(t == TxInterrupt){
-        if(!is_tx_in_progress_ && txBufferedSize())
-        {
-            // To prevent the same data from being sent by the TX_DONE event
-            // of the UARTE interrupt before processing the ring buffer.
-            // Only the order in the Serial.dataTransmitted() function is different.
-            uint16_t pre_txBuffTail = txBuffTail;
-            txBuffTail = (txBuffTail + 1) % txBuffSize;
-            putc((char)txBuff[pre_txBuffTail]);
-            if(txBuffTail == txBuffHead){
-                Event(DEVICE_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
-            }
-        }
+        // Hand the UARTE as much of the ring as we can. The ENDTX interrupt moves on to the rest.
+        IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+        int wasEnabled = NVIC_GetEnableIRQ(IRQn);
+
+        NVIC_DisableIRQ(IRQn);
+        startTx();
+
+        if (wasEnabled)
+            NVIC_EnableIRQ(IRQn);
     }
 
     return DEVICE_OK;
@@ -176,7 +246,8 @@ int NRF52Serial::disableInterrupt(SerialInterruptType t)
 {
     if (t == RxInterrupt){
         nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_ERROR_MASK |
-                                        NRF_UARTE_INT_ENDRX_MASK);
+                                        NRF_UARTE_INT_ENDRX_MASK |
+                                        NRF_UARTE_INT_RXSTARTED_MASK);
     }else if (t == TxInterrupt){
         // IDLE:
         // Since UARTE (DMA) is used, there is no need to turn off and turn off interrupts.
@@ -221,6 +292,262 @@ int NRF52Serial::configurePins(Pin& tx, Pin& rx)
     return DEVICE_OK;
 }
 
+/**
+  * Returns the buffer staging txBuffer, if any.
+  */
+void NRF52Serial::releaseTxBounce()
+{
+    if (txBounce != &txByte)
+        free_dma_buffer(txBounce);
+
+    txBounce = NULL;
+    txBounceSize = 0;
+}
+
+/**
+  * Starts a DMA transfer of the next contiguous span of data awaiting transmission, if the transmitter is idle.
+  *
+  * Data is taken from the TX ring up to its end (or txMark, if a ManagedBuffer is waiting), then from txBuffer.
+  *
+  * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+  */
+void NRF52Serial::startTx()
+{
+    if (is_tx_in_progress_)
+        return;
+
+    if (txBuffer.length() && txBuffTail == txMark)
+    {
+        // Everything queued before the buffer has gone. Send it from where it is, unless EasyDMA can't reach it.
+        const uint8_t *tx = txBuffer.getBytes() + txOffset;
+        txChunk = min(txBuffer.length() - txOffset, NRF52_SERIAL_DMA_MAX_TX);
+        txFromBuffer = true;
+
+        if (!is_dma_capable(tx, txChunk))
+        {
+            if (txBounce == NULL)
+            {
+                txBounceSize = min(txBuffer.length() - txOffset, DMA_BOUNCE_BUFFER_SIZE);
+                txBounce = allocate_dma_buffer(txBounceSize);
+
+                if (txBounce == NULL)
+                {
+                    txBounce = &txByte;
+                    txBounceSize = 1;
+                }
+            }
+
+            txChunk = min(txChunk, txBounceSize);
+            memcpy(txBounce, tx, txChunk);
+            tx = txBounce;
+        }
+
+        is_tx_in_progress_ = true;
+        nrf_uarte_tx_buffer_set(p_uarte_, tx, txChunk);
+        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+        return;
+    }
+
+    if (txBuff == NULL)
+        return;
+
+    uint16_t end = txBuffer.length() ? txMark : txBuffHead;
+
+    if (txBuffTail == end)
+        return;
+
+    // Send up to the end of the data, or the end of the ring if the data wraps around.
+    // The bytes stay in the ring until ENDTX, so the writer can't overwrite them during the transfer.
+    int span = end > txBuffTail ? end - txBuffTail : txBuffSize - txBuffTail;
+
+    txChunk = min(span, NRF52_SERIAL_DMA_MAX_TX);
+    txFromBuffer = false;
+
+    is_tx_in_progress_ = true;
+    nrf_uarte_tx_buffer_set(p_uarte_, &txBuff[txBuffTail], txChunk);
+    nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+}
+
+/**
+  * Transmits the given buffer directly from its own memory, without copying it into the TX ring.
+  *
+  * The buffer is sent after any data already in the TX ring, and is held until the transmission completes.
+  * Only one buffer can be outstanding at a time.
+  *
+  * @param buffer The data to transmit.
+  *
+  * @param mode ASYNC returns immediately (DEVICE_BUSY if another buffer is still being sent).
+  *             SYNC_SPINWAIT and SYNC_SLEEP wait for any earlier buffer, then for this one to be sent,
+  *             by spinning or by sleeping the calling fiber respectively.
+  *
+  * @return DEVICE_OK on success, or DEVICE_BUSY.
+  */
+int NRF52Serial::send(ManagedBuffer buffer, SerialMode mode)
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+
+    if (buffer.length() == 0)
+        return DEVICE_OK;
+
+    if (txBuffer.length() && mode == ASYNC)
+        return DEVICE_BUSY;
+
+    waitForTxBuffer(mode);
+
+    NVIC_DisableIRQ(IRQn);
+    queueTxBuffer(buffer);
+    NVIC_EnableIRQ(IRQn);
+
+    if (mode != ASYNC)
+        waitForTxBuffer(mode);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Queues a ManagedBuffer to be transmitted after the current contents of the TX ring.
+  *
+  * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+  */
+void NRF52Serial::queueTxBuffer(ManagedBuffer buffer)
+{
+    txBuffer = buffer;
+    txOffset = 0;
+    txMark = txBuffHead;
+    startTx();
+}
+
+/**
+  * Pulls the next buffer from txSource, if one has been announced and the transmitter can take it.
+  *
+  * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+  */
+void NRF52Serial::pullTxSource()
+{
+    // The source may call pullRequest() again from within pull(). The loop below picks that up.
+    if (txPulling)
+        return;
+
+    txPulling = true;
+
+    // Leave data upstream until we're ready for it, so the source sees back pressure.
+    while (txSource && txDataReady && txBuffer.length() == 0)
+    {
+        txDataReady--;
+
+        ManagedBuffer b = txSource->pull();
+
+        if (b.length())
+            queueTxBuffer(b);
+    }
+
+    txPulling = false;
+}
+
+/**
+  * Transmits the buffers provided by the given DataSource, as they become available.
+  *
+  * Each buffer is sent directly from its own memory (see send(ManagedBuffer)), and the next is only pulled
+  * once the previous one has been transmitted.
+  *
+  * @param source The component providing data to transmit.
+  *
+  * @return DEVICE_OK on success.
+  */
+int NRF52Serial::setUpstream(DataSource &source)
+{
+    txSource = &source;
+    source.connect(*this);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Callback provided when data is ready from our upstream component.
+  */
+int NRF52Serial::pullRequest()
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+    int wasEnabled = NVIC_GetEnableIRQ(IRQn);
+
+    NVIC_DisableIRQ(IRQn);
+
+    txDataReady++;
+    pullTxSource();
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Provide the next received block to our downstream caller, if available.
+  *
+  * Blocks are only produced in block receive mode (see setRxBlockMode()). Full DMA buffers are handed over
+  * without copying; blocks passed on after an idle timeout are copied out of the DMA buffer still in use.
+  *
+  * @return The block, or an empty ManagedBuffer if none is available.
+  */
+ManagedBuffer NRF52Serial::pull()
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+    int wasEnabled = NVIC_GetEnableIRQ(IRQn);
+    ManagedBuffer b;
+
+    NVIC_DisableIRQ(IRQn);
+
+    if (rxOutputCount)
+    {
+        b = rxOutput[rxOutputHead];
+        rxOutput[rxOutputHead] = ManagedBuffer();
+        rxOutputHead = (rxOutputHead + 1) % NRF52_SERIAL_RX_QUEUE_SIZE;
+        rxOutputCount--;
+    }
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(IRQn);
+
+    return b;
+}
+
+/**
+  * Update our reference to a downstream component. Once connected, received data no longer enters the
+  * codal Serial ringbuffer.
+  */
+void NRF52Serial::connect(DataSink &sink)
+{
+    rxDownstream = &sink;
+}
+
+/**
+  * Waits until no buffer passed to send(ManagedBuffer) is outstanding.
+  *
+  * @param mode SYNC_SLEEP to sleep the calling fiber, otherwise spin.
+  */
+void NRF52Serial::waitForTxBuffer(SerialMode mode)
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+
+    while (txBuffer.length())
+    {
+        if (mode == SYNC_SLEEP && fiber_scheduler_running())
+        {
+            // Register for the completion event before the interrupt can raise it, so the wakeup can't be lost.
+            NVIC_DisableIRQ(IRQn);
+
+            if (txBuffer.length())
+                fiber_wake_on_event(id, NRF52_SERIAL_EVT_TX_COMPLETE);
+
+            NVIC_EnableIRQ(IRQn);
+            schedule();
+        }
+
+        // txBuffer is updated by the interrupt handler.
+        __DMB();
+    }
+}
+
 int NRF52Serial::putc(char c)
 {
     int res = DEVICE_OK;
@@ -231,6 +558,9 @@ int NRF52Serial::putc(char c)
         nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDTX);
         nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
     }
+    // Not part of the TX ring, so the ENDTX interrupt has nothing to release.
+    txChunk = 0;
+    txFromBuffer = false;
     is_tx_in_progress_ = true;
     nrf_uarte_tx_buffer_set(p_uarte_, (const uint8_t*)&c, 1);
     nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
@@ -297,6 +627,248 @@ void NRF52Serial::updateRxBufferAfterRXSTARTED()
     nrf_uarte_rx_buffer_set(p_uarte_, dmaBuffer, CONFIG_SERIAL_DMA_BUFFER_SIZE);
 }
 
+/**
+  * Passes bytes received by DMA to the codal Serial ringbuffer, or to rxDownstream if connected.
+  *
+  * @param index The DMA buffer (0 or 1).
+  *
+  * @param length The number of bytes in the buffer that have been received.
+  */
+void NRF52Serial::processRxBlock(int index, int length)
+{
+    uint8_t *data = rxBlock[index].getBytes();
+
+    if (rxDownstream == NULL)
+    {
+        while (bytesProcessed < length)
+            dataReceived(data[bytesProcessed++]);
+
+        return;
+    }
+
+    if (bytesProcessed >= length)
+        return;
+
+    ManagedBuffer b;
+
+    // Drop the block if our downstream component isn't keeping up.
+    if (rxOutputCount >= NRF52_SERIAL_RX_QUEUE_SIZE)
+    {
+        bytesProcessed = length;
+        return;
+    }
+
+    if (bytesProcessed == 0 && length == rxBlockSize)
+    {
+        // A complete buffer. Hand it over as it is, and give the UARTE a released one from the pool next time round.
+        // We're in interrupt context, so never allocate: if downstream still holds them all, drop the block instead.
+        ManagedBuffer fresh = buffer_pool_recycle(rxPool, NRF52_SERIAL_RX_POOL_SIZE, rxBlockSize);
+
+        if (fresh.length() == 0)
+        {
+            bytesProcessed = length;
+            return;
+        }
+
+        b = rxBlock[index];
+        rxBlock[index] = fresh;
+    }
+    else
+    {
+        b = ManagedBuffer(data + bytesProcessed, length - bytesProcessed);
+    }
+
+    bytesProcessed = length;
+
+    rxOutput[(rxOutputHead + rxOutputCount) % NRF52_SERIAL_RX_QUEUE_SIZE] = b;
+    rxOutputCount++;
+
+    rxDownstream->pullRequest();
+}
+
+/**
+  * Handles the ENDRX and RXSTARTED events in block receive mode.
+  */
+void NRF52Serial::rxBlockIrq()
+{
+    // RXSTARTED always follows the ENDRX of the previous buffer. Sample it first, so that if we see it,
+    // we also see (and process) the ENDRX that came before it.
+    bool started = nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_RXSTARTED);
+
+    if (nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_ENDRX))
+    {
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDRX);
+
+        // The ENDRX_STARTRX short has already moved the UARTE on to the other buffer.
+        int rxBytes = nrf_uarte_rx_amount_get(p_uarte_);
+
+        processRxBlock(rxBlockIndex, rxBytes);
+
+        rxBlockCount += rxBytes;
+        rxBlockIndex ^= 1;
+        bytesProcessed = 0;
+    }
+
+    if (started)
+    {
+        // The UARTE has latched the buffer it is now filling, so we can give it the next one.
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXSTARTED);
+        nrf_uarte_rx_buffer_set(p_uarte_, rxBlock[rxBlockIndex ^ 1].getBytes(), rxBlockSize);
+    }
+}
+
+/**
+  * Passes on any partially filled DMA buffer once no bytes have been received for an idle timeout.
+  */
+void NRF52Serial::onRxIdle()
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+
+    if (rxCounter == NULL)
+        return;
+
+    int wasEnabled = NVIC_GetEnableIRQ(IRQn);
+    NVIC_DisableIRQ(IRQn);
+
+    // The idle timer stops itself at the timeout, and every byte received clears it, so it only reads the
+    // timeout if the line is still quiet (this also filters out interrupts raised by other instances' timers).
+    if (rxIdleTimer->captureCounter() >= rxIdleTimer->timer->CC[0])
+    {
+        uint32_t count = rxCounter->captureCounter();
+
+        // A count beyond the end of the buffer means an ENDRX is pending, which will deal with it.
+        if (count != rxBlockCount && count - rxBlockCount <= rxBlockSize)
+            processRxBlock(rxBlockIndex, count - rxBlockCount);
+    }
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(IRQn);
+}
+
+/**
+  * Switches reception to block mode, for sustained high baud rates.
+  *
+  * Rather than taking an interrupt for every byte, the UARTE receives alternately into two larger DMA
+  * buffers. Each is passed on to the codal Serial ringbuffer in one go once full. Received bytes are
+  * counted by a hardware timer (RXDRDY -> COUNT via PPI). Every byte also clears and restarts a second
+  * timer, which stops itself and interrupts once the line has been idle for a timeout, so that any
+  * partially filled buffer is passed on too, without polling.
+  *
+  * @param counter A timer dedicated to counting received bytes. It is placed in counter mode.
+  *
+  * @param idle A timer dedicated to timing the idle line. It is placed in 1MHz timer mode.
+  *
+  * @param bufferSize The size of each DMA buffer, in bytes.
+  *
+  * @param idleTimeout The time the line must be quiet before a partial buffer is passed on, in microseconds.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if bufferSize is out of range,
+  *         DEVICE_BUSY if block mode is already enabled or DEVICE_NO_RESOURCES if the buffers or PPI channels could not be allocated.
+  */
+int NRF52Serial::setRxBlockMode(NRFLowLevelTimer &counter, NRFLowLevelTimer &idle, uint16_t bufferSize, uint32_t idleTimeout)
+{
+    IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+
+    if (rxCounter)
+        return DEVICE_BUSY;
+
+    if (bufferSize == 0 || bufferSize > NRF52_SERIAL_DMA_MAX_RX || idleTimeout == 0 || &idle == &counter)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Allocate every DMA buffer now, so that the interrupt only ever recycles them.
+    for (int i = 0; i < NRF52_SERIAL_RX_POOL_SIZE; i++)
+        rxPool[i] = ManagedBuffer();
+
+    if (buffer_pool_reserve(rxPool, NRF52_SERIAL_RX_POOL_SIZE, bufferSize, NRF52_SERIAL_RX_POOL_SIZE) < NRF52_SERIAL_RX_POOL_SIZE)
+    {
+        for (int i = 0; i < NRF52_SERIAL_RX_POOL_SIZE; i++)
+            rxPool[i] = ManagedBuffer();
+
+        return DEVICE_NO_RESOURCES;
+    }
+
+    ManagedBuffer b0 = rxPool[0];
+    ManagedBuffer b1 = rxPool[1];
+
+    rxPpi = allocate_ppi_channel();
+    rxIdlePpi = allocate_ppi_channel();
+
+    if (rxPpi < 0 || rxIdlePpi < 0)
+    {
+        free_ppi_channel(rxPpi);
+        free_ppi_channel(rxIdlePpi);
+        rxPpi = -1;
+        rxIdlePpi = -1;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    NVIC_DisableIRQ(IRQn);
+
+    bool running = status & CODAL_SERIAL_STATUS_RX_BUFF_INIT;
+
+    if (running)
+    {
+        // Stop the receiver, and pass on whatever it had already received.
+        nrf_uarte_shorts_disable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXTO);
+        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPRX);
+        while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_RXTO))
+        {}
+
+        updateRxBufferAfterENDRX();
+
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDRX);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXSTARTED);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXTO);
+        nrf_uarte_shorts_enable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
+    }
+
+    rxBlock[0] = b0;
+    rxBlock[1] = b1;
+    rxBlockSize = bufferSize;
+
+    // Count bytes in hardware, rather than taking an interrupt for each one.
+    counter.disable();
+    counter.setMode(TimerMode::TimerModeCounter);
+    counter.setBitMode(BitMode32);
+    counter.reset();
+    counter.enable();
+
+    // Time the gap since the last byte in hardware too. The timer stops itself and interrupts at the timeout,
+    // and each byte clears and restarts it, so a busy line never interrupts and an idle one does so only once.
+    idle.disable();
+    idle.setMode(TimerMode::TimerModeTimer);
+    idle.setClockSpeed(1000);
+    idle.setBitMode(BitMode32);
+    idle.reset();
+    idle.setCompare(0, idleTimeout);
+    idle.timer->SHORTS = TIMER_SHORTS_COMPARE0_STOP_Msk;
+    idle.setIRQ(rx_idle_timer_irq);
+    idle.enableIRQ();
+
+    ppi_route(rxPpi, &p_uarte_->EVENTS_RXDRDY, &counter.timer->TASKS_COUNT, &idle.timer->TASKS_START);
+    ppi_route(rxIdlePpi, &p_uarte_->EVENTS_RXDRDY, &idle.timer->TASKS_CLEAR);
+    ppi_enable(rxPpi);
+    ppi_enable(rxIdlePpi);
+
+    rxCounter = &counter;
+    rxIdleTimer = &idle;
+
+    target_disable_irq();
+    nextRxIdle = rx_idle_instances;
+    rx_idle_instances = this;
+    target_enable_irq();
+    nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK);
+
+    if (running)
+        enableInterrupt(RxInterrupt);
+
+    NVIC_EnableIRQ(IRQn);
+
+    return DEVICE_OK;
+}
+
 /**
  * Puts the component in (or out of) sleep (low power) mode.
  */
@@ -47,17 +47,23 @@ static void touch_sense_irq(uint16_t mask)
 NRF52TouchSensor::NRF52TouchSensor(NRFLowLevelTimer& t, uint16_t id) : TouchSensor(id), timer(t)
 {
     channel = 0;
+    width = 1;
+    averaging = 1;
+    extraTimer = NULL;
+    sampleMax = NRF52_TOUCH_SENSE_SAMPLE_MAX;
     instance = this;
 
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+
     // Configure as a fixed period timer for the required period    
     timer.setMode(TimerMode::TimerModeTimer);
     timer.setClockSpeed(16000);
     timer.setCompare(0, NRF52_TOUCH_SENSOR_PERIOD*16);
 
     // Use a PPI channel to capture a timestamp 
-    NRF_PPI->CH[NRF52_TOUCH_SENSOR_PPI_CHANNEL].EEP = (uint32_t) &NRF_GPIOTE->EVENTS_IN[NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL];   
-    NRF_PPI->CH[NRF52_TOUCH_SENSOR_PPI_CHANNEL].TEP = (uint32_t) &timer.timer->TASKS_CAPTURE[1];
-    NRF_PPI->CHENSET = 1 << NRF52_TOUCH_SENSOR_PPI_CHANNEL;
+    if (claimPad(0, NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL, NRF52_TOUCH_SENSOR_PPI_CHANNEL) != DEVICE_OK)
+        target_panic(DEVICE_HARDWARE_CONFIGURATION_ERROR);
 
     // register for a low level interrupt when the timer matches CC0.
     timer.setIRQ(touch_sense_irq);
@@ -84,6 +90,195 @@ NRF52TouchSensor::addTouchButton(TouchButton *button)
     return DEVICE_OK;
 }
 
+/**
+ * Determines the timer that captures the result for the given parallel pad.
+ */
+NRF_TIMER_Type*
+NRF52TouchSensor::getCaptureTimer(int pad)
+{
+    return pad < NRF52_TOUCH_SENSOR_PADS_PER_TIMER ? timer.timer : extraTimer->timer;
+}
+
+/**
+ * Claims the GPIOTE and PPI channels for the given parallel pad, and routes its input event to its capture register.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if no channel is free.
+ */
+int
+NRF52TouchSensor::claimPad(int pad, int preferredGpiote, int preferredPpi)
+{
+    int gpiote = preferredGpiote >= 0 ? allocate_gpiote_channel(preferredGpiote) : DEVICE_NO_RESOURCES;
+    int ppi = preferredPpi >= 0 ? allocate_ppi_channel(preferredPpi) : DEVICE_NO_RESOURCES;
+
+    if (gpiote < 0)
+        gpiote = allocate_gpiote_channel();
+
+    if (ppi < 0)
+        ppi = allocate_ppi_channel();
+
+    if (gpiote < 0 || ppi < 0)
+    {
+        free_gpiote_channel(gpiote);
+        free_ppi_channel(ppi);
+        return DEVICE_NO_RESOURCES;
+    }
+
+    gpioteChannel[pad] = gpiote;
+    ppiChannel[pad] = ppi;
+
+    ppi_route(ppi, &NRF_GPIOTE->EVENTS_IN[gpiote], &getCaptureTimer(pad)->TASKS_CAPTURE[1 + pad % NRF52_TOUCH_SENSOR_PADS_PER_TIMER]);
+    ppi_enable(ppi);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Releases the GPIOTE and PPI channels of the given parallel pad.
+ */
+void
+NRF52TouchSensor::releasePad(int pad)
+{
+    ppi_disconnect(ppiChannel[pad]);
+    free_gpiote_channel(gpioteChannel[pad]);
+}
+
+/**
+ * Selects how many buttons are sensed at the same time.
+ *
+ * @param pads The number of buttons sensed at once. 1 (the default) senses one button at a time.
+ *             Values above NRF52_TOUCH_SENSOR_PADS_PER_TIMER require a second timer.
+ *
+ * @param t A second timer module, used to capture the results of the additional pads. This is configured to
+ *          match the first timer, and remains in use until sequential sensing is restored.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the number of pads cannot be supported, or
+ *         DEVICE_NO_RESOURCES if too few GPIOTE or PPI channels are free (in which case one button is sensed at a time).
+ */
+int
+NRF52TouchSensor::setParallel(int pads, NRFLowLevelTimer *t)
+{
+    int result = DEVICE_OK;
+
+    if (pads < 1 || pads > NRF52_TOUCH_SENSOR_MAX_PARALLEL || (pads > NRF52_TOUCH_SENSOR_PADS_PER_TIMER && t == NULL))
+        return DEVICE_INVALID_PARAMETER;
+
+    timer.disableIRQ();
+
+    // Release the resources of the current configuration.
+    for (int pad = 1; pad < width; pad++)
+        releasePad(pad);
+
+    NRF_GPIOTE->CONFIG[gpioteChannel[0]] = 0;
+
+    if (extraTimer)
+        extraTimer->disable();
+
+    extraTimer = pads > NRF52_TOUCH_SENSOR_PADS_PER_TIMER ? t : NULL;
+    width = 1;
+
+    // The second timer runs alongside the first, and is cleared with it at the start of each period.
+    if (extraTimer)
+    {
+        extraTimer->disable();
+        extraTimer->setMode(TimerMode::TimerModeTimer);
+        extraTimer->setClockSpeed(16000);
+        extraTimer->timer->BITMODE = timer.timer->BITMODE;
+        extraTimer->enable();
+    }
+
+    // Route the input event of each additional pad to its own capture register.
+    while (width < pads && claimPad(width) == DEVICE_OK)
+        width++;
+
+    if (width < pads)
+    {
+        for (int pad = 1; pad < width; pad++)
+            releasePad(pad);
+
+        if (extraTimer)
+            extraTimer->disable();
+
+        extraTimer = NULL;
+        width = 1;
+        result = DEVICE_NO_RESOURCES;
+    }
+
+    // Restart the scan from the first button, after a timeslot for the pins to drain.
+    channel = -1;
+    memset(counts, 0, sizeof(counts));
+    memset(sums, 0, sizeof(sums));
+
+    timer.enableIRQ();
+
+    return result;
+}
+
+/**
+ * Defines the time given to each group of buttons to charge.
+ * Longer periods give greater sensitivity, at the cost of a slower scan.
+ *
+ * @param period The sensing period, in microseconds.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the period is zero or above NRF52_TOUCH_SENSOR_MAX_PERIOD.
+ */
+int
+NRF52TouchSensor::setPeriod(uint32_t period)
+{
+    if (period == 0 || period > NRF52_TOUCH_SENSOR_MAX_PERIOD)
+        return DEVICE_INVALID_PARAMETER;
+
+    timer.disableIRQ();
+    sampleMax = period * 16;
+    timer.setCompare(0, sampleMax);
+    timer.enableIRQ();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Defines the number of samples averaged into each value reported to a button.
+ *
+ * @param samples The number of samples, in the range 1..NRF52_TOUCH_SENSOR_MAX_AVERAGING. 1 (the default) reports every sample.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the number of samples is out of range.
+ */
+int
+NRF52TouchSensor::setAveraging(int samples)
+{
+    if (samples < 1 || samples > NRF52_TOUCH_SENSOR_MAX_AVERAGING)
+        return DEVICE_INVALID_PARAMETER;
+
+    timer.disableIRQ();
+    averaging = samples;
+    memset(counts, 0, sizeof(counts));
+    memset(sums, 0, sizeof(sums));
+    timer.enableIRQ();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Records a sample of the given button, reporting it once enough samples have been averaged.
+ */
+void
+NRF52TouchSensor::recordSample(int button, uint32_t sample)
+{
+    if (averaging == 1)
+    {
+        buttons[button]->setValue(sample);
+        return;
+    }
+
+    sums[button] += sample;
+
+    if (++counts[button] >= averaging)
+    {
+        buttons[button]->setValue(sums[button] / averaging);
+        sums[button] = 0;
+        counts[button] = 0;
+    }
+}
+
 extern void calibrateTest(float sample);
 
 /**
@@ -92,43 +287,52 @@ extern void calibrateTest(float sample);
 void 
 NRF52TouchSensor::onSampleEvent()
 {
-    int result;
-
     // If we have no channels, to monitor then there's nothing to do.
     if (numberOfButtons == 0)
         return;
 
-    // Capture the result from the last sense pass, and reset the capture value.
-    result = timer.timer->CC[1];
-    timer.timer->CC[1] = NRF52_TOUCH_SENSE_SAMPLE_MAX;
+    // Capture the results from the last sense pass, and reset the capture values.
+    // If we sensed a valid group, configure the pins used as outputs again, and start draining them.
+    for (int pad = 0; pad < width; pad++)
+    {
+        NRF_TIMER_Type *t = getCaptureTimer(pad);
+        int cc = 1 + pad % NRF52_TOUCH_SENSOR_PADS_PER_TIMER;
+        uint32_t result = t->CC[cc];
 
-    // If we sensed a valid channel, configure the last pin used as an output, and start draining the pin.
-    if (channel >= 0){
+        t->CC[cc] = sampleMax;
 
-        // DEBUG
-        //if (channel == 1)
-        //    calibrateTest(result);
+        if (channel >= 0 && channel + pad < numberOfButtons)
+        {
+            // DEBUG
+            //if (channel + pad == 1)
+            //    calibrateTest(result);
 
-        buttons[channel]->setValue(result);
+            recordSample(channel + pad, result);
+        }
+
+        NRF_GPIOTE->CONFIG[gpioteChannel[pad]] = 0;
     }
-    
-    NRF_GPIOTE->CONFIG[NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL] = 0;
-    
-    // Move on to the next channel. If we only have a single channel, then leave an empty timeslot for that
-    // channel to drain all its charge before sampling it again.
-    if (channel == 0 && numberOfButtons == 1)
+
+    // Move on to the next group. If every button is in a single group, then leave an empty timeslot for those
+    // buttons to drain all their charge before sampling them again.
+    if (channel == 0 && numberOfButtons <= width)
         channel = -1;
+    else if (channel < 0 || channel + width >= numberOfButtons)
+        channel = 0;
     else
-        channel = (channel + 1) % numberOfButtons;
+        channel += width;
 
-    // Reset the timer, and enable the pin input event, unless we're leaving a timeslot for a single channel to charge.
+    // Reset the timers, and enable the pin input events, unless we're leaving a timeslot for the buttons to drain.
     target_disable_irq();
 
     timer.timer->TASKS_CLEAR = 1;
-    
+
+    if (extraTimer)
+        extraTimer->timer->TASKS_CLEAR = 1;
+
     if (channel >= 0)
-        NRF_GPIOTE->CONFIG[NRF52_TOUCH_SENSOR_GPIOTE_CHANNEL] = 0x00010001 | (buttons[channel]->_pin.name << 8);
+        for (int pad = 0; pad < width && channel + pad < numberOfButtons; pad++)
+            NRF_GPIOTE->CONFIG[gpioteChannel[pad]] = 0x00010001 | (buttons[channel + pad]->_pin.name << 8);
 
     target_enable_irq();
 }
-
@@ -26,7 +26,11 @@ DEALINGS IN THE SOFTWARE.
 #include "Event.h"
 
 #if CONFIG_ENABLED(DEVICE_USB)
+#include "NRF52USB.h"
 #include "CodalDmesg.h"
+#include "CodalFiber.h"
+#include "NotifyEvents.h"
+#include "peripheral_alloc.h"
 #include "nrfx_usbd.h"
 #include "nrfx_power.h"
 #include "nrfx_clock.h"
@@ -204,6 +208,492 @@ extern "C" void POWER_CLOCK_IRQHandler() {
 
 static volatile uint32_t ep_status = 0;
 
+/**
+ * The state of an interrupt driven write to a (non control) IN endpoint.
+ *
+ * The write is staged through two packet buffers: while EasyDMA and the host take one, the next is copied into the
+ * other, so each packet can be started from the EPDATA interrupt as soon as the host has acknowledged the last.
+ */
+struct UsbInTransfer
+{
+    uint8_t packet[2][USB_MAX_PKT_SIZE];    // The packet buffers.
+    uint8_t length[2];                      // The size of the packet in each buffer.
+    uint8_t next;                           // The buffer holding the next packet to send.
+    bool ready;                             // true if the next packet has been staged.
+    bool zlp;                               // true if a zero length packet may still be needed to end the write.
+    volatile bool busy;                     // true while the write is in progress.
+    const uint8_t *data;                    // The next byte of the write to stage.
+    uint32_t remaining;                     // The number of bytes still to stage.
+    volatile uint32_t packets;              // A count of packets taken by the host, used to detect a stalled write.
+    uint16_t doneEvent;                     // The DEVICE_ID_NOTIFY event value raised as each write completes.
+    PVoidCallback doneHandler;
+    void *doneHandlerArg;
+};
+
+static UsbInTransfer *inTransfer[NUM_IN_EP];
+
+/**
+ * Copies the next packet of the write in progress into the free packet buffer, if there is another to send.
+ */
+static void usb_in_stage(UsbInTransfer *t)
+{
+    if (t->remaining == 0 && !t->zlp)
+        return;
+
+    int n = t->remaining > USB_MAX_PKT_SIZE ? USB_MAX_PKT_SIZE : t->remaining;
+
+    // A short packet ends the write by itself.
+    if (n < USB_MAX_PKT_SIZE)
+        t->zlp = false;
+
+    memcpy(t->packet[t->next], t->data, n);
+    t->length[t->next] = n;
+    t->data += n;
+    t->remaining -= n;
+    t->ready = true;
+}
+
+/**
+ * Hands the staged packet to the USBD, then stages the one after it in the other buffer.
+ */
+static void usb_in_start(int ep, UsbInTransfer *t)
+{
+    NRF_USBD->EPIN[ep].PTR    = (uint32_t) t->packet[t->next];
+    NRF_USBD->EPIN[ep].MAXCNT = t->length[t->next];
+    NRF_USBD->EVENTS_ENDEPIN[ep] = 0;
+    NRF_USBD->TASKS_STARTEPIN[ep] = 1;
+
+    // Let EasyDMA take the packet before another endpoint can start a transfer (see usb_out_packet()).
+    while (NRF_USBD->EVENTS_ENDEPIN[ep] == 0);
+
+    t->next ^= 1;
+    t->ready = false;
+
+    usb_in_stage(t);
+}
+
+/**
+ * Called from the EPDATA interrupt once the host has taken a packet from the given IN endpoint.
+ */
+static void usb_in_complete(int ep)
+{
+    UsbInTransfer *t = inTransfer[ep];
+
+    // Packets sent by a blocking write in interrupt context are not ours.
+    if (t == NULL || !t->busy)
+        return;
+
+    t->packets++;
+
+    if (t->ready)
+    {
+        usb_in_start(ep, t);
+        return;
+    }
+
+    t->busy = false;
+
+    if (t->doneHandler)
+    {
+        PVoidCallback done = t->doneHandler;
+        t->doneHandler = NULL;
+        done(t->doneHandlerArg);
+    }
+
+    Event(DEVICE_ID_NOTIFY, t->doneEvent);
+}
+
+/**
+ * Abandons any write in progress on the given IN endpoint. The completion handler is not called.
+ */
+static void usb_in_abort(int ep)
+{
+    UsbInTransfer *t = ep < NUM_IN_EP ? inTransfer[ep] : NULL;
+
+    if (t == NULL)
+        return;
+
+    NVIC_DisableIRQ(USBD_IRQn);
+    t->busy = false;
+    t->ready = false;
+    t->remaining = 0;
+    t->doneHandler = NULL;
+    NVIC_EnableIRQ(USBD_IRQn);
+}
+
+/**
+ * Waits for the write in progress on the given IN endpoint to complete, sleeping the calling fiber.
+ * The write is abandoned if the host takes no packets for NRF52_USB_IN_TIMEOUT milliseconds.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the write timed out.
+ */
+static int usb_in_wait(int ep)
+{
+    UsbInTransfer *t = inTransfer[ep];
+    uint32_t progress;
+
+    do
+    {
+        progress = t->packets;
+
+        // Register for the completion event before the interrupt can raise it, so the wakeup can't be lost.
+        NVIC_DisableIRQ(USBD_IRQn);
+
+        if (t->busy)
+        {
+            fiber_wake_on_event(DEVICE_ID_NOTIFY, t->doneEvent);
+            system_timer_event_after(NRF52_USB_IN_TIMEOUT, DEVICE_ID_NOTIFY, t->doneEvent);
+        }
+
+        NVIC_EnableIRQ(USBD_IRQn);
+
+        schedule();
+        system_timer_cancel_event(DEVICE_ID_NOTIFY, t->doneEvent);
+    } while (t->busy && t->packets != progress);
+
+    if (t->busy)
+    {
+        usb_in_abort(ep);
+        return DEVICE_INVALID_STATE;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * The state of an OUT endpoint receiving directly into buffers supplied by the application.
+ *
+ * Up to two buffers are armed at a time, so there is always somewhere for the next packet to go while the
+ * application consumes a completed buffer. If no buffer is armed, bulk packets are held off (the host is NAKed)
+ * and isochronous packets are dropped.
+ */
+struct UsbOutTransfer
+{
+    uint8_t *buffer[2];                     // The armed buffers, oldest (the one being filled) first.
+    uint16_t size[2];                       // The size of each armed buffer.
+    uint16_t received;                      // The number of bytes received into buffer[0].
+    uint16_t packetSize;                    // The maximum packet size of the endpoint.
+    uint8_t count;                          // The number of buffers armed.
+    bool active;                            // true while reception is directed to the armed buffers.
+    bool pending;                           // true if a received packet awaits a buffer.
+    uint32_t dropped;                       // The number of isochronous packets dropped for lack of a buffer.
+    UsbReadCallback handler;
+    void *handlerArg;
+};
+
+static UsbOutTransfer *outTransfer[NUM_OUT_EP];
+static uint16_t isoOutSize;
+
+static UsbOutTransfer *usb_out_active(int ep)
+{
+    UsbOutTransfer *t = ep < NUM_OUT_EP ? outTransfer[ep] : NULL;
+
+    return t && t->active ? t : NULL;
+}
+
+/**
+ * Passes the oldest armed buffer back to the application, and moves on to the next.
+ */
+static void usb_out_complete(UsbOutTransfer *t)
+{
+    uint8_t *b = t->buffer[0];
+    int len = t->received;
+
+    t->buffer[0] = t->buffer[1];
+    t->size[0] = t->size[1];
+    t->received = 0;
+    t->count--;
+
+    if (t->handler)
+        t->handler(t->handlerArg, b, len);
+}
+
+/**
+ * Transfers the packet received on the given bulk or interrupt OUT endpoint straight into the armed buffer.
+ * Called from the EPDATA interrupt, and when a buffer is armed for a packet that has been waiting.
+ */
+static void usb_out_packet(int ep, UsbOutTransfer *t)
+{
+    if (t->count == 0)
+    {
+        // Leave the packet in the endpoint. The host is NAKed until a buffer is armed.
+        t->pending = true;
+        return;
+    }
+
+    t->pending = false;
+
+    int n = nrf_usbd_epout_size_get(NRF_USBD, ep);
+
+    NRF_USBD->EPOUT[ep].PTR    = (uint32_t) (t->buffer[0] + t->received);
+    NRF_USBD->EPOUT[ep].MAXCNT = n;
+    NRF_USBD->EVENTS_ENDEPOUT[ep] = 0;
+    NRF_USBD->TASKS_STARTEPOUT[ep] = 1;
+
+    // The USBD can only run one EasyDMA transfer at a time, and a packet takes well under a microsecond.
+    while (NRF_USBD->EVENTS_ENDEPOUT[ep] == 0);
+
+    NRF_USBD->SIZE.EPOUT[ep] = 0;
+    t->received += n;
+
+    // A short packet ends a transfer.
+    if (n < t->packetSize || t->received == t->size[0])
+        usb_out_complete(t);
+}
+
+/**
+ * Transfers the packet received on the isochronous OUT endpoint in the last frame into the armed buffer.
+ * Called from the SOF interrupt.
+ */
+static void usb_iso_out_frame()
+{
+    UsbOutTransfer *t = usb_out_active(USB_ISO_EP);
+
+    if (t == NULL)
+        return;
+
+    int n = NRF_USBD->SIZE.ISOOUT & USBD_SIZE_ISOOUT_SIZE_Msk;
+
+    if (n == 0)
+        return;
+
+    if (t->count == 0 || n > t->size[0] - t->received)
+    {
+        t->dropped++;
+        return;
+    }
+
+    NRF_USBD->ISOOUT.PTR    = (uint32_t) (t->buffer[0] + t->received);
+    NRF_USBD->ISOOUT.MAXCNT = n;
+    NRF_USBD->EVENTS_ENDISOOUT = 0;
+    NRF_USBD->TASKS_STARTISOOUT = 1;
+
+    while (NRF_USBD->EVENTS_ENDISOOUT == 0);
+
+    t->received += n;
+
+    // Isochronous packets vary in size, so pass the buffer on once another maximum size packet won't fit.
+    if (t->size[0] - t->received < t->packetSize)
+        usb_out_complete(t);
+}
+
+/**
+ * Directs the packets received on an OUT endpoint into buffers supplied through usb_read_buffer(), rather than
+ * through UsbEndpointOut::read(). Each buffer is passed to the given handler once it is full or, for bulk and
+ * interrupt endpoints, when a short packet ends the transfer.
+ *
+ * @param endpoint The endpoint to receive from. Control endpoints are not supported.
+ * @param handler Called (in IRQ context) with each completed buffer, and the number of bytes received into it.
+ * @param arg An argument passed to handler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint is invalid, or DEVICE_NO_RESOURCES if
+ *         the endpoint state could not be allocated.
+ */
+int codal::usb_read_start(UsbEndpointOut *endpoint, UsbReadCallback handler, void *arg)
+{
+    int ep = endpoint->ep;
+
+    if (ep == 0 || ep >= NUM_OUT_EP)
+        return DEVICE_INVALID_PARAMETER;
+
+    UsbOutTransfer *t = outTransfer[ep];
+
+    if (t == NULL)
+    {
+        t = (UsbOutTransfer *)malloc(sizeof(UsbOutTransfer));
+
+        if (t == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        memset(t, 0, sizeof(UsbOutTransfer));
+        outTransfer[ep] = t;
+    }
+
+    NVIC_DisableIRQ(USBD_IRQn);
+
+    t->count = 0;
+    t->received = 0;
+    t->dropped = 0;
+    t->packetSize = ep == USB_ISO_EP ? isoOutSize : USB_MAX_PKT_SIZE;
+    t->handler = handler;
+    t->handlerArg = arg;
+    t->active = true;
+
+    if (ep == USB_ISO_EP)
+    {
+        t->pending = false;
+        NRF_USBD->INTENSET = USBD_INTEN_SOF_Msk;
+    }
+    else
+    {
+        // Take over any packet already waiting for read().
+        t->pending = (ep_status & (USBD_EPDATASTATUS_EPOUT1_Msk << (ep - 1))) != 0;
+        ep_status &= ~(USBD_EPDATASTATUS_EPOUT1_Msk << (ep - 1));
+    }
+
+    NVIC_EnableIRQ(USBD_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Arms a buffer to receive into. Up to two buffers can be armed at a time, and they are filled in turn.
+ * May be called from the handler given to usb_read_start(), typically to re-arm the buffer just completed.
+ *
+ * @param endpoint The endpoint, which must have been started with usb_read_start().
+ * @param buffer A word aligned buffer in RAM. This must remain valid until it is passed to the handler, or
+ *               usb_read_stop() is called.
+ * @param size The size of the buffer. For bulk and interrupt endpoints, this must be a multiple of the packet size;
+ *             for the isochronous endpoint, it must hold at least one maximum size packet.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint or buffer are invalid, or DEVICE_BUSY if
+ *         two buffers are already armed.
+ */
+int codal::usb_read_buffer(UsbEndpointOut *endpoint, uint8_t *buffer, int size)
+{
+    int ep = endpoint->ep;
+    UsbOutTransfer *t = usb_out_active(ep);
+
+    if (t == NULL || buffer == NULL || ((uint32_t)buffer & 3) || !is_dma_capable(buffer, size) || size > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (size < t->packetSize || (ep != USB_ISO_EP && size % t->packetSize))
+        return DEVICE_INVALID_PARAMETER;
+
+    NVIC_DisableIRQ(USBD_IRQn);
+
+    if (t->count == 2)
+    {
+        NVIC_EnableIRQ(USBD_IRQn);
+        return DEVICE_BUSY;
+    }
+
+    t->buffer[t->count] = buffer;
+    t->size[t->count] = size;
+    t->count++;
+
+    if (t->pending)
+        usb_out_packet(ep, t);
+
+    NVIC_EnableIRQ(USBD_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Returns an OUT endpoint to UsbEndpointOut::read(). Any armed buffers are released without being passed to the
+ * handler, and the data received into them so far is discarded.
+ *
+ * @param endpoint The endpoint.
+ *
+ * @return DEVICE_OK on success.
+ */
+int codal::usb_read_stop(UsbEndpointOut *endpoint)
+{
+    int ep = endpoint->ep;
+    UsbOutTransfer *t = usb_out_active(ep);
+
+    if (t == NULL)
+        return DEVICE_OK;
+
+    NVIC_DisableIRQ(USBD_IRQn);
+
+    if (ep == USB_ISO_EP)
+        NRF_USBD->INTENCLR = USBD_INTEN_SOF_Msk;
+
+    // Hand a waiting packet back to read().
+    if (t->pending)
+        ep_status |= USBD_EPDATASTATUS_EPOUT1_Msk << (ep - 1);
+
+    t->active = false;
+    t->pending = false;
+    t->count = 0;
+    t->received = 0;
+
+    NVIC_EnableIRQ(USBD_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the number of isochronous packets dropped since usb_read_start(), for lack of an armed buffer.
+ */
+uint32_t codal::usb_read_dropped(UsbEndpointOut *endpoint)
+{
+    UsbOutTransfer *t = endpoint->ep < NUM_OUT_EP ? outTransfer[endpoint->ep] : NULL;
+
+    return t ? t->dropped : 0;
+}
+
+/**
+ * Starts writing the given data to an IN endpoint, returning immediately. The data is sent packet by packet from
+ * the USB interrupt as the host polls the endpoint, ending with a zero length packet if the endpoint requires one.
+ *
+ * @param endpoint The endpoint to write to. Control endpoints are not supported.
+ * @param data The bytes to write. These must remain valid until the write has completed.
+ * @param len The number of bytes to write.
+ * @param doneHandler Called (in IRQ context) once the host has taken the last packet. May be NULL.
+ * @param arg An argument passed to doneHandler.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the endpoint is invalid, DEVICE_BUSY if a write is
+ *         already in progress on the endpoint, or DEVICE_NO_RESOURCES if the packet buffers could not be allocated.
+ */
+int codal::usb_write_async(UsbEndpointIn *endpoint, const void *data, int len, PVoidCallback doneHandler, void *arg)
+{
+    int ep = endpoint->ep;
+
+    if (ep == 0 || ep >= NUM_IN_EP || len < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    UsbInTransfer *t = inTransfer[ep];
+
+    if (t == NULL)
+    {
+        t = (UsbInTransfer *)malloc(sizeof(UsbInTransfer));
+
+        if (t == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        memset(t, 0, sizeof(UsbInTransfer));
+        t->doneEvent = allocateNotifyEvent();
+        inTransfer[ep] = t;
+    }
+
+    NVIC_DisableIRQ(USBD_IRQn);
+
+    if (t->busy)
+    {
+        NVIC_EnableIRQ(USBD_IRQn);
+        return DEVICE_BUSY;
+    }
+
+    t->data = (const uint8_t *)data;
+    t->remaining = len;
+    t->zlp = len == 0 || !(endpoint->flags & USB_EP_FLAG_NO_AUTO_ZLP);
+    t->next = 0;
+    t->ready = false;
+    t->busy = true;
+    t->doneHandler = doneHandler;
+    t->doneHandlerArg = arg;
+
+    usb_in_stage(t);
+    usb_in_start(ep, t);
+
+    NVIC_EnableIRQ(USBD_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if an asynchronous write is in progress on the given IN endpoint.
+ */
+bool codal::usb_write_busy(UsbEndpointIn *endpoint)
+{
+    UsbInTransfer *t = endpoint->ep < NUM_IN_EP ? inTransfer[endpoint->ep] : NULL;
+
+    return t && t->busy;
+}
+
 extern "C" void USBD_IRQHandler(void) {
 
     uint32_t enabled = nrf_usbd_int_enable_get(NRF_USBD);
@@ -260,12 +750,34 @@ extern "C" void USBD_IRQHandler(void) {
         CodalUSB::usbInstance->setupRequest(stp);
     }
 
+    if (set & USBD_INTEN_SOF_Msk)
+        usb_iso_out_frame();
+
     if (set & USBD_INTEN_EPDATA_Msk)
     {
-        ep_status = NRF_USBD->EPDATASTATUS;
-        NRF_USBD->EPDATASTATUS = ep_status;
+        uint32_t status = NRF_USBD->EPDATASTATUS;
+        NRF_USBD->EPDATASTATUS = status;
+
+        LOG("EPDATASTATUS %d",status);
+
+        // Packets for endpoints receiving into application buffers never reach read().
+        for (int i = 1; i < USB_ISO_EP; i++)
+        {
+            uint32_t bit = USBD_EPDATASTATUS_EPOUT1_Msk << (i - 1);
+            UsbOutTransfer *t = usb_out_active(i);
+
+            if ((status & bit) && t)
+            {
+                status &= ~bit;
+                usb_out_packet(i, t);
+            }
+        }
 
-        LOG("EPDATASTATUS %d",ep_status);
+        ep_status = status;
+
+        for (int i = 1; i < NUM_IN_EP; i++)
+            if (ep_status & (USBD_EPDATASTATUS_EPIN1_Msk << (i - 1)))
+                usb_in_complete(i);
 
         if (ep_status & 0xff0000)
         {
@@ -318,7 +830,7 @@ int UsbEndpointIn::clearStall()
 int UsbEndpointIn::reset()
 {
     LOG("reset IN %d", ep);
-    // TODO?
+    usb_in_abort(ep);
     wLength = 0;
     return DEVICE_OK;
 }
@@ -336,6 +848,9 @@ int UsbEndpointIn::stall()
 
 int UsbEndpointOut::clearStall()
 {
+    if (ep == USB_ISO_EP)
+        return DEVICE_OK;
+
     nrf_usbd_ep_unstall(NRF_USBD, (nrfx_usbd_ep_t)ep);
     nrf_usbd_dtoggle_set(NRF_USBD, (nrfx_usbd_ep_t)ep, NRF_USBD_DTOGGLE_DATA0);
     NRF_USBD->SIZE.EPOUT[ep] = 0; // start accepting data again
@@ -345,11 +860,25 @@ int UsbEndpointOut::clearStall()
 int UsbEndpointOut::reset()
 {
     LOG("reset OUT %d", ep);
+
+    // Anything part way through a buffer belonged to a transfer the reset has abandoned.
+    UsbOutTransfer *t = usb_out_active(ep);
+
+    if (t)
+    {
+        t->received = 0;
+        t->pending = false;
+    }
+
     return DEVICE_OK;
 }
 
 int UsbEndpointOut::stall()
 {
+    // Isochronous endpoints have no handshake, so can't be stalled.
+    if (ep == USB_ISO_EP)
+        return DEVICE_NOT_SUPPORTED;
+
     if (NRF_USBD_EP_NR_GET(ep) == 0)
         NRF_USBD->TASKS_EP0STALL = 1;
     else
@@ -374,12 +903,22 @@ UsbEndpointIn::UsbEndpointIn(uint8_t idx, uint8_t type, uint8_t size)
 
 UsbEndpointOut::UsbEndpointOut(uint8_t idx, uint8_t type, uint8_t size)
 {
-    usb_assert(size == 64);
     usb_assert(type <= USB_EP_TYPE_INTERRUPT);
-    usb_assert(type != USB_EP_TYPE_ISOCHRONOUS); // iso not supported yet
     ep = idx;
     userdata = 0;
 
+    if (type == USB_EP_TYPE_ISOCHRONOUS)
+    {
+        // The USBD has a single isochronous OUT endpoint, with its own EasyDMA channel.
+        // Its data can only be received through usb_read_start().
+        usb_assert(idx == USB_ISO_EP);
+        isoOutSize = size;
+        NRF_USBD->EPOUTEN |= USBD_EPOUTEN_ISOOUT_Msk;
+        return;
+    }
+
+    usb_assert(size == 64);
+
     NRF_USBD->EPOUTEN |= 0x1 << ep;
 
     startRead();
@@ -409,6 +948,9 @@ int UsbEndpointOut::read(void *dst, int maxlen)
 {
     usb_assert(this != NULL);
 
+    if (usb_out_active(ep) || ep == USB_ISO_EP)
+        return 0;
+
     if (ep != 0 && !(ep_status & (USBD_EPDATASTATUS_EPOUT1_Msk << (ep - 1))))
         return 0;
 
@@ -468,6 +1010,13 @@ static int writeEP(UsbEndpointIn* endpoint, uint8_t *data, int len)
     return DEVICE_OK;
 }
 
+/**
+ * Writes the given data to the endpoint, returning once the host has taken it all.
+ *
+ * Writes to data endpoints from a fiber are interrupt driven, and the fiber sleeps while the host polls for each
+ * packet. Control endpoint writes, and writes made from interrupt context or before the scheduler is running,
+ * busy wait on each packet instead.
+ */
 int UsbEndpointIn::write(const void *src, int len)
 {
     LOG("outer write %p/%d %d", src, len, wLength);
@@ -493,6 +1042,20 @@ int UsbEndpointIn::write(const void *src, int len)
         wLength = 0;
     }
 
+    if (ep != 0 && !__get_IPSR() && fiber_scheduler_running())
+    {
+        int ret = usb_write_async(this, src, len, NULL, NULL);
+
+        if (ret == DEVICE_OK)
+            ret = usb_in_wait(ep);
+
+        return ret;
+    }
+
+    // An interrupt driven write can't progress while we hold off the interrupt.
+    if (usb_write_busy(this))
+        return DEVICE_BUSY;
+
     NVIC_DisableIRQ(USBD_IRQn);
 
     for (;;)
@@ -505,7 +1068,10 @@ int UsbEndpointIn::write(const void *src, int len)
         int ret = writeEP(this, buf, n);
 
         if (ret < 0)
-            return 0;
+        {
+            NVIC_EnableIRQ(USBD_IRQn);
+            return ret;
+        }
 
         len -= n;
         src = (const uint8_t *)src + n;
@@ -0,0 +1,331 @@
+#include "NRFLowLevelRTC.h"
+#include "CodalDmesg.h"
+#include "codal_target_hal.h"
+
+// The number of ticks ahead of the counter a compare value must be for the RTC to be certain to match it.
+#define RTC_MIN_COMPARE_DELAY   2
+
+// The furthest ahead a compare value is programmed. Later times are reached in several steps.
+#define RTC_MAX_COMPARE_DELAY   (RTC_COUNTER_MASK >> 1)
+
+using namespace codal;
+
+// One tick of the 32.768kHz clock is exactly 15625/512 microseconds.
+static inline uint32_t ticks_to_us(uint64_t ticks)
+{
+    return (uint32_t) ((ticks * 15625) >> 9);
+}
+
+static inline uint64_t us_to_ticks(uint32_t us)
+{
+    return ((uint64_t) us * 512 + 15624) / 15625;
+}
+
+static NRFLowLevelRTC *instances[3] = { 0 };
+
+/**
+  * Calibrates the RC oscillator against the 16MHz crystal, if it is the source of the low frequency clock.
+  * Takes around a millisecond, most of it spent starting the crystal if nothing else is using it.
+  */
+static void lfclk_calibrate()
+{
+#if NRF_RTC_LFCLK_CALIBRATE
+    if ((NRF_CLOCK->LFCLKSTAT & CLOCK_LFCLKSTAT_SRC_Msk) != (CLOCK_LFCLKSTAT_SRC_RC << CLOCK_LFCLKSTAT_SRC_Pos))
+        return;
+
+    // Leave the crystal running afterwards if someone else (e.g. the radio or USB) has asked for it. Its status is polled rather than
+    // its HFCLKSTARTED event, which belongs to them.
+    bool requested = NRF_CLOCK->HFCLKRUN & CLOCK_HFCLKRUN_STATUS_Msk;
+
+    if (!requested)
+        NRF_CLOCK->TASKS_HFCLKSTART = 1;
+
+    while ((NRF_CLOCK->HFCLKSTAT & (CLOCK_HFCLKSTAT_STATE_Msk | CLOCK_HFCLKSTAT_SRC_Msk)) !=
+           (CLOCK_HFCLKSTAT_STATE_Msk | (CLOCK_HFCLKSTAT_SRC_Xtal << CLOCK_HFCLKSTAT_SRC_Pos)));
+
+    NRF_CLOCK->EVENTS_DONE = 0;
+    NRF_CLOCK->TASKS_CAL = 1;
+    while (NRF_CLOCK->EVENTS_DONE == 0);
+    NRF_CLOCK->EVENTS_DONE = 0;
+
+    if (!requested)
+        NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+#endif
+}
+
+static void rtc_handler(uint8_t instance_number)
+{
+    if (instances[instance_number])
+        instances[instance_number]->onInterrupt();
+}
+
+#ifdef NRF52_SERIES
+extern "C" void RTC0_IRQHandler()
+{
+    rtc_handler(0);
+}
+
+extern "C" void RTC1_IRQHandler()
+{
+    rtc_handler(1);
+}
+
+extern "C" void RTC2_IRQHandler()
+{
+    rtc_handler(2);
+}
+
+#elif defined(NRF51)
+#error rtc handler needs implementing.
+#else
+#error invalid chip
+#endif
+
+// RTC0 has three compare channels, the others have four. The counter is read directly, so none are used for capture.
+NRFLowLevelRTC::NRFLowLevelRTC(NRF_RTC_Type* r, IRQn_Type irqn) : LowLevelTimer(r == NRF_RTC0 ? 3 : RTC_CHANNEL_COUNT)
+{
+    this->rtc = r;
+    this->irqn = irqn;
+    this->overflows = 0;
+
+    uint8_t instanceNumber = 0;
+
+    if (r == NRF_RTC1)
+        instanceNumber = 1;
+    if (r == NRF_RTC2)
+        instanceNumber = 2;
+
+    instances[instanceNumber] = this;
+
+    for (int i = 0; i < RTC_CHANNEL_COUNT; i++)
+        compare[i] = 0;
+
+    disable();
+    setIRQPriority(2);
+
+    rtc->PRESCALER = 0;
+    rtc->EVTENCLR = 0xFFFFFFFF;
+    rtc->INTENCLR = 0xFFFFFFFF;
+    rtc->INTENSET = RTC_INTENSET_OVRFLW_Msk;
+
+    this->bitMode = BitMode32;
+}
+
+int NRFLowLevelRTC::setIRQPriority(int priority)
+{
+    NVIC_SetPriority(irqn, priority);
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::enable()
+{
+    // Start the low frequency clock if nothing else has. This does not need the 16MHz clock once running.
+    if (!(NRF_CLOCK->LFCLKSTAT & CLOCK_LFCLKSTAT_STATE_Msk))
+    {
+        NRF_CLOCK->LFCLKSRC = NRF_RTC_LFCLK_SOURCE << CLOCK_LFCLKSRC_SRC_Pos;
+        NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
+        NRF_CLOCK->TASKS_LFCLKSTART = 1;
+        while (NRF_CLOCK->EVENTS_LFCLKSTARTED == 0);
+
+        lfclk_calibrate();
+    }
+
+    NVIC_ClearPendingIRQ(irqn);
+
+    rtc->TASKS_START = 1;
+
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::enableIRQ()
+{
+    NVIC_EnableIRQ(irqn);
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::disable()
+{
+    disableIRQ();
+    rtc->TASKS_STOP = 1;
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::disableIRQ()
+{
+    NVIC_DisableIRQ(irqn);
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::reset()
+{
+    int wasEnabled = NVIC_GetEnableIRQ(irqn);
+    disableIRQ();
+    rtc->TASKS_CLEAR = 1;
+    rtc->EVENTS_OVRFLW = 0;
+    overflows = 0;
+    if ( wasEnabled)
+        enableIRQ();
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::setMode(TimerMode t)
+{
+    // The RTC can only count its own clock.
+    if (t != TimerModeTimer)
+        return DEVICE_NOT_SUPPORTED;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Reads the extended counter, in ticks of the 32.768kHz clock.
+  */
+uint64_t NRFLowLevelRTC::getTicks()
+{
+    target_disable_irq();
+
+    uint32_t counter = rtc->COUNTER;
+    uint64_t wraps = overflows;
+
+    // An overflow may have occurred that the interrupt handler has not yet seen. A pending event with a small counter
+    // value means it happened before we read the counter; with a large one, it happened just after.
+    if (rtc->EVENTS_OVRFLW && counter < (RTC_COUNTER_MASK >> 1))
+        wraps++;
+
+    target_enable_irq();
+
+    return (wraps << 24) | counter;
+}
+
+/**
+  * Programs the hardware compare register of the given channel for the time held in compare[channel].
+  * Times further ahead than half the counter range are approached in steps.
+  */
+void NRFLowLevelRTC::program(uint8_t channel)
+{
+    uint64_t now = getTicks();
+    int32_t delta = (int32_t) (compare[channel] - ticks_to_us(now));
+
+    // Times already passed fire as soon as the hardware allows.
+    uint64_t ticks = delta > 0 ? us_to_ticks(delta) : 0;
+
+    if (ticks < RTC_MIN_COMPARE_DELAY)
+        ticks = RTC_MIN_COMPARE_DELAY;
+
+    if (ticks > RTC_MAX_COMPARE_DELAY)
+        ticks = RTC_MAX_COMPARE_DELAY;
+
+    rtc->CC[channel] = (uint32_t) (now + ticks) & RTC_COUNTER_MASK;
+}
+
+int NRFLowLevelRTC::setCompare(uint8_t channel, uint32_t value)
+{
+    if (channel > getChannelCount() - 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    compare[channel] = value;
+    rtc->EVENTS_COMPARE[channel] = 0;
+    program(channel);
+    rtc->INTENSET = (1 << channel) << RTC_INTENSET_COMPARE0_Pos;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::offsetCompare(uint8_t channel, uint32_t value)
+{
+    if (channel > getChannelCount() - 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    return setCompare(channel, compare[channel] + value);
+}
+
+int NRFLowLevelRTC::clearCompare(uint8_t channel)
+{
+    if (channel > getChannelCount() - 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    rtc->INTENCLR = (1 << channel) << RTC_INTENCLR_COMPARE0_Pos;
+    return DEVICE_OK;
+}
+
+uint32_t NRFLowLevelRTC::captureCounter()
+{
+    return ticks_to_us(getTicks());
+}
+
+int NRFLowLevelRTC::setClockSpeed(uint32_t speedKHz)
+{
+    // The counter is always presented in microseconds, whatever the resolution of the underlying clock.
+    if (speedKHz != 1000)
+        return DEVICE_INVALID_PARAMETER;
+
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::setBitMode(TimerBitMode t)
+{
+    // The 24 bit counter is extended in software, so only full 32 bit operation is available.
+    if (t != BitMode32)
+        return DEVICE_INVALID_PARAMETER;
+
+    return DEVICE_OK;
+}
+
+int NRFLowLevelRTC::setSleep(bool doSleep)
+{
+    if (doSleep)
+    {
+        if ( NVIC_GetEnableIRQ(irqn))
+        {
+            status |= CODAL_LOWLEVELTIMER_STATUS_SLEEP_IRQENABLE;
+            disableIRQ();
+        }
+    }
+
+    if (!doSleep)
+    {
+        if ( status & CODAL_LOWLEVELTIMER_STATUS_SLEEP_IRQENABLE)
+        {
+            status &= ~CODAL_LOWLEVELTIMER_STATUS_SLEEP_IRQENABLE;
+            enableIRQ();
+        }
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Interrupt handler, called on each compare and overflow event.
+  */
+void NRFLowLevelRTC::onInterrupt()
+{
+    uint8_t channel_bitmsk = 0;
+
+    if (rtc->EVENTS_OVRFLW)
+    {
+        rtc->EVENTS_OVRFLW = 0;
+        overflows++;
+
+        // The RC oscillator drifts with temperature, so keep it trimmed.
+        lfclk_calibrate();
+    }
+
+    for (int i = 0; i < getChannelCount(); i++)
+    {
+        if (rtc->EVENTS_COMPARE[i] && (rtc->INTENSET & ((1 << i) << RTC_INTENSET_COMPARE0_Pos)))
+        {
+            rtc->EVENTS_COMPARE[i] = 0;
+
+            // A distant compare is reached in steps, so only report the channel once its time has actually come.
+            if ((int32_t) (captureCounter() - compare[i]) >= 0)
+                channel_bitmsk |= 1 << i;
+            else
+                program(i);
+        }
+    }
+
+    if (channel_bitmsk && timer_pointer)
+        timer_pointer(channel_bitmsk);
+}
@@ -1,5 +1,7 @@
 #include "NRFLowLevelTimer.h"
 #include "CodalDmesg.h"
+#include "codal_target_hal.h"
+#include "irq_profile.h"
 
 #define PRESCALE_VALUE_MAX  9
 
@@ -13,24 +15,53 @@ static inline uint32_t counter_value(NRF_TIMER_Type* t, uint8_t cc)
 
 static NRFLowLevelTimer *instances[6] = { 0 };
 
-void timer_handler(uint8_t instance_number)
+#if CONFIG_ENABLED(DEVICE_IRQ_PROFILE)
+// Records how long after its compare event a timer interrupt was taken, from how far the counter has moved on since.
+// Counter mode has no time base, so is not measured. Nor are timers that have never used captureCounter(), as their
+// driver may be using CC3 for something else (e.g. NRF52TouchSensor captures a pad's result into it).
+static void timer_latency(int source, NRFLowLevelTimer *timer)
 {
-    if (instances[instance_number] == NULL)
-        return;
+    static const uint8_t width[] = { 16, 8, 24, 32 };
+    NRF_TIMER_Type *t = timer->timer;
+    uint32_t enabled = (t->INTENSET >> TIMER_INTENSET_COMPARE0_Pos) & ((1 << TIMER_CHANNEL_COUNT) - 1);
 
-    uint8_t channel_bitmsk = 0;
+    if (!timer->capturing || t->MODE != TIMER_MODE_MODE_Timer)
+        return;
 
-    for(int i = 0; i < TIMER_CHANNEL_COUNT; i++)
+    while (enabled)
     {
-        if(instances[instance_number]->timer->EVENTS_COMPARE[i])
+        int i = __builtin_ctz(enabled);
+        enabled &= enabled - 1;
+
+        if (t->EVENTS_COMPARE[i])
         {
-            channel_bitmsk |= 1 << i;
-            instances[instance_number]->timer->EVENTS_COMPARE[i] = 0;
+            uint32_t bits = width[t->BITMODE & 3];
+            uint32_t ticks = counter_value(t, 3) - t->CC[i];
+
+            if (bits < 32)
+                ticks &= (1 << bits) - 1;
+
+            // Each tick is 2^PRESCALER cycles of the 16MHz timer clock, or 4 << PRESCALER CPU cycles at 64MHz.
+            IRQ_PROFILE_LATENCY(source, ticks * (4 << t->PRESCALER));
+            return;
         }
     }
+}
+#endif
+
+void timer_handler(uint8_t instance_number)
+{
+    IRQ_PROFILE_ENTER();
+
+    if (instances[instance_number])
+    {
+#if CONFIG_ENABLED(DEVICE_IRQ_PROFILE)
+        timer_latency(IRQ_PROFILE_TIMER + instance_number, instances[instance_number]);
+#endif
+        instances[instance_number]->onInterrupt();
+    }
 
-    if (instances[instance_number]->timer_pointer)
-        instances[instance_number]->timer_pointer(channel_bitmsk);
+    IRQ_PROFILE_EXIT(IRQ_PROFILE_TIMER + instance_number);
 }
 
 #ifdef NRF52_SERIES
@@ -84,6 +115,10 @@ NRFLowLevelTimer::NRFLowLevelTimer(NRF_TIMER_Type* t, IRQn_Type irqn) : LowLevel
 
     instances[instanceNumber] = this;
 
+    this->overflows = 0;
+    this->overflowChannel = TIMER_NO_OVERFLOW_CHANNEL;
+    this->capturing = false;
+
     disable();
     setIRQPriority(2);
     setClockSpeed(1000);
@@ -158,6 +193,8 @@ int NRFLowLevelTimer::setCompare(uint8_t channel, uint32_t value)
     if (channel > getChannelCount() - 1)
         return DEVICE_INVALID_PARAMETER;
 
+    // Discard any match from while the interrupt was disabled, so it doesn't fire as soon as we enable it.
+    timer->EVENTS_COMPARE[channel] = 0;
     timer->CC[channel] = value;
     timer->INTENSET = (1 << channel) << TIMER_INTENSET_COMPARE0_Pos;
 
@@ -169,6 +206,7 @@ int NRFLowLevelTimer::offsetCompare(uint8_t channel, uint32_t value)
     if (channel > getChannelCount() - 1)
         return DEVICE_INVALID_PARAMETER;
 
+    timer->EVENTS_COMPARE[channel] = 0;
     timer->CC[channel] += value;
     timer->INTENSET = (1 << channel) << TIMER_INTENSET_COMPARE0_Pos;
 
@@ -187,12 +225,116 @@ int NRFLowLevelTimer::clearCompare(uint8_t channel)
 uint32_t NRFLowLevelTimer::captureCounter()
 {
     // 1 channel is used to capture the timer value (channel 3 indexed from zero)
+    // This is not masked: if an interrupt captures in between our trigger and read, we simply return its (slightly later) value.
+    capturing = true;
+    return counter_value(timer, 3);
+}
+
+/**
+  * Dedicates a compare channel to detecting when the counter wraps around, so captureCounter64() can
+  * extend it to 64 bits. The channel is no longer reported to the IRQ handler set by setIRQ().
+  *
+  * @param channel The compare channel to use, or TIMER_NO_OVERFLOW_CHANNEL to stop tracking overflows.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the channel is out of range.
+  */
+int NRFLowLevelTimer::setOverflowChannel(uint8_t channel)
+{
+    if (channel != TIMER_NO_OVERFLOW_CHANNEL && channel >= getChannelCount())
+        return DEVICE_INVALID_PARAMETER;
+
     int wasEnabled = NVIC_GetEnableIRQ(irqn);
     disableIRQ();
-    uint32_t elapsed = counter_value(timer, 3);
-    if ( wasEnabled)
+
+    if (overflowChannel != TIMER_NO_OVERFLOW_CHANNEL)
+        timer->INTENCLR = (1 << overflowChannel) << TIMER_INTENCLR_COMPARE0_Pos;
+
+    overflowChannel = channel;
+    overflows = 0;
+
+    // The counter passes zero as it wraps around.
+    if (overflowChannel != TIMER_NO_OVERFLOW_CHANNEL)
+    {
+        timer->CC[overflowChannel] = 0;
+        timer->EVENTS_COMPARE[overflowChannel] = 0;
+        timer->INTENSET = (1 << overflowChannel) << TIMER_INTENSET_COMPARE0_Pos;
+    }
+
+    if (wasEnabled)
+        enableIRQ();
+
+    // The IRQ must be enabled for overflows to be counted, even if no other compare channel is in use.
+    if (overflowChannel != TIMER_NO_OVERFLOW_CHANNEL)
         enableIRQ();
-    return elapsed;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Reads the counter, extended to 64 bits by the number of times it has wrapped around.
+  * This does not mask interrupts, and may be called from any context.
+  *
+  * @return The extended counter value. If no overflow channel is set, this is the same as captureCounter().
+  */
+uint64_t NRFLowLevelTimer::captureCounter64()
+{
+    static const uint8_t width[] = { 16, 8, 24, 32 };
+    uint32_t high, low, pending;
+
+    if (overflowChannel == TIMER_NO_OVERFLOW_CHANNEL)
+        return captureCounter();
+
+    // Retry if the interrupt handler counts an overflow while we read.
+    do
+    {
+        high = overflows;
+        low = captureCounter();
+        pending = timer->EVENTS_COMPARE[overflowChannel];
+    } while (high != overflows);
+
+    uint32_t bits = width[timer->BITMODE & 3];
+
+    // An overflow may not have been counted yet, if we've interrupted the handler or interrupts are disabled.
+    // A pending event with a small counter value means the wrap happened before we read the counter; with a large one, just after.
+    if (pending && (low >> (bits - 1)) == 0)
+        high++;
+
+    return ((uint64_t) high << bits) | low;
+}
+
+/**
+  * Interrupt handler, called on each compare event.
+  */
+void NRFLowLevelTimer::onInterrupt()
+{
+    // Only visit the channels that are both enabled and have fired.
+    uint32_t enabled = (timer->INTENSET >> TIMER_INTENSET_COMPARE0_Pos) & ((1 << TIMER_CHANNEL_COUNT) - 1);
+    uint8_t channel_bitmsk = 0;
+
+    while (enabled)
+    {
+        int i = __builtin_ctz(enabled);
+        enabled &= enabled - 1;
+
+        if (timer->EVENTS_COMPARE[i])
+        {
+            if (i == overflowChannel)
+            {
+                // Count the overflow and clear the event together, so captureCounter64() never sees one without the other.
+                target_disable_irq();
+                overflows++;
+                timer->EVENTS_COMPARE[i] = 0;
+                target_enable_irq();
+                continue;
+            }
+
+            channel_bitmsk |= 1 << i;
+            timer->EVENTS_COMPARE[i] = 0;
+        }
+    }
+
+    if (channel_bitmsk && timer_pointer)
+        timer_pointer(channel_bitmsk);
 }
 
 int NRFLowLevelTimer::setClockSpeed(uint32_t speedKHz)
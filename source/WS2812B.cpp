@@ -23,9 +23,22 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "WS2812B.h"
+#include "buffer_pool.h"
 
 using namespace codal;
 
+#define WS2812B_BIT(b)              ((b) ? WS2812B_HIGH : WS2812B_LOW)
+#define WS2812B_PAIR(a, b)          ((uint32_t) WS2812B_BIT(a) | ((uint32_t) WS2812B_BIT(b) << 16))
+#define WS2812B_NIBBLE(n)           { WS2812B_PAIR((n) & 8, (n) & 4), WS2812B_PAIR((n) & 2, (n) & 1) }
+
+// The PWM samples for each nibble of input, most significant bit first, packed two per word.
+const uint32_t ws2812b_nibble[16][2] = {
+    WS2812B_NIBBLE(0),  WS2812B_NIBBLE(1),  WS2812B_NIBBLE(2),  WS2812B_NIBBLE(3),
+    WS2812B_NIBBLE(4),  WS2812B_NIBBLE(5),  WS2812B_NIBBLE(6),  WS2812B_NIBBLE(7),
+    WS2812B_NIBBLE(8),  WS2812B_NIBBLE(9),  WS2812B_NIBBLE(10), WS2812B_NIBBLE(11),
+    WS2812B_NIBBLE(12), WS2812B_NIBBLE(13), WS2812B_NIBBLE(14), WS2812B_NIBBLE(15)
+};
+
 /**
  * Constructor.
  *
@@ -69,15 +82,24 @@ WS2812B::getBufferSize()
 
 /**
  *  Defines the maximum size of the buffers streamed out of this component.
- *  @param size the size of this component's output buffers, in bytes.
+ *  @param size the size of this component's output buffers, in bytes. This is rounded down to a multiple of
+ *  16 bytes (the encoding of one byte of input), with a minimum of 16.
  */
 int
 WS2812B::setBufferSize(int size)
 {
-    outputBufferSize = size;
+    outputBufferSize = max(16, size & ~15);
     return DEVICE_OK;
 }
 
+/**
+ * Obtain an output buffer from the pool, recycling one released by our downstream component where possible.
+ */
+ManagedBuffer WS2812B::allocateBuffer()
+{
+    return buffer_pool_allocate(pool, WS2812B_POOL_SIZE, outputBufferSize);
+}
+
 /**
  * Provide the next available ManagedBuffer to our downstream caller, if available.
  */
@@ -85,28 +107,48 @@ ManagedBuffer WS2812B::pull()
 {
     // Calculate the amount of data we can transfer in this pull request.
     // Ensure we send at least two buffers, as most downstream components will likely be double buffered...
-    int totalSamples = max(outputBufferSize, samplesToSend + 2 * WS2812B_ZERO_PADDING);
-    ManagedBuffer buffer(outputBufferSize);
+    int dataEnd = WS2812B_LEAD_PADDING + samplesToSend;
+    int totalSamples = max(outputBufferSize, dataEnd + WS2812B_ZERO_PADDING);
+    ManagedBuffer buffer = allocateBuffer();
 
     uint16_t *out = (uint16_t *) &buffer[0];
-    uint16_t *end = (uint16_t *) &buffer[buffer.length()];
+    int end = samplesSent + buffer.length() / 2;
+
+    // Add the front padding if applicable
+    while (samplesSent < WS2812B_LEAD_PADDING && samplesSent < end)
+    {
+        *out++ = WS2812B_PAD;
+        samplesSent++;
+    }
 
-    while (out < end)
+    // Encode whole bytes, each as 16 bytes of output. The leading padding and the buffer size are both
+    // multiples of 8 samples, so a byte never straddles two buffers, and the output is always word aligned.
+    if (samplesSent < dataEnd && samplesSent < end)
     {
-        // Add the front/rear padding if aplicable
-        if (samplesSent < WS2812B_ZERO_PADDING || samplesSent > (WS2812B_ZERO_PADDING + samplesToSend))
+        int bytes = (min(dataEnd, end) - samplesSent) / 8;
+        const uint8_t *in = data + (samplesSent - WS2812B_LEAD_PADDING) / 8;
+        uint32_t *o = (uint32_t *) out;
+
+        for (int i = 0; i < bytes; i++)
         {
-            *out = WS2812B_PAD;
+            const uint32_t *hi = ws2812b_nibble[in[i] >> 4];
+            const uint32_t *lo = ws2812b_nibble[in[i] & 0x0F];
+
+            o[0] = hi[0];
+            o[1] = hi[1];
+            o[2] = lo[0];
+            o[3] = lo[1];
+            o += 4;
         }
-        else
-        {
-            int index = (samplesSent - WS2812B_ZERO_PADDING) / 8;
-            int bit = (samplesSent - WS2812B_ZERO_PADDING) % 8;
 
-            *out = ((data[index] >> (7-bit)) & 1) ? WS2812B_HIGH : WS2812B_LOW;
-        }
+        out = (uint16_t *) o;
+        samplesSent += bytes * 8;
+    }
 
-        out++;
+    // Add the rear padding if applicable
+    while (samplesSent < end)
+    {
+        *out++ = WS2812B_PAD;
         samplesSent++;
     }
 
@@ -0,0 +1,260 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CodalConfig.h"
+#include "WS2812BParallel.h"
+#include "buffer_pool.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param module The PWM module to use to generate the output. This must not be in use by any other NRF52PWM instance,
+ * and remains claimed for the lifetime of the application.
+ */
+WS2812BParallel::WS2812BParallel(NRF_PWM_Type *module)
+{
+    this->downstream = NULL;
+    this->periodsToSend = 0;
+    this->periodsSent = 0;
+    this->blockingPlayout = false;
+    this->setBufferSize(WS2812B_PARALLEL_BUFFER_SIZE);
+    lock.wait();
+
+    // Each PWM period loads one sample into each of the four channels, so every strip advances by one bit at a time.
+    pwm = new NRF52PWM(module, *this, WS2812B_PWM_FREQ);
+    pwm->setStreamingMode(true, false);
+    pwm->setDecoderMode(PWM_DECODER_LOAD_Individual);
+    pwm->setSampleRate(WS2812B_PWM_FREQ);
+}
+
+/**
+ * Connects the given pin to the given strip.
+ *
+ * @param pin The pin connected to the strip.
+ * @param strip The strip number, in the range 0..WS2812B_PARALLEL_MAX_STRIPS-1.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the strip number is out of range.
+ */
+int WS2812BParallel::connectPin(Pin &pin, int strip)
+{
+    if (strip < 0 || strip >= WS2812B_PARALLEL_MAX_STRIPS)
+        return DEVICE_INVALID_PARAMETER;
+
+    return pwm->connectPin(pin, strip);
+}
+
+/**
+ * Disconnects the given pin from its strip.
+ *
+ * @param pin The pin to disconnect.
+ *
+ * @return DEVICE_OK on success.
+ */
+int WS2812BParallel::disconnectPin(Pin &pin)
+{
+    return pwm->disconnectPin(pin);
+}
+
+/*
+ * Allow out downstream component to register itself with us
+ */
+void WS2812BParallel::connect(DataSink &sink)
+{
+    this->downstream = &sink;
+}
+
+/**
+ *  Determine the data format of the buffers streamed out of this component.
+ */
+int WS2812BParallel::getFormat()
+{
+    return DATASTREAM_FORMAT_8BIT_UNSIGNED;
+}
+
+/**
+ *  Determine the maximum size of the buffers streamed out of this component.
+ *  @return The maximum size of this component's output buffers, in bytes.
+ */
+int WS2812BParallel::getBufferSize()
+{
+    return outputBufferSize;
+}
+
+/**
+ *  Defines the maximum size of the buffers streamed out of this component.
+ *  @param size the size of this component's output buffers, in bytes. This is rounded down to a multiple of
+ *  WS2812B_PARALLEL_BYTE_SIZE bytes (the encoding of one byte of input for every strip), with a minimum of one.
+ */
+int WS2812BParallel::setBufferSize(int size)
+{
+    outputBufferSize = max(WS2812B_PARALLEL_BYTE_SIZE, size - (size % WS2812B_PARALLEL_BYTE_SIZE));
+    return DEVICE_OK;
+}
+
+/**
+ * Obtain an output buffer from the pool, recycling one released by our downstream component where possible.
+ */
+ManagedBuffer WS2812BParallel::allocateBuffer()
+{
+    return buffer_pool_allocate(pool, WS2812B_POOL_SIZE, outputBufferSize);
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer WS2812BParallel::pull()
+{
+    int dataEnd = WS2812B_LEAD_PADDING + periodsToSend;
+    int totalPeriods = max(outputBufferSize / WS2812B_PARALLEL_PERIOD_SIZE, dataEnd + WS2812B_ZERO_PADDING);
+    ManagedBuffer buffer = allocateBuffer();
+
+    uint32_t *out = (uint32_t *) &buffer[0];
+    int end = periodsSent + buffer.length() / WS2812B_PARALLEL_PERIOD_SIZE;
+
+    // Add the front padding if applicable. Each period is two words: one sample for each of the four channels.
+    while (periodsSent < WS2812B_LEAD_PADDING && periodsSent < end)
+    {
+        *out++ = WS2812B_PARALLEL_PAD_PAIR;
+        *out++ = WS2812B_PARALLEL_PAD_PAIR;
+        periodsSent++;
+    }
+
+    // Encode whole bytes, taking the same byte of every strip at a time. The leading padding and the buffer size are
+    // both multiples of 8 periods, so a byte never straddles two buffers.
+    if (periodsSent < dataEnd && periodsSent < end)
+    {
+        int first = (periodsSent - WS2812B_LEAD_PADDING) / 8;
+        int last = first + (min(dataEnd, end) - periodsSent) / 8;
+
+        for (int i = first; i < last; i++)
+        {
+            uint32_t bits = 0;
+            uint32_t mask[2] = {0x80008000, 0x80008000};
+
+            // Gather byte i of each strip into its own byte lane, strip 0 uppermost. Strips that have no byte i
+            // keep only the PWM polarity bit of their samples, so they are held low.
+            for (int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+            {
+                if (i < strips[s].length())
+                {
+                    bits |= (uint32_t) strips[s][i] << (24 - 8 * s);
+                    mask[s >> 1] |= 0xFFFFU << (16 * (s & 1));
+                }
+            }
+
+            // Each bit of the byte, most significant first, is one period. Collecting the top bit of every lane
+            // gives a nibble whose samples are those of the four channels, in channel order.
+            for (int b = 0; b < 8; b++)
+            {
+                uint32_t top = bits & 0x80808080;
+                const uint32_t *samples = ws2812b_nibble[((top >> 28) | (top >> 21) | (top >> 14) | (top >> 7)) & 0x0F];
+
+                out[0] = samples[0] & mask[0];
+                out[1] = samples[1] & mask[1];
+                out += 2;
+                bits <<= 1;
+            }
+        }
+
+        periodsSent += (last - first) * 8;
+    }
+
+    // Add the rear padding if applicable
+    while (periodsSent < end)
+    {
+        *out++ = WS2812B_PARALLEL_PAD_PAIR;
+        *out++ = WS2812B_PARALLEL_PAD_PAIR;
+        periodsSent++;
+    }
+
+    // If we still have data to send, indicate this to our downstream component
+    if (periodsSent < totalPeriods)
+        downstream->pullRequest();
+
+    // If we have completed playback and blockingbehaviour was requested, wake the fiber that is blocked waiting.
+    if ((periodsSent >= totalPeriods) && blockingPlayout)
+        lock.notify();
+
+    return buffer;
+}
+
+/**
+ * Perform a blocking playout of the given 24 bit RGB/GRB encoded datastreams, one per strip. This method performs
+ * no ordering of red/green/blue elements - it simply clocks out the data in the order provided.
+ * Strips may be of different lengths; the shorter strips are held low once their data has been sent.
+ *
+ * @param buffers The RGB buffers to playout. buffers[n] is sent to the pin connected to strip n.
+ * @param count The number of buffers, in the range 1..WS2812B_PARALLEL_MAX_STRIPS.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+ */
+int WS2812BParallel::play(ManagedBuffer *buffers, int count)
+{
+    return _play(buffers, count, true);
+}
+
+/**
+ * Perform a non-blocking playout of the given 24 bit RGB/GRB encoded datastreams, one per strip.
+ * The buffers are retained until the next playout, so may be released by the caller.
+ *
+ * @param buffers The RGB buffers to playout. buffers[n] is sent to the pin connected to strip n.
+ * @param count The number of buffers, in the range 1..WS2812B_PARALLEL_MAX_STRIPS.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+ */
+int WS2812BParallel::playAsync(ManagedBuffer *buffers, int count)
+{
+    return _play(buffers, count, false);
+}
+
+int WS2812BParallel::_play(ManagedBuffer *buffers, int count, bool mode)
+{
+    int length = 0;
+
+    if (buffers == NULL || count < 1 || count > WS2812B_PARALLEL_MAX_STRIPS)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+    {
+        strips[s] = s < count ? buffers[s] : ManagedBuffer();
+        length = max(length, strips[s].length());
+    }
+
+    if (downstream == NULL || length == 0)
+        return DEVICE_OK;
+
+    this->periodsToSend = length * 8;
+    this->periodsSent = 0;
+    this->blockingPlayout = mode;
+
+    downstream->pullRequest();
+
+    if (this->blockingPlayout)
+        lock.wait();
+
+    return DEVICE_OK;
+}
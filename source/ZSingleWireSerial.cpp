@@ -3,6 +3,8 @@
 #include "core_cm4.h"
 #include "CodalDmesg.h"
 #include "peripheral_alloc.h"
+#include "ppi_alloc.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -18,18 +20,58 @@ void ZSingleWireSerial::irq_handler(void *inst)
 void ZSingleWireSerial::irq_handler()
 {
     int eventValue = 0;
+
+    // TXSTARTED and ENDTX strictly alternate, so consume them in that order. This keeps our view of the
+    // transmitter straight even if a short frame ends before we've seen it start.
+    for (;;)
+    {
+        if (!txStarted && uart->EVENTS_TXSTARTED)
+        {
+            uart->EVENTS_TXSTARTED = 0;
+            txStarted = true;
+
+            // The UARTE has latched the current frame, so the next one can be loaded behind it.
+            chainTx();
+            continue;
+        }
+
+        if (txStarted && uart->EVENTS_ENDTX)
+        {
+            uart->EVENTS_ENDTX = 0;
+            txStarted = false;
+
+            txHead = (txHead + 1) % ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE;
+            txCount--;
+
+            if (txChained)
+            {
+                // PPI has already started the next frame, and disarmed itself through txGroup in doing so.
+                txChained = false;
+            }
+            else if (txCount)
+            {
+                uart->TXD.PTR = (uint32_t)txQueue[txHead].data;
+                uart->TXD.MAXCNT = txQueue[txHead].len;
+                uart->TASKS_STARTTX = 1;
+            }
+            else
+            {
+                configureTxInterrupt(0);
+            }
+
+            eventValue = SWS_EVT_DATA_SENT;
+            continue;
+        }
+
+        break;
+    }
+
     if (uart->EVENTS_ENDRX)
     {
         uart->EVENTS_ENDRX = 0;
         configureRxInterrupt(0);
         eventValue = SWS_EVT_DATA_RECEIVED;
     }
-    else if (uart->EVENTS_ENDTX)
-    {
-        uart->EVENTS_ENDTX = 0;
-        configureTxInterrupt(0);
-        eventValue = SWS_EVT_DATA_SENT;
-    }
     else if (uart->EVENTS_ERROR && (uart->INTEN & UARTE_INTENSET_ERROR_Msk))
     {
         uart->EVENTS_ERROR = 0;
@@ -44,12 +86,54 @@ void ZSingleWireSerial::irq_handler()
         //eventValue = SWS_EVT_ERROR;
     }
 
+    if (eventValue == SWS_EVT_DATA_RECEIVED)
+    {
+        // The frame is complete, so stop watching for the end of it.
+        if (idleTimer)
+        {
+            disableIdlePpi();
+            idleTimer->timer->TASKS_STOP = 1;
+        }
+
+        rxActive = false;
+    }
+
     if (eventValue > 0 && cb)
     {
         cb(eventValue);
     }
 }
 
+/**
+  * Loads the frame following the head of txQueue into the UARTE, to be started by PPI as soon as the
+  * current frame ends.
+  *
+  * @note should only be called with the UARTE interrupt disabled, or from the interrupt handler.
+  */
+void ZSingleWireSerial::chainTx()
+{
+    if (!txStarted || txChained || txCount < 2)
+        return;
+
+    ZSingleWireFrame *f = &txQueue[(txHead + 1) % ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE];
+
+    // TXD.PTR and MAXCNT are double buffered, so this doesn't affect the frame being sent.
+    uart->TXD.PTR = (uint32_t)f->data;
+    uart->TXD.MAXCNT = f->len;
+
+    // Arm the channel for exactly one ENDTX: the same event disables its group, so it can never start a frame twice.
+    *ppi_group_enable_task(txGroup) = 1;
+    txChained = true;
+
+    // If the current frame ended before the channel was armed, PPI missed it and the channel is still enabled.
+    // If it ended afterwards, PPI has already started the next frame and disarmed the channel, so there is nothing to do.
+    if (uart->EVENTS_ENDTX && (NRF_PPI->CHEN & (1 << ppi[ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN])))
+    {
+        *ppi_group_disable_task(txGroup) = 1;
+        uart->TASKS_STARTTX = 1;
+    }
+}
+
 void ZSingleWireSerial::configureRxInterrupt(int enable)
 {
     if (enable)
@@ -61,30 +145,30 @@ void ZSingleWireSerial::configureRxInterrupt(int enable)
 void ZSingleWireSerial::configureTxInterrupt(int enable)
 {
     if (enable)
-        uart->INTENSET = (UARTE_INTENSET_ENDTX_Msk);
+        uart->INTENSET = (UARTE_INTENSET_ENDTX_Msk | UARTE_INTENSET_TXSTARTED_Msk);
     else
-        uart->INTENCLR = (UARTE_INTENCLR_ENDTX_Msk);
+        uart->INTENCLR = (UARTE_INTENCLR_ENDTX_Msk | UARTE_INTENCLR_TXSTARTED_Msk);
 }
 
 int ZSingleWireSerial::configureTx(int enable)
 {
     if (enable && !(status & TX_CONFIGURED))
     {
-        NRF_P0->DIR |= (1 << p.name);
-        NRF_P0->PIN_CNF[p.name] =  3 << 2; // this overrides DIR setting above
+        // PSEL can only be changed while the UARTE is disabled, so a turnaround costs one disable/enable.
+        // The pin itself is configured once, in the constructor - the UARTE overrides its direction while enabled.
+        if (status & RX_CONFIGURED)
+            configureRx(0);
+
         uart->PSEL.TXD = p.name;
         uart->EVENTS_ENDTX = 0;
+        uart->EVENTS_TXSTARTED = 0;
         uart->ENABLE = 8;
-        while(!(uart->ENABLE));
         status |= TX_CONFIGURED;
     }
-    else if (status & TX_CONFIGURED)
+    else if (enable == 0 && status & TX_CONFIGURED)
     {
         uart->TASKS_STOPTX = 1;
-        while(uart->TASKS_STOPTX);
         uart->ENABLE = 0;
-        while((uart->ENABLE));
-
         uart->PSEL.TXD = 0xFFFFFFFF;
         status &= ~TX_CONFIGURED;
     }
@@ -96,22 +180,20 @@ int ZSingleWireSerial::configureRx(int enable)
 {
     if (enable && !(status & RX_CONFIGURED))
     {
-        NRF_P0->DIR &= ~(1 << p.name);
-        NRF_P0->PIN_CNF[p.name] =  3 << 2; // this overrides DIR setting above
+        if (status & TX_CONFIGURED)
+            configureTx(0);
+
         uart->PSEL.RXD = p.name;
         uart->EVENTS_ENDRX = 0;
         uart->EVENTS_ERROR = 0;
         uart->ERRORSRC = uart->ERRORSRC;
         uart->ENABLE = 8;
-        while(!(uart->ENABLE));
         status |= RX_CONFIGURED;
     }
     else if (enable == 0 && status & RX_CONFIGURED)
     {
         uart->TASKS_STOPRX = 1;
-        while(uart->TASKS_STOPRX);
         uart->ENABLE = 0;
-        while((uart->ENABLE));
         uart->PSEL.RXD = 0xFFFFFFFF;
         status &= ~RX_CONFIGURED;
     }
@@ -127,6 +209,16 @@ ZSingleWireSerial::ZSingleWireSerial(Pin& p) : DMASingleWireSerial(p)
 
     status = 0;
 
+    txHead = 0;
+    txCount = 0;
+    txStarted = false;
+    txChained = false;
+    rxActive = false;
+    idleTimer = NULL;
+
+    for (int i = 0; i < ZSINGLE_WIRE_SERIAL_PPI_CHANNELS; i++)
+        ppi[i] = -1;
+
     uart->CONFIG = 0;
 
     // these lines are disabled
@@ -137,6 +229,21 @@ ZSingleWireSerial::ZSingleWireSerial(Pin& p) : DMASingleWireSerial(p)
     uart->PSEL.TXD = 0xFFFFFFFF;
     uart->PSEL.RXD = 0xFFFFFFFF;
 
+    // The bus idles high. The UARTE takes over the pin while it's enabled.
+    NRF_P0->PIN_CNF[p.name] =  3 << 2;
+
+    // Chain queued frames back to back in hardware.
+    ppi[ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN] = allocate_ppi_channel();
+    if (ppi[ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN] < 0)
+        target_panic(DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    txGroup = allocate_ppi_group();
+    if (txGroup < 0)
+        target_panic(DEVICE_HARDWARE_CONFIGURATION_ERROR);
+
+    ppi_route(ppi[ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN], &uart->EVENTS_ENDTX, &uart->TASKS_STARTTX, ppi_group_disable_task(txGroup));
+    ppi_group_add(txGroup, ppi[ZSINGLE_WIRE_SERIAL_PPI_TX_CHAIN]);
+
     setBaud(1000000);
 
     IRQn_Type irqn = get_alloc_peri_irqn(uart);
@@ -150,34 +257,110 @@ ZSingleWireSerial::ZSingleWireSerial(Pin& p) : DMASingleWireSerial(p)
 
 int ZSingleWireSerial::putc(char c)
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    uint8_t b = c;
+
+    return send(&b, 1);
 }
+
 int ZSingleWireSerial::getc()
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    uint8_t c;
+
+    if (receive(&c, 1) != 1)
+        return DEVICE_NO_DATA;
+
+    return c;
 }
 
 int ZSingleWireSerial::send(uint8_t* data, int len)
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    int result = sendDMA(data, len);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    // Wait for this frame, and any queued before it, to leave.
+    CODAL_TIMESTAMP start = system_timer_current_time();
+
+    while (txCount)
+    {
+        if (system_timer_current_time() - start > ZSINGLE_WIRE_SERIAL_TIMEOUT)
+        {
+            abortDMA();
+            return DEVICE_CANCELLED;
+        }
+    }
+
+    return DEVICE_OK;
 }
 
 int ZSingleWireSerial::receive(uint8_t* data, int len)
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    int result = receiveDMA(data, len);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    CODAL_TIMESTAMP start = system_timer_current_time();
+
+    while (rxActive)
+    {
+        if (system_timer_current_time() - start > ZSINGLE_WIRE_SERIAL_TIMEOUT)
+        {
+            abortDMA();
+            return DEVICE_CANCELLED;
+        }
+    }
+
+    return getBytesReceived();
 }
 
 int ZSingleWireSerial::sendDMA(uint8_t* data, int len)
 {
+    if (data == NULL || len <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
     if (!(status & TX_CONFIGURED))
         setMode(SingleWireTx);
 
-    uart->TXD.PTR = (uint32_t)data;
-    uart->TXD.MAXCNT = len;
+    IRQn_Type irqn = get_alloc_peri_irqn(uart);
+    int wasEnabled = NVIC_GetEnableIRQ(irqn);
+    NVIC_DisableIRQ(irqn);
 
-    configureTxInterrupt(1);
+    if (txCount >= ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE)
+    {
+        if (wasEnabled)
+            NVIC_EnableIRQ(irqn);
 
-    uart->TASKS_STARTTX = 1;
+        return DEVICE_BUSY;
+    }
+
+    ZSingleWireFrame *f = &txQueue[(txHead + txCount) % ZSINGLE_WIRE_SERIAL_TX_QUEUE_SIZE];
+    f->data = data;
+    f->len = len;
+    txCount++;
+
+    if (txCount == 1)
+    {
+        // The transmitter is idle, so start straight away.
+        txStarted = false;
+        txChained = false;
+
+        uart->TXD.PTR = (uint32_t)data;
+        uart->TXD.MAXCNT = len;
+
+        configureTxInterrupt(1);
+
+        uart->TASKS_STARTTX = 1;
+    }
+    else
+    {
+        // Queue behind the current frame. If it's already under way, PPI will start this one the moment it ends.
+        chainTx();
+    }
+
+    if (wasEnabled)
+        NVIC_EnableIRQ(irqn);
 
     return DEVICE_OK;
 }
@@ -190,6 +373,17 @@ int ZSingleWireSerial::receiveDMA(uint8_t* data, int len)
     uart->RXD.PTR = (uint32_t)data;
     uart->RXD.MAXCNT = len;
 
+    rxActive = true;
+
+    if (idleTimer)
+    {
+        // The timer starts with the first byte, and stops the receiver if the line then goes quiet.
+        idleTimer->timer->TASKS_STOP = 1;
+        idleTimer->timer->TASKS_CLEAR = 1;
+        ppi_enable(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY]);
+        ppi_enable(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE]);
+    }
+
     configureRxInterrupt(1);
 
     uart->TASKS_STARTRX = 1;
@@ -202,9 +396,88 @@ int ZSingleWireSerial::abortDMA()
     configureTxInterrupt(0);
     configureRxInterrupt(0);
 
+    *ppi_group_disable_task(txGroup) = 1;
+    disableIdlePpi();
+
     uart->RXD.MAXCNT = 0;
     uart->TXD.MAXCNT = 0;
 
+    txCount = 0;
+    txStarted = false;
+    txChained = false;
+    rxActive = false;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Disables the PPI channels detecting the end of received frames, if allocated.
+  */
+void ZSingleWireSerial::disableIdlePpi()
+{
+    if (ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY] >= 0)
+        ppi_disable(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY]);
+
+    if (ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE] >= 0)
+        ppi_disable(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE]);
+}
+
+/**
+  * Ends each reception once the line has been idle for the given time, rather than only once the
+  * buffer passed to receiveDMA() is full. getBytesReceived() then gives the length of the frame.
+  *
+  * Idle detection is done in hardware: every received byte restarts the timer through PPI, and the timer
+  * stops the receiver through PPI when it expires.
+  *
+  * @param timer A timer dedicated to idle detection. It is configured for 1MHz operation.
+  *
+  * @param idleTime The idle time that ends a frame, in microseconds, or 0 to disable idle detection.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if too few PPI channels are free.
+  */
+int ZSingleWireSerial::setIdleTimeout(NRFLowLevelTimer &timer, uint32_t idleTime)
+{
+    disableIdlePpi();
+
+    if (idleTime == 0)
+    {
+        ppi_disconnect(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY]);
+        ppi_disconnect(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE]);
+        ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY] = ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE] = -1;
+
+        timer.timer->SHORTS = 0;
+        timer.disable();
+        idleTimer = NULL;
+        return DEVICE_OK;
+    }
+
+    for (int i = ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY; i <= ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE; i++)
+    {
+        if (ppi[i] < 0)
+            ppi[i] = allocate_ppi_channel();
+
+        if (ppi[i] < 0)
+        {
+            idleTimer = NULL;
+            return DEVICE_NO_RESOURCES;
+        }
+    }
+
+    timer.disable();
+    timer.setMode(TimerMode::TimerModeTimer);
+    timer.setClockSpeed(1000);
+    timer.setBitMode(BitMode32);
+    timer.reset();
+
+    // The timer runs only while bytes are arriving, and stops itself on expiry.
+    timer.timer->CC[0] = idleTime;
+    timer.timer->SHORTS = TIMER_SHORTS_COMPARE0_STOP_Msk;
+
+    ppi_route(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_ACTIVITY], &uart->EVENTS_RXDRDY, &timer.timer->TASKS_CLEAR, &timer.timer->TASKS_START);
+    ppi_route(ppi[ZSINGLE_WIRE_SERIAL_PPI_RX_IDLE], &timer.timer->EVENTS_COMPARE[0], &uart->TASKS_STOPRX);
+
+    idleTimer = &timer;
+
     return DEVICE_OK;
 }
 
@@ -242,15 +515,47 @@ uint32_t ZSingleWireSerial::getBaud()
 
 int ZSingleWireSerial::getBytesTransmitted()
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    return uart->TXD.AMOUNT;
 }
 
 int ZSingleWireSerial::getBytesReceived()
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    return uart->RXD.AMOUNT;
 }
 
 int ZSingleWireSerial::sendBreak()
 {
-    return DEVICE_NOT_IMPLEMENTED;
+    if (!(status & TX_CONFIGURED))
+        setMode(SingleWireTx);
+
+    // Let anything queued go first.
+    CODAL_TIMESTAMP start = system_timer_current_time();
+
+    while (txCount)
+    {
+        if (system_timer_current_time() - start > ZSINGLE_WIRE_SERIAL_TIMEOUT)
+        {
+            abortDMA();
+            return DEVICE_CANCELLED;
+        }
+    }
+
+    // A break must outlast a full frame at the current baud rate, so the receiver sees a framing error.
+    uint32_t baud = getBaud();
+    uint32_t breakTime = baud ? (11 * 1000000 + baud - 1) / baud : 0;
+
+    if (breakTime < ZSINGLE_WIRE_SERIAL_BREAK_TIME)
+        breakTime = ZSINGLE_WIRE_SERIAL_BREAK_TIME;
+
+    // Briefly hand the pin back to the GPIO, and hold the line low.
+    uart->ENABLE = 0;
+    NRF_P0->OUTCLR = 1 << p.name;
+    NRF_P0->DIRSET = 1 << p.name;
+
+    target_wait_us(breakTime);
+
+    NRF_P0->DIRCLR = 1 << p.name;
+    uart->ENABLE = 8;
+
+    return DEVICE_OK;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "CodalConfig.h"
+#include "buffer_pool.h"
+
+namespace codal
+{
+
+bool buffer_pool_unique(ManagedBuffer &b)
+{
+    // RefCounted stores (2 * count) + 1, so a single reference is a refCount of 3.
+    BufferData *d = (BufferData *) (b.getBytes() - sizeof(BufferData));
+    return d->refCount == 3;
+}
+
+ManagedBuffer buffer_pool_allocate(ManagedBuffer *pool, int poolSize, int size)
+{
+    int spare = -1;
+
+    for (int i = 0; i < poolSize; i++)
+    {
+        if (pool[i].length() == 0)
+        {
+            if (spare < 0)
+                spare = i;
+
+            continue;
+        }
+
+        if (buffer_pool_unique(pool[i]))
+        {
+            if (pool[i].length() == size)
+                return pool[i];
+
+            // A released buffer of the wrong size can be replaced.
+            if (spare < 0 || pool[spare].length() != 0)
+                spare = i;
+        }
+    }
+
+    ManagedBuffer b(size, BufferInitialize::None);
+
+    if (spare >= 0)
+        pool[spare] = b;
+
+    return b;
+}
+
+ManagedBuffer buffer_pool_recycle(ManagedBuffer *pool, int poolSize, int size)
+{
+    for (int i = 0; i < poolSize; i++)
+        if (pool[i].length() == size && buffer_pool_unique(pool[i]))
+            return pool[i];
+
+    return ManagedBuffer();
+}
+
+int buffer_pool_reserve(ManagedBuffer *pool, int poolSize, int size, int count)
+{
+    int held = 0;
+
+    for (int i = 0; i < poolSize; i++)
+        if (pool[i].length() == size)
+            held++;
+
+    for (int i = 0; i < poolSize && held < count; i++)
+    {
+        if (pool[i].length() == 0)
+        {
+            pool[i] = ManagedBuffer(size, BufferInitialize::None);
+
+            if (pool[i].length() == size)
+                held++;
+        }
+    }
+
+    return held;
+}
+
+} // namespace codal
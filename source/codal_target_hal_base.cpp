@@ -3,6 +3,7 @@
 #include "CodalDmesg.h"
 #include "CodalCompat.h"
 #include "Timer.h"
+#include "ramfunc.h"
 
 static int8_t irq_disabled;
 
@@ -87,11 +88,35 @@ extern "C" void target_start()
     _start();
 }
 
+void icache_profile_start()
+{
+    NRF_NVMC->IHIT = 0;
+    NRF_NVMC->IMISS = 0;
+    NRF_NVMC->ICACHECNF |= NVMC_ICACHECNF_CACHEPROFEN_Msk;
+}
+
+void icache_profile_stop()
+{
+    NRF_NVMC->ICACHECNF &= ~NVMC_ICACHECNF_CACHEPROFEN_Msk;
+}
+
+uint32_t icache_hits()
+{
+    return NRF_NVMC->IHIT;
+}
+
+uint32_t icache_misses()
+{
+    return NRF_NVMC->IMISS;
+}
+
 /**
  *  Thread Context for an ARM Cortex core.
  *
  * This is probably overkill, but the ARMCC compiler uses a lot register optimisation
  * in its calling conventions, so better safe than sorry!
+ *
+ * The layout is shared with asm/CortexContextSwitch.s, which must be updated to match any change.
  */
 struct PROCESSOR_TCB
 {
@@ -111,6 +136,8 @@ struct PROCESSOR_TCB
     uint32_t SP;
     uint32_t LR;
     uint32_t stack_base;
+    uint32_t FPU;           // Non-zero if S16 to S31 below hold the fiber's (callee saved) FPU registers.
+    uint32_t S[16];         // S16 to S31, stored only for fibers that have used the FPU.
 };
 
 PROCESSOR_WORD_TYPE fiber_initial_stack_base()
@@ -118,9 +145,44 @@ PROCESSOR_WORD_TYPE fiber_initial_stack_base()
     return DEVICE_STACK_BASE;
 }
 
+// The number of fiber TCBs allocated statically. Any further fibers take their TCBs from the heap.
+#ifndef DEVICE_TCB_POOL_SIZE
+#define DEVICE_TCB_POOL_SIZE 4
+#endif
+
+#if DEVICE_TCB_POOL_SIZE > 0
+static PROCESSOR_TCB tcb_pool[DEVICE_TCB_POOL_SIZE];
+static uint8_t tcb_pool_used;
+#endif
+
+/**
+ * Allocates the TCB for a new fiber.
+ *
+ * The scheduler keeps the fibers that complete in a pool, along with their TCBs, and reuses them for new fibers.
+ * So TCBs are never released, and the first DEVICE_TCB_POOL_SIZE are simply taken in turn from a static pool,
+ * keeping them out of the heap.
+ */
 void *tcb_allocate()
 {
-    return (void *)malloc(sizeof(PROCESSOR_TCB));
+    PROCESSOR_TCB *tcb = NULL;
+
+#if DEVICE_TCB_POOL_SIZE > 0
+    target_disable_irq();
+
+    if (tcb_pool_used < DEVICE_TCB_POOL_SIZE)
+        tcb = &tcb_pool[tcb_pool_used++];
+
+    target_enable_irq();
+#endif
+
+    if (tcb == NULL)
+        tcb = (PROCESSOR_TCB *)malloc(sizeof(PROCESSOR_TCB));
+
+    // The FPU registers are only restored once a fiber has used the FPU (see CortexContextSwitch.s).
+    if (tcb)
+        tcb->FPU = 0;
+
+    return (void *)tcb;
 }
 
 /**
@@ -0,0 +1,137 @@
+#include "CodalConfig.h"
+#include "CodalDmesg.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+#include "irq_profile.h"
+#include <string.h>
+
+#if CONFIG_ENABLED(DEVICE_IRQ_PROFILE)
+
+static IrqProfile profiles[IRQ_PROFILE_SOURCES];
+static volatile bool recording = false;
+
+static const char * const source_names[IRQ_PROFILE_SOURCES] = {
+    "SPI0/TWI0", "SPI1/TWI1", "SPI2", "UARTE0", "SPI3", "UARTE1",
+    "TIMER0", "TIMER1", "TIMER2", "TIMER3", "TIMER4",
+    "GPIOTE", "RADIO", "SAADC", "PDM",
+    "PWM0", "PWM1", "PWM2"
+};
+
+// Maps a sample to its histogram bucket: the number of significant bits, capped at the last bucket.
+static inline int bucket(uint32_t cycles)
+{
+    int b = cycles ? 32 - __builtin_clz(cycles) : 0;
+    return b < IRQ_PROFILE_BUCKETS ? b : IRQ_PROFILE_BUCKETS - 1;
+}
+
+void irq_profile_start()
+{
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    irq_profile_reset();
+    recording = true;
+}
+
+void irq_profile_stop()
+{
+    recording = false;
+}
+
+void irq_profile_reset()
+{
+    target_disable_irq();
+    memset(profiles, 0, sizeof(profiles));
+    target_enable_irq();
+}
+
+// Each source is only updated by its own handler, which cannot preempt itself, so no locking is needed here.
+void irq_profile_record(int source, uint32_t cycles)
+{
+    if (!recording)
+        return;
+
+    IrqProfile &p = profiles[source];
+
+    p.count++;
+    p.cycles += cycles;
+    p.execution[bucket(cycles)]++;
+
+    if (cycles > p.maxCycles)
+        p.maxCycles = cycles;
+}
+
+void irq_profile_record_latency(int source, uint32_t cycles)
+{
+    if (!recording)
+        return;
+
+    IrqProfile &p = profiles[source];
+
+    p.latencyCount++;
+    p.latency[bucket(cycles)]++;
+
+    if (cycles > p.maxLatency)
+        p.maxLatency = cycles;
+}
+
+int irq_profile_get(int source, IrqProfile &profile)
+{
+    if (source < 0 || source >= IRQ_PROFILE_SOURCES)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    profile = profiles[source];
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+static void dump_histogram(const char *label, const uint32_t *h)
+{
+    DMESG("  %s: %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d", label,
+        h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], h[8], h[9], h[10], h[11], h[12], h[13], h[14], h[15]);
+}
+
+void irq_profile_dump()
+{
+    IrqProfile p;
+
+    for (int i = 0; i < IRQ_PROFILE_SOURCES; i++)
+    {
+        irq_profile_get(i, p);
+
+        if (p.count == 0)
+            continue;
+
+        DMESG("%s: n=%d avg=%d max=%d cycles", source_names[i], p.count, (uint32_t)(p.cycles / p.count), p.maxCycles);
+        dump_histogram("run", p.execution);
+
+        if (p.latencyCount)
+        {
+            DMESG("  latency: n=%d max=%d cycles", p.latencyCount, p.maxLatency);
+            dump_histogram("lat", p.latency);
+        }
+    }
+}
+
+#else
+
+void irq_profile_start() {}
+void irq_profile_stop() {}
+void irq_profile_reset() {}
+void irq_profile_record(int source, uint32_t cycles) {}
+void irq_profile_record_latency(int source, uint32_t cycles) {}
+
+int irq_profile_get(int source, IrqProfile &profile)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+void irq_profile_dump() {}
+
+#endif
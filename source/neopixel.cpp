@@ -3,31 +3,51 @@
 // 1 - 0.80uS hi 0.45uS low
 
 #include "neopixel.h"
-
-#if CONFIG_ENABLED(HARDWARE_NEOPIXEL)
-
-void neopixel_send_buffer(Pin &pin, const uint8_t *ptr, int numBytes)
+#include "CodalFiber.h"
+#include "ramfunc.h"
+
+static NRF_PWM_Type * const neopixel_pwm_modules[NRF52PWM_PWM_PERIPHERALS] = { NRF_PWM0, NRF_PWM1, NRF_PWM2 };
+
+static NRF52PWM *neopixel_pwm = NULL;
+static WS2812B *neopixel_ws = NULL;
+static Pin *neopixel_pin = NULL;
+
+/**
+ * Claims a PWM module for neopixel output, if one is free.
+ * PWM2 is preferred, as NRF52Pin allocates analog outputs from PWM0 upwards.
+ *
+ * @return true if a PWM module is available.
+ */
+static bool neopixel_claim_pwm()
 {
-    static NRF52PWM *pwm = NULL;
-    static WS2812B *ws = NULL;
+    if (neopixel_pwm)
+        return true;
 
-    if (pwm == NULL)
+    for (int p = NRF52PWM_PWM_PERIPHERALS - 1; p >= 0; p--)
     {
-        ws = new WS2812B();
-        pwm = new NRF52PWM(NRF_PWM2, *ws, WS2812B_PWM_FREQ);
-        pwm->setStreamingMode(true, false);
-        pwm->setDecoderMode(PWM_DECODER_LOAD_Common);
-        pwm->setSampleRate(WS2812B_PWM_FREQ);
-    }
+#if !CONFIG_ENABLED(HARDWARE_NEOPIXEL)
+        // Leave alone any module already driven by another NRF52PWM instance.
+        if (NRF52PWM::nrf52_pwm_driver[p])
+            continue;
+#endif
 
-    pwm->connectPin(pin, 0);
+        neopixel_ws = new WS2812B();
+        neopixel_pwm = new NRF52PWM(neopixel_pwm_modules[p], *neopixel_ws, WS2812B_PWM_FREQ);
+        neopixel_pwm->setStreamingMode(true, false);
+        neopixel_pwm->setDecoderMode(PWM_DECODER_LOAD_Common);
+        neopixel_pwm->setSampleRate(WS2812B_PWM_FREQ);
 
-    ws->play(ptr, numBytes);
-}
+        return true;
+    }
 
-#else
+    return false;
+}
 
-__attribute__((noinline)) void neopixel_send_buffer(Pin &pin, const uint8_t *ptr, int numBytes)
+/**
+ * Sends the given data by bit-banging, with interrupts disabled throughout.
+ * This runs from RAM, so a cache miss can't stretch a bit.
+ */
+NRF52_RAMFUNC static void neopixel_send_buffer_bitbang(Pin &pin, const uint8_t *ptr, int numBytes)
 {
     pin.setDigitalValue(0);
 
@@ -84,7 +104,26 @@ __attribute__((noinline)) void neopixel_send_buffer(Pin &pin, const uint8_t *ptr
     }
     target_enable_irq();
 }
-#endif
+
+void neopixel_send_buffer(Pin &pin, const uint8_t *ptr, int numBytes)
+{
+    // Streaming blocks the calling fiber until the PWM has finished, so this is only possible from a fiber.
+    if ((CONFIG_ENABLED(HARDWARE_NEOPIXEL) || CONFIG_ENABLED(NEOPIXEL_HARDWARE_AUTO)) &&
+        fiber_scheduler_running() && __get_IPSR() == 0 && neopixel_claim_pwm())
+    {
+        // Only one strip can be driven at a time, so release the last pin if it was a different one.
+        if (neopixel_pin && neopixel_pin != &pin)
+            neopixel_pwm->disconnectPin(*neopixel_pin);
+
+        neopixel_pin = &pin;
+        neopixel_pwm->connectPin(pin, 0);
+        neopixel_ws->play(ptr, numBytes);
+
+        return;
+    }
+
+    neopixel_send_buffer_bitbang(pin, ptr, numBytes);
+}
 
 void neopixel_send_buffer(Pin &pin, ManagedBuffer buffer)
 {
@@ -3,6 +3,8 @@
 #include "CodalDmesg.h"
 #include "peripheral_alloc.h"
 #include "codal_target_hal.h"
+#include "irq_profile.h"
+#include <stdlib.h>
 
 namespace codal
 {
@@ -110,10 +112,70 @@ void set_alloc_peri_irq(void *device, PUserCallback fn, void *userdata)
     irq_callback_data[i] = userdata;
 }
 
-#define DEF_IRQ(name, id)                           \
-    extern "C" void name()                          \
-    {                                               \
-        irq_callback[id](irq_callback_data[id]);    \
+static uint8_t dma_bounce_pool[DMA_BOUNCE_BUFFER_COUNT][DMA_BOUNCE_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint32_t used_bounce_buffers;
+
+bool is_dma_capable(const void *data, uint32_t len)
+{
+    uint32_t start = (uint32_t)data;
+
+    if (len == 0)
+        return true;
+
+    // EasyDMA can't reach flash, or the code RAM alias of data RAM.
+    return start >= 0x20000000 && start + len <= 0x20000000 + (NRF_FICR->INFO.RAM << 10);
+}
+
+uint8_t *allocate_dma_buffer(uint32_t len)
+{
+    if (len <= DMA_BOUNCE_BUFFER_SIZE)
+    {
+        target_disable_irq();
+
+        for (int i = 0; i < DMA_BOUNCE_BUFFER_COUNT; i++)
+        {
+            if (!(used_bounce_buffers & (1 << i)))
+            {
+                used_bounce_buffers |= 1 << i;
+                target_enable_irq();
+                return dma_bounce_pool[i];
+            }
+        }
+
+        target_enable_irq();
+    }
+
+    // The heap may not be used from interrupt context. Callers stage the data in smaller pieces instead.
+    if (__get_IPSR() != 0)
+        return NULL;
+
+    return (uint8_t *)malloc(len);
+}
+
+void free_dma_buffer(void *buffer)
+{
+    uint8_t *b = (uint8_t *)buffer;
+
+    if (b == NULL)
+        return;
+
+    if (b >= &dma_bounce_pool[0][0] && b < &dma_bounce_pool[DMA_BOUNCE_BUFFER_COUNT][0])
+    {
+        target_disable_irq();
+        used_bounce_buffers &= ~(1 << ((b - &dma_bounce_pool[0][0]) / DMA_BOUNCE_BUFFER_SIZE));
+        target_enable_irq();
+        return;
+    }
+
+    free(b);
+}
+
+#define DEF_IRQ(name, id)                               \
+    extern "C" void name()                              \
+    {                                                   \
+        IRQ_PROFILE_ENTER();                            \
+        irq_callback[id](irq_callback_data[id]);        \
+        IRQ_PROFILE_EXIT(IRQ_PROFILE_PERIPHERAL + id);  \
     }
 
 DEF_IRQ(SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQHandler, 0)
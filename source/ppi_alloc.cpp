@@ -0,0 +1,285 @@
+#include "CodalConfig.h"
+#include "ErrorNo.h"
+#include "ppi_alloc.h"
+#include "codal_target_hal.h"
+
+namespace codal
+{
+
+static uint32_t used_ppi_channels = NRF_PPI_RESERVED_CHANNELS;
+static uint32_t used_ppi_groups = NRF_PPI_RESERVED_GROUPS;
+static uint32_t used_gpiote_channels = NRF_GPIOTE_RESERVED_CHANNELS;
+static uint32_t used_egu_channels;
+
+static GpioteCallback gpiote_callback[NRF_GPIOTE_CHANNEL_COUNT];
+static void *gpiote_callback_data[NRF_GPIOTE_CHANNEL_COUNT];
+
+// Claims the highest free resource in the given mask, so dynamic claims stay clear of the low, fixed numbers
+// used by drivers.
+static int allocate_from(uint32_t &used, int count)
+{
+    int result = DEVICE_NO_RESOURCES;
+
+    target_disable_irq();
+
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (!(used & (1 << i)))
+        {
+            used |= 1 << i;
+            result = i;
+            break;
+        }
+    }
+
+    target_enable_irq();
+
+    return result;
+}
+
+// To be able to select a specific resource
+static int allocate_at(uint32_t &used, int count, int i)
+{
+    int result = DEVICE_NO_RESOURCES;
+
+    if (i < 0 || i >= count)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+
+    if (!(used & (1 << i)))
+    {
+        used |= 1 << i;
+        result = i;
+    }
+
+    target_enable_irq();
+
+    return result;
+}
+
+static void free_at(uint32_t &used, int count, int i)
+{
+    if (i < 0 || i >= count)
+        return;
+
+    target_disable_irq();
+    used &= ~(1 << i);
+    target_enable_irq();
+}
+
+int allocate_ppi_channel()
+{
+    return allocate_from(used_ppi_channels, NRF_PPI_CHANNEL_COUNT);
+}
+
+int allocate_ppi_channel(int channel)
+{
+    return allocate_at(used_ppi_channels, NRF_PPI_CHANNEL_COUNT, channel);
+}
+
+void free_ppi_channel(int channel)
+{
+    free_at(used_ppi_channels, NRF_PPI_CHANNEL_COUNT, channel);
+}
+
+int allocate_ppi_group()
+{
+    int group = allocate_from(used_ppi_groups, NRF_PPI_GROUP_COUNT);
+
+    if (group >= 0)
+        NRF_PPI->CHG[group] = 0;
+
+    return group;
+}
+
+void free_ppi_group(int group)
+{
+    if (group < 0 || group >= NRF_PPI_GROUP_COUNT)
+        return;
+
+    NRF_PPI->TASKS_CHG[group].DIS = 1;
+    NRF_PPI->CHG[group] = 0;
+    free_at(used_ppi_groups, NRF_PPI_GROUP_COUNT, group);
+}
+
+int allocate_gpiote_channel()
+{
+    return allocate_from(used_gpiote_channels, NRF_GPIOTE_CHANNEL_COUNT);
+}
+
+int allocate_gpiote_channel(int channel)
+{
+    return allocate_at(used_gpiote_channels, NRF_GPIOTE_CHANNEL_COUNT, channel);
+}
+
+void free_gpiote_channel(int channel)
+{
+    if (channel < 0 || channel >= NRF_GPIOTE_CHANNEL_COUNT)
+        return;
+
+    // Return the pin to GPIO control before the channel is reused.
+    set_gpiote_irq(channel, NULL, NULL);
+    NRF_GPIOTE->CONFIG[channel] = 0;
+    free_at(used_gpiote_channels, NRF_GPIOTE_CHANNEL_COUNT, channel);
+}
+
+// Registers a handler for the IN event of the given channel, and enables its interrupt. A NULL handler disables it.
+void set_gpiote_irq(int channel, GpioteCallback fn, void *userdata)
+{
+    if (channel < 0 || channel >= NRF_GPIOTE_CHANNEL_COUNT)
+        return;
+
+    NRF_GPIOTE->INTENCLR = 1 << channel;
+
+    gpiote_callback[channel] = fn;
+    gpiote_callback_data[channel] = userdata;
+
+    if (fn)
+    {
+        NRF_GPIOTE->EVENTS_IN[channel] = 0;
+        NRF_GPIOTE->INTENSET = 1 << channel;
+        NVIC_EnableIRQ(GPIOTE_IRQn);
+    }
+}
+
+// Called from GPIOTE_IRQHandler, to dispatch the IN events of channels with a registered handler.
+void gpiote_channel_irq()
+{
+    uint32_t enabled = NRF_GPIOTE->INTENSET & ((1 << NRF_GPIOTE_CHANNEL_COUNT) - 1);
+
+    while (enabled)
+    {
+        int i = __builtin_ctz(enabled);
+        enabled &= enabled - 1;
+
+        if (NRF_GPIOTE->EVENTS_IN[i])
+        {
+            NRF_GPIOTE->EVENTS_IN[i] = 0;
+            gpiote_callback[i](gpiote_callback_data[i]);
+        }
+    }
+}
+
+int allocate_egu_channel()
+{
+    int channel = allocate_from(used_egu_channels, NRF_EGU_CHANNEL_COUNT);
+
+    if (channel >= 0)
+        NRF_PPI_ALLOC_EGU->EVENTS_TRIGGERED[channel] = 0;
+
+    return channel;
+}
+
+void free_egu_channel(int channel)
+{
+    if (channel < 0 || channel >= NRF_EGU_CHANNEL_COUNT)
+        return;
+
+    NRF_PPI_ALLOC_EGU->INTENCLR = 1 << channel;
+    free_at(used_egu_channels, NRF_EGU_CHANNEL_COUNT, channel);
+}
+
+HardwareEvent egu_event(int channel)
+{
+    return &NRF_PPI_ALLOC_EGU->EVENTS_TRIGGERED[channel];
+}
+
+HardwareTask egu_task(int channel)
+{
+    return &NRF_PPI_ALLOC_EGU->TASKS_TRIGGER[channel];
+}
+
+// Allocates a channel and routes the given event to the given task (and optional fork task), enabling it.
+// Returns the channel, or DEVICE_NO_RESOURCES if none are free.
+int ppi_connect(HardwareEvent event, HardwareTask task, HardwareTask fork)
+{
+    int channel = allocate_ppi_channel();
+
+    if (channel < 0)
+        return channel;
+
+    ppi_route(channel, event, task, fork);
+    ppi_enable(channel);
+
+    return channel;
+}
+
+// Routes the given event to the given task (and optional fork task) on a channel already claimed, leaving it
+// enabled or disabled as it was.
+int ppi_route(int channel, HardwareEvent event, HardwareTask task, HardwareTask fork)
+{
+    if (channel < 0 || channel >= NRF_PPI_CHANNEL_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    NRF_PPI->CH[channel].EEP = (uint32_t) event;
+    NRF_PPI->CH[channel].TEP = (uint32_t) task;
+    NRF_PPI->FORK[channel].TEP = (uint32_t) fork;
+
+    return DEVICE_OK;
+}
+
+// Disables the given channel, removes it from every group and returns it to the allocator.
+void ppi_disconnect(int channel)
+{
+    if (channel < 0 || channel >= NRF_PPI_CHANNEL_COUNT)
+        return;
+
+    ppi_disable(channel);
+
+    for (int group = 0; group < NRF_PPI_GROUP_COUNT; group++)
+        NRF_PPI->CHG[group] &= ~(1 << channel);
+
+    NRF_PPI->CH[channel].EEP = 0;
+    NRF_PPI->CH[channel].TEP = 0;
+    NRF_PPI->FORK[channel].TEP = 0;
+
+    free_ppi_channel(channel);
+}
+
+void ppi_enable(int channel)
+{
+    NRF_PPI->CHENSET = 1 << channel;
+}
+
+void ppi_disable(int channel)
+{
+    NRF_PPI->CHENCLR = 1 << channel;
+}
+
+int ppi_group_add(int group, int channel)
+{
+    if (group < 0 || group >= NRF_PPI_GROUP_COUNT || channel < 0 || channel >= NRF_PPI_CHANNEL_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    NRF_PPI->CHG[group] |= 1 << channel;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+int ppi_group_remove(int group, int channel)
+{
+    if (group < 0 || group >= NRF_PPI_GROUP_COUNT || channel < 0 || channel >= NRF_PPI_CHANNEL_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    NRF_PPI->CHG[group] &= ~(1 << channel);
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+// The tasks that enable and disable every channel in a group, so groups can themselves be driven through PPI.
+HardwareTask ppi_group_enable_task(int group)
+{
+    return &NRF_PPI->TASKS_CHG[group].EN;
+}
+
+HardwareTask ppi_group_disable_task(int group)
+{
+    return &NRF_PPI->TASKS_CHG[group].DIS;
+}
+
+} // namespace codal